@@ -0,0 +1,35 @@
+// Copyright (c) 2021 Chanjung Kim. All rights reserved.
+// Licensed under the MIT License.
+
+#ifndef MNIST_FPGA_ACTIVATION_HH
+#define MNIST_FPGA_ACTIVATION_HH
+
+#include <cstdint>
+
+namespace mf
+{
+
+/**
+ * Represents the function applied to the output of an FC layer.
+ */
+enum class Activation : uint8_t
+{
+    /**
+     * The output is used as it is.
+     */
+    Linear,
+
+    /**
+     * Negative outputs are replaced with zero.
+     */
+    Relu,
+
+    /**
+     * The outputs of each sample are exponentiated and normalized to sum to one.
+     */
+    Softmax,
+};
+
+}
+
+#endif
@@ -0,0 +1,88 @@
+// Copyright (c) 2021 Chanjung Kim. All rights reserved.
+// Licensed under the MIT License.
+
+#ifndef MNIST_FPGA_ALIGNED_ALLOCATOR_HH
+#define MNIST_FPGA_ALIGNED_ALLOCATOR_HH
+
+#include <cstddef>
+#include <cstdint>
+#include <new>
+#include <vector>
+
+namespace mf
+{
+
+/**
+ * A standard allocator returning memory aligned to `Alignment` bytes.
+ */
+template <typename T, size_t Alignment>
+struct AlignedAllocator
+{
+    static_assert(Alignment >= alignof(T) && (Alignment & (Alignment - 1)) == 0,
+                  "Alignment must be a power of two not less than alignof(T)");
+
+    using value_type = T;
+
+    template <typename U>
+    struct rebind
+    {
+        using other = AlignedAllocator<U, Alignment>;
+    };
+
+    AlignedAllocator() noexcept = default;
+
+    template <typename U>
+    AlignedAllocator(AlignedAllocator<U, Alignment> const&) noexcept
+    {}
+
+    T* allocate(size_t n)
+    {
+        return (T*)::operator new(n * sizeof(T), std::align_val_t { Alignment });
+    }
+
+    void deallocate(T* ptr, size_t) noexcept
+    {
+        ::operator delete(ptr, std::align_val_t { Alignment });
+    }
+
+    template <typename U>
+    bool operator==(AlignedAllocator<U, Alignment> const&) const noexcept
+    {
+        return true;
+    }
+
+    template <typename U>
+    bool operator!=(AlignedAllocator<U, Alignment> const&) const noexcept
+    {
+        return false;
+    }
+};
+
+/**
+ * The alignment of buffers read by vectorized kernels; the size of a cache line and of an AVX-512
+ * register.
+ */
+constexpr size_t cacheLineSize { 64 };
+
+/**
+ * A `std::vector` whose buffer is aligned to a cache line.
+ */
+template <typename T>
+using AlignedVector = std::vector<T, AlignedAllocator<T, cacheLineSize>>;
+
+/**
+ * The alignment of buffers shared with devices; the size of a page. OpenCL implementations wrap
+ * page-aligned host memory given with `CL_MEM_USE_HOST_PTR` without copying it, and DMA engines
+ * transfer whole pages.
+ */
+constexpr size_t pageSize { 4096 };
+
+/**
+ * A `std::vector` whose buffer is aligned to a page, so it can be shared with a device.
+ */
+template <typename T>
+using PageAlignedVector = std::vector<T, AlignedAllocator<T, pageSize>>;
+
+}
+
+#endif
@@ -0,0 +1,70 @@
+// Copyright (c) 2021 Chanjung Kim. All rights reserved.
+// Licensed under the MIT License.
+
+#ifndef MNIST_FPGA_ARRAY_VIEW_HH
+#define MNIST_FPGA_ARRAY_VIEW_HH
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+namespace mf
+{
+
+/**
+ * A non-owning, read-only view of a contiguous array. Member functions are named after those of
+ * `std::vector`, so a view can replace a `std::vector const&` without changing the callers.
+ */
+template <typename T>
+class ArrayView
+{
+  private:
+    T const* _data;
+    size_t   _size;
+
+  public:
+    ArrayView() noexcept : _data { nullptr }, _size { 0 } {}
+
+    ArrayView(T const* data, size_t size) noexcept : _data { data }, _size { size } {}
+
+    template <typename Allocator>
+    ArrayView(std::vector<T, Allocator> const& vector) noexcept :
+        _data { vector.data() },
+        _size { vector.size() }
+    {}
+
+  public:
+    T const* data() const noexcept
+    {
+        return _data;
+    }
+
+    size_t size() const noexcept
+    {
+        return _size;
+    }
+
+    bool empty() const noexcept
+    {
+        return _size == 0;
+    }
+
+    T const& operator[](size_t idx) const noexcept
+    {
+        return _data[idx];
+    }
+
+    T const* begin() const noexcept
+    {
+        return _data;
+    }
+
+    T const* end() const noexcept
+    {
+        return _data + _size;
+    }
+};
+
+}
+
+#endif
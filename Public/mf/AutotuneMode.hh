@@ -0,0 +1,35 @@
+// Copyright (c) 2021 Chanjung Kim. All rights reserved.
+// Licensed under the MIT License.
+
+#ifndef MNIST_FPGA_AUTOTUNE_MODE_HH
+#define MNIST_FPGA_AUTOTUNE_MODE_HH
+
+#include <cstdint>
+
+namespace mf
+{
+
+/**
+ * Represents where the parameters of the CPU kernels come from.
+ */
+enum class AutotuneMode : uint8_t
+{
+    /**
+     * The configuration, or the compiled-in defaults.
+     */
+    Off,
+
+    /**
+     * The autotune cache if it has an entry for this CPU and model, or the configuration.
+     */
+    Cached,
+
+    /**
+     * `Autotuner`, which measures the candidates at startup and updates the cache.
+     */
+    On,
+};
+
+}
+
+#endif
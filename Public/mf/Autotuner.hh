@@ -0,0 +1,140 @@
+// Copyright (c) 2021 Chanjung Kim. All rights reserved.
+// Licensed under the MIT License.
+
+#ifndef MNIST_FPGA_AUTOTUNER_HH
+#define MNIST_FPGA_AUTOTUNER_HH
+
+#include <mf/Config.hh>
+#include <mf/Dense.hh>
+#include <mf/Mnist.hh>
+#include <mf/Model.hh>
+#include <mf/Weights.hh>
+
+#include <chrono>
+#include <cstdint>
+#include <filesystem>
+#include <optional>
+#include <string>
+#include <vector>
+
+namespace mf
+{
+
+/**
+ * `TunedParameters` is the configuration of the CPU engine chosen by `Autotuner`, and how fast it
+ * ran when it was chosen.
+ */
+struct TunedParameters
+{
+    /**
+     * the number of samples of one batch.
+     */
+    size_t batchSize;
+
+    /**
+     * the number of worker threads.
+     */
+    size_t numThreads;
+
+    /**
+     * the cache blocking parameters of the layers computed with `Dense::ApplyBatch`.
+     */
+    DenseBlocking blocking;
+
+    /**
+     * whether the layers are run fused by `MnistNetwork` (see `Engine::MakeFromPlan`).
+     */
+    bool fused;
+
+    /**
+     * the number of images classified per second with every thread.
+     */
+    double throughput;
+
+    /**
+     * the 99th percentile of the time one batch took on one thread, in seconds.
+     */
+    double latency;
+};
+
+/**
+ * `Autotuner` chooses the batch size, the number of threads and the parameters of the CPU kernels
+ * by measuring candidates on the loaded weights and samples, and keeps the choices in a JSON file,
+ * one entry per CPU model, instruction set, pixel format and model shape (see `GetCacheKey`), so
+ * that later runs load them instead of measuring again. All member functions of `Autotuner` are
+ * static.
+ */
+class Autotuner
+{
+  public:
+    /**
+     * Returns the key of the entry of the cache for the given model on this CPU, with the
+     * instruction set currently used by `Dense`.
+     *
+     * @param weights the weight collection containing the layers
+     * @param layers the layers, from the input to the output
+     * @param pixelFormat the pixel format of the samples
+     * @throws LayerNotFoundException
+     */
+    static std::string GetCacheKey(WeightCollection const&       weights,
+                                   std::vector<LayerSpec> const& layers,
+                                   MnistPixelFormat              pixelFormat);
+
+    /**
+     * Reads the entry with the given key from the given cache file.
+     *
+     * @param path the path of the cache file
+     * @param key the key of the entry
+     * @return the parameters, or `std::nullopt` if the file or the entry does not exist or cannot
+     * be read
+     */
+    static std::optional<TunedParameters> Load(std::filesystem::path const& path,
+                                               std::string const&           key);
+
+    /**
+     * Writes the entry with the given key to the given cache file, keeping its other entries. The
+     * cache is an optimization, so failures are ignored; the file is written under a temporary
+     * name and renamed, so concurrent processes never read a partial file.
+     *
+     * @param path the path of the cache file
+     * @param key the key of the entry
+     * @param parameters the parameters
+     */
+    static void Store(std::filesystem::path const& path,
+                      std::string const&           key,
+                      TunedParameters const&       parameters);
+
+    /**
+     * Measures the candidate configurations of the CPU engine on the given model and samples, and
+     * returns the one classifying the most images per second among those whose batches take at
+     * most `latencyBudget` on one thread. If none does, the one with the lowest latency is
+     * returned. Takes a few seconds.
+     *
+     * @param weights the weight collection containing the layers
+     * @param layers the layers, from the input to the output
+     * @param mnist the samples to classify
+     * @param latencyBudget the greatest time one batch may take, or zero for no limit
+     * @param maxThreads the greatest number of threads
+     * @throws LayerNotFoundException
+     * @throws LayerShapeMismatchException
+     * @throws std::invalid_argument if `mnist` is empty or `maxThreads` is zero
+     */
+    static TunedParameters Tune(WeightCollection const&       weights,
+                                std::vector<LayerSpec> const& layers,
+                                Mnist const&                  mnist,
+                                std::chrono::microseconds     latencyBudget,
+                                size_t                        maxThreads);
+
+    /**
+     * Copies the given parameters to the configuration, except those set explicitly (see
+     * `Config::IsExplicit`), so that the user can still override them.
+     *
+     * @param parameters the parameters
+     * @param config the configuration to update
+     */
+    static void Apply(TunedParameters const& parameters, Config& config);
+};
+
+}
+
+#endif
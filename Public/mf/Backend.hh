@@ -0,0 +1,36 @@
+// Copyright (c) 2021 Chanjung Kim. All rights reserved.
+// Licensed under the MIT License.
+
+#ifndef MNIST_FPGA_BACKEND_HH
+#define MNIST_FPGA_BACKEND_HH
+
+#include <cstdint>
+
+namespace mf
+{
+
+/**
+ * Represents where the floating-point path is evaluated.
+ */
+enum class Backend : uint8_t
+{
+    /**
+     * `Engine` on the thread pool of the host.
+     */
+    Cpu,
+
+    /**
+     * `ClEngine` on the OpenCL device selected by the configuration.
+     */
+    OpenCl,
+
+    /**
+     * `HybridEngine`, which splits every round between `Engine` on the host and `ClEngine` on the
+     * OpenCL devices by their throughput.
+     */
+    Hybrid,
+};
+
+}
+
+#endif
@@ -0,0 +1,173 @@
+// Copyright (c) 2021 Chanjung Kim. All rights reserved.
+// Licensed under the MIT License.
+
+#ifndef MNIST_FPGA_CL_BUFFER_POOL_HH
+#define MNIST_FPGA_CL_BUFFER_POOL_HH
+
+#include <mf/ClHelpers.hh>
+#include <mf/Exception.hh>
+
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+namespace mf
+{
+
+/**
+ * `BufferPoolExhaustedException` is thrown when a buffer cannot be leased without exceeding the
+ * capacity of a `ClBufferPool`, and no leased buffer is left to wait for.
+ */
+MF_MAKE_NEW_EXCEPTION(BufferPoolExhaustedException, "The OpenCL buffer pool is exhausted");
+
+/**
+ * `ClBufferPoolStatistics` tells how a `ClBufferPool` was used.
+ */
+struct ClBufferPoolStatistics
+{
+    /**
+     * the number of buffers created, i.e. calls to `clCreateBuffer`.
+     */
+    size_t numCreated;
+
+    /**
+     * the number of buffers released to make room under the capacity.
+     */
+    size_t numEvicted;
+
+    /**
+     * the number of leases, and how many of them reused a buffer.
+     */
+    size_t numLeases, numReused;
+
+    /**
+     * the number of bytes of the buffers owned by the pool, leased or not.
+     */
+    size_t numBytesOwned;
+
+    /**
+     * the number of bytes of the buffers leased now, and the most ever leased at once.
+     */
+    size_t numBytesLeased, maxBytesLeased;
+};
+
+/**
+ * `ClBufferPool` keeps the device buffers of one `cl::Context` for reuse, so that a steady stream
+ * of batches does not create a buffer per batch. The sizes are rounded up to size classes, powers
+ * of two of at least 4 KiB, and buffers are reused within a size class with the same flags. A
+ * leased buffer is returned either at once, or once an event completes, so that the buffers of a
+ * batch go back to the pool when the batch is done without the host waiting for it.
+ *
+ * The pool owns at most `capacity` bytes of buffers. A lease that would exceed it first releases
+ * the buffers not leased, then waits for the pending returns, oldest first.
+ *
+ * Instances are thread-safe, and are shared by their users.
+ */
+class ClBufferPool
+{
+  public:
+    /**
+     * The smallest size class, in bytes.
+     */
+    constexpr static size_t minClassSize = 4096;
+
+    /**
+     * Creates an empty pool for the given context.
+     *
+     * @param context the context to create the buffers in
+     * @param capacity the maximum number of bytes of buffers to own, or zero for no limit
+     */
+    static std::shared_ptr<ClBufferPool> MakeFromContext(cl::Context const& context,
+                                                         size_t             capacity = 0);
+
+  private:
+    struct PendingReturn
+    {
+        cl::Event  event;
+        cl::Buffer buffer;
+    };
+
+  private:
+    mutable std::mutex                                               _mutex;
+    cl::Context                                                      _context;
+    size_t                                                           _capacity;
+    std::map<std::pair<cl_mem_flags, size_t>, std::vector<cl::Buffer>> _free;
+    std::unordered_map<cl_mem, std::pair<cl_mem_flags, size_t>>       _owned;
+    std::vector<PendingReturn>                                       _pending;
+    ClBufferPoolStatistics                                           _statistics;
+
+  private:
+    ClBufferPool(cl::Context const& context, size_t capacity);
+
+  public:
+    ClBufferPool(ClBufferPool const&) = delete;
+    ClBufferPool& operator=(ClBufferPool const&) = delete;
+
+  public:
+    /**
+     * Returns the size class of the given size.
+     */
+    static size_t GetClassSize(size_t size) noexcept;
+
+    /**
+     * Returns the maximum number of bytes of buffers the pool owns, or zero for no limit.
+     */
+    size_t GetCapacity() const noexcept
+    {
+        return _capacity;
+    }
+
+    /**
+     * Returns a copy of the statistics.
+     */
+    ClBufferPoolStatistics GetStatistics() const;
+
+    /**
+     * Leases a buffer of at least `size` bytes, reusing a returned one if possible. The buffer
+     * must be returned to the pool with `Return` or `ReturnAfter`.
+     *
+     * @param size the number of bytes needed
+     * @param flags the flags to create the buffer with, which must not refer to a host pointer
+     * @throws ClException
+     * @throws BufferPoolExhaustedException if the size class exceeds the capacity, or nothing is
+     * left to wait for
+     */
+    cl::Buffer Lease(size_t size, cl_mem_flags flags);
+
+    /**
+     * Returns a leased buffer to the pool at once.
+     */
+    void Return(cl::Buffer const& buffer);
+
+    /**
+     * Returns a leased buffer to the pool once the given event has completed, e.g. the last
+     * command reading or writing the buffer.
+     */
+    void ReturnAfter(cl::Event const& event, cl::Buffer const& buffer);
+
+  private:
+    /**
+     * Moves the pending returns whose events have completed to the free lists. If `wait` is set
+     * and none have completed, waits for the oldest one. The mutex must be held.
+     */
+    void CollectPending(bool wait);
+
+    /**
+     * Releases buffers not leased until the pool owns at most `capacity - size` bytes. Returns
+     * whether it does. The mutex must be held.
+     */
+    bool MakeRoom(size_t size);
+
+    /**
+     * Moves the given buffer to its free list. The mutex must be held.
+     */
+    void Free(cl::Buffer const& buffer);
+};
+
+}
+
+#endif
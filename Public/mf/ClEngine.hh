@@ -0,0 +1,291 @@
+// Copyright (c) 2021 Chanjung Kim. All rights reserved.
+// Licensed under the MIT License.
+
+#ifndef MNIST_FPGA_CL_ENGINE_HH
+#define MNIST_FPGA_CL_ENGINE_HH
+
+#include <mf/AlignedAllocator.hh>
+#include <mf/ClBufferPool.hh>
+#include <mf/ClHelpers.hh>
+#include <mf/ClProfiler.hh>
+#include <mf/ExecutionPlan.hh>
+#include <mf/Mnist.hh>
+
+#include <array>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <optional>
+#include <string>
+#include <vector>
+
+namespace mf
+{
+
+/**
+ * `ClEngine` runs an `ExecutionPlan` on an OpenCL device. The weights are uploaded once on
+ * construction. Batches are then streamed through a ring of slots, each of which has its own
+ * device buffers and kernels; the commands of a batch are chained with events instead of the
+ * order of the queue, so on an out-of-order queue the upload of one batch, the kernels of another
+ * and the readback of a third overlap. The host only waits for a slot when it is about to reuse
+ * it, and picks the predictions of that batch meanwhile. The device buffers of each batch are
+ * leased from a `ClBufferPool` and go back to it once the batch is done, so a steady stream of
+ * batches creates no buffers.
+ *
+ * Instances own device memory and cannot be copied.
+ */
+class ClEngine
+{
+  public:
+    /**
+     * The type of the function called with the index of the first sample and the number of
+     * samples of each batch whose predictions have been written, in the order of the samples.
+     */
+    using BatchCallback = std::function<void(size_t begin, size_t numSamples)>;
+
+    /**
+     * The type of the function called to take the next batch whenever a slot is free. It sets the
+     * index of the first sample and the number of samples of the batch, at most `GetBatchSize()`,
+     * and returns `true`, or returns `false` if there are no batches left. It is called from the
+     * thread running `ClassifyFrom`.
+     */
+    using BatchSource = std::function<bool(size_t& begin, size_t& numSamples)>;
+
+    /**
+     * Uploads the layers of the given plan and allocates the buffers of `numSlots` batches.
+     *
+     * With zero-copy, the device reads page-aligned host memory in place (`CL_MEM_USE_HOST_PTR`)
+     * instead of copies in its own memory: the raw kernel matrices and biases of the plan, and
+     * the inputs given to `Classify` if they are aligned to a page (see `PageAlignedVector`). This
+     * saves every host-side copy on devices sharing the memory of the host, such as CPUs and
+     * integrated GPUs, but makes a discrete device read the host memory over the bus.
+     *
+     * @param plan the plan to run, whose batch size the engine uses. With zero-copy, its weights
+     * must outlive the engine.
+     * @param context the context of the device
+     * @param queue the queue to enqueue to, preferably in out-of-order mode
+     * @param program the program containing the kernels (see `ClFactory::MakeProgram`)
+     * @param numSlots the number of batches in flight, at least two
+     * @param zeroCopy whether to read host memory in place, or `std::nullopt` to do so if the
+     * device reports `CL_DEVICE_HOST_UNIFIED_MEMORY`
+     * @param pool the pool of `context` to lease the buffers of the batches from, or `nullptr`
+     * to create one without a capacity
+     * @throws ClException
+     * @throws std::invalid_argument if `numSlots` is less than two
+     */
+    static ClEngine MakeFromPlan(ExecutionPlan const&          plan,
+                                 cl::Context const&            context,
+                                 cl::CommandQueue const&       queue,
+                                 cl::Program const&            program,
+                                 size_t                        numSlots = 2,
+                                 std::optional<bool>           zeroCopy = std::nullopt,
+                                 std::shared_ptr<ClBufferPool> pool     = nullptr);
+
+  private:
+    struct Layer
+    {
+        std::string name;
+        cl::Buffer  kernel;
+        cl::Buffer  bias;
+        size_t      inputSize;
+        size_t      outputSize;
+        bool        relu;
+    };
+
+    struct Slot
+    {
+        cl::Buffer              input;
+        cl::Buffer              view;
+        cl::Buffer              activations[2];
+        std::vector<cl::Kernel> kernels;
+        cl::Kernel              firstByteKernel;
+        AlignedVector<float>    output;
+        cl::Event               done;
+        std::vector<cl::Event>  events;
+        size_t                  begin;
+        size_t                  numSamples;
+        size_t                  inputBytes;
+    };
+
+  private:
+    cl::Context           _context;
+    cl::CommandQueue      _queue;
+    std::vector<Layer>    _layers;
+    size_t                _batchSize;
+    std::vector<Slot>     _slots;
+    std::array<size_t, 2>         _workGroupSize;
+    bool                          _zeroCopy;
+    size_t                        _baseAddressAlignment;
+    ClProfiler*                   _profiler;
+    std::shared_ptr<ClBufferPool> _pool;
+    size_t                        _activationSize;
+
+  private:
+    ClEngine(ExecutionPlan const&          plan,
+             cl::Context const&            context,
+             cl::CommandQueue const&       queue,
+             cl::Program const&            program,
+             size_t                        numSlots,
+             std::optional<bool>           zeroCopy,
+             std::shared_ptr<ClBufferPool> pool);
+
+  public:
+    ClEngine(ClEngine&&) = default;
+    ClEngine& operator=(ClEngine&&) = default;
+
+    ClEngine(ClEngine const&) = delete;
+    ClEngine& operator=(ClEngine const&) = delete;
+
+  public:
+    /**
+     * Returns the maximum number of samples of one batch.
+     */
+    size_t GetBatchSize() const noexcept
+    {
+        return _batchSize;
+    }
+
+    /**
+     * Returns the length of the input of one sample.
+     */
+    size_t GetInputSize() const noexcept
+    {
+        return _layers.front().inputSize;
+    }
+
+    /**
+     * Returns the length of the output of one sample.
+     */
+    size_t GetOutputSize() const noexcept
+    {
+        return _layers.back().outputSize;
+    }
+
+    /**
+     * Returns the number of batches in flight.
+     */
+    size_t GetNumSlots() const noexcept
+    {
+        return _slots.size();
+    }
+
+    /**
+     * Returns whether the device reads host memory in place.
+     */
+    bool IsZeroCopy() const noexcept
+    {
+        return _zeroCopy;
+    }
+
+    /**
+     * Returns the pool the buffers of the batches are leased from.
+     */
+    ClBufferPool const& GetBufferPool() const noexcept
+    {
+        return *_pool;
+    }
+
+    /**
+     * Sets the profiler to record the upload, the kernels and the readback of every batch to, or
+     * `nullptr` to stop profiling. The queue must have been created with
+     * `CL_QUEUE_PROFILING_ENABLE`, and the profiler must outlive the engine.
+     */
+    void SetProfiler(ClProfiler* profiler) noexcept
+    {
+        _profiler = profiler;
+    }
+
+    /**
+     * Classifies any number of samples, split into batches of `GetBatchSize()` samples, and
+     * writes the index of the greatest output of each sample. Returns after every batch has
+     * completed; the input is read by the device until then. With zero-copy, an input aligned to
+     * a page is read in place without being uploaded.
+     *
+     * @param in the input matrix of dimension (`numSamples`, `GetInputSize()`), row-major
+     * @param numSamples the number of samples
+     * @param labels the array of length `numSamples` to write the results
+     * @param onBatch the function to call after the predictions of each batch are written, or
+     * an empty function
+     * @throws ClException
+     */
+    void Classify(float const*         in,
+                  size_t               numSamples,
+                  MnistLabel*          labels,
+                  BatchCallback const& onBatch = {});
+
+    /**
+     * The same as the overload taking `float` inputs, but reads the input as 8-bit integers (see
+     * `Dense::ApplyBatch`). Uploads a quarter of the bytes.
+     */
+    void Classify(uint8_t const*       in,
+                  size_t               numSamples,
+                  MnistLabel*          labels,
+                  BatchCallback const& onBatch = {});
+
+    /**
+     * The same as `Classify`, but classifies the batches taken from `source` instead of every
+     * sample in order, until it returns `false`. A batch is only taken once one of the slots is
+     * free, so engines sharing one source take batches at the pace of their devices (see
+     * `ClShardedEngine`). `onBatch` is called in the order the batches were taken.
+     *
+     * @param in the input matrix of dimension (`numSamples`, `GetInputSize()`), row-major
+     * @param numSamples the number of samples of the input, which the batches must lie within
+     * @param labels the array of length `numSamples` to write the results
+     * @param source the function to take the next batch
+     * @param onBatch the function to call after the predictions of each batch are written, or
+     * an empty function
+     * @throws ClException
+     */
+    void ClassifyFrom(float const*         in,
+                      size_t               numSamples,
+                      MnistLabel*          labels,
+                      BatchSource const&   source,
+                      BatchCallback const& onBatch = {});
+
+    /**
+     * The same as the overload taking `float` inputs, but reads the input as 8-bit integers.
+     */
+    void ClassifyFrom(uint8_t const*       in,
+                      size_t               numSamples,
+                      MnistLabel*          labels,
+                      BatchSource const&   source,
+                      BatchCallback const& onBatch = {});
+
+  private:
+    template <typename In>
+    void ClassifyWith(In const*            in,
+                      size_t               numSamples,
+                      MnistLabel*          labels,
+                      BatchCallback const& onBatch);
+
+    template <typename In>
+    void ClassifyWith(In const*            in,
+                      size_t               numSamples,
+                      MnistLabel*          labels,
+                      BatchSource const&   source,
+                      BatchCallback const& onBatch);
+
+    /**
+     * Enqueues the upload, the kernels and the readback of one batch to the given slot. If
+     * `hostInput` wraps the whole input in place, the batch is read from a sub-buffer of it
+     * instead of being uploaded.
+     */
+    template <typename In>
+    void Submit(
+        Slot& slot, In const* in, cl::Buffer& hostInput, size_t begin, size_t numSamples);
+
+    /**
+     * Waits for the batch of the given slot, if any, writes its predictions and records its
+     * commands to the profiler, if any.
+     */
+    void Retire(Slot& slot, MnistLabel* labels, BatchCallback const& onBatch);
+
+    /**
+     * Returns the buffers still leased by the given slot to the pool at once.
+     */
+    void ReturnBuffers(Slot& slot);
+};
+
+}
+
+#endif
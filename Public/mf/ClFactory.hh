@@ -9,6 +9,7 @@
 #include <mf/Exception.hh>
 
 #include <utility>
+#include <vector>
 
 namespace mf
 {
@@ -23,6 +24,12 @@ MF_MAKE_NEW_EXCEPTION(PlatformNotFoundException, "Failed to find the platform");
  */
 MF_MAKE_NEW_EXCEPTION(DeviceNotFoundException, "Failed to find the device");
 
+/**
+ * `ProgramBuildException` is thrown when the OpenCL C kernels failed to build. The message is the
+ * build log.
+ */
+MF_MAKE_NEW_EXCEPTION(ProgramBuildException, "Failed to build the OpenCL program");
+
 /**
  * `ClFactory` contains helper functions to create OpenCL resources. All member functions of
  * `ClFactory` are static.
@@ -39,6 +46,19 @@ class ClFactory
      */
     static std::pair<cl::Platform, cl::Device> MakePlatformAndDevice(Config const& config);
 
+    /**
+     * Creates a `cl::Device` instance for every device of the platform whose name matches the
+     * configuration, or only the first one unless `config.clAllDevices` is set. If
+     * `config.clNumSubDevices` is at least 2, each of them is split into that many sub-devices
+     * with an equal share of its compute units, which are returned instead.
+     * @param config the configuration containig the name of the vendor and the device
+     * @throws ClException
+     * @throws PlatformNotFoundException
+     * @throws DeviceNotFoundException
+     * @throws InvalidConfigException if a device has fewer compute units than sub-devices
+     */
+    static std::vector<cl::Device> MakeDevices(Config const& config);
+
     /**
      * Creates a `cl::Context` and a `cl::Queue` instance in out-of-order mode.
      * @param device the `cl::Device` instance in which the context and the queue instance is to be
@@ -48,10 +68,16 @@ class ClFactory
     static std::pair<cl::Context, cl::CommandQueue> MakeContextAndQueue(cl::Device device);
 
     /**
-     * Creates a `cl::Program` instance from the xclbin file specified in the configuration.
+     * Creates a `cl::Program` instance from the xclbin file specified in the configuration, or
+     * from the OpenCL C source of the kernels of `ClEngine` if no xclbin file is specified. The
+     * source is built with the tile sizes of the configuration, and the binary is cached in
+     * `config.clCacheDirectory`, keyed by the device, its driver version, the tile sizes and the
+     * source, so later runs skip the compilation.
      * @param config the configuration
      * @throws ClException
+     * @throws InvalidConfigException if the device cannot run work-groups of the tile sizes
      * @throws NoSuchFileException
+     * @throws ProgramBuildException
      */
     static cl::Program MakeProgram(Config const& config, cl::Context context, cl::Device device);
 };
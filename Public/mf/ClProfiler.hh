@@ -0,0 +1,169 @@
+// Copyright (c) 2021 Chanjung Kim. All rights reserved.
+// Licensed under the MIT License.
+
+#ifndef MNIST_FPGA_CL_PROFILER_HH
+#define MNIST_FPGA_CL_PROFILER_HH
+
+#include <mf/ClHelpers.hh>
+#include <mf/Statistics.hh>
+
+#include <cstdint>
+#include <map>
+#include <mutex>
+#include <ostream>
+#include <string>
+#include <string_view>
+#include <vector>
+
+namespace mf
+{
+
+/**
+ * Represents what an OpenCL command does.
+ */
+enum class ClCommandKind : uint8_t
+{
+    /**
+     * Copies host memory to the device.
+     */
+    Write,
+
+    /**
+     * Runs a kernel.
+     */
+    Kernel,
+
+    /**
+     * Copies device memory to the host.
+     */
+    Read,
+};
+
+/**
+ * `ClCommandStatistics` aggregates the profiling timestamps of every command of one name. All
+ * times are in nanoseconds.
+ */
+struct ClCommandStatistics
+{
+    /**
+     * the name of the commands, e.g. `write` or the name of a layer.
+     */
+    std::string name;
+
+    /**
+     * what the commands do.
+     */
+    ClCommandKind kind;
+
+    /**
+     * the number of commands.
+     */
+    uint64_t count = 0;
+
+    /**
+     * the number of bytes copied by the commands, or zero for kernels.
+     */
+    uint64_t numBytes = 0;
+
+    /**
+     * the total time from being enqueued on the host to being submitted to the device
+     * (`CL_PROFILING_COMMAND_QUEUED` to `CL_PROFILING_COMMAND_SUBMIT`).
+     */
+    uint64_t queuedTime = 0;
+
+    /**
+     * the total time from being submitted to starting, which includes the time waiting for the
+     * commands the command depends on (`CL_PROFILING_COMMAND_SUBMIT` to
+     * `CL_PROFILING_COMMAND_START`).
+     */
+    uint64_t waitTime = 0;
+
+    /**
+     * the total execution time (`CL_PROFILING_COMMAND_START` to `CL_PROFILING_COMMAND_END`).
+     */
+    uint64_t executionTime = 0;
+
+    /**
+     * the shortest and the longest execution time.
+     */
+    uint64_t minExecutionTime = UINT64_MAX, maxExecutionTime = 0;
+
+    /**
+     * the histogram of the execution time.
+     */
+    Histogram histogram;
+
+    /**
+     * Returns the achieved bandwidth of the transfers in bytes per second, or zero for kernels.
+     */
+    double GetBandwidth() const noexcept;
+};
+
+/**
+ * `ClProfiler` reads the profiling timestamps of completed OpenCL commands, enqueued to a queue
+ * created with `CL_QUEUE_PROFILING_ENABLE` (see `ClFactory::MakeContextAndQueue`), and aggregates
+ * them by name. It tells whether the device path is bound by the transfers or by the kernels.
+ *
+ * Instances are thread-safe.
+ */
+class ClProfiler
+{
+  private:
+    mutable std::mutex               _mutex;
+    std::vector<ClCommandStatistics> _statistics;
+    uint64_t                         _firstStart;
+    uint64_t                         _lastEnd;
+
+    // The disjoint intervals, from start to end, in which at least one transfer or kernel ran,
+    // and their total lengths. Commands of different batches overlap, so the busy time is less
+    // than the sum of the execution times.
+    std::map<uint64_t, uint64_t> _transferIntervals, _kernelIntervals;
+    uint64_t                     _transferBusyTime, _kernelBusyTime;
+
+  public:
+    ClProfiler() noexcept :
+        _firstStart { UINT64_MAX },
+        _lastEnd { 0 },
+        _transferBusyTime { 0 },
+        _kernelBusyTime { 0 }
+    {
+    }
+
+    ClProfiler(ClProfiler const&) = delete;
+    ClProfiler& operator=(ClProfiler const&) = delete;
+
+  public:
+    /**
+     * Records the timestamps of the given command, which must have completed.
+     *
+     * @param event the event of the command
+     * @param name the name to aggregate the command under
+     * @param kind what the command does
+     * @param numBytes the number of bytes copied by the command, or zero for kernels
+     * @throws ClException if the queue was not created with `CL_QUEUE_PROFILING_ENABLE`
+     */
+    void Record(cl::Event const& event,
+                std::string_view name,
+                ClCommandKind    kind,
+                uint64_t         numBytes = 0);
+
+    /**
+     * Returns a copy of the statistics of each name, in the order the names were first recorded.
+     */
+    std::vector<ClCommandStatistics> GetStatistics() const;
+
+    /**
+     * Prints a human-readable summary: the latency of each name with its histogram, and the time
+     * the device was busy with transfers and with kernels.
+     */
+    void PrintSummary(std::ostream& os) const;
+
+    /**
+     * Writes every statistic as a JSON document.
+     */
+    void WriteReport(std::ostream& os) const;
+};
+
+}
+
+#endif
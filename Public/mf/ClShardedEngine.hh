@@ -0,0 +1,184 @@
+// Copyright (c) 2021 Chanjung Kim. All rights reserved.
+// Licensed under the MIT License.
+
+#ifndef MNIST_FPGA_CL_SHARDED_ENGINE_HH
+#define MNIST_FPGA_CL_SHARDED_ENGINE_HH
+
+#include <mf/ClEngine.hh>
+#include <mf/ClProfiler.hh>
+#include <mf/Mnist.hh>
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+namespace mf
+{
+
+/**
+ * `ClShardStatistics` tells how much of the work one device of a `ClShardedEngine` did.
+ */
+struct ClShardStatistics
+{
+    /**
+     * the name of the device.
+     */
+    std::string name;
+
+    /**
+     * the number of batches classified by the device.
+     */
+    size_t numBatches;
+
+    /**
+     * the number of samples classified by the device.
+     */
+    size_t numSamples;
+
+    /**
+     * the total time the device spent classifying, in seconds.
+     */
+    double busyTime;
+
+    /**
+     * Returns the number of samples classified per second.
+     */
+    double GetThroughput() const noexcept
+    {
+        return busyTime == 0.0 ? 0.0 : numSamples / busyTime;
+    }
+};
+
+/**
+ * `ClShardedEngine` shards the batches across several `ClEngine` instances, each of which has
+ * its own device, context, queue and program. Each engine is driven by its own host thread and
+ * takes the next batch from a shared counter whenever one of its slots is free, so a slower or
+ * busier device takes fewer batches instead of holding back the others. The predictions are
+ * written in place, and the batches are reported in the order of the samples.
+ *
+ * Instances own device memory and cannot be copied.
+ */
+class ClShardedEngine
+{
+  public:
+    using BatchCallback = ClEngine::BatchCallback;
+
+    /**
+     * Creates an engine sharding the batches across the given engines.
+     *
+     * @param engines the engines to shard across, all running the same plan
+     * @param names the name of the device of each engine, used in the statistics
+     * @throws std::invalid_argument if `engines` is empty, or the engines or the names do not
+     * match
+     */
+    static ClShardedEngine MakeFromEngines(std::vector<ClEngine>    engines,
+                                           std::vector<std::string> names);
+
+  private:
+    std::vector<ClEngine>          _engines;
+    std::vector<ClShardStatistics> _statistics;
+
+  private:
+    ClShardedEngine(std::vector<ClEngine> engines, std::vector<std::string> names);
+
+  public:
+    ClShardedEngine(ClShardedEngine&&) = default;
+    ClShardedEngine& operator=(ClShardedEngine&&) = default;
+
+    ClShardedEngine(ClShardedEngine const&) = delete;
+    ClShardedEngine& operator=(ClShardedEngine const&) = delete;
+
+  public:
+    /**
+     * Returns the maximum number of samples of one batch.
+     */
+    size_t GetBatchSize() const noexcept
+    {
+        return _engines.front().GetBatchSize();
+    }
+
+    /**
+     * Returns the length of the input of one sample.
+     */
+    size_t GetInputSize() const noexcept
+    {
+        return _engines.front().GetInputSize();
+    }
+
+    /**
+     * Returns the length of the output of one sample.
+     */
+    size_t GetOutputSize() const noexcept
+    {
+        return _engines.front().GetOutputSize();
+    }
+
+    /**
+     * Returns the number of engines the batches are sharded across.
+     */
+    size_t GetNumShards() const noexcept
+    {
+        return _engines.size();
+    }
+
+    /**
+     * Returns the engine of the given shard.
+     */
+    ClEngine& GetShard(size_t index) noexcept
+    {
+        return _engines[index];
+    }
+
+    /**
+     * Returns the work done by each shard since the engine was created.
+     */
+    std::vector<ClShardStatistics> const& GetStatistics() const noexcept
+    {
+        return _statistics;
+    }
+
+    /**
+     * Sets the profiler of every shard (see `ClEngine::SetProfiler`).
+     */
+    void SetProfiler(ClProfiler* profiler) noexcept
+    {
+        for (auto& engine : _engines) engine.SetProfiler(profiler);
+    }
+
+    /**
+     * Classifies any number of samples as `ClEngine::Classify` does, sharding the batches across
+     * the engines. `onBatch` is called once for each batch in the order of the samples, never
+     * concurrently, after the predictions of every earlier batch are written. If an engine throws,
+     * the others stop taking batches and the first exception is rethrown once they are done.
+     *
+     * @param in the input matrix of dimension (`numSamples`, `GetInputSize()`), row-major
+     * @param numSamples the number of samples
+     * @param labels the array of length `numSamples` to write the results
+     * @param onBatch the function to call after the predictions of each batch are written, or
+     * an empty function
+     * @throws ClException
+     */
+    void Classify(float const*         in,
+                  size_t               numSamples,
+                  MnistLabel*          labels,
+                  BatchCallback const& onBatch = {});
+
+    /**
+     * The same as the overload taking `float` inputs, but reads the input as 8-bit integers.
+     */
+    void Classify(uint8_t const*       in,
+                  size_t               numSamples,
+                  MnistLabel*          labels,
+                  BatchCallback const& onBatch = {});
+
+  private:
+    template <typename In>
+    void ClassifyWith(In const*            in,
+                      size_t               numSamples,
+                      MnistLabel*          labels,
+                      BatchCallback const& onBatch);
+};
+
+}
+
+#endif
@@ -4,11 +4,18 @@
 #ifndef MNIST_FPGA_CONFIG_HH
 #define MNIST_FPGA_CONFIG_HH
 
+#include <mf/AutotuneMode.hh>
+#include <mf/Backend.hh>
+#include <mf/Cpu.hh>
 #include <mf/Exception.hh>
+#include <mf/File.hh>
+#include <mf/MnistPixelFormat.hh>
+#include <mf/WeightLayout.hh>
 
 #include <cstdint>
 #include <cstdlib>
 #include <filesystem>
+#include <optional>
 #include <string>
 
 namespace mf
@@ -19,6 +26,25 @@ namespace mf
  */
 MF_MAKE_NEW_EXCEPTION(ConfigNotFoundException, "Failed to load the configuration");
 
+/**
+ * `InvalidConfigException` is thrown when the value of an environmental variable cannot be parsed.
+ */
+MF_MAKE_NEW_EXCEPTION(InvalidConfigException, "The configuration has an invalid value");
+
+/**
+ * Represents the fields of `Config` that `Autotuner` may choose, as bits of
+ * `Config::explicitFields`.
+ */
+enum class ConfigField : uint32_t
+{
+    BatchSize        = 1 << 0,
+    NumThreads       = 1 << 1,
+    DenseTileSamples = 1 << 2,
+    DenseTileInputs  = 1 << 3,
+    DenseTileOutputs = 1 << 4,
+    DenseFused       = 1 << 5,
+};
+
 /**
  * `Config` contains options required during the execution of the program.
  */
@@ -35,7 +61,9 @@ struct Config
     std::string deviceName;
 
     /**
-     * the path of the device binary file. Corresponds to the `XCLBIN_PATH` environmental variable.
+     * the path of the device binary file, or an empty path to build the OpenCL C kernels from
+     * source. Corresponds to the `XCLBIN_PATH` environmental variable. Optional; defaults to an
+     * empty path.
      */
     std::filesystem::path xclbinPath;
 
@@ -44,6 +72,13 @@ struct Config
      */
     std::filesystem::path weightFilePath;
 
+    /**
+     * the representations of the kernel matrices to keep after loading the weight file.
+     * Corresponds to the `WEIGHT_LAYOUT` environmental variable, which is one of `raw`, `packed`
+     * and `both`. Optional; defaults to `both`.
+     */
+    WeightLayout weightLayout;
+
     /**
      * the path of the file containing MNIST images. Corresponds to the `MNIST_IMAGE_PATH`
      * environmental variable.
@@ -56,12 +91,246 @@ struct Config
      */
     std::filesystem::path mnistLabelFilePath;
 
+    /**
+     * the representation of the pixels of the MNIST images in memory. Corresponds to the
+     * `MNIST_PIXEL_FORMAT` environmental variable, which is one of `float` and `uint8`. Optional;
+     * defaults to `float`.
+     */
+    MnistPixelFormat mnistPixelFormat;
+
+    /**
+     * the hint given to the kernel when the MNIST files are mapped to memory, or `std::nullopt` to
+     * read the files instead. Corresponds to the `MNIST_MMAP` environmental variable, which is one
+     * of `off`, `on`, `populate`, `sequential` and `willneed`. Optional; defaults to `off`.
+     */
+    std::optional<MapHint> mnistMapHint;
+
+    /**
+     * the number of samples read from the MNIST files at once, or zero to load the whole dataset
+     * before evaluating it. If not zero, the dataset is streamed instead, and the images are read
+     * as `MnistPixelFormat::Byte` regardless of `mnistPixelFormat`. Corresponds to the
+     * `MNIST_STREAM_BATCH` environmental variable. Optional; defaults to 0.
+     */
+    size_t mnistStreamBatch;
+
+    /**
+     * the number of batches of the stream kept in memory, at least two. Corresponds to the
+     * `MNIST_STREAM_BUFFERS` environmental variable. Optional; defaults to 4.
+     */
+    size_t mnistStreamBuffers;
+
+    /**
+     * where the floating-point path is evaluated. Corresponds to the `BACKEND` environmental
+     * variable, which is one of `cpu`, `opencl` and `hybrid`. Optional; defaults to `cpu`.
+     */
+    Backend backend;
+
+    /**
+     * the number of samples of one round of the hybrid backend, which is split between the host
+     * and the OpenCL devices. Corresponds to the `HYBRID_ROUND_SIZE` environmental variable.
+     * Optional; defaults to 4096.
+     */
+    size_t hybridRoundSize;
+
+    /**
+     * whether to shard the batches across every OpenCL device matching `deviceName` instead of
+     * using the first one. Corresponds to the `CL_DEVICES` environmental variable, which is one
+     * of `first` and `all`. Optional; defaults to `first`.
+     */
+    bool clAllDevices;
+
+    /**
+     * the number of sub-devices to split each OpenCL device into, so that the batches are sharded
+     * across parts of one device, or zero not to split them. Corresponds to the `CL_SUB_DEVICES`
+     * environmental variable. Optional; defaults to 0.
+     */
+    size_t clNumSubDevices;
+
+    /**
+     * the number of batches in flight on the OpenCL device, at least two, so that the transfers
+     * of one batch overlap the kernels of another. Corresponds to the `CL_NUM_BUFFERS`
+     * environmental variable. Optional; defaults to 2.
+     */
+    size_t clNumBuffers;
+
+    /**
+     * the maximum number of bytes of device buffers pooled for the batches of each OpenCL
+     * device, or zero for no limit. Corresponds to the `CL_POOL_CAPACITY` environmental variable.
+     * Optional; defaults to 0.
+     */
+    size_t clPoolCapacity;
+
+    /**
+     * whether the OpenCL device reads the weights and the images in place from page-aligned host
+     * memory instead of copies, or `std::nullopt` to do so if the device shares the memory of the
+     * host. Corresponds to the `CL_ZERO_COPY` environmental variable, which is one of `auto`,
+     * `on` and `off`. Optional; defaults to `auto`.
+     */
+    std::optional<bool> clZeroCopy;
+
+    /**
+     * the number of outputs computed by one work-group of the OpenCL C kernels. Corresponds to
+     * the `CL_TILE_OUTPUTS` environmental variable. Optional; defaults to 16.
+     */
+    size_t clTileOutputs;
+
+    /**
+     * the number of samples computed by one work-group of the OpenCL C kernels. Corresponds to
+     * the `CL_TILE_SAMPLES` environmental variable. Optional; defaults to 16.
+     */
+    size_t clTileSamples;
+
+    /**
+     * the number of inputs staged in local memory at once by the OpenCL C kernels. Corresponds to
+     * the `CL_TILE_INPUTS` environmental variable. Optional; defaults to 32.
+     */
+    size_t clTileInputs;
+
+    /**
+     * the directory where the binaries of the OpenCL C kernels are cached, or an empty path to
+     * always build them. Corresponds to the `CL_CACHE_DIR` environmental variable. Optional;
+     * defaults to `mnist-fpga` in `$XDG_CACHE_HOME` or `$HOME/.cache`.
+     */
+    std::filesystem::path clCacheDirectory;
+
+    /**
+     * whether to print the latency of every kind of command run on the OpenCL device and the
+     * time spent on transfers and kernels after the evaluation. Corresponds to the `CL_PROFILE`
+     * environmental variable, which is one of `off` and `on`. Optional; defaults to `off`.
+     */
+    bool clProfile;
+
+    /**
+     * the path to write the profile of the OpenCL device to as JSON, or an empty path not to
+     * write it. Corresponds to the `CL_PROFILE_REPORT` environmental variable. Optional; defaults
+     * to an empty path.
+     */
+    std::filesystem::path clProfileReportPath;
+
+    /**
+     * the maximum number of samples processed at once. Corresponds to the `BATCH_SIZE`
+     * environmental variable. Optional; defaults to 256.
+     */
+    size_t batchSize;
+
+    /**
+     * the instruction set the CPU kernels are forced to use (e.g. `avx2`). Corresponds to the
+     * `DENSE_ISA` environmental variable. Optional; the widest one available is used if not set.
+     */
+    std::optional<Isa> denseIsa;
+
+    /**
+     * whether the CPU kernels may run the layers of networks of the shapes they are specialized
+     * for fused, instead of one layer after another. Corresponds to the `DENSE_FUSED`
+     * environmental variable, which is one of `off` and `on`. Optional; defaults to `on`.
+     */
+    bool denseFused;
+
+    /**
+     * the number of samples, inputs and outputs of one block of the CPU kernels running one layer
+     * after another. Correspond to the `DENSE_TILE_SAMPLES`, `DENSE_TILE_INPUTS` and
+     * `DENSE_TILE_OUTPUTS` environmental variables. Optional; default to 64, 256 and 128.
+     */
+    size_t denseTileSamples, denseTileInputs, denseTileOutputs;
+
+    /**
+     * the fraction of nonzero elements of the input of a layer below which the CPU kernels
+     * compute the layer from the nonzero elements only, or zero to always compute it densely.
+     * Corresponds to the `DENSE_SPARSE_THRESHOLD` environmental variable, a number from 0 to 1.
+     * Optional; defaults to `SparseBatch::defaultThreshold`.
+     */
+    double denseSparseThreshold;
+
+    /**
+     * where the batch size, the number of threads and the parameters of the CPU kernels come
+     * from. Corresponds to the `AUTOTUNE` environmental variable, which is one of `off`, `cached`
+     * and `on`. Optional; defaults to `cached`.
+     */
+    AutotuneMode autotune;
+
+    /**
+     * the file the parameters found by `Autotuner` are stored to, or an empty path not to store
+     * them. Corresponds to the `AUTOTUNE_CACHE` environmental variable. Optional; defaults to
+     * `autotune.json` in `$XDG_CACHE_HOME/mnist-fpga` or `$HOME/.cache/mnist-fpga`.
+     */
+    std::filesystem::path autotuneCachePath;
+
+    /**
+     * the greatest time in microseconds one batch may take on one thread for a configuration to
+     * be chosen by `Autotuner`, or zero for no limit. Corresponds to the
+     * `AUTOTUNE_LATENCY_BUDGET` environmental variable. Optional; defaults to 0.
+     */
+    size_t autotuneLatencyBudget;
+
+    /**
+     * whether to count hardware events per stage with `PerfCounters` and print them after the
+     * evaluation. Corresponds to the `PERF_COUNTERS` environmental variable, which is one of `off`
+     * and `on`. Optional; defaults to `off`.
+     */
+    bool perfCounters;
+
+    /**
+     * the number of threads evaluating the dataset. Corresponds to the `NUM_THREADS`
+     * environmental variable. Optional; defaults to the number of hardware threads.
+     */
+    size_t numThreads;
+
+    /**
+     * the minimum time in milliseconds between two progress lines, or zero to disable progress
+     * reporting. Corresponds to the `PROGRESS_INTERVAL` environmental variable. Optional; defaults
+     * to 1000.
+     */
+    size_t progressInterval;
+
+    /**
+     * the number of samples used to calibrate the activation ranges of the int8 path, or zero to
+     * disable the int8 path. Corresponds to the `INT8_CALIBRATION_SIZE` environmental variable.
+     * Optional; defaults to 0.
+     */
+    size_t int8CalibrationSize;
+
+    /**
+     * the greatest accuracy drop of the int8 path from the floating-point path, in percentage
+     * points, with which the int8 path is accepted. Corresponds to the `INT8_MAX_ACCURACY_DROP`
+     * environmental variable. Optional; defaults to 0.5.
+     */
+    double int8MaxAccuracyDrop;
+
+    /**
+     * the path of the Unix domain socket to serve classification requests on with
+     * `InferenceServer`, or an empty path to evaluate the dataset and exit. Corresponds to the
+     * `SERVER_SOCKET` environmental variable. Optional; defaults to an empty path.
+     */
+    std::filesystem::path serverSocketPath;
+
+    /**
+     * the greatest time in microseconds a request waits for others to fill its batch. Corresponds
+     * to the `SERVER_MAX_WAIT` environmental variable. Optional; defaults to 1000.
+     */
+    size_t serverMaxWait;
+
+    /**
+     * the `ConfigField` bits of the fields whose environmental variables are set, which
+     * `Autotuner::Apply` leaves as they are.
+     */
+    uint32_t explicitFields;
+
     /**
      * Creates a `Config` instance from environmental variables.
      *
      * @throws ConfigNotFoundException If any required environmental variable is not set.
+     * @throws InvalidConfigException If any environmental variable has an invalid value.
      */
     static Config MakeFromEnvironment();
+
+    /**
+     * Returns whether the given field was set by its environmental variable instead of being left
+     * to its default.
+     */
+    bool IsExplicit(ConfigField field) const noexcept
+    {
+        return (explicitFields & (uint32_t)field) != 0;
+    }
 };
 
 }
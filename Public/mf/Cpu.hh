@@ -0,0 +1,62 @@
+// Copyright (c) 2021 Chanjung Kim. All rights reserved.
+// Licensed under the MIT License.
+
+#ifndef MNIST_FPGA_CPU_HH
+#define MNIST_FPGA_CPU_HH
+
+#include <cstdint>
+#include <string>
+
+namespace mf
+{
+
+/**
+ * Represents a vector instruction set which CPU kernels can be compiled for. A greater value
+ * implies all smaller ones.
+ */
+enum class Isa : uint8_t
+{
+    Scalar,
+    Sse4,
+    Avx2,
+    Avx512,
+};
+
+/**
+ * `Cpu` contains helper functions to query the features of the host CPU. All member functions of
+ * `Cpu` are static.
+ */
+class Cpu
+{
+  public:
+    /**
+     * Returns the widest instruction set supported by both the CPU and the operating system. The
+     * value is detected with `cpuid` on the first call and cached afterwards.
+     */
+    static Isa GetIsa() noexcept;
+
+    /**
+     * Returns the brand string of the CPU (e.g. `Intel(R) Xeon(R) Gold 6248 CPU @ 2.50GHz`), or
+     * `unknown` if the CPU does not tell. The value is read on the first call and cached
+     * afterwards.
+     */
+    static std::string const& GetModelName();
+
+    /**
+     * Returns the lowercase name of the given instruction set (e.g. `avx2`).
+     */
+    static char const* GetIsaName(Isa isa) noexcept;
+
+    /**
+     * Finds the instruction set with the given lowercase name.
+     *
+     * @param name the name of the instruction set
+     * @param isa the variable to store the result
+     * @return `true` if the name is valid
+     */
+    static bool ParseIsaName(char const* name, Isa& isa) noexcept;
+};
+
+}
+
+#endif
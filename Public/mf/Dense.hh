@@ -0,0 +1,264 @@
+// Copyright (c) 2021 Chanjung Kim. All rights reserved.
+// Licensed under the MIT License.
+
+#ifndef MNIST_FPGA_DENSE_HH
+#define MNIST_FPGA_DENSE_HH
+
+#include <mf/Activation.hh>
+#include <mf/Cpu.hh>
+#include <mf/Exception.hh>
+#include <mf/Weights.hh>
+
+#include <cstdint>
+#include <vector>
+
+namespace mf
+{
+
+/**
+ * `UnsupportedIsaException` is thrown when the requested instruction set is not supported by the
+ * CPU or was not compiled in.
+ */
+MF_MAKE_NEW_EXCEPTION(UnsupportedIsaException, "The instruction set is not available");
+
+/**
+ * `DenseBlocking` contains the cache blocking parameters of `Dense::ApplyBatch`. A tile of the
+ * kernel matrix of `numInputs` x `numOutputs` elements is loaded once and reused for `numSamples`
+ * samples before moving on to the next tile.
+ */
+struct DenseBlocking
+{
+    /**
+     * the number of samples sharing one kernel tile.
+     */
+    size_t numSamples { 64 };
+
+    /**
+     * the number of rows of one kernel tile, i.e. the number of input features accumulated per
+     * pass.
+     */
+    size_t numInputs { 256 };
+
+    /**
+     * the number of columns of one kernel tile, i.e. the number of output features computed per
+     * pass.
+     */
+    size_t numOutputs { 128 };
+};
+
+/**
+ * `SparseBatch` is a batch of input vectors in the compressed sparse row format: the nonzero
+ * elements of each sample and their indices, back to back. `Dense::ApplySparse` reads only the
+ * kernel rows of these elements, so a layer whose inputs are mostly zeros, such as the first layer
+ * on MNIST images or a layer after ReLU, does a fraction of the work of `Dense::ApplyBatch`.
+ */
+class SparseBatch
+{
+  private:
+    std::vector<uint32_t> _offsets;
+    std::vector<uint32_t> _indices;
+    std::vector<float>    _values;
+    size_t                _numSamples;
+    size_t                _inputSize;
+
+  public:
+    /**
+     * The default density below which a layer is computed from a `SparseBatch`, below the density
+     * at which `Dense::ApplySparse` stops being faster than `Dense::ApplyBatch` on the first layer
+     * of `MnistNetwork` (see `sparse/` in `mnist-fpga-bench`).
+     */
+    constexpr static double defaultThreshold = 0.25;
+
+    /**
+     * Returns the fraction of the elements of the given array which are not zero.
+     *
+     * @param in the array
+     * @param size the length of the array, which may be zero
+     */
+    static double GetDensity(float const* in, size_t size) noexcept;
+
+    /**
+     * The same as the overload taking `float` inputs, but reads the input as 8-bit integers.
+     */
+    static double GetDensity(uint8_t const* in, size_t size) noexcept;
+
+    /**
+     * Creates an empty batch with room for the given number of samples, so that encoding that many
+     * samples allocates nothing.
+     *
+     * @param batchSize the number of samples
+     * @param inputSize the length of the input of one sample
+     */
+    explicit SparseBatch(size_t batchSize = 0, size_t inputSize = 0);
+
+  public:
+    /**
+     * Replaces the batch with the nonzero elements of the given samples.
+     *
+     * @param in the input matrix of dimension (`numSamples`, `inputSize`), row-major
+     * @param numSamples the number of samples
+     * @param inputSize the length of the input of one sample
+     */
+    void Encode(float const* in, size_t numSamples, size_t inputSize);
+
+    /**
+     * The same as the overload taking `float` inputs, but reads the input as 8-bit integers.
+     */
+    void Encode(uint8_t const* in, size_t numSamples, size_t inputSize);
+
+    /**
+     * Returns the number of samples.
+     */
+    size_t GetNumSamples() const noexcept
+    {
+        return _numSamples;
+    }
+
+    /**
+     * Returns the length of the input of one sample, zeros included.
+     */
+    size_t GetInputSize() const noexcept
+    {
+        return _inputSize;
+    }
+
+    /**
+     * Returns the number of nonzero elements of all samples.
+     */
+    size_t GetNumNonzeros() const noexcept
+    {
+        return _offsets[_numSamples];
+    }
+
+    /**
+     * Returns the array of length `GetNumSamples() + 1` whose elements `s` and `s + 1` delimit the
+     * nonzero elements of sample `s` in `GetIndices()` and `GetValues()`.
+     */
+    uint32_t const* GetOffsets() const noexcept
+    {
+        return _offsets.data();
+    }
+
+    /**
+     * Returns the indices of the nonzero elements within their samples, in ascending order.
+     */
+    uint32_t const* GetIndices() const noexcept
+    {
+        return _indices.data();
+    }
+
+    /**
+     * Returns the nonzero elements.
+     */
+    float const* GetValues() const noexcept
+    {
+        return _values.data();
+    }
+};
+
+/**
+ * `Dense` contains CPU implementations of the FC layer followed by an activation, ReLU unless
+ * specified otherwise. All member functions of `Dense` are static.
+ *
+ * `ApplyBatch` has one implementation per instruction set (see `Isa`). The widest one supported by
+ * the CPU is selected once on the first call, so a single binary uses AVX-512 on Skylake-SP and
+ * AVX2/FMA on Zen 3, and falls back to the scalar implementation elsewhere.
+ */
+class Dense
+{
+  public:
+    /**
+     * Computes one single sample. This is the straightforward matrix-vector implementation and is
+     * kept as the reference of the other implementations.
+     *
+     * @param in the input vector of length I
+     * @param out the output vector of length O
+     * @param layer the weight of the layer
+     * @throws std::invalid_argument if `layer` does not keep the raw layout
+     */
+    static void Apply(float const* in, float* out, Weight const& layer);
+
+    /**
+     * Computes `batchSize` samples at once as a cache-blocked matrix-matrix multiplication with the
+     * bias addition and ReLU fused in, using the implementation returned by `GetIsa()`. The packed
+     * kernel matrix is used if the layer has one, and the raw one otherwise. Softmax is applied by
+     * `Softmax` after the multiplication.
+     *
+     * @param in the input matrix of dimension (`batchSize`, I), row-major
+     * @param out the output matrix of dimension (`batchSize`, O), row-major
+     * @param batchSize the number of samples
+     * @param layer the weight of the layer
+     * @param blocking the cache blocking parameters
+     * @param activation the activation applied to the output
+     */
+    static void ApplyBatch(float const*         in,
+                           float*               out,
+                           size_t               batchSize,
+                           Weight const&        layer,
+                           DenseBlocking const& blocking   = {},
+                           Activation           activation = Activation::Relu);
+
+    /**
+     * The same as the overload taking `float` inputs, but reads the input as 8-bit integers. Used
+     * for the first layer when the images are kept as stored in the file (see
+     * `MnistPixelFormat::Byte`), in which case the normalization must be folded into the kernel.
+     *
+     * @param in the input matrix of dimension (`batchSize`, I), row-major
+     * @param out the output matrix of dimension (`batchSize`, O), row-major
+     * @param batchSize the number of samples
+     * @param layer the weight of the layer
+     * @param blocking the cache blocking parameters
+     * @param activation the activation applied to the output
+     */
+    static void ApplyBatch(uint8_t const*       in,
+                           float*               out,
+                           size_t               batchSize,
+                           Weight const&        layer,
+                           DenseBlocking const& blocking   = {},
+                           Activation           activation = Activation::Relu);
+
+    /**
+     * Computes the samples of the given batch as `ApplyBatch` would, but accumulates only the
+     * kernel rows of the nonzero inputs. The work is proportional to the number of nonzero inputs
+     * instead of the length of the input, which makes it faster than `ApplyBatch` below a density
+     * of the inputs measured by `mnist-fpga-bench`.
+     *
+     * @param in the input samples, of length I
+     * @param out the output matrix of dimension (`in.GetNumSamples()`, O), row-major
+     * @param layer the weight of the layer
+     * @param activation the activation applied to the output
+     */
+    static void ApplySparse(SparseBatch const& in,
+                            float*             out,
+                            Weight const&      layer,
+                            Activation         activation = Activation::Relu);
+
+    /**
+     * Replaces each row of the given matrix with its softmax. The greatest element of each row is
+     * subtracted first, so large logits do not overflow.
+     *
+     * @param inout the matrix of dimension (`batchSize`, `size`), row-major
+     * @param batchSize the number of rows
+     * @param size the number of columns
+     */
+    static void Softmax(float* inout, size_t batchSize, size_t size) noexcept;
+
+    /**
+     * Returns the instruction set of the implementation `ApplyBatch` currently uses.
+     */
+    static Isa GetIsa() noexcept;
+
+    /**
+     * Makes `ApplyBatch` use the implementation for the given instruction set. Intended to be
+     * called at startup to compare implementations; not thread-safe with concurrent `ApplyBatch`
+     * calls.
+     *
+     * @param isa the instruction set
+     * @throws UnsupportedIsaException
+     */
+    static void SetIsa(Isa isa);
+};
+
+}
+
+#endif
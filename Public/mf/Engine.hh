@@ -0,0 +1,198 @@
+// Copyright (c) 2021 Chanjung Kim. All rights reserved.
+// Licensed under the MIT License.
+
+#ifndef MNIST_FPGA_ENGINE_HH
+#define MNIST_FPGA_ENGINE_HH
+
+#include <mf/AlignedAllocator.hh>
+#include <mf/Dense.hh>
+#include <mf/ExecutionPlan.hh>
+#include <mf/Mnist.hh>
+#include <mf/StaticNetwork.hh>
+#include <mf/Weights.hh>
+
+#include <cstdint>
+#include <memory>
+#include <optional>
+#include <string>
+#include <vector>
+
+namespace mf
+{
+
+/**
+ * `Engine` runs an `ExecutionPlan` on batches of samples. Every layer is computed with
+ * `Dense::ApplyBatch`, so each weight tile is reused across the whole batch instead of being
+ * streamed from memory once per sample. If the layers have the shape of `MnistNetwork`, packed
+ * kernels and ReLU on every hidden layer, `MnistNetwork` is used instead, which runs every layer on
+ * a few samples at a time with compile-time sizes.
+ *
+ * The input of each layer whose fraction of nonzero elements is below the sparse threshold is
+ * encoded as a `SparseBatch` and computed with `Dense::ApplySparse`, which skips the zero pixels of
+ * MNIST images and the outputs zeroed by ReLU. `MnistNetwork` does so for its first layer only,
+ * since it keeps the later activations in registers.
+ *
+ * The activations live in an arena laid out by the plan and allocated once on construction, so
+ * running a batch allocates nothing.
+ */
+class Engine
+{
+  public:
+    /**
+     * The default sparse threshold, `SparseBatch::defaultThreshold`.
+     */
+    constexpr static double defaultSparseThreshold = SparseBatch::defaultThreshold;
+
+    /**
+     * Creates an `Engine` instance running the given plan.
+     *
+     * @param plan the plan, which may be shared with other engines
+     * @param blocking the cache blocking parameters
+     * @param fused whether to use `MnistNetwork` if the layers have its shape; if false, every
+     * layer is computed with `Dense::ApplyBatch`
+     * @param sparseThreshold the density of the input of a batch below which a layer is computed
+     * from the nonzero inputs only, or zero to always compute the layers densely
+     */
+    static Engine MakeFromPlan(std::shared_ptr<ExecutionPlan const> plan,
+                               DenseBlocking const&                 blocking = {},
+                               bool                                 fused    = true,
+                               double sparseThreshold = defaultSparseThreshold);
+
+    /**
+     * Creates an `Engine` instance running the given layers in the given order, with ReLU applied
+     * to the output of every layer.
+     *
+     * @param weights the weight collection containing the layers
+     * @param layerNames the names of the layers, from the input to the output
+     * @param batchSize the maximum number of samples processed at once
+     * @param blocking the cache blocking parameters
+     * @throws LayerNotFoundException
+     * @throws LayerShapeMismatchException
+     * @throws std::invalid_argument if `layerNames` is empty or `batchSize` is zero
+     */
+    static Engine MakeFromWeights(WeightCollection const&         weights,
+                                  std::vector<std::string> const& layerNames,
+                                  size_t                          batchSize,
+                                  DenseBlocking const&            blocking = {});
+
+  private:
+    std::shared_ptr<ExecutionPlan const> _plan;
+    DenseBlocking                        _blocking;
+    double                               _sparseThreshold;
+    AlignedVector<float>                 _arena;
+    SparseBatch                          _sparse;
+    std::optional<MnistNetwork>          _mnistNetwork;
+
+  private:
+    Engine(std::shared_ptr<ExecutionPlan const>&& plan,
+           DenseBlocking const&                   blocking,
+           bool                                   fused,
+           double                                 sparseThreshold);
+
+  public:
+    /**
+     * Returns the plan the engine runs.
+     */
+    ExecutionPlan const& GetPlan() const noexcept
+    {
+        return *_plan;
+    }
+
+    /**
+     * Returns the cache blocking parameters of the layers computed with `Dense::ApplyBatch`.
+     */
+    DenseBlocking const& GetBlocking() const noexcept
+    {
+        return _blocking;
+    }
+
+    /**
+     * Returns the density of the input below which a layer is computed from the nonzero inputs
+     * only.
+     */
+    double GetSparseThreshold() const noexcept
+    {
+        return _sparseThreshold;
+    }
+
+    /**
+     * Returns whether the layers are run fused by `MnistNetwork`, in which case the cache blocking
+     * parameters are not used.
+     */
+    bool IsFused() const noexcept
+    {
+        return _mnistNetwork.has_value();
+    }
+
+    /**
+     * Returns the maximum number of samples processed at once.
+     */
+    size_t GetBatchSize() const noexcept
+    {
+        return _plan->GetBatchSize();
+    }
+
+    /**
+     * Returns the length of the input of one sample.
+     */
+    size_t GetInputSize() const noexcept
+    {
+        return _plan->GetInputSize();
+    }
+
+    /**
+     * Returns the length of the output of one sample.
+     */
+    size_t GetOutputSize() const noexcept
+    {
+        return _plan->GetOutputSize();
+    }
+
+    /**
+     * Runs all layers on the given samples and returns the output of the last layer, after its
+     * activation. The returned buffer is owned by the engine and is overwritten by the next call.
+     *
+     * @param in the input matrix of dimension (`numSamples`, `GetInputSize()`), row-major
+     * @param numSamples the number of samples
+     * @return the output matrix of dimension (`numSamples`, `GetOutputSize()`), row-major
+     * @throws std::invalid_argument if `numSamples` is greater than `GetBatchSize()`
+     */
+    float const* Forward(float const* in, size_t numSamples);
+
+    /**
+     * Runs all layers on the given samples and writes the index of the greatest output of each
+     * sample. A softmax on the last layer is skipped, since it does not change the greatest output.
+     *
+     * @param in the input matrix of dimension (`numSamples`, `GetInputSize()`), row-major
+     * @param numSamples the number of samples
+     * @param labels the array of length `numSamples` to write the results
+     * @throws std::invalid_argument if `numSamples` is greater than `GetBatchSize()`
+     */
+    void Classify(float const* in, size_t numSamples, MnistLabel* labels);
+
+    /**
+     * The same as the overload taking `float` inputs, but reads the input as 8-bit integers (see
+     * `Dense::ApplyBatch`).
+     */
+    float const* Forward(uint8_t const* in, size_t numSamples);
+
+    /**
+     * The same as the overload taking `float` inputs, but reads the input as 8-bit integers (see
+     * `Dense::ApplyBatch`).
+     */
+    void Classify(uint8_t const* in, size_t numSamples, MnistLabel* labels);
+
+  private:
+    template <typename In>
+    bool TryEncodeSparse(In const* in, size_t numSamples, size_t inputSize);
+
+    template <typename In>
+    float const* ForwardWith(In const* in, size_t numSamples, bool normalize);
+
+    template <typename In>
+    void ClassifyWith(In const* in, size_t numSamples, MnistLabel* labels);
+};
+
+}
+
+#endif
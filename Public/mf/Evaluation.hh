@@ -0,0 +1,248 @@
+// Copyright (c) 2021 Chanjung Kim. All rights reserved.
+// Licensed under the MIT License.
+
+#ifndef MNIST_FPGA_EVALUATION_HH
+#define MNIST_FPGA_EVALUATION_HH
+
+#include <mf/ClEngine.hh>
+#include <mf/ClShardedEngine.hh>
+#include <mf/Engine.hh>
+#include <mf/HybridEngine.hh>
+#include <mf/Mnist.hh>
+#include <mf/MnistStream.hh>
+#include <mf/QuantizedEngine.hh>
+#include <mf/ThreadPool.hh>
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <mutex>
+#include <ostream>
+#include <thread>
+
+namespace mf
+{
+
+/**
+ * `EvaluationResult` contains the result of classifying a dataset.
+ */
+struct EvaluationResult
+{
+    /**
+     * the number of classified samples.
+     */
+    size_t numSamples;
+
+    /**
+     * the number of samples classified correctly.
+     */
+    size_t numCorrect;
+
+    /**
+     * `confusion[label][prediction]` is the number of samples of class `label` classified as
+     * `prediction`.
+     */
+    std::array<std::array<size_t, numMnistLabels>, numMnistLabels> confusion;
+
+    /**
+     * Returns the ratio of the samples classified correctly.
+     */
+    double GetAccuracy() const noexcept
+    {
+        return numSamples == 0 ? 0.0 : (double)numCorrect / numSamples;
+    }
+};
+
+/**
+ * `ProgressReporter` prints the number of classified samples periodically from its own thread.
+ * Workers only increment atomic counters, so they never wait for each other on the output stream.
+ */
+class ProgressReporter
+{
+  private:
+    std::ostream&             _os;
+    std::chrono::milliseconds _interval;
+    std::atomic<size_t>       _numSamples;
+    std::atomic<size_t>       _numCorrect;
+    std::mutex                _mutex;
+    std::condition_variable   _stopped;
+    bool                      _stop;
+    std::thread               _thread;
+
+  public:
+    /**
+     * Starts the reporting thread.
+     *
+     * @param os the stream to print to
+     * @param interval the minimum time between two lines
+     */
+    ProgressReporter(std::ostream& os, std::chrono::milliseconds interval);
+
+    ProgressReporter(ProgressReporter const&) = delete;
+    ProgressReporter& operator=(ProgressReporter const&) = delete;
+
+    /**
+     * Stops the reporting thread.
+     */
+    ~ProgressReporter();
+
+  public:
+    /**
+     * Records that the given number of samples have been classified. Thread-safe and lock-free.
+     */
+    void Add(size_t numSamples, size_t numCorrect) noexcept
+    {
+        _numCorrect.fetch_add(numCorrect, std::memory_order_relaxed);
+        _numSamples.fetch_add(numSamples, std::memory_order_relaxed);
+    }
+
+  private:
+    void Run();
+};
+
+/**
+ * `Evaluation` contains helper functions to measure the accuracy of a model. All member functions
+ * of `Evaluation` are static.
+ */
+class Evaluation
+{
+  public:
+    /**
+     * Classifies every sample of the dataset on the given thread pool. The samples are split into
+     * chunks of `engine.GetBatchSize()` samples; each worker runs its own copy of `engine`, so no
+     * activation buffer is shared, and counts into its own result, which are summed at the end.
+     * Since the prediction of a sample does not depend on which chunk it belongs to, the result
+     * is the same regardless of the number of threads.
+     *
+     * @param engine the engine to copy for each worker
+     * @param mnist the dataset
+     * @param pool the thread pool to run on
+     * @param reporter the progress reporter to notify after each chunk, or `nullptr`
+     */
+    static EvaluationResult Evaluate(Engine const&     engine,
+                                     Mnist const&      mnist,
+                                     ThreadPool&       pool,
+                                     ProgressReporter* reporter = nullptr);
+
+    /**
+     * Classifies every sample of the dataset on the given thread pool with the quantized engine.
+     * Otherwise the same as the overload taking an `Engine`.
+     *
+     * @param engine the engine to copy for each worker
+     * @param mnist the dataset
+     * @param pool the thread pool to run on
+     * @param reporter the progress reporter to notify after each chunk, or `nullptr`
+     */
+    static EvaluationResult Evaluate(QuantizedEngine const& engine,
+                                     Mnist const&           mnist,
+                                     ThreadPool&            pool,
+                                     ProgressReporter*      reporter = nullptr);
+
+    /**
+     * Classifies every sample read from the stream on the given thread pool. Each batch of the
+     * stream is split into chunks of `engine.GetBatchSize()` samples, which are classified as in
+     * the overload taking a `Mnist` while the stream reads the following batches. The stream must
+     * not have been consumed, and the engine must take images of `MnistPixelFormat::Byte`.
+     *
+     * @param engine the engine to copy for each worker
+     * @param stream the stream to consume
+     * @param pool the thread pool to run on
+     * @param reporter the progress reporter to notify after each chunk, or `nullptr`
+     * @throws NoSuchFileException
+     * @throws InvalidMnistDatasetException
+     */
+    static EvaluationResult Evaluate(Engine const&     engine,
+                                     MnistStream&      stream,
+                                     ThreadPool&       pool,
+                                     ProgressReporter* reporter = nullptr);
+
+    /**
+     * Classifies every sample read from the stream on the given thread pool with the quantized
+     * engine. Otherwise the same as the overload taking an `Engine`.
+     *
+     * @param engine the engine to copy for each worker
+     * @param stream the stream to consume
+     * @param pool the thread pool to run on
+     * @param reporter the progress reporter to notify after each chunk, or `nullptr`
+     * @throws NoSuchFileException
+     * @throws InvalidMnistDatasetException
+     */
+    static EvaluationResult Evaluate(QuantizedEngine const& engine,
+                                     MnistStream&           stream,
+                                     ThreadPool&            pool,
+                                     ProgressReporter*      reporter = nullptr);
+
+    /**
+     * Classifies every sample of the dataset on the OpenCL device. The batches are pipelined by
+     * the engine, and the predictions of each batch are counted on the host while the device works
+     * on the following ones.
+     *
+     * @param engine the engine to run
+     * @param mnist the dataset
+     * @param reporter the progress reporter to notify after each batch, or `nullptr`
+     * @throws ClException
+     */
+    static EvaluationResult Evaluate(ClEngine&         engine,
+                                     Mnist const&      mnist,
+                                     ProgressReporter* reporter = nullptr);
+
+    /**
+     * Classifies every sample read from the stream on the OpenCL device. Each batch of the stream
+     * is classified as in the overload taking a `Mnist` while the stream reads the following
+     * batches. The stream must not have been consumed, and the engine must take images of
+     * `MnistPixelFormat::Byte`.
+     *
+     * @param engine the engine to run
+     * @param stream the stream to consume
+     * @param reporter the progress reporter to notify after each batch, or `nullptr`
+     * @throws ClException
+     * @throws NoSuchFileException
+     * @throws InvalidMnistDatasetException
+     */
+    static EvaluationResult Evaluate(ClEngine&         engine,
+                                     MnistStream&      stream,
+                                     ProgressReporter* reporter = nullptr);
+
+    /**
+     * The same as the overload taking a `ClEngine`, but shards the batches across the devices of
+     * the engine. The predictions are still counted in the order of the samples.
+     */
+    static EvaluationResult Evaluate(ClShardedEngine&  engine,
+                                     Mnist const&      mnist,
+                                     ProgressReporter* reporter = nullptr);
+
+    /**
+     * The same as the overload taking a `ClEngine`, but shards the batches of each batch of the
+     * stream across the devices of the engine.
+     */
+    static EvaluationResult Evaluate(ClShardedEngine&  engine,
+                                     MnistStream&      stream,
+                                     ProgressReporter* reporter = nullptr);
+
+    /**
+     * The same as the overload taking a `ClEngine`, but splits every round between the host and
+     * the devices of the engine. The predictions are counted after each round.
+     */
+    static EvaluationResult Evaluate(HybridEngine&     engine,
+                                     Mnist const&      mnist,
+                                     ProgressReporter* reporter = nullptr);
+
+    /**
+     * The same as the overload taking a `ClEngine`, but splits every round of each batch of the
+     * stream between the host and the devices of the engine.
+     */
+    static EvaluationResult Evaluate(HybridEngine&     engine,
+                                     MnistStream&      stream,
+                                     ProgressReporter* reporter = nullptr);
+
+    /**
+     * Prints the accuracy and the confusion matrix.
+     */
+    static void Print(std::ostream& os, EvaluationResult const& result);
+};
+
+}
+
+#endif
@@ -0,0 +1,150 @@
+// Copyright (c) 2021 Chanjung Kim. All rights reserved.
+// Licensed under the MIT License.
+
+#ifndef MNIST_FPGA_EXECUTION_PLAN_HH
+#define MNIST_FPGA_EXECUTION_PLAN_HH
+
+#include <mf/Activation.hh>
+#include <mf/Exception.hh>
+#include <mf/Model.hh>
+#include <mf/Weights.hh>
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+namespace mf
+{
+
+/**
+ * `LayerNotFoundException` is thrown when the weight collection does not contain the given layer.
+ */
+MF_MAKE_NEW_EXCEPTION(LayerNotFoundException, "Failed to find the layer");
+
+/**
+ * `LayerShapeMismatchException` is thrown when the output of a layer cannot be fed to the next
+ * layer.
+ */
+MF_MAKE_NEW_EXCEPTION(LayerShapeMismatchException, "The shapes of the consecutive layers differ");
+
+/**
+ * `ExecutionPlan` is a model resolved against its weights for one batch size: the layers in the
+ * order they run, the activation of each, and the layout of the activation arena. An engine
+ * running the plan allocates the arena once, as two ping-pong buffers each holding the widest
+ * activation of a full batch, so running a batch allocates nothing.
+ *
+ * Plans are immutable and can be shared between engines, each of which owns its own arena. The
+ * weights must outlive the plan.
+ */
+class ExecutionPlan
+{
+  public:
+    /**
+     * `Step` is one layer of the plan.
+     */
+    struct Step
+    {
+        /**
+         * the name of the layer.
+         */
+        std::string name;
+
+        /**
+         * the weight of the layer.
+         */
+        Weight const* layer;
+
+        /**
+         * the activation applied to the output of the layer.
+         */
+        Activation activation;
+    };
+
+    /**
+     * Resolves the given layers against the weights.
+     *
+     * @param weights the weight collection containing the layers
+     * @param layers the layers, from the input to the output
+     * @param batchSize the maximum number of samples processed at once
+     * @throws LayerNotFoundException
+     * @throws LayerShapeMismatchException
+     * @throws std::invalid_argument if `layers` is empty or `batchSize` is zero
+     */
+    static ExecutionPlan Compile(WeightCollection const&       weights,
+                                 std::vector<LayerSpec> const& layers,
+                                 size_t                        batchSize);
+
+  private:
+    std::vector<Step> _steps;
+    size_t            _batchSize;
+    size_t            _bufferSize;
+
+  private:
+    ExecutionPlan(std::vector<Step>&& steps, size_t batchSize);
+
+  public:
+    /**
+     * Returns the layers in the order they run.
+     */
+    std::vector<Step> const& GetSteps() const noexcept
+    {
+        return _steps;
+    }
+
+    /**
+     * Returns the weights of the layers in the order they run.
+     */
+    std::vector<Weight const*> GetLayers() const;
+
+    /**
+     * Returns the maximum number of samples processed at once.
+     */
+    size_t GetBatchSize() const noexcept
+    {
+        return _batchSize;
+    }
+
+    /**
+     * Returns the length of the input of one sample.
+     */
+    size_t GetInputSize() const noexcept
+    {
+        return _steps.front().layer->GetInputSize();
+    }
+
+    /**
+     * Returns the length of the output of one sample.
+     */
+    size_t GetOutputSize() const noexcept
+    {
+        return _steps.back().layer->GetOutputSize();
+    }
+
+    /**
+     * Returns the activation of the last layer.
+     */
+    Activation GetOutputActivation() const noexcept
+    {
+        return _steps.back().activation;
+    }
+
+    /**
+     * Returns the number of floats of one ping-pong buffer, a multiple of a cache line.
+     */
+    size_t GetBufferSize() const noexcept
+    {
+        return _bufferSize;
+    }
+
+    /**
+     * Returns the number of floats of the whole arena.
+     */
+    size_t GetArenaSize() const noexcept
+    {
+        return 2 * _bufferSize;
+    }
+};
+
+}
+
+#endif
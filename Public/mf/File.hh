@@ -8,6 +8,8 @@
 
 #include <cstdint>
 #include <filesystem>
+#include <functional>
+#include <ostream>
 #include <vector>
 
 namespace mf
@@ -19,6 +21,83 @@ namespace mf
  */
 MF_MAKE_NEW_EXCEPTION(NoSuchFileException, "Could not open the file");
 
+/**
+ * Represents the hints given to the kernel when a file is mapped to memory.
+ */
+enum class MapHint : uint8_t
+{
+    /**
+     * No hint; pages are read on the first access.
+     */
+    None,
+
+    /**
+     * Reads every page before `MappedFile::Open` returns (`MAP_POPULATE`).
+     */
+    Populate,
+
+    /**
+     * Pages will be accessed in order, so they are read ahead aggressively (`MADV_SEQUENTIAL`).
+     */
+    Sequential,
+
+    /**
+     * Pages will be accessed soon, so they are read in the background (`MADV_WILLNEED`).
+     */
+    WillNeed,
+};
+
+/**
+ * `MappedFile` is a read-only, shared memory mapping of a whole file. Since the mapping is shared,
+ * processes mapping the same file on one host share a single copy in the page cache. The mapping
+ * is released when the instance is destroyed.
+ */
+class MappedFile
+{
+  public:
+    /**
+     * Maps the whole file to memory.
+     *
+     * @param path the file to map
+     * @param hint the hint given to the kernel
+     * @throws NoSuchFileException
+     */
+    static MappedFile Open(std::filesystem::path const& path, MapHint hint = MapHint::None);
+
+  private:
+    uint8_t const* _data;
+    size_t         _size;
+
+  private:
+    MappedFile(uint8_t const* data, size_t size) noexcept : _data { data }, _size { size } {}
+
+  public:
+    MappedFile(MappedFile&& other) noexcept;
+    MappedFile& operator=(MappedFile&& other) noexcept;
+
+    MappedFile(MappedFile const&) = delete;
+    MappedFile& operator=(MappedFile const&) = delete;
+
+    ~MappedFile();
+
+  public:
+    /**
+     * Returns the first byte of the mapping.
+     */
+    uint8_t const* GetData() const noexcept
+    {
+        return _data;
+    }
+
+    /**
+     * Returns the size of the file.
+     */
+    size_t GetSize() const noexcept
+    {
+        return _size;
+    }
+};
+
 /**
  * Contains file IO helper functions. All member functions of this class are static.
  */
@@ -32,6 +111,18 @@ class File
      * @throws NoSuchFileException
      */
     static std::vector<uint8_t> ReadFile(std::filesystem::path const& path);
+
+    /**
+     * Writes the file with what `write` writes to the given stream. The content is written under
+     * a temporary name and renamed, so concurrent processes never read a partial file. The
+     * directory of the file is created if it does not exist.
+     *
+     * @param path the file to write
+     * @param write the function writing the content
+     * @return whether the file was written; if not, the temporary file is removed
+     */
+    static bool WriteFileAtomically(std::filesystem::path const&              path,
+                                    std::function<void(std::ostream&)> const& write);
 };
 
 }
@@ -0,0 +1,182 @@
+// Copyright (c) 2021 Chanjung Kim. All rights reserved.
+// Licensed under the MIT License.
+
+#ifndef MNIST_FPGA_HYBRID_ENGINE_HH
+#define MNIST_FPGA_HYBRID_ENGINE_HH
+
+#include <mf/ClShardedEngine.hh>
+#include <mf/Engine.hh>
+#include <mf/Mnist.hh>
+#include <mf/ThreadPool.hh>
+
+#include <cstdint>
+#include <functional>
+#include <vector>
+
+namespace mf
+{
+
+/**
+ * `HybridStatistics` tells how the work of a `HybridEngine` was split between the host and the
+ * devices. The throughputs are in samples per second.
+ */
+struct HybridStatistics
+{
+    /**
+     * the number of samples classified by the host and by the devices.
+     */
+    size_t numHostSamples, numDeviceSamples;
+
+    /**
+     * the total time spent classifying on the host and on the devices, in seconds.
+     */
+    double hostTime, deviceTime;
+
+    /**
+     * the moving averages of the throughput of the host and of the devices, or zero until
+     * measured.
+     */
+    double hostThroughput, deviceThroughput;
+};
+
+/**
+ * `HybridEngine` classifies on the host and on the OpenCL devices at the same time. The samples
+ * are processed in rounds; each round is split into a leading part for the devices and a trailing
+ * part for the host, sized from moving averages of the throughput each side showed in the
+ * previous rounds, so that both sides finish a round together and the split follows changes of
+ * load. The host part runs `Engine` on the thread pool, the device part `ClShardedEngine`.
+ *
+ * Instances own device memory and cannot be copied.
+ */
+class HybridEngine
+{
+  public:
+    /**
+     * The type of the function called with the index of the first sample and the number of
+     * samples of each round whose predictions have been written, in the order of the samples.
+     */
+    using BatchCallback = std::function<void(size_t begin, size_t numSamples)>;
+
+    /**
+     * The weight of the latest round in the moving averages of the throughput.
+     */
+    constexpr static double smoothing = 0.25;
+
+    /**
+     * The number of rounds after which a side given no samples is given one batch again, so that
+     * its throughput is measured again and the split recovers when the load changes.
+     */
+    constexpr static size_t probeInterval = 16;
+
+    /**
+     * Creates an engine running the given host engine and device engine side by side.
+     *
+     * @param host the engine to copy for every worker of the pool
+     * @param device the engine of the devices, with the same batch size as `host`
+     * @param pool the thread pool to run the host part on, which must outlive the engine
+     * @param roundSize the number of samples of one round
+     * @throws std::invalid_argument if the engines do not match or `roundSize` is zero
+     */
+    static HybridEngine MakeFromEngines(Engine const&   host,
+                                        ClShardedEngine device,
+                                        ThreadPool&     pool,
+                                        size_t          roundSize);
+
+  private:
+    std::vector<Engine> _hostEngines;
+    ClShardedEngine     _device;
+    ThreadPool*         _pool;
+    size_t              _roundSize;
+    HybridStatistics    _statistics;
+    size_t              _numIdleHostRounds;
+    size_t              _numIdleDeviceRounds;
+
+  private:
+    HybridEngine(Engine const& host, ClShardedEngine&& device, ThreadPool& pool, size_t roundSize);
+
+  public:
+    HybridEngine(HybridEngine&&) = default;
+    HybridEngine& operator=(HybridEngine&&) = default;
+
+    HybridEngine(HybridEngine const&) = delete;
+    HybridEngine& operator=(HybridEngine const&) = delete;
+
+  public:
+    /**
+     * Returns the maximum number of samples of one batch of either side.
+     */
+    size_t GetBatchSize() const noexcept
+    {
+        return _device.GetBatchSize();
+    }
+
+    /**
+     * Returns the length of the input of one sample.
+     */
+    size_t GetInputSize() const noexcept
+    {
+        return _device.GetInputSize();
+    }
+
+    /**
+     * Returns the engine of the devices.
+     */
+    ClShardedEngine& GetDevice() noexcept
+    {
+        return _device;
+    }
+
+    /**
+     * Returns the work done by each side since the engine was created.
+     */
+    HybridStatistics const& GetStatistics() const noexcept
+    {
+        return _statistics;
+    }
+
+    /**
+     * Returns the fraction of the next round to be given to the devices.
+     */
+    double GetDeviceShare() const noexcept;
+
+    /**
+     * Classifies any number of samples and writes the index of the greatest output of each
+     * sample. Returns after every round has completed.
+     *
+     * @param in the input matrix of dimension (`numSamples`, `GetInputSize()`), row-major
+     * @param numSamples the number of samples
+     * @param labels the array of length `numSamples` to write the results
+     * @param onBatch the function to call after the predictions of each round are written, or
+     * an empty function
+     * @throws ClException
+     */
+    void Classify(float const*         in,
+                  size_t               numSamples,
+                  MnistLabel*          labels,
+                  BatchCallback const& onBatch = {});
+
+    /**
+     * The same as the overload taking `float` inputs, but reads the input as 8-bit integers.
+     */
+    void Classify(uint8_t const*       in,
+                  size_t               numSamples,
+                  MnistLabel*          labels,
+                  BatchCallback const& onBatch = {});
+
+  private:
+    template <typename In>
+    void ClassifyWith(In const*            in,
+                      size_t               numSamples,
+                      MnistLabel*          labels,
+                      BatchCallback const& onBatch);
+
+    /**
+     * Returns the number of samples of a round of `numSamples` samples to be given to the
+     * devices, a multiple of the batch size unless it is all of them.
+     */
+    size_t GetDeviceCount(size_t numSamples) const noexcept;
+};
+
+}
+
+#endif
@@ -0,0 +1,197 @@
+// Copyright (c) 2021 Chanjung Kim. All rights reserved.
+// Licensed under the MIT License.
+
+#ifndef MNIST_FPGA_INFERENCE_SERVER_HH
+#define MNIST_FPGA_INFERENCE_SERVER_HH
+
+#include <mf/Engine.hh>
+#include <mf/Exception.hh>
+#include <mf/ServerProtocol.hh>
+#include <mf/Statistics.hh>
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <filesystem>
+#include <memory>
+#include <mutex>
+#include <ostream>
+#include <thread>
+#include <vector>
+
+namespace mf
+{
+
+/**
+ * `ServerSocketException` is thrown when the socket of `InferenceServer` cannot be set up.
+ */
+MF_MAKE_NEW_EXCEPTION(ServerSocketException, "Failed to listen on the socket");
+
+/**
+ * `ServerStatistics` is what `InferenceServer` has served so far.
+ */
+struct ServerStatistics
+{
+    /**
+     * the number of requests answered, and the number of batches they were answered in.
+     */
+    size_t numRequests, numBatches;
+
+    /**
+     * the number of requests waiting for a batch now, and the greatest and the sum of the numbers
+     * of requests that waited each time a batch was formed.
+     */
+    size_t queueDepth, maxQueueDepth, sumQueueDepth;
+
+    /**
+     * the number of batches of each size, indexed by the size; the length is the greatest batch
+     * size plus one.
+     */
+    std::vector<size_t> batchSizes;
+
+    /**
+     * upper bounds of the 50th, 99th and 99.9th percentiles of the time from receiving a request
+     * to handing its response to the I/O thread, in seconds, accurate to the width of a bucket of
+     * `Histogram`. Zero if no request was answered.
+     */
+    double p50Latency, p99Latency, p999Latency;
+};
+
+/**
+ * `InferenceServer` classifies the images sent to a Unix domain socket (see `ServerRequest`). An
+ * I/O thread accepts the connections and reads the requests into a queue; each worker takes up
+ * to `GetBatchSize()` requests from the queue, waiting at most `maxWait` after the oldest one
+ * arrived for more to come, runs them through its own copy of the engine at once and hands the
+ * responses back to the I/O thread. Under a light load a request waits `maxWait` at most, and
+ * under a heavy one the batches fill up without waiting.
+ *
+ * The sockets are non-blocking, and only the I/O thread writes to them, as they accept more
+ * bytes. A client which sends requests but does not read the responses is not read from either
+ * once it has `maxResponsesInFlight` of them pending, so it stalls neither the workers nor the
+ * other clients.
+ *
+ * The server runs from construction to `Stop()` or destruction. The first layer of the engine is
+ * given the pixels as stored in the files, so its kernel must have the normalization folded in
+ * (see `Weight::ScaleKernel`).
+ */
+class InferenceServer
+{
+  private:
+    struct Connection;
+
+    struct Request
+    {
+        std::shared_ptr<Connection>           connection;
+        ServerRequest                         request;
+        std::chrono::steady_clock::time_point arrival;
+    };
+
+    /**
+     * The number of requests of one connection being answered or whose responses are not written
+     * yet, above which the I/O thread stops reading the connection.
+     */
+    constexpr static size_t maxResponsesInFlight = 1024;
+
+    /**
+     * The time `Stop()` waits for the responses to be written after the workers have stopped.
+     */
+    constexpr static std::chrono::milliseconds stopFlushTimeout { 1000 };
+
+  private:
+    Engine                    _engine;
+    std::filesystem::path     _socketPath;
+    std::chrono::microseconds _maxWait;
+    size_t                    _queueCapacity;
+    int                       _listenFd;
+    int                       _wakeFds[2];
+    std::atomic<bool>         _stop;
+    std::atomic<bool>         _workersStopped;
+
+    std::mutex              _mutex;
+    std::condition_variable _queued;
+    std::deque<Request>     _queue;
+    bool                    _readingStopped;
+
+    std::mutex       _statisticsMutex;
+    ServerStatistics _statistics;
+    Histogram        _latencies;
+
+    std::vector<std::thread> _workers;
+    std::thread              _ioThread;
+
+  public:
+    /**
+     * Starts listening on the given socket.
+     *
+     * @param engine the engine, copied once per worker
+     * @param socketPath the path of the socket; an existing socket at the path is replaced
+     * @param numWorkers the number of workers
+     * @param maxWait the greatest time a request waits for others to fill its batch
+     * @throws ServerSocketException
+     * @throws std::invalid_argument if `numWorkers` is zero, or the engine does not output
+     * `serverNumClasses` scores from `MnistByteSample::width` x `MnistByteSample::height` pixels
+     */
+    InferenceServer(Engine const&                engine,
+                    std::filesystem::path const& socketPath,
+                    size_t                       numWorkers,
+                    std::chrono::microseconds    maxWait);
+
+    InferenceServer(InferenceServer const&) = delete;
+    InferenceServer& operator=(InferenceServer const&) = delete;
+
+    /**
+     * Stops the server.
+     */
+    ~InferenceServer();
+
+  public:
+    /**
+     * Returns the greatest number of requests answered at once.
+     */
+    size_t GetBatchSize() const noexcept
+    {
+        return _engine.GetBatchSize();
+    }
+
+    /**
+     * Returns the number of workers.
+     */
+    size_t GetNumWorkers() const noexcept
+    {
+        return _workers.size();
+    }
+
+    /**
+     * Stops accepting requests, answers the requests already read, closes the socket and removes
+     * it. The responses not written `stopFlushTimeout` after the last one was answered are
+     * dropped. Does nothing if the server is already stopped.
+     */
+    void Stop();
+
+    /**
+     * Returns what the server has served so far. Thread-safe.
+     */
+    ServerStatistics GetStatistics();
+
+    /**
+     * Prints one line with the number of requests, the queue depth and the latency percentiles of
+     * the given statistics.
+     */
+    static void PrintSummary(std::ostream& os, ServerStatistics const& statistics);
+
+    /**
+     * Prints the summary and the distribution of the batch sizes of the given statistics.
+     */
+    static void Print(std::ostream& os, ServerStatistics const& statistics);
+
+  private:
+    void Wake() noexcept;
+    void RunIo();
+    void RunWorker();
+};
+
+}
+
+#endif
@@ -0,0 +1,222 @@
+// Copyright (c) 2021 Chanjung Kim. All rights reserved.
+// Licensed under the MIT License.
+
+#ifndef MNIST_FPGA_INFERENCE_SESSION_HH
+#define MNIST_FPGA_INFERENCE_SESSION_HH
+
+#include <mf/ArrayView.hh>
+#include <mf/Config.hh>
+#include <mf/Dense.hh>
+#include <mf/Engine.hh>
+#include <mf/ExecutionPlan.hh>
+#include <mf/Mnist.hh>
+#include <mf/Model.hh>
+#include <mf/MpmcQueue.hh>
+#include <mf/Weights.hh>
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <exception>
+#include <functional>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace mf
+{
+
+/**
+ * `InferenceResult` is the classification of one image.
+ */
+struct InferenceResult
+{
+    /**
+     * the class with the greatest score.
+     */
+    MnistLabel label;
+
+    /**
+     * the output of the model for each class, after its activation.
+     */
+    std::vector<float> scores;
+};
+
+/**
+ * `InferenceSession` classifies images on a pool of worker threads, for programs embedding the
+ * model instead of running `mnist-fpga`. It owns the weights and one engine per worker.
+ *
+ * `Submit` copies the images into tasks of at most `GetBatchSize()` images and pushes them to a
+ * lock-free queue (see `MpmcQueue`) without waiting for them to run, unless the queue is full.
+ * Each worker pops as many tasks as fit in one batch, so images submitted one at a time by many
+ * threads are still run together, and sleeps only while the queue is empty. The results are
+ * delivered through a future or a callback.
+ *
+ * The images are given as stored in the MNIST files, `MnistByteSample::width` x
+ * `MnistByteSample::height` bytes row by row; the normalization is folded into the first layer
+ * of the session's weights. All member functions are thread-safe.
+ */
+class InferenceSession
+{
+  public:
+    /**
+     * The type of the function called with the results of `Submit`, or with the exception which
+     * failed them. It is called on a worker thread, so it should return quickly, and must not
+     * throw.
+     */
+    using Callback = std::function<void(std::vector<InferenceResult> results,
+                                        std::exception_ptr           error)>;
+
+  private:
+    struct Job;
+
+    /**
+     * Consecutive images of one job, run in one batch.
+     */
+    struct Task
+    {
+        std::shared_ptr<Job> job;
+        size_t               first;
+        size_t               count;
+    };
+
+    /**
+     * The number of tasks the queue holds per worker before `Submit` waits for space.
+     */
+    constexpr static size_t queueTasksPerWorker = 64;
+
+  private:
+    WeightCollection                     _weights;
+    std::shared_ptr<ExecutionPlan const> _plan;
+    Engine                               _engine;
+
+    MpmcQueue<Task>     _queue;
+    std::atomic<size_t> _numQueued;
+    std::atomic<size_t> _numSleeping;
+    std::atomic<bool>   _stop;
+
+    std::mutex              _mutex;
+    std::condition_variable _wakeUp;
+
+    std::vector<std::thread> _workers;
+
+  public:
+    /**
+     * Creates a session with the weights and the model given by `WEIGHT_PATH` and `MODEL_PATH`,
+     * and the batch size, the number of threads and the dense parameters of the configuration.
+     *
+     * @throws see `Weights::MakeFromFile`, `Model::ReadFromFile` and the constructor
+     */
+    static std::unique_ptr<InferenceSession> MakeFromConfig(Config const& config);
+
+    /**
+     * Starts the workers.
+     *
+     * @param weights the weights, as read from the files
+     * @param layers the layers, from the input to the output
+     * @param batchSize the greatest number of images run at once by a worker
+     * @param numThreads the number of workers. If zero, the number of hardware threads is used.
+     * @param blocking the cache blocking parameters (see `Engine::MakeFromPlan`)
+     * @param fused whether to use `MnistNetwork` if the layers have its shape
+     * @param sparseThreshold the density of the input below which a layer is computed from the
+     * nonzero inputs only (see `Engine::MakeFromPlan`)
+     * @throws LayerNotFoundException
+     * @throws LayerShapeMismatchException
+     * @throws std::invalid_argument if `layers` is empty or `batchSize` is zero
+     */
+    InferenceSession(WeightCollection              weights,
+                     std::vector<LayerSpec> const& layers,
+                     size_t                        batchSize,
+                     size_t                        numThreads,
+                     DenseBlocking const&          blocking = {},
+                     bool                          fused    = true,
+                     double sparseThreshold = Engine::defaultSparseThreshold);
+
+    InferenceSession(InferenceSession const&) = delete;
+    InferenceSession& operator=(InferenceSession const&) = delete;
+
+    /**
+     * Runs the images already submitted, then stops the workers. Nothing may be submitted once
+     * the destructor has started.
+     */
+    ~InferenceSession();
+
+  public:
+    /**
+     * Returns the greatest number of images run at once by a worker.
+     */
+    size_t GetBatchSize() const noexcept
+    {
+        return _engine.GetBatchSize();
+    }
+
+    /**
+     * Returns the number of workers.
+     */
+    size_t GetNumThreads() const noexcept
+    {
+        return _workers.size();
+    }
+
+    /**
+     * Returns the number of bytes of one image.
+     */
+    size_t GetInputSize() const noexcept
+    {
+        return _engine.GetInputSize();
+    }
+
+    /**
+     * Returns the number of scores of one result.
+     */
+    size_t GetOutputSize() const noexcept
+    {
+        return _engine.GetOutputSize();
+    }
+
+    /**
+     * Submits one image and returns the future of its result.
+     *
+     * @param image the `GetInputSize()` bytes of the image, copied before returning
+     */
+    std::future<InferenceResult> Submit(uint8_t const* image);
+
+    /**
+     * Submits the given images and returns the future of their results, in the same order.
+     *
+     * @param images the images back to back, copied before returning
+     * @throws std::invalid_argument if the size of `images` is not a multiple of `GetInputSize()`
+     */
+    std::future<std::vector<InferenceResult>> Submit(ArrayView<uint8_t> images);
+
+    /**
+     * Submits the given images and calls `callback` with their results once all of them are done.
+     *
+     * @param images the images back to back, copied before returning
+     * @param callback the function called with the results, in the same order as the images
+     * @throws std::invalid_argument if the size of `images` is not a multiple of `GetInputSize()`
+     */
+    void Submit(ArrayView<uint8_t> images, Callback callback);
+
+    /**
+     * Classifies the given images on the workers and waits for the results. The images are read
+     * in place instead of being copied.
+     *
+     * @param images the images back to back
+     * @return the results, in the same order as the images
+     * @throws std::invalid_argument if the size of `images` is not a multiple of `GetInputSize()`
+     */
+    std::vector<InferenceResult> Classify(ArrayView<uint8_t> images);
+
+  private:
+    void Enqueue(ArrayView<uint8_t> images, bool copy, Callback&& callback);
+    bool Pop(Task& task);
+    bool WaitForTask();
+    void RunWorker();
+};
+
+}
+
+#endif
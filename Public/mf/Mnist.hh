@@ -4,11 +4,15 @@
 #ifndef MNIST_FGPA_MNIST_HH
 #define MNIST_FGPA_MNIST_HH
 
+#include <mf/AlignedAllocator.hh>
+#include <mf/ArrayView.hh>
 #include <mf/Config.hh>
 #include <mf/File.hh>
+#include <mf/MnistPixelFormat.hh>
 
 #include <cstdint>
 #include <filesystem>
+#include <memory>
 #include <stdexcept>
 #include <vector>
 
@@ -32,6 +36,11 @@ enum class MnistLabel : uint8_t
     Nine
 };
 
+/**
+ * The number of classes of the MNIST dataset.
+ */
+constexpr size_t numMnistLabels { 10 };
+
 /**
  * Represents one single immutable MNIST sample.
  */
@@ -44,6 +53,19 @@ struct MnistSample
     MnistLabel const label;
 };
 
+/**
+ * Represents one single immutable MNIST sample whose pixels are kept as stored in the file, i.e.
+ * in [0, 255].
+ */
+struct MnistByteSample
+{
+    constexpr static size_t width { MnistSample::width };
+    constexpr static size_t height { MnistSample::height };
+
+    uint8_t const (&image)[width][height];
+    MnistLabel const label;
+};
+
 MF_MAKE_NEW_EXCEPTION(InvalidMnistDatasetException, "MNIST dataset file is corrupted");
 
 MF_MAKE_NEW_EXCEPTION(MnistSampleNumberDoesNotMatchException,
@@ -55,21 +77,53 @@ MF_MAKE_NEW_EXCEPTION(MnistSampleNumberDoesNotMatchException,
 class Mnist
 {
   public:
+    /**
+     * the size of the header of an IDX file containing images.
+     */
+    constexpr static size_t imageHeaderSize { 16 };
+
+    /**
+     * the size of the header of an IDX file containing labels.
+     */
+    constexpr static size_t labelHeaderSize { 8 };
+
     /**
      * Reads the given two files and creates one complete MNIST dataset instance.
      *
      * @param imagePath the file containing image data
      * @param labelPath the file containing label data
+     * @param pixelFormat the representation of the pixels in memory
      * @throws NoSuchFileException
      * @throws InvalidMnistDatasetException
      * @throws MnistSampleNumberDoesNotMatchException
      */
     static Mnist MakeFromFile(std::filesystem::path const& imagePath,
-                              std::filesystem::path const& labelPath);
+                              std::filesystem::path const& labelPath,
+                              MnistPixelFormat             pixelFormat = MnistPixelFormat::Float);
+
+    /**
+     * Maps the given two files to memory and creates one complete MNIST dataset instance. Only
+     * the headers are read here. Labels, and images if `pixelFormat` is `MnistPixelFormat::Byte`,
+     * are views of the mappings, so no data is copied and processes mapping the same files share
+     * one copy in the page cache. Images in `MnistPixelFormat::Float` are converted from the
+     * mapping, which is released afterwards.
+     *
+     * @param imagePath the file containing image data
+     * @param labelPath the file containing label data
+     * @param pixelFormat the representation of the pixels in memory
+     * @param hint the hint given to the kernel when the files are mapped
+     * @throws NoSuchFileException
+     * @throws InvalidMnistDatasetException
+     * @throws MnistSampleNumberDoesNotMatchException
+     */
+    static Mnist MakeFromMappedFile(std::filesystem::path const& imagePath,
+                                    std::filesystem::path const& labelPath,
+                                    MnistPixelFormat pixelFormat = MnistPixelFormat::Byte,
+                                    MapHint          hint        = MapHint::None);
 
     /**
      * Reads two MNIST data files specified in the config and creates one complete MNIST dataset
-     * instance.
+     * instance. The files are mapped to memory if `config.mnistMapHint` is set.
      *
      * @param config the configuration
      * @throws NoSuchFileException
@@ -78,54 +132,122 @@ class Mnist
      */
     inline static Mnist MakeFromFile(Config const& config)
     {
-        return MakeFromFile(config.mnistImageFilePath, config.mnistLabelFilePath);
+        if (config.mnistMapHint)
+        {
+            return MakeFromMappedFile(config.mnistImageFilePath,
+                                      config.mnistLabelFilePath,
+                                      config.mnistPixelFormat,
+                                      *config.mnistMapHint);
+        }
+        return MakeFromFile(
+            config.mnistImageFilePath, config.mnistLabelFilePath, config.mnistPixelFormat);
     }
 
   private:
-    size_t                  _numSamples;
-    std::vector<float>      _images;
-    std::vector<MnistLabel> _labels;
+    size_t                            _numSamples;
+    MnistPixelFormat                  _pixelFormat;
+    PageAlignedVector<float>          _images;
+    PageAlignedVector<uint8_t>        _byteImages;
+    std::vector<MnistLabel>           _labels;
+    std::shared_ptr<MappedFile const> _imageFile;
+    std::shared_ptr<MappedFile const> _labelFile;
 
   private:
-    Mnist(size_t numSamples, std::vector<float>&& images, std::vector<MnistLabel>&& labels) :
+    Mnist(size_t numSamples, MnistPixelFormat pixelFormat) :
         _numSamples { numSamples },
-        _images { std::move(images) },
-        _labels { std::move(labels) }
+        _pixelFormat { pixelFormat }
     {}
 
   public:
+    /**
+     * Returns the representation of the pixels in memory.
+     */
+    MnistPixelFormat GetPixelFormat() const noexcept
+    {
+        return _pixelFormat;
+    }
+
     /**
      * Returns a `MnistSample` instance corresponding to the given index.
      *
      * @param idx the index of the sample
      * @throws std::invalid_argument if the index is equal to or greater than the number of samples
+     * @throws std::logic_error if the pixel format is not `MnistPixelFormat::Float`
      */
     MnistSample GetSample(size_t idx) const
     {
         if (idx >= _numSamples)
             throw std::invalid_argument { "idx" };
+        if (_pixelFormat != MnistPixelFormat::Float)
+            throw std::logic_error { "pixel format is not float" };
 
         return MnistSample {
             ((float(*)[MnistSample::width][MnistSample::height])_images.data())[idx],
-            _labels[idx],
+            GetLabels()[idx],
+        };
+    }
+
+    /**
+     * Returns a `MnistByteSample` instance corresponding to the given index.
+     *
+     * @param idx the index of the sample
+     * @throws std::invalid_argument if the index is equal to or greater than the number of samples
+     * @throws std::logic_error if the pixel format is not `MnistPixelFormat::Byte`
+     */
+    MnistByteSample GetByteSample(size_t idx) const
+    {
+        if (idx >= _numSamples)
+            throw std::invalid_argument { "idx" };
+        if (_pixelFormat != MnistPixelFormat::Byte)
+            throw std::logic_error { "pixel format is not uint8" };
+
+        return MnistByteSample {
+            ((uint8_t const(*)[MnistByteSample::width][MnistByteSample::height])GetByteImages()
+                 .data())[idx],
+            GetLabels()[idx],
         };
     }
 
     /**
      * Returns the internal buffer containing image data. The length of the vector is 28 x 28 x
-     * `GetNumberSamples()`.
+     * `GetNumberSamples()` if the pixel format is `MnistPixelFormat::Float`; the vector is empty
+     * otherwise. The buffer is aligned to a page, so devices can read it in place.
      */
-    std::vector<float> const& GetImages() const noexcept
+    PageAlignedVector<float> const& GetImages() const noexcept
     {
         return _images;
     }
 
     /**
-     * Returns the internal buffer containing label data. The length of the vector is
-     * `GetNumberSamples()`.
+     * Returns the internal buffer, or the mapping, containing image data as stored in the file.
+     * The length of the view is 28 x 28 x `GetNumberSamples()` if the pixel format is
+     * `MnistPixelFormat::Byte`; the view is empty otherwise.
+     */
+    ArrayView<uint8_t> GetByteImages() const noexcept
+    {
+        if (_imageFile)
+        {
+            return ArrayView<uint8_t> {
+                _imageFile->GetData() + imageHeaderSize,
+                _numSamples * MnistSample::width * MnistSample::height,
+            };
+        }
+        return _byteImages;
+    }
+
+    /**
+     * Returns the internal buffer, or the mapping, containing label data. The length of the view
+     * is `GetNumberSamples()`.
      */
-    std::vector<MnistLabel> const& GetLabels() const noexcept
+    ArrayView<MnistLabel> GetLabels() const noexcept
     {
+        if (_labelFile)
+        {
+            return ArrayView<MnistLabel> {
+                (MnistLabel const*)(_labelFile->GetData() + labelHeaderSize),
+                _numSamples,
+            };
+        }
         return _labels;
     }
 
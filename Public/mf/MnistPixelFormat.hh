@@ -0,0 +1,32 @@
+// Copyright (c) 2021 Chanjung Kim. All rights reserved.
+// Licensed under the MIT License.
+
+#ifndef MNIST_FPGA_MNIST_PIXEL_FORMAT_HH
+#define MNIST_FPGA_MNIST_PIXEL_FORMAT_HH
+
+#include <cstdint>
+
+namespace mf
+{
+
+/**
+ * Represents how a `Mnist` instance stores the pixels of its images.
+ */
+enum class MnistPixelFormat : uint8_t
+{
+    /**
+     * `float` values in [0, 1], i.e. the pixels of the file divided by 255.
+     */
+    Float,
+
+    /**
+     * `uint8_t` values in [0, 255] exactly as stored in the file. A quarter of the memory of
+     * `Float`; the first layer is expected to have the normalization folded into its kernel (see
+     * `Weight::ScaleKernel`).
+     */
+    Byte,
+};
+
+}
+
+#endif
@@ -0,0 +1,149 @@
+// Copyright (c) 2021 Chanjung Kim. All rights reserved.
+// Licensed under the MIT License.
+
+#ifndef MNIST_FPGA_MNIST_STREAM_HH
+#define MNIST_FPGA_MNIST_STREAM_HH
+
+#include <mf/AlignedAllocator.hh>
+#include <mf/Mnist.hh>
+
+#include <condition_variable>
+#include <cstdint>
+#include <exception>
+#include <filesystem>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace mf
+{
+
+/**
+ * `MnistBatch` is a view of consecutive samples read by `MnistStream`. The pointed buffers stay
+ * valid until the next call to `MnistStream::Next`.
+ */
+struct MnistBatch
+{
+    /**
+     * the index of the first sample of the batch in the dataset.
+     */
+    size_t first;
+
+    /**
+     * the number of samples of the batch.
+     */
+    size_t numSamples;
+
+    /**
+     * the images of dimension (`numSamples`, `MnistSample::height` x `MnistSample::width`), as
+     * stored in the file (see `MnistPixelFormat::Byte`).
+     */
+    uint8_t const* images;
+
+    /**
+     * the labels of length `numSamples`.
+     */
+    MnistLabel const* labels;
+};
+
+/**
+ * `MnistStream` reads a pair of IDX files batch by batch, so datasets larger than the memory can be
+ * evaluated. A background thread fills a ring of `numBuffers` batches with large sequential reads
+ * while the consumer works on the batch it holds; the memory used is bounded by the ring, not by
+ * the size of the dataset.
+ *
+ * Only one thread may consume the stream.
+ */
+class MnistStream
+{
+  private:
+    struct Buffer
+    {
+        PageAlignedVector<uint8_t> images;
+        std::vector<MnistLabel>    labels;
+    };
+
+  private:
+    std::filesystem::path _imagePath;
+    std::filesystem::path _labelPath;
+    int                   _imageFd;
+    int                   _labelFd;
+    size_t                _numSamples;
+    size_t                _batchSize;
+    size_t                _numBatches;
+
+    std::vector<Buffer> _buffers;
+
+    std::mutex              _mutex;
+    std::condition_variable _filled;
+    std::condition_variable _freed;
+    size_t                  _numFilled;
+    size_t                  _numReleased;
+    bool                    _holding;
+    bool                    _stop;
+    std::exception_ptr      _exception;
+    std::thread             _thread;
+
+  public:
+    /**
+     * Validates the headers of the files and starts the reading thread.
+     *
+     * @param imagePath the path of the file containing images
+     * @param labelPath the path of the file containing labels
+     * @param batchSize the number of samples of one batch; the last batch may be shorter
+     * @param numBuffers the number of batches kept in memory, including the one being consumed
+     * @throws NoSuchFileException
+     * @throws InvalidMnistDatasetException
+     * @throws MnistSampleNumberDoesNotMatchException
+     * @throws std::invalid_argument if `batchSize` is zero or `numBuffers` is less than two
+     */
+    MnistStream(std::filesystem::path const& imagePath,
+                std::filesystem::path const& labelPath,
+                size_t                       batchSize,
+                size_t                       numBuffers = 4);
+
+    MnistStream(MnistStream const&) = delete;
+    MnistStream& operator=(MnistStream const&) = delete;
+
+    /**
+     * Stops and joins the reading thread, and closes the files.
+     */
+    ~MnistStream();
+
+  public:
+    /**
+     * Returns the number of samples of the dataset.
+     */
+    size_t GetNumSamples() const noexcept
+    {
+        return _numSamples;
+    }
+
+    /**
+     * Returns the number of samples of one batch.
+     */
+    size_t GetBatchSize() const noexcept
+    {
+        return _batchSize;
+    }
+
+    /**
+     * Releases the batch returned by the previous call, and waits until the next one is read.
+     *
+     * @param batch the batch to write to
+     * @return `false` if every batch has been returned
+     * @throws NoSuchFileException if reading failed
+     * @throws InvalidMnistDatasetException if a file ended before the header says, or a label is
+     * not less than `numMnistLabels`
+     */
+    bool Next(MnistBatch& batch);
+
+  private:
+    void Run();
+
+    void Read(size_t batchIndex, Buffer& buffer);
+};
+
+}
+
+#endif
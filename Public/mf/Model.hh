@@ -0,0 +1,96 @@
+// Copyright (c) 2021 Chanjung Kim. All rights reserved.
+// Licensed under the MIT License.
+
+#ifndef MNIST_FPGA_MODEL_HH
+#define MNIST_FPGA_MODEL_HH
+
+#include <mf/Activation.hh>
+#include <mf/Config.hh>
+#include <mf/Exception.hh>
+
+#include <filesystem>
+#include <string>
+#include <string_view>
+#include <vector>
+
+namespace mf
+{
+
+/**
+ * `InvalidModelConfigException` is thrown when the architecture of a model is missing, malformed,
+ * or uses a layer or an activation this project does not implement.
+ */
+MF_MAKE_NEW_EXCEPTION(InvalidModelConfigException, "The model configuration is not supported");
+
+/**
+ * `LayerSpec` describes one FC layer of a model as it appears in the architecture.
+ */
+struct LayerSpec
+{
+    /**
+     * the name of the layer, which is the key of its weight in `WeightCollection`.
+     */
+    std::string name;
+
+    /**
+     * the activation applied to the output of the layer.
+     */
+    Activation activation;
+};
+
+/**
+ * `Model` contains helper functions reading the architecture of a model, i.e. the order of its
+ * layers and their activations, which `WeightCollection` does not keep. All member functions of
+ * `Model` are static.
+ */
+class Model
+{
+  public:
+    /**
+     * Parses the `model_config` JSON document Keras stores in its HDF5 files. Only `Sequential`
+     * models of `Dense` layers are supported; `InputLayer`, `Flatten` and `Dropout` are no-ops at
+     * inference and are skipped, and `Activation`, `ReLU` and `Softmax` layers are folded into the
+     * preceding `Dense` layer.
+     *
+     * @param json the document
+     * @return the FC layers, from the input to the output
+     * @throws InvalidModelConfigException
+     */
+    static std::vector<LayerSpec> ParseKerasConfig(std::string_view json);
+
+    /**
+     * Reads the `model_config` attribute of the given Keras HDF5 file.
+     *
+     * @param path the path of the HDF5 file
+     * @return the FC layers, from the input to the output
+     * @throws NoSuchFileException
+     * @throws InvalidModelConfigException
+     */
+    static std::vector<LayerSpec> ReadFromHdf5(std::filesystem::path const& path);
+
+    /**
+     * Reads the layer order and the activations stored in the given flat weight file (see
+     * `Weights::WriteFlatFile`).
+     *
+     * @param path the path of the flat weight file
+     * @return the FC layers, from the input to the output
+     * @throws NoSuchFileException
+     * @throws InvalidFlatWeightFileException
+     * @throws InvalidModelConfigException if the file was written without the architecture
+     */
+    static std::vector<LayerSpec> ReadFromFlatFile(std::filesystem::path const& path);
+
+    /**
+     * Reads the architecture from the weight file specified in the configuration, which may be
+     * either a flat weight file or a HDF5 file.
+     *
+     * @param config the configuration
+     * @throws NoSuchFileException
+     * @throws InvalidModelConfigException
+     */
+    static std::vector<LayerSpec> ReadFromFile(Config const& config);
+};
+
+}
+
+#endif
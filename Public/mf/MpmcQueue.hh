@@ -0,0 +1,146 @@
+// Copyright (c) 2021 Chanjung Kim. All rights reserved.
+// Licensed under the MIT License.
+
+#ifndef MNIST_FPGA_MPMC_QUEUE_HH
+#define MNIST_FPGA_MPMC_QUEUE_HH
+
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <stdexcept>
+#include <utility>
+
+namespace mf
+{
+
+/**
+ * `MpmcQueue` is a bounded lock-free queue which any number of threads may push to and pop from
+ * at the same time. Every cell carries a sequence number telling whether it is ready to be written
+ * or read in the current lap of the ring, so a push or a pop claims a position with one
+ * compare-and-swap and never waits for another thread unless the queue is full or empty. This is
+ * the queue of Dmitry Vyukov.
+ *
+ * `T` must be default-constructible and move-assignable.
+ */
+template <typename T>
+class MpmcQueue
+{
+  private:
+    /**
+     * The size of a cache line, so that the positions and the cells of different threads do not
+     * share one.
+     */
+    constexpr static size_t cacheLineSize = 64;
+
+    struct alignas(cacheLineSize) Cell
+    {
+        std::atomic<size_t> sequence;
+        T                   value;
+    };
+
+  private:
+    std::unique_ptr<Cell[]> _cells;
+    size_t                  _mask;
+
+    alignas(cacheLineSize) std::atomic<size_t> _pushPosition;
+    alignas(cacheLineSize) std::atomic<size_t> _popPosition;
+
+  public:
+    /**
+     * Creates an empty queue.
+     *
+     * @param capacity the greatest number of elements, rounded up to a power of two
+     * @throws std::invalid_argument if `capacity` is zero
+     */
+    explicit MpmcQueue(size_t capacity) : _pushPosition { 0 }, _popPosition { 0 }
+    {
+        if (capacity == 0)
+            throw std::invalid_argument { "capacity" };
+
+        size_t size = 1;
+        while (size < capacity) size *= 2;
+
+        _cells.reset(new Cell[size]);
+        _mask = size - 1;
+        for (size_t i = 0; i < size; ++i) _cells[i].sequence.store(i, std::memory_order_relaxed);
+    }
+
+    MpmcQueue(MpmcQueue const&) = delete;
+    MpmcQueue& operator=(MpmcQueue const&) = delete;
+
+  public:
+    /**
+     * Returns the greatest number of elements.
+     */
+    size_t GetCapacity() const noexcept
+    {
+        return _mask + 1;
+    }
+
+    /**
+     * Moves the given value to the back of the queue, unless the queue is full.
+     *
+     * @return whether the value was pushed; if not, it is left untouched
+     */
+    bool TryPush(T& value)
+    {
+        size_t position { _pushPosition.load(std::memory_order_relaxed) };
+        Cell*  cell;
+        while (true)
+        {
+            cell = &_cells[position & _mask];
+            size_t const sequence { cell->sequence.load(std::memory_order_acquire) };
+            intptr_t const difference { (intptr_t)sequence - (intptr_t)position };
+            if (difference == 0)
+            {
+                if (_pushPosition.compare_exchange_weak(
+                        position, position + 1, std::memory_order_relaxed))
+                    break;
+            }
+            else if (difference < 0)
+                return false;
+            else
+                position = _pushPosition.load(std::memory_order_relaxed);
+        }
+
+        cell->value = std::move(value);
+        cell->sequence.store(position + 1, std::memory_order_release);
+        return true;
+    }
+
+    /**
+     * Moves the value at the front of the queue to `value`, unless the queue is empty.
+     *
+     * @return whether a value was popped
+     */
+    bool TryPop(T& value)
+    {
+        size_t position { _popPosition.load(std::memory_order_relaxed) };
+        Cell*  cell;
+        while (true)
+        {
+            cell = &_cells[position & _mask];
+            size_t const sequence { cell->sequence.load(std::memory_order_acquire) };
+            intptr_t const difference { (intptr_t)sequence - (intptr_t)(position + 1) };
+            if (difference == 0)
+            {
+                if (_popPosition.compare_exchange_weak(
+                        position, position + 1, std::memory_order_relaxed))
+                    break;
+            }
+            else if (difference < 0)
+                return false;
+            else
+                position = _popPosition.load(std::memory_order_relaxed);
+        }
+
+        value = std::move(cell->value);
+        cell->value = T {};
+        cell->sequence.store(position + _mask + 1, std::memory_order_release);
+        return true;
+    }
+};
+
+}
+
+#endif
@@ -0,0 +1,179 @@
+// Copyright (c) 2021 Chanjung Kim. All rights reserved.
+// Licensed under the MIT License.
+
+#ifndef MNIST_FPGA_PERF_COUNTERS_HH
+#define MNIST_FPGA_PERF_COUNTERS_HH
+
+#include <array>
+#include <atomic>
+#include <cstdint>
+#include <ostream>
+#include <string>
+#include <string_view>
+#include <vector>
+
+namespace mf
+{
+
+/**
+ * Represents a hardware event counted by `PerfCounters`.
+ */
+enum class PerfEvent : uint8_t
+{
+    Cycles,
+    Instructions,
+    L1dMisses,
+    LlcMisses,
+    DtlbMisses,
+    BranchMisses,
+};
+
+/**
+ * The number of values of `PerfEvent`.
+ */
+constexpr size_t numPerfEvents = 6;
+
+/**
+ * The counts of the hardware events of one stage, summed over every thread.
+ */
+using PerfEventCounts = std::array<uint64_t, numPerfEvents>;
+
+/**
+ * `PerfStageStatistics` is what `PerfCounters` counted during one stage.
+ */
+struct PerfStageStatistics
+{
+    /**
+     * the name of the stage, e.g. `load dataset` or the name of a layer.
+     */
+    std::string name;
+
+    /**
+     * the number of times the stage ran, and the number of samples it processed.
+     */
+    size_t numCalls, numSamples;
+
+    /**
+     * the counts of the events, indexed by `PerfEvent`. The counts of the events the CPU could not
+     * count are zero.
+     */
+    PerfEventCounts counts;
+};
+
+/**
+ * `PerfCounters` counts hardware events with `perf_event_open` while it is started, and attributes
+ * them to the stages measured by `PerfScope`. Every thread opens its own group of counters the
+ * first time it enters a stage, counting the calling thread in user mode only. If the counters
+ * cannot be opened, e.g. because of `perf_event_paranoid`, in a container, or on a system other
+ * than Linux, nothing is counted and the summary says why. All member functions of
+ * `PerfCounters` are static.
+ */
+class PerfCounters
+{
+  private:
+    static std::atomic<bool> _enabled;
+
+  public:
+    /**
+     * Returns the lowercase name of the given event (e.g. `llc-misses`).
+     */
+    static char const* GetEventName(PerfEvent event) noexcept;
+
+    /**
+     * Returns whether the stages are being counted.
+     */
+    static bool IsEnabled() noexcept
+    {
+        return _enabled.load(std::memory_order_relaxed);
+    }
+
+    /**
+     * Starts counting the stages.
+     */
+    static void Start() noexcept;
+
+    /**
+     * Stops counting the stages. The counts already taken are kept.
+     */
+    static void Stop() noexcept;
+
+    /**
+     * Returns whether the given event could be counted by every thread that entered a stage.
+     */
+    static bool IsAvailable(PerfEvent event) noexcept;
+
+    /**
+     * Returns the counts of every stage, in the order the stages were first entered.
+     */
+    static std::vector<PerfStageStatistics> GetStatistics();
+
+    /**
+     * Prints the instructions per cycle and the events per sample of every stage, or why nothing
+     * could be counted.
+     */
+    static void PrintSummary(std::ostream& out);
+
+    /**
+     * Reads the counters of the calling thread, opening them on the first call. Returns whether
+     * they could be read.
+     */
+    static bool Read(PerfEventCounts& counts) noexcept;
+
+    /**
+     * Adds the difference of the given counts to the given stage of the calling thread.
+     */
+    static void Add(std::string_view       stage,
+                    size_t                 numSamples,
+                    PerfEventCounts const& begin,
+                    PerfEventCounts const& end) noexcept;
+};
+
+/**
+ * `PerfScope` attributes the hardware events from its construction to its destruction to a stage
+ * of `PerfCounters`. If `PerfCounters` is not started on construction, it only checks a flag.
+ * Reading the counters takes a system call, so a stage should take much longer than that.
+ */
+class PerfScope
+{
+  private:
+    std::string_view _stage;
+    size_t           _numSamples;
+    PerfEventCounts  _begin;
+    bool             _active;
+
+  public:
+    /**
+     * Begins a stage.
+     *
+     * @param stage the name of the stage, which must outlive the scope
+     * @param numSamples the number of samples the stage processes
+     */
+    explicit PerfScope(std::string_view stage, size_t numSamples = 0) noexcept :
+        _stage { stage },
+        _numSamples { numSamples },
+        _active { PerfCounters::IsEnabled() && PerfCounters::Read(_begin) }
+    {
+    }
+
+    PerfScope(PerfScope const&) = delete;
+    PerfScope& operator=(PerfScope const&) = delete;
+
+    ~PerfScope()
+    {
+        PerfEventCounts end;
+        if (_active && PerfCounters::Read(end))
+            PerfCounters::Add(_stage, _numSamples, _begin, end);
+    }
+
+    /**
+     * Sets the number of samples the stage processes, if not known on construction.
+     */
+    void SetNumSamples(size_t numSamples) noexcept
+    {
+        _numSamples = numSamples;
+    }
+};
+
+}
+
+#endif
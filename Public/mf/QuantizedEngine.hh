@@ -0,0 +1,237 @@
+// Copyright (c) 2021 Chanjung Kim. All rights reserved.
+// Licensed under the MIT License.
+
+#ifndef MNIST_FPGA_QUANTIZED_ENGINE_HH
+#define MNIST_FPGA_QUANTIZED_ENGINE_HH
+
+#include <mf/AlignedAllocator.hh>
+#include <mf/Activation.hh>
+#include <mf/Engine.hh>
+#include <mf/ExecutionPlan.hh>
+#include <mf/Mnist.hh>
+#include <mf/Weights.hh>
+
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+namespace mf
+{
+
+/**
+ * `QuantizedLayer` contains the parameters of one FC layer converted to 8-bit integers.
+ *
+ * The input of the layer is quantized per tensor to unsigned 7-bit integers, i.e. x = q *
+ * `inputScale` with q in [0, 127]. Inputs of FC layers followed by ReLU are never negative, and 7
+ * bits keep the sum of two products of `vpmaddubsw` from saturating. The kernel is quantized per
+ * output channel to signed integers in [-127, 127], so the accumulator of output o converts back
+ * to a real value by multiplying `scales[o]` = `inputScale` x (the scale of the column o).
+ */
+struct QuantizedLayer
+{
+    /**
+     * the number of inputs accumulated by one `vpmaddubsw`/`vpmaddwd` pair per output.
+     */
+    constexpr static size_t groupSize { 4 };
+
+    /**
+     * the number of outputs of one panel of the packed kernel, i.e. the number of 32-bit
+     * accumulators of one AVX2 register.
+     */
+    constexpr static size_t panelWidth { 8 };
+
+    /**
+     * the length of the input.
+     */
+    size_t inputSize;
+
+    /**
+     * the length of the output.
+     */
+    size_t outputSize;
+
+    /**
+     * the length of the input rounded up to a multiple of `groupSize`.
+     */
+    size_t paddedInputSize;
+
+    /**
+     * the length of the output rounded up to a multiple of `panelWidth`.
+     */
+    size_t paddedOutputSize;
+
+    /**
+     * the real value of one step of the quantized input.
+     */
+    float inputScale;
+
+    /**
+     * the quantized kernel. The matrix is split into panels of `panelWidth` columns, and each
+     * panel is split into groups of `groupSize` rows, each of which is stored column by column, so
+     * the element (i, o) is at `(o / panelWidth) * paddedInputSize * panelWidth + (i / groupSize) *
+     * panelWidth * groupSize + (o % panelWidth) * groupSize + i % groupSize`. The padding is
+     * zero.
+     */
+    AlignedVector<int8_t> kernel;
+
+    /**
+     * the factor converting the accumulator of each output to a real value, padded to
+     * `paddedOutputSize`.
+     */
+    AlignedVector<float> scales;
+
+    /**
+     * the bias, padded with zeros to `paddedOutputSize`.
+     */
+    AlignedVector<float> bias;
+
+    /**
+     * the activation applied to the output, which is `Activation::Relu` except for the last layer.
+     */
+    Activation activation;
+};
+
+/**
+ * `QuantizedEngine` runs a chain of FC layers followed by ReLU, except for the last layer which may
+ * be linear or followed by softmax, with 8-bit integer dot products and 32-bit accumulation.
+ * Weights take a quarter of the memory of `Engine`'s and four products are computed per 32-bit
+ * lane; `Engine` stays the reference the accuracy is compared against.
+ *
+ * Instances are cheap to copy; the layers are shared between copies, and only the activation
+ * buffers are duplicated.
+ */
+class QuantizedEngine
+{
+  public:
+    /**
+     * Quantizes the layers of the given plan. The activation range of the input of every layer is
+     * calibrated by running the first `numCalibrationSamples` samples of the dataset through the
+     * layers in floating point.
+     *
+     * @param plan the plan to quantize, whose batch size the engine uses
+     * @param mnist the dataset to calibrate with
+     * @param numCalibrationSamples the number of samples to calibrate with
+     * @throws InvalidModelConfigException if a layer other than the last is not followed by ReLU
+     * @throws std::invalid_argument if `numCalibrationSamples` is zero
+     */
+    static QuantizedEngine MakeFromPlan(ExecutionPlan const& plan,
+                                        Mnist const&         mnist,
+                                        size_t               numCalibrationSamples);
+
+    /**
+     * Quantizes the given layers, with ReLU applied to the output of every layer. The activation
+     * range of the input of every layer is calibrated
+     * by running the first `numCalibrationSamples` samples of the dataset through the layers in
+     * floating point.
+     *
+     * @param weights the weight collection containing the layers
+     * @param layerNames the names of the layers, from the input to the output
+     * @param mnist the dataset to calibrate with
+     * @param numCalibrationSamples the number of samples to calibrate with
+     * @param batchSize the maximum number of samples processed at once
+     * @throws LayerNotFoundException
+     * @throws LayerShapeMismatchException
+     * @throws std::invalid_argument if `layerNames` is empty, `batchSize` is zero or
+     * `numCalibrationSamples` is zero
+     */
+    static QuantizedEngine MakeFromWeights(WeightCollection const&         weights,
+                                           std::vector<std::string> const& layerNames,
+                                           Mnist const&                    mnist,
+                                           size_t                          numCalibrationSamples,
+                                           size_t                          batchSize);
+
+  private:
+    std::shared_ptr<std::vector<QuantizedLayer> const> _layers;
+    size_t                                             _batchSize;
+    AlignedVector<uint8_t>                             _inputs[2];
+    AlignedVector<int32_t>                             _accumulators;
+    std::vector<float>                                 _output;
+
+  private:
+    QuantizedEngine(std::shared_ptr<std::vector<QuantizedLayer> const>&& layers, size_t batchSize);
+
+  public:
+    /**
+     * Returns the maximum number of samples processed at once.
+     */
+    size_t GetBatchSize() const noexcept
+    {
+        return _batchSize;
+    }
+
+    /**
+     * Returns the length of the input of one sample.
+     */
+    size_t GetInputSize() const noexcept
+    {
+        return _layers->front().inputSize;
+    }
+
+    /**
+     * Returns the length of the output of one sample.
+     */
+    size_t GetOutputSize() const noexcept
+    {
+        return _layers->back().outputSize;
+    }
+
+    /**
+     * Returns the quantized layers, from the input to the output.
+     */
+    std::vector<QuantizedLayer> const& GetLayers() const noexcept
+    {
+        return *_layers;
+    }
+
+    /**
+     * Runs all layers on the given samples and returns the output of the last layer. The returned
+     * buffer is owned by the engine and is overwritten by the next call.
+     *
+     * @param in the input matrix of dimension (`numSamples`, `GetInputSize()`), row-major
+     * @param numSamples the number of samples
+     * @return the output matrix of dimension (`numSamples`, `GetOutputSize()`), row-major
+     * @throws std::invalid_argument if `numSamples` is greater than `GetBatchSize()`
+     */
+    float const* Forward(float const* in, size_t numSamples);
+
+    /**
+     * Runs all layers on the given samples and writes the index of the greatest output of each
+     * sample. A softmax on the last layer is skipped, since it does not change the greatest output.
+     *
+     * @param in the input matrix of dimension (`numSamples`, `GetInputSize()`), row-major
+     * @param numSamples the number of samples
+     * @param labels the array of length `numSamples` to write the results
+     * @throws std::invalid_argument if `numSamples` is greater than `GetBatchSize()`
+     */
+    void Classify(float const* in, size_t numSamples, MnistLabel* labels);
+
+    /**
+     * The same as the overload taking `float` inputs, but reads the input as 8-bit integers (see
+     * `Dense::ApplyBatch`).
+     */
+    float const* Forward(uint8_t const* in, size_t numSamples);
+
+    /**
+     * The same as the overload taking `float` inputs, but reads the input as 8-bit integers (see
+     * `Dense::ApplyBatch`).
+     */
+    void Classify(uint8_t const* in, size_t numSamples, MnistLabel* labels);
+
+  private:
+    template <typename In>
+    float const* ForwardWith(In const* in, size_t numSamples, bool normalize);
+
+    template <typename In>
+    void ClassifyWith(In const* in, size_t numSamples, MnistLabel* labels);
+
+    /**
+     * Runs all layers on the quantized input in `_inputs[0]`, applying a softmax on the last layer
+     * only if `normalize` is set.
+     */
+    void ForwardQuantized(size_t numSamples, bool normalize);
+};
+
+}
+
+#endif
@@ -0,0 +1,70 @@
+// Copyright (c) 2021 Chanjung Kim. All rights reserved.
+// Licensed under the MIT License.
+
+#ifndef MNIST_FPGA_SERVER_PROTOCOL_HH
+#define MNIST_FPGA_SERVER_PROTOCOL_HH
+
+#include <mf/Mnist.hh>
+
+#include <cstdint>
+
+namespace mf
+{
+
+/**
+ * The number of classes a response has a score for.
+ */
+constexpr size_t serverNumClasses = 10;
+
+/**
+ * `ServerRequest` is one image sent to `InferenceServer`. A client writes requests back to back on
+ * its connection, and may write the next ones before the responses to the previous ones arrive.
+ * The fields are in the byte order of the host, since the server only listens on a Unix domain
+ * socket.
+ */
+struct ServerRequest
+{
+    /**
+     * an identifier chosen by the client, copied to the response. The responses to the requests
+     * of one connection may come in any order.
+     */
+    uint32_t id;
+
+    /**
+     * the pixels of the image, row by row, as stored in the MNIST files (see
+     * `MnistPixelFormat::Byte`).
+     */
+    uint8_t pixels[MnistByteSample::height * MnistByteSample::width];
+};
+
+/**
+ * `ServerResponse` is the classification of one `ServerRequest`.
+ */
+struct ServerResponse
+{
+    /**
+     * the identifier of the request.
+     */
+    uint32_t id;
+
+    /**
+     * the class with the greatest score.
+     */
+    MnistLabel label;
+
+    uint8_t reserved[3];
+
+    /**
+     * the output of the model for each class, after its activation, e.g. the probabilities of a
+     * model ending with softmax.
+     */
+    float scores[serverNumClasses];
+};
+
+static_assert(sizeof(ServerRequest) == 4 + 28 * 28, "ServerRequest must not be padded");
+static_assert(sizeof(ServerResponse) == 8 + 4 * serverNumClasses,
+              "ServerResponse must not be padded");
+
+}
+
+#endif
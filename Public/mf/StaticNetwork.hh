@@ -0,0 +1,228 @@
+// Copyright (c) 2021 Chanjung Kim. All rights reserved.
+// Licensed under the MIT License.
+
+#ifndef MNIST_FPGA_STATIC_NETWORK_HH
+#define MNIST_FPGA_STATIC_NETWORK_HH
+
+#include <mf/Dense.hh>
+#include <mf/Weights.hh>
+
+#include <array>
+#include <cstdint>
+#include <optional>
+#include <vector>
+
+namespace mf
+{
+
+/**
+ * The type of the functions implementing `StaticNetwork::Forward`.
+ *
+ * @param in the input matrix of dimension (`numSamples`, I), row-major
+ * @param numSamples the number of samples
+ * @param out the output matrix of dimension (`numSamples`, O), row-major
+ * @param kernels the packed kernel matrix of each layer
+ * @param biases the padded bias of each layer
+ * @param lastRelu whether the last layer is followed by ReLU; the others always are
+ */
+using StaticForwardFunction = void (*)(float const*        in,
+                                       size_t              numSamples,
+                                       float*              out,
+                                       float const* const* kernels,
+                                       float const* const* biases,
+                                       bool                lastRelu);
+
+/**
+ * The type of the functions implementing `StaticNetwork::Forward` for inputs of `uint8_t`.
+ */
+using StaticForwardBytesFunction = void (*)(uint8_t const*      in,
+                                            size_t              numSamples,
+                                            float*              out,
+                                            float const* const* kernels,
+                                            float const* const* biases,
+                                            bool                lastRelu);
+
+/**
+ * The type of the functions implementing `StaticNetwork::Forward` for inputs of `SparseBatch`,
+ * given as its arrays.
+ */
+using StaticForwardSparseFunction = void (*)(uint32_t const*     offsets,
+                                             uint32_t const*     indices,
+                                             float const*        values,
+                                             size_t              numSamples,
+                                             float*              out,
+                                             float const* const* kernels,
+                                             float const* const* biases,
+                                             bool                lastRelu);
+
+/**
+ * `StaticNetwork` is a chain of FC layers followed by ReLU whose widths are known at compile time;
+ * the ReLU of the last layer is optional, so the logits of a classifier can be computed.
+ * Every loop bound is a constant and activations live in fixed-size aligned arrays on the stack, so
+ * the compiler can unroll the inner loops and keep the accumulators in registers. Samples go
+ * through all layers in small groups, so activations never leave the L1 cache.
+ *
+ * An implementation exists only for the shapes instantiated in `Source/StaticNetwork.cc` (see
+ * `MnistNetwork`); `TryMakeFromWeights` returns `std::nullopt` for any other shape.
+ *
+ * @tparam Widths the length of the input followed by the length of the output of each layer
+ */
+template <size_t... Widths>
+class StaticNetwork
+{
+    static_assert(sizeof...(Widths) >= 2, "StaticNetwork needs at least one layer");
+
+  public:
+    /**
+     * the number of layers.
+     */
+    constexpr static size_t numLayers { sizeof...(Widths) - 1 };
+
+    /**
+     * the length of the input followed by the length of the output of each layer.
+     */
+    constexpr static std::array<size_t, sizeof...(Widths)> widths { Widths... };
+
+    /**
+     * Creates a `StaticNetwork` instance if the shapes of the given layers are exactly `Widths`
+     * and all of them have packed kernels. The implementation is selected by `Dense::GetIsa()`.
+     * The layers must outlive the returned instance.
+     *
+     * @param layers the layers, from the input to the output
+     * @param lastRelu whether the last layer is followed by ReLU
+     * @return the network, or `std::nullopt` if the layers do not match or no implementation of
+     * this shape was compiled in
+     */
+    static std::optional<StaticNetwork> TryMakeFromWeights(std::vector<Weight const*> const& layers,
+                                                           bool lastRelu = true)
+    {
+        auto forward { GetForward(Dense::GetIsa()) };
+        auto forwardBytes { GetForwardBytes(Dense::GetIsa()) };
+        auto forwardSparse { GetForwardSparse(Dense::GetIsa()) };
+        if (forward == nullptr || forwardBytes == nullptr || forwardSparse == nullptr
+            || layers.size() != numLayers)
+            return std::nullopt;
+
+        std::array<float const*, numLayers> kernels {}, biases {};
+        for (size_t i = 0; i < numLayers; ++i)
+        {
+            auto& layer = *layers[i];
+            if (layer.GetInputSize() != widths[i] || layer.GetOutputSize() != widths[i + 1]
+                || !layer.HasPackedKernel())
+                return std::nullopt;
+
+            kernels[i] = layer.GetPackedKernelWeight().data();
+            biases[i]  = layer.GetPackedBiasWeight().data();
+        }
+
+        return StaticNetwork { forward, forwardBytes, forwardSparse, kernels, biases, lastRelu };
+    }
+
+  private:
+    /**
+     * Returns the implementation for the widest instruction set not wider than `isa`, or `nullptr`
+     * if this shape has no implementation.
+     */
+    static StaticForwardFunction GetForward(Isa isa) noexcept
+    {
+        return nullptr;
+    }
+
+    /**
+     * The same as `GetForward` for inputs of `uint8_t`.
+     */
+    static StaticForwardBytesFunction GetForwardBytes(Isa isa) noexcept
+    {
+        return nullptr;
+    }
+
+    /**
+     * The same as `GetForward` for inputs of `SparseBatch`.
+     */
+    static StaticForwardSparseFunction GetForwardSparse(Isa isa) noexcept
+    {
+        return nullptr;
+    }
+
+  private:
+    StaticForwardFunction               _forward;
+    StaticForwardBytesFunction          _forwardBytes;
+    StaticForwardSparseFunction         _forwardSparse;
+    std::array<float const*, numLayers> _kernels;
+    std::array<float const*, numLayers> _biases;
+    bool                                _lastRelu;
+
+  private:
+    StaticNetwork(StaticForwardFunction                      forward,
+                  StaticForwardBytesFunction                 forwardBytes,
+                  StaticForwardSparseFunction                forwardSparse,
+                  std::array<float const*, numLayers> const& kernels,
+                  std::array<float const*, numLayers> const& biases,
+                  bool                                       lastRelu) :
+        _forward { forward },
+        _forwardBytes { forwardBytes },
+        _forwardSparse { forwardSparse },
+        _kernels { kernels },
+        _biases { biases },
+        _lastRelu { lastRelu }
+    {}
+
+  public:
+    /**
+     * Runs all layers on the given samples.
+     *
+     * @param in the input matrix of dimension (`numSamples`, `widths.front()`), row-major
+     * @param numSamples the number of samples
+     * @param out the output matrix of dimension (`numSamples`, `widths.back()`), row-major
+     */
+    void Forward(float const* in, size_t numSamples, float* out) const
+    {
+        _forward(in, numSamples, out, _kernels.data(), _biases.data(), _lastRelu);
+    }
+
+    /**
+     * The same as the overload taking `float` inputs, but reads the input as 8-bit integers (see
+     * `Dense::ApplyBatch`).
+     */
+    void Forward(uint8_t const* in, size_t numSamples, float* out) const
+    {
+        _forwardBytes(in, numSamples, out, _kernels.data(), _biases.data(), _lastRelu);
+    }
+
+    /**
+     * The same as the overload taking `float` inputs, but computes the first layer from the
+     * nonzero inputs only (see `Dense::ApplySparse`).
+     *
+     * @param in the input samples, of length `widths.front()`
+     * @param out the output matrix of dimension (`in.GetNumSamples()`, `widths.back()`), row-major
+     */
+    void Forward(SparseBatch const& in, float* out) const
+    {
+        _forwardSparse(in.GetOffsets(),
+                       in.GetIndices(),
+                       in.GetValues(),
+                       in.GetNumSamples(),
+                       out,
+                       _kernels.data(),
+                       _biases.data(),
+                       _lastRelu);
+    }
+};
+
+/**
+ * The topology of the model trained by `Model/mnist.py`.
+ */
+using MnistNetwork = StaticNetwork<784, 128, 64, 10>;
+
+template <>
+StaticForwardFunction MnistNetwork::GetForward(Isa isa) noexcept;
+
+template <>
+StaticForwardBytesFunction MnistNetwork::GetForwardBytes(Isa isa) noexcept;
+
+template <>
+StaticForwardSparseFunction MnistNetwork::GetForwardSparse(Isa isa) noexcept;
+
+}
+
+#endif
@@ -0,0 +1,127 @@
+// Copyright (c) 2021 Chanjung Kim. All rights reserved.
+// Licensed under the MIT License.
+
+#ifndef MNIST_FPGA_STATISTICS_HH
+#define MNIST_FPGA_STATISTICS_HH
+
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <cstdint>
+#include <vector>
+
+// Summaries of measured times, shared by the benchmark, the autotuner, the load generator, the
+// OpenCL profiler and the inference server.
+
+namespace mf
+{
+
+/**
+ * Returns the `p`-th quantile of the given sorted times with the nearest-rank method, or zero if
+ * there is no time.
+ */
+inline double GetPercentile(std::vector<double> const& sorted, double p) noexcept
+{
+    if (sorted.empty())
+        return 0.0;
+
+    size_t const rank = (size_t)std::ceil(p * sorted.size());
+    return sorted[std::clamp<size_t>(rank, 1, sorted.size()) - 1];
+}
+
+/**
+ * `Histogram` counts durations in nanoseconds in log-linear buckets: the durations below 4 have a
+ * bucket each, and every power of two above is split into quarters, so any duration falls into a
+ * bucket at most 25% wider than itself.
+ */
+class Histogram
+{
+  public:
+    /**
+     * The number of buckets, enough for any 64-bit duration.
+     */
+    constexpr static size_t numBuckets = 252;
+
+  private:
+    std::array<uint64_t, numBuckets> _counts {};
+    uint64_t                         _count = 0;
+    uint64_t                         _max   = 0;
+
+  public:
+    /**
+     * Returns the index of the bucket of the given duration.
+     */
+    static size_t GetBucket(uint64_t duration) noexcept
+    {
+        if (duration < 4)
+            return (size_t)duration;
+
+        // The two bits after the most significant one pick the quarter of the power of two.
+        size_t const msb = 63 - __builtin_clzll(duration);
+        return 4 * (msb - 1) + ((duration >> (msb - 2)) & 3);
+    }
+
+    /**
+     * Returns the shortest duration of the given bucket; the bucket ends at the lower bound of the
+     * next one.
+     */
+    static uint64_t GetBucketLowerBound(size_t bucket) noexcept
+    {
+        if (bucket < 4)
+            return bucket;
+
+        size_t const msb = bucket / 4 + 1;
+        return (uint64_t)(4 + bucket % 4) << (msb - 2);
+    }
+
+  public:
+    /**
+     * Counts the given duration.
+     */
+    void Add(uint64_t duration) noexcept
+    {
+        _counts[GetBucket(duration)] += 1;
+        _count += 1;
+        _max = std::max(_max, duration);
+    }
+
+    /**
+     * Returns the number of durations counted.
+     */
+    uint64_t GetCount() const noexcept
+    {
+        return _count;
+    }
+
+    /**
+     * Returns the number of durations counted in the given bucket.
+     */
+    uint64_t GetBucketCount(size_t bucket) const noexcept
+    {
+        return _counts[bucket];
+    }
+
+    /**
+     * Returns an upper bound of the `p`-th quantile with the nearest-rank method, e.g. 0.99 for
+     * p99, accurate to the width of a bucket, or zero if there is no duration.
+     */
+    uint64_t GetQuantile(double p) const noexcept
+    {
+        if (_count == 0)
+            return 0;
+
+        uint64_t const rank = std::clamp<uint64_t>((uint64_t)std::ceil(p * _count), 1, _count);
+        uint64_t       seen = 0;
+        for (size_t b = 0; b + 1 < numBuckets; ++b)
+        {
+            seen += _counts[b];
+            if (seen >= rank)
+                return std::min(GetBucketLowerBound(b + 1), _max);
+        }
+        return _max;
+    }
+};
+
+}
+
+#endif
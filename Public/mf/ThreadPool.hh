@@ -0,0 +1,106 @@
+// Copyright (c) 2021 Chanjung Kim. All rights reserved.
+// Licensed under the MIT License.
+
+#ifndef MNIST_FPGA_THREAD_POOL_HH
+#define MNIST_FPGA_THREAD_POOL_HH
+
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace mf
+{
+
+/**
+ * `ThreadPool` runs data-parallel loops on a fixed set of worker threads. Each worker owns a deque
+ * of chunks; it takes chunks from the front of its own deque, and steals from the back of the
+ * others' once its own is empty, so a slow worker does not hold back the whole loop.
+ */
+class ThreadPool
+{
+  public:
+    /**
+     * The type of the function called for each chunk. `threadIndex` is the index of the worker
+     * running the chunk, which is less than `GetNumThreads()` and can be used to select per-thread
+     * scratch buffers.
+     */
+    using ChunkFunction = std::function<void(size_t threadIndex, size_t begin, size_t end)>;
+
+  private:
+    struct Worker
+    {
+        std::mutex         mutex;
+        std::deque<size_t> chunks;
+        std::thread        thread;
+    };
+
+  private:
+    std::vector<std::unique_ptr<Worker>> _workers;
+
+    std::mutex              _mutex;
+    std::condition_variable _wakeUp;
+    std::condition_variable _done;
+    uint64_t                _generation;
+    size_t                  _numActive;
+    bool                    _stop;
+
+    ChunkFunction const* _function;
+    size_t               _begin;
+    size_t               _end;
+    size_t               _chunkSize;
+    std::exception_ptr   _exception;
+
+  public:
+    /**
+     * Starts the worker threads.
+     *
+     * @param numThreads the number of worker threads. If zero, the number of hardware threads is
+     * used.
+     */
+    explicit ThreadPool(size_t numThreads = 0);
+
+    ThreadPool(ThreadPool const&) = delete;
+    ThreadPool& operator=(ThreadPool const&) = delete;
+
+    /**
+     * Stops and joins the worker threads.
+     */
+    ~ThreadPool();
+
+  public:
+    /**
+     * Returns the number of worker threads.
+     */
+    size_t GetNumThreads() const noexcept
+    {
+        return _workers.size();
+    }
+
+    /**
+     * Splits [`begin`, `end`) into chunks of `chunkSize` indices and calls `function` once per
+     * chunk on the worker threads. Blocks until all chunks are done. If any call throws, the
+     * remaining chunks are skipped and the first exception is rethrown here. Must not be called
+     * concurrently from multiple threads.
+     *
+     * @param begin the first index
+     * @param end the index past the last one
+     * @param chunkSize the number of indices of one chunk; the last chunk may be shorter
+     * @param function the function to call
+     */
+    void ParallelFor(size_t begin, size_t end, size_t chunkSize, ChunkFunction const& function);
+
+  private:
+    void Run(size_t threadIndex);
+
+    bool TakeChunk(size_t threadIndex, size_t& chunk);
+};
+
+}
+
+#endif
@@ -0,0 +1,127 @@
+// Copyright (c) 2021 Chanjung Kim. All rights reserved.
+// Licensed under the MIT License.
+
+#ifndef MNIST_FPGA_TRACE_HH
+#define MNIST_FPGA_TRACE_HH
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <ostream>
+
+namespace mf
+{
+
+/**
+ * `Trace` records the spans of `TraceSpan` while it is started, and writes them in the Chrome trace
+ * event format, which `chrome://tracing` and Perfetto open. Every thread records into a buffer of
+ * its own without locking; the buffers are kept until the process exits, so spans recorded by
+ * threads that have already exited are written as well. All member functions of `Trace` are
+ * static.
+ */
+class Trace
+{
+  private:
+    static std::atomic<bool> _enabled;
+
+  public:
+    /**
+     * Returns whether the spans are being recorded.
+     */
+    static bool IsEnabled() noexcept
+    {
+        return _enabled.load(std::memory_order_relaxed);
+    }
+
+    /**
+     * Starts recording the spans. The timestamps are relative to the first call.
+     */
+    static void Start() noexcept;
+
+    /**
+     * Stops recording the spans. The spans already recorded are kept.
+     */
+    static void Stop() noexcept;
+
+    /**
+     * Returns the nanoseconds elapsed on the clock of the timestamps.
+     */
+    static int64_t GetTime() noexcept
+    {
+        return std::chrono::duration_cast<std::chrono::nanoseconds>(
+                   std::chrono::steady_clock::now().time_since_epoch())
+            .count();
+    }
+
+    /**
+     * Records a span on the calling thread.
+     *
+     * @param name the name of the span, which must outlive the trace, e.g. a string literal
+     * @param argName the name of the argument of the span, which must outlive the trace, or null
+     * @param arg the argument of the span, ignored if `argName` is null
+     * @param begin the time the span began at, from `GetTime()`
+     * @param end the time the span ended at, from `GetTime()`
+     */
+    static void Record(char const* name,
+                       char const* argName,
+                       uint64_t    arg,
+                       int64_t     begin,
+                       int64_t     end) noexcept;
+
+    /**
+     * Writes the spans recorded so far as a Chrome trace JSON document. Spans being recorded at
+     * the same time may or may not be written.
+     */
+    static void WriteChromeJson(std::ostream& out);
+};
+
+/**
+ * `TraceSpan` records the time from its construction to its destruction as a span of `Trace`. If
+ * `Trace` is not started on construction, it only checks a flag and records nothing.
+ */
+class TraceSpan
+{
+  private:
+    char const* _name;
+    char const* _argName;
+    uint64_t    _arg;
+    int64_t     _begin;
+
+  public:
+    /**
+     * Begins a span.
+     *
+     * @param name the name of the span, which must outlive the trace, e.g. a string literal
+     * @param argName the name of the argument of the span, which must outlive the trace, or null
+     * @param arg the argument of the span, e.g. the number of samples of a batch
+     */
+    explicit TraceSpan(char const* name, char const* argName = nullptr, uint64_t arg = 0) noexcept :
+        _name { Trace::IsEnabled() ? name : nullptr },
+        _argName { argName },
+        _arg { arg },
+        _begin { _name != nullptr ? Trace::GetTime() : 0 }
+    {
+    }
+
+    TraceSpan(TraceSpan const&) = delete;
+    TraceSpan& operator=(TraceSpan const&) = delete;
+
+    ~TraceSpan()
+    {
+        if (_name != nullptr)
+            Trace::Record(_name, _argName, _arg, _begin, Trace::GetTime());
+    }
+};
+
+}
+
+#define MF_TRACE_CONCAT_IMPL(A, B) A##B
+#define MF_TRACE_CONCAT(A, B)      MF_TRACE_CONCAT_IMPL(A, B)
+
+/**
+ * Records a span from this statement to the end of the enclosing scope. Takes the arguments of the
+ * constructor of `TraceSpan`.
+ */
+#define MF_TRACE_SPAN(...) mf::TraceSpan MF_TRACE_CONCAT(mfTraceSpan, __LINE__) { __VA_ARGS__ }
+
+#endif
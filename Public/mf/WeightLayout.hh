@@ -0,0 +1,35 @@
+// Copyright (c) 2021 Chanjung Kim. All rights reserved.
+// Licensed under the MIT License.
+
+#ifndef MNIST_FPGA_WEIGHT_LAYOUT_HH
+#define MNIST_FPGA_WEIGHT_LAYOUT_HH
+
+#include <cstdint>
+
+namespace mf
+{
+
+/**
+ * Represents which representations of the kernel matrix a `Weight` instance keeps.
+ */
+enum class WeightLayout : uint8_t
+{
+    /**
+     * Only the (I, O) row-major matrix as stored by Keras.
+     */
+    Raw,
+
+    /**
+     * Only the panel-major matrix read by the CPU kernels. See `Weight::GetPackedKernelWeight`.
+     */
+    Packed,
+
+    /**
+     * Both of the above.
+     */
+    RawAndPacked,
+};
+
+}
+
+#endif
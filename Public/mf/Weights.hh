@@ -4,13 +4,18 @@
 #ifndef MNIST_FPGA_WEIGHTS_HH
 #define MNIST_FPGA_WEIGHTS_HH
 
+#include <mf/AlignedAllocator.hh>
+#include <mf/ArrayView.hh>
 #include <mf/Config.hh>
 #include <mf/Exception.hh>
 #include <mf/File.hh>
+#include <mf/Model.hh>
+#include <mf/WeightLayout.hh>
 
 #include <cstdint>
 #include <filesystem>
 #include <map>
+#include <memory>
 #include <string>
 #include <vector>
 
@@ -22,6 +27,12 @@ namespace mf
  */
 MF_MAKE_NEW_EXCEPTION(InvalidWeightFileException, "HDF5 file does not contain model weights");
 
+/**
+ * `InvalidFlatWeightFileException` is thrown when a flat weight file is malformed, has an
+ * unsupported version, or lacks a representation requested by the caller.
+ */
+MF_MAKE_NEW_EXCEPTION(InvalidFlatWeightFileException, "Flat weight file is invalid");
+
 /**
  * `Weight` contains parameter values for one single FC layer.
  */
@@ -29,11 +40,28 @@ class Weight
 {
     friend class Weights;
 
+  public:
+    /**
+     * the number of columns of one panel of the packed kernel matrix. One row of a panel fills
+     * one cache line, one AVX-512 register or two AVX2 registers.
+     */
+    constexpr static size_t panelWidth { cacheLineSize / sizeof(float) };
+
   private:
-    size_t             _inputSize;
-    size_t             _outputSize;
-    std::vector<float> _kernel;
-    std::vector<float> _bias;
+    size_t                   _inputSize;
+    size_t                   _outputSize;
+    PageAlignedVector<float> _kernel;
+    PageAlignedVector<float> _bias;
+    AlignedVector<float>     _packedKernel;
+    AlignedVector<float>     _packedBias;
+
+    // Set if the weights are used directly from a mapped flat weight file (see
+    // `Weights::MakeFromFlatFile`), in which case the vectors above are empty.
+    std::shared_ptr<MappedFile const> _file;
+    ArrayView<float>                  _mappedKernel;
+    ArrayView<float>                  _mappedBias;
+    ArrayView<float>                  _mappedPackedKernel;
+    ArrayView<float>                  _mappedPackedBias;
 
   public:
     /**
@@ -54,31 +82,101 @@ class Weight
 
     /**
      * Returns the weight of the matmul operation. The dimension of the matrix is (I, O), where
-     * I is the length of the input and O is the length of the output.
+     * I is the length of the input and O is the length of the output. Unless the weights are used
+     * from a mapped file, the buffer is aligned to a page, so devices can read it in place.
      */
-    std::vector<float> const& GetKernelWeight() const noexcept
+    ArrayView<float> GetKernelWeight() const noexcept
     {
-        return _kernel;
+        return _file ? _mappedKernel : ArrayView<float> { _kernel };
     }
 
     /**
      * Returns the weight of the vector addition. The length of the vector is O.
      */
-    std::vector<float> const& GetBiasWeight() const noexcept
+    ArrayView<float> GetBiasWeight() const noexcept
     {
-        return _bias;
+        return _file ? _mappedBias : ArrayView<float> { _bias };
     }
 
+    /**
+     * Returns `true` if the kernel matrix is kept in the (I, O) row-major layout, i.e.
+     * `GetKernelWeight()` and `GetBiasWeight()` are not empty.
+     */
+    bool HasRawKernel() const noexcept
+    {
+        return !GetKernelWeight().empty();
+    }
+
+    /**
+     * Returns `true` if the kernel matrix is kept in the packed layout, i.e.
+     * `GetPackedKernelWeight()` and `GetPackedBiasWeight()` are not empty.
+     */
+    bool HasPackedKernel() const noexcept
+    {
+        return !GetPackedKernelWeight().empty();
+    }
+
+    /**
+     * Returns the length of the output rounded up to a multiple of `panelWidth`.
+     */
+    size_t GetPackedOutputSize() const noexcept
+    {
+        return (_outputSize + panelWidth - 1) / panelWidth * panelWidth;
+    }
+
+    /**
+     * Returns the weight of the matmul operation in the packed layout. The matrix is split into
+     * P = `GetPackedOutputSize()` / `panelWidth` panels of `panelWidth` columns each. Panels are
+     * stored one after another, and each panel is an (I, `panelWidth`) row-major matrix, so the
+     * element (i, o) is at `(o / panelWidth) * I * panelWidth + i * panelWidth + o % panelWidth`.
+     * The columns past O are zero. The buffer is aligned to a cache line.
+     */
+    ArrayView<float> GetPackedKernelWeight() const noexcept
+    {
+        return _file ? _mappedPackedKernel : ArrayView<float> { _packedKernel };
+    }
+
+    /**
+     * Returns the weight of the vector addition padded with zeros to `GetPackedOutputSize()`. The
+     * buffer is aligned to a cache line.
+     */
+    ArrayView<float> GetPackedBiasWeight() const noexcept
+    {
+        return _file ? _mappedPackedBias : ArrayView<float> { _packedBias };
+    }
+
+    /**
+     * Multiplies every element of the kernel matrix, in every representation it is kept in, by
+     * the given factor. Scaling the kernel by s is the same as scaling the input by s, so this
+     * folds a normalization of the input into the layer (e.g. 1/255 for the pixels of
+     * `MnistPixelFormat::Byte`). The bias is not changed. Weights used from a mapped file are
+     * copied out of the mapping first.
+     *
+     * @param factor the factor to multiply
+     */
+    void ScaleKernel(float factor);
+
   private:
-    Weight(size_t               inputSize,
-           size_t               outputSize,
-           std::vector<float>&& kernel,
-           std::vector<float>&& bias) :
+    Weight(size_t                     inputSize,
+           size_t                     outputSize,
+           PageAlignedVector<float>&& kernel,
+           PageAlignedVector<float>&& bias) :
         _inputSize { inputSize },
         _outputSize { outputSize },
         _kernel { std::move(kernel) },
         _bias { std::move(bias) }
     {}
+
+    /**
+     * Fills the packed representation from the raw one, and drops the raw one unless `layout` is
+     * `WeightLayout::RawAndPacked`.
+     */
+    void ApplyLayout(WeightLayout layout);
+
+    /**
+     * Copies the weights used from a mapped file into the vectors, so they can be modified.
+     */
+    void CopyFromFile();
 };
 
 /**
@@ -98,9 +196,12 @@ class Weights
      * Reads layer weights from given HDF5 file.
      *
      * @param path the path of the HDF5 file to read.
+     * @param layout the representations of the kernel matrices to keep. Packing is done once here
+     * so that the compute kernels can read the weights contiguously.
      * @throws NoSuchFileException
      */
-    static WeightCollection MakeFromHdf5(std::filesystem::path const& path);
+    static WeightCollection MakeFromHdf5(std::filesystem::path const& path,
+                                         WeightLayout                 layout = WeightLayout::Raw);
 
     /**
      * Reads layer weights from the file specified in the configuration.
@@ -110,8 +211,53 @@ class Weights
      */
     inline static WeightCollection MakeFromHdf5(Config const& config)
     {
-        return MakeFromHdf5(config.weightFilePath);
+        return MakeFromHdf5(config.weightFilePath, config.weightLayout);
     }
+
+    /**
+     * Maps a flat weight file written by `WriteFlatFile` to memory. The kernels and biases are
+     * used directly from the mapping, so loading only reads the layer table; the mapping is
+     * released when the last `Weight` using it is destroyed. If `layout` asks for the packed
+     * representation and the file only has the raw one, the packed one is computed instead.
+     *
+     * @param path the path of the flat weight file
+     * @param layout the representations of the kernel matrices to keep
+     * @throws NoSuchFileException
+     * @throws InvalidFlatWeightFileException if the file is malformed, or `layout` asks for the
+     * raw representation which the file does not have
+     */
+    static WeightCollection MakeFromFlatFile(std::filesystem::path const& path,
+                                             WeightLayout layout = WeightLayout::Raw);
+
+    /**
+     * Writes the layers to a flat weight file, with every representation each layer keeps. The
+     * file is written next to `path` and renamed over it, so readers never see a partial file.
+     *
+     * @param weights the layers to write
+     * @param path the path of the file to write
+     * @param layers the architecture of the model, read back by `Model::ReadFromFlatFile`, or an
+     * empty vector to write the weights only
+     * @throws NoSuchFileException if the file could not be written
+     * @throws LayerNotFoundException if `layers` names a layer `weights` does not contain
+     */
+    static void WriteFlatFile(WeightCollection const&       weights,
+                              std::filesystem::path const&  path,
+                              std::vector<LayerSpec> const& layers = {});
+
+    /**
+     * Returns `true` if the given file starts with the signature of a flat weight file.
+     */
+    static bool IsFlatFile(std::filesystem::path const& path);
+
+    /**
+     * Reads layer weights from the file specified in the configuration, which may be either a
+     * flat weight file or a HDF5 file. HDF5 is not touched if it is a flat weight file.
+     *
+     * @param config the configuration
+     * @throws NoSuchFileException
+     * @throws InvalidFlatWeightFileException
+     */
+    static WeightCollection MakeFromFile(Config const& config);
 };
 
 }
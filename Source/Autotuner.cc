@@ -0,0 +1,455 @@
+// Copyright (c) 2021 Chanjung Kim. All rights reserved.
+// Licensed under the MIT License.
+
+#include <mf/AlignedAllocator.hh>
+#include <mf/Autotuner.hh>
+#include <mf/Cpu.hh>
+#include <mf/Engine.hh>
+#include <mf/ExecutionPlan.hh>
+#include <mf/File.hh>
+#include <mf/Statistics.hh>
+#include <mf/ThreadPool.hh>
+#include <mf/Trace.hh>
+
+#include "Json.hh"
+
+#include <algorithm>
+#include <cmath>
+#include <fstream>
+#include <iomanip>
+#include <memory>
+#include <sstream>
+#include <stdexcept>
+#include <utility>
+
+namespace mf
+{
+
+namespace
+{
+
+using Clock = std::chrono::steady_clock;
+
+/**
+ * The time each candidate runs for. The threads are measured for longer, since starting them and
+ * spreading the batches takes a while to settle.
+ */
+constexpr std::chrono::milliseconds candidateTime { 30 }, threadCandidateTime { 100 };
+
+/**
+ * The least number of measured batches of a candidate, however long they take.
+ */
+constexpr size_t minIterations = 5;
+
+/**
+ * The batch size the tiles are compared at.
+ */
+constexpr size_t tileBatchSize = 256;
+
+constexpr size_t tileSamples[] { 16, 32, 64, 128 };
+constexpr size_t tileInputs[] { 128, 256, 512 };
+constexpr size_t tileOutputs[] { 64, 128, 256 };
+constexpr size_t batchSizes[] { 1, 4, 16, 64, 256, 1024 };
+
+/**
+ * The largest value of `batchSizes`, which is the number of samples the candidates read.
+ */
+constexpr size_t maxBatchSize = 1024;
+
+/**
+ * A thread count must be this much faster than the next smaller one to be chosen, so that noise
+ * does not add threads that do not pay off.
+ */
+constexpr double minThreadGain = 1.02;
+
+/**
+ * The number of images classified per second, and the 99th percentile of the time of one batch.
+ */
+struct Measurement
+{
+    double throughput;
+    double latency;
+};
+
+using CacheEntry = std::pair<std::string, TunedParameters>;
+
+/**
+ * Classifies the first `GetBatchSize()` samples of `in` on the calling thread, once to warm the
+ * caches and then repeatedly for `candidateTime`. The throughput is taken from the median time,
+ * so that a batch preempted by another process does not decide between two candidates.
+ */
+template <typename In>
+Measurement MeasureEngine(Engine& engine, In const* in)
+{
+    std::vector<MnistLabel> labels(engine.GetBatchSize());
+    engine.Classify(in, engine.GetBatchSize(), labels.data());
+
+    std::vector<double> times;
+    double              totalTime = 0.0;
+    while (totalTime < std::chrono::duration<double> { candidateTime }.count()
+           || times.size() < minIterations)
+    {
+        auto const begin { Clock::now() };
+        engine.Classify(in, engine.GetBatchSize(), labels.data());
+        double const time { std::chrono::duration<double> { Clock::now() - begin }.count() };
+        times.push_back(time);
+        totalTime += time;
+    }
+
+    std::sort(times.begin(), times.end());
+    return Measurement { engine.GetBatchSize() / GetPercentile(times, 0.50),
+                         GetPercentile(times, 0.99) };
+}
+
+/**
+ * Classifies the samples of `in` with copies of the given engine on `numThreads` threads for
+ * `threadCandidateTime`, each batch reading the next `GetBatchSize()` samples.
+ */
+template <typename In>
+Measurement MeasureThreads(Engine const& engine, In const* in, size_t numThreads)
+{
+    ThreadPool                           pool { numThreads };
+    std::vector<Engine>                  engines(numThreads, engine);
+    std::vector<std::vector<MnistLabel>> labels(numThreads);
+    std::vector<std::vector<double>>     times(numThreads);
+    for (auto& threadLabels : labels) threadLabels.resize(engine.GetBatchSize());
+
+    size_t const batchSize { engine.GetBatchSize() };
+    size_t const numOffsets { maxBatchSize / batchSize };
+    size_t const inputSize { engine.GetInputSize() };
+    auto const   run { [&](size_t threadIndex, size_t begin, size_t end) {
+        In const*  batch { in + (begin / batchSize % numOffsets) * batchSize * inputSize };
+        auto const batchBegin { Clock::now() };
+        engines[threadIndex].Classify(batch, end - begin, labels[threadIndex].data());
+        times[threadIndex].push_back(
+            std::chrono::duration<double> { Clock::now() - batchBegin }.count());
+    } };
+
+    // Every thread runs a few batches per round, so the rounds are not dominated by waking them.
+    size_t const numRoundSamples { batchSize * numThreads * 4 };
+    pool.ParallelFor(0, numRoundSamples, batchSize, run);
+    for (auto& threadTimes : times) threadTimes.clear();
+
+    size_t     numSamples = 0;
+    auto const begin { Clock::now() };
+    do
+    {
+        pool.ParallelFor(0, numRoundSamples, batchSize, run);
+        numSamples += numRoundSamples;
+    } while (Clock::now() - begin < threadCandidateTime);
+    double const totalTime { std::chrono::duration<double> { Clock::now() - begin }.count() };
+
+    std::vector<double> allTimes;
+    for (auto const& threadTimes : times)
+        allTimes.insert(allTimes.end(), threadTimes.begin(), threadTimes.end());
+    std::sort(allTimes.begin(), allTimes.end());
+    return Measurement { numSamples / totalTime, GetPercentile(allTimes, 0.99) };
+}
+
+/**
+ * Implementation of `Autotuner::Tune` for the given type of pixels. `in` holds `maxBatchSize`
+ * samples.
+ */
+template <typename In>
+TunedParameters TuneWith(WeightCollection const&       weights,
+                         std::vector<LayerSpec> const& layers,
+                         In const*                     in,
+                         double                        latencyBudget,
+                         size_t                        maxThreads)
+{
+    std::vector<std::shared_ptr<ExecutionPlan const>> plans;
+    auto const getPlan { [&](size_t batchSize) {
+        for (auto const& plan : plans)
+        {
+            if (plan->GetBatchSize() == batchSize)
+                return plan;
+        }
+        return plans.emplace_back(std::make_shared<ExecutionPlan const>(
+            ExecutionPlan::Compile(weights, layers, batchSize)));
+    } };
+
+    // The tiles only matter to the layers computed one after another, so they are compared
+    // unfused, at a batch size large enough for every tile.
+    DenseBlocking blocking;
+    double        bestThroughput = 0.0;
+    for (size_t numSamples : tileSamples)
+    {
+        for (size_t numInputs : tileInputs)
+        {
+            for (size_t numOutputs : tileOutputs)
+            {
+                DenseBlocking const candidate { numSamples, numInputs, numOutputs };
+                auto engine { Engine::MakeFromPlan(getPlan(tileBatchSize), candidate, false) };
+                if (auto measurement { MeasureEngine(engine, in) };
+                    measurement.throughput > bestThroughput)
+                {
+                    blocking       = candidate;
+                    bestThroughput = measurement.throughput;
+                }
+            }
+        }
+    }
+
+    // The batch size and whether to fuse are chosen together, since the fused network and the
+    // layers computed one after another need not be fastest at the same batch size.
+    auto const withinBudget { [&](Measurement const& measurement) {
+        return latencyBudget == 0.0 || measurement.latency <= latencyBudget;
+    } };
+    auto const isBetter { [&](Measurement const& lhs, Measurement const& rhs) {
+        if (withinBudget(lhs) != withinBudget(rhs))
+            return withinBudget(lhs);
+        return withinBudget(lhs) ? lhs.throughput > rhs.throughput : lhs.latency < rhs.latency;
+    } };
+    std::optional<Engine> best;
+    Measurement           bestMeasurement {};
+    for (size_t batchSize : batchSizes)
+    {
+        for (bool fused : { true, false })
+        {
+            auto engine { Engine::MakeFromPlan(getPlan(batchSize), blocking, fused) };
+            if (fused && !engine.IsFused())
+                continue;
+
+            auto const measurement { MeasureEngine(engine, in) };
+            if (!best || isBetter(measurement, bestMeasurement))
+            {
+                best.emplace(std::move(engine));
+                bestMeasurement = measurement;
+            }
+        }
+    }
+
+    // More threads are added while they pay off and the batches stay within the budget, which
+    // they may not once the threads share the caches and the memory bandwidth.
+    size_t      numThreads = 1;
+    Measurement threadMeasurement { MeasureThreads(*best, in, 1) };
+    for (size_t candidate = 2; candidate / 2 < maxThreads; candidate *= 2)
+    {
+        size_t const count { std::min(candidate, maxThreads) };
+        auto const   measurement { MeasureThreads(*best, in, count) };
+        if (measurement.throughput < threadMeasurement.throughput * minThreadGain
+            || (withinBudget(bestMeasurement) && !withinBudget(measurement)))
+            break;
+
+        numThreads        = count;
+        threadMeasurement = measurement;
+    }
+
+    return TunedParameters {
+        best->GetBatchSize(),
+        numThreads,
+        best->GetBlocking(),
+        best->IsFused(),
+        threadMeasurement.throughput,
+        threadMeasurement.latency,
+    };
+}
+
+/**
+ * Returns the given member of the given object as a non-negative integer.
+ *
+ * @throws InvalidJsonException if the member is missing or not a non-negative integer
+ */
+size_t GetSizeMember(JsonValue const& object, char const* key)
+{
+    JsonValue const* member { object.Find(key) };
+    if (member == nullptr)
+        throw InvalidJsonException { std::string { key } + " is missing" };
+
+    double const number { member->GetNumber() };
+    if (number < 0.0 || number != std::floor(number))
+        throw InvalidJsonException { std::string { key } + " must be a non-negative integer" };
+    return (size_t)number;
+}
+
+/**
+ * Reads every entry of the given cache file. Returns no entries if the file does not exist or
+ * cannot be parsed, and skips the entries that cannot be read.
+ */
+std::vector<CacheEntry> ReadEntries(std::filesystem::path const& path)
+{
+    std::ifstream ifs { path };
+    if (!ifs)
+        return {};
+
+    std::stringstream text;
+    text << ifs.rdbuf();
+
+    JsonValue root;
+    try
+    {
+        root = JsonValue::Parse(text.str());
+    }
+    catch (InvalidJsonException const&)
+    {
+        return {};
+    }
+
+    JsonValue const* entries { root.Find("entries") };
+    if (entries == nullptr || entries->GetType() != JsonValue::Type::Array)
+        return {};
+
+    std::vector<CacheEntry> rtn;
+    for (auto const& entry : entries->GetArray())
+    {
+        try
+        {
+            JsonValue const* key { entry.Find("key") };
+            JsonValue const* fused { entry.Find("fused") };
+            JsonValue const* throughput { entry.Find("throughput") };
+            JsonValue const* latency { entry.Find("latency") };
+            if (key == nullptr || fused == nullptr || throughput == nullptr || latency == nullptr)
+                continue;
+
+            TunedParameters parameters {
+                GetSizeMember(entry, "batch_size"),
+                GetSizeMember(entry, "num_threads"),
+                DenseBlocking { GetSizeMember(entry, "tile_samples"),
+                                GetSizeMember(entry, "tile_inputs"),
+                                GetSizeMember(entry, "tile_outputs") },
+                fused->GetBool(),
+                throughput->GetNumber(),
+                latency->GetNumber(),
+            };
+            auto const& blocking { parameters.blocking };
+            if (parameters.batchSize == 0 || parameters.numThreads == 0
+                || blocking.numSamples == 0 || blocking.numInputs == 0
+                || blocking.numOutputs == 0)
+                continue;
+
+            rtn.emplace_back(key->GetString(), parameters);
+        }
+        catch (InvalidJsonException const&)
+        {
+        }
+    }
+    return rtn;
+}
+
+/**
+ * Writes the given entries as a cache file.
+ */
+void WriteEntries(std::ostream& os, std::vector<CacheEntry> const& entries)
+{
+    os << std::setprecision(17) << "{\n  \"entries\": [";
+    for (size_t i = 0; i < entries.size(); ++i)
+    {
+        auto const& [key, parameters] { entries[i] };
+        auto const& blocking { parameters.blocking };
+
+        os << (i == 0 ? "\n" : ",\n") << "    {\"key\": ";
+        WriteJsonString(os, key);
+        os << ", \"batch_size\": " << parameters.batchSize
+           << ", \"num_threads\": " << parameters.numThreads
+           << ", \"tile_samples\": " << blocking.numSamples
+           << ", \"tile_inputs\": " << blocking.numInputs
+           << ", \"tile_outputs\": " << blocking.numOutputs
+           << ", \"fused\": " << (parameters.fused ? "true" : "false")
+           << ", \"throughput\": " << parameters.throughput
+           << ", \"latency\": " << parameters.latency << "}";
+    }
+    os << "\n  ]\n}\n";
+}
+
+}
+
+std::string Autotuner::GetCacheKey(WeightCollection const&       weights,
+                                   std::vector<LayerSpec> const& layers,
+                                   MnistPixelFormat              pixelFormat)
+{
+    std::string rtn { Cpu::GetModelName() };
+    rtn += "|";
+    rtn += Cpu::GetIsaName(Dense::GetIsa());
+    rtn += pixelFormat == MnistPixelFormat::Byte ? "|byte|" : "|float|";
+    for (size_t i = 0; i < layers.size(); ++i)
+    {
+        auto it { weights.find(layers[i].name) };
+        if (it == weights.end())
+            throw LayerNotFoundException { layers[i].name };
+
+        if (i == 0)
+            rtn += std::to_string(it->second.GetInputSize());
+        rtn += "x" + std::to_string(it->second.GetOutputSize());
+    }
+    return rtn;
+}
+
+std::optional<TunedParameters> Autotuner::Load(std::filesystem::path const& path,
+                                               std::string const&           key)
+{
+    MF_TRACE_SPAN("Autotuner::Load");
+    for (auto& [entryKey, parameters] : ReadEntries(path))
+    {
+        if (entryKey == key)
+            return parameters;
+    }
+    return std::nullopt;
+}
+
+void Autotuner::Store(std::filesystem::path const& path,
+                      std::string const&           key,
+                      TunedParameters const&       parameters)
+{
+    auto entries { ReadEntries(path) };
+    auto it { std::find_if(
+        entries.begin(), entries.end(), [&](auto const& entry) { return entry.first == key; }) };
+    if (it != entries.end())
+        it->second = parameters;
+    else
+        entries.emplace_back(key, parameters);
+
+    File::WriteFileAtomically(path, [&](std::ostream& os) { WriteEntries(os, entries); });
+}
+
+TunedParameters Autotuner::Tune(WeightCollection const&       weights,
+                                std::vector<LayerSpec> const& layers,
+                                Mnist const&                  mnist,
+                                std::chrono::microseconds     latencyBudget,
+                                size_t                        maxThreads)
+{
+    if (mnist.GetNumSamples() == 0)
+        throw std::invalid_argument { "mnist" };
+    if (maxThreads == 0)
+        throw std::invalid_argument { "maxThreads" };
+
+    MF_TRACE_SPAN("Autotuner::Tune");
+    double const budget { std::chrono::duration<double> { latencyBudget }.count() };
+
+    // The samples are repeated if the dataset has fewer than the largest batch.
+    constexpr size_t imageSize { MnistByteSample::width * MnistByteSample::height };
+    size_t const     numSamples { std::min(mnist.GetNumSamples(), maxBatchSize) };
+    if (mnist.GetPixelFormat() == MnistPixelFormat::Byte)
+    {
+        std::vector<uint8_t> in(maxBatchSize * imageSize);
+        for (size_t i = 0; i < maxBatchSize; ++i)
+            std::copy_n(mnist.GetByteImages().data() + i % numSamples * imageSize,
+                        imageSize,
+                        in.data() + i * imageSize);
+        return TuneWith(weights, layers, in.data(), budget, maxThreads);
+    }
+
+    AlignedVector<float> in(maxBatchSize * imageSize);
+    for (size_t i = 0; i < maxBatchSize; ++i)
+        std::copy_n(mnist.GetImages().data() + i % numSamples * imageSize,
+                    imageSize,
+                    in.data() + i * imageSize);
+    return TuneWith(weights, layers, in.data(), budget, maxThreads);
+}
+
+void Autotuner::Apply(TunedParameters const& parameters, Config& config)
+{
+    if (!config.IsExplicit(ConfigField::BatchSize))
+        config.batchSize = parameters.batchSize;
+    if (!config.IsExplicit(ConfigField::NumThreads))
+        config.numThreads = parameters.numThreads;
+    if (!config.IsExplicit(ConfigField::DenseTileSamples))
+        config.denseTileSamples = parameters.blocking.numSamples;
+    if (!config.IsExplicit(ConfigField::DenseTileInputs))
+        config.denseTileInputs = parameters.blocking.numInputs;
+    if (!config.IsExplicit(ConfigField::DenseTileOutputs))
+        config.denseTileOutputs = parameters.blocking.numOutputs;
+    if (!config.IsExplicit(ConfigField::DenseFused))
+        config.denseFused = parameters.fused;
+}
+
+}
@@ -0,0 +1,429 @@
+// Copyright (c) 2021 Chanjung Kim. All rights reserved.
+// Licensed under the MIT License.
+
+#include <mf/AlignedAllocator.hh>
+#include <mf/Cpu.hh>
+#include <mf/Dense.hh>
+#include <mf/Engine.hh>
+#include <mf/ExecutionPlan.hh>
+#include <mf/Mnist.hh>
+#include <mf/Model.hh>
+#include <mf/Statistics.hh>
+#include <mf/Weights.hh>
+
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <filesystem>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <iterator>
+#include <memory>
+#include <random>
+#include <stdexcept>
+#include <string>
+#include <utility>
+#include <vector>
+
+// Measures the loaders, the dense kernels and the whole forward pass on the host, and reports
+// their throughput, latency percentiles, GFLOP/s and bytes/s. Needs neither Vitis nor OpenCL.
+//
+// The inputs are read from `WEIGHT_PATH`, `MNIST_IMAGE_PATH` and `MNIST_LABEL_PATH` as in
+// `mnist-fpga`. `BENCH_MIN_TIME` is the minimum time in milliseconds each benchmark runs for
+// (default: 500), `DENSE_ISA` forces the instruction set of the kernels, and `BENCH_REPORT` is the
+// path to write the results to as JSON (default: not written).
+
+namespace
+{
+
+/**
+ * The least number of measured iterations of a benchmark, however long they take.
+ */
+constexpr size_t minIterations = 5;
+
+/**
+ * The batch sizes of the forward pass benchmarks.
+ */
+constexpr size_t minBatchSize = 1, maxBatchSize = 1024;
+
+/**
+ * The batch size and the densities of the inputs of the sparse benchmarks, in percent.
+ */
+constexpr size_t sparseBatchSize = 256;
+constexpr int    sparseDensities[] { 5, 10, 15, 20, 25, 30, 40, 50, 60, 80 };
+
+/**
+ * `BenchmarkResult` is the outcome of one benchmark. The times are in seconds, and the amounts
+ * are per iteration.
+ */
+struct BenchmarkResult
+{
+    std::string name;
+    size_t      numIterations;
+    double      meanTime, p50Time, p99Time;
+    double      numItems, numFlops, numBytes;
+};
+
+/**
+ * Returns the value of the given environment variable, or throws if it is not set.
+ */
+std::string GetRequiredVariable(char const* name)
+{
+    char const* value { std::getenv(name) };
+    if (value == nullptr || *value == '\0')
+        throw std::runtime_error { std::string { "Environment variable " } + name + " is not set" };
+    return value;
+}
+
+/**
+ * Calls `body` once to warm the caches, then repeatedly until `minTime` seconds have passed and
+ * at least `minIterations` calls were made, timing each call.
+ */
+template <typename Body>
+BenchmarkResult Measure(std::string name,
+                        double      minTime,
+                        double      numItems,
+                        double      numFlops,
+                        double      numBytes,
+                        Body&&      body)
+{
+    using Clock = std::chrono::steady_clock;
+
+    body();
+
+    std::vector<double> times;
+    double              totalTime = 0.0;
+    while (totalTime < minTime || times.size() < minIterations)
+    {
+        auto begin { Clock::now() };
+        body();
+        double const time { std::chrono::duration<double> { Clock::now() - begin }.count() };
+        times.push_back(time);
+        totalTime += time;
+    }
+
+    std::sort(times.begin(), times.end());
+    return BenchmarkResult {
+        std::move(name),
+        times.size(),
+        totalTime / times.size(),
+        mf::GetPercentile(times, 0.50),
+        mf::GetPercentile(times, 0.99),
+        numItems,
+        numFlops,
+        numBytes,
+    };
+}
+
+/**
+ * Prints one line of the summary table.
+ */
+void PrintResult(BenchmarkResult const& result)
+{
+    std::cout << std::left << std::setw(32) << result.name << std::right << std::fixed
+              << std::setprecision(2) << std::setw(12) << result.p50Time * 1e6 << std::setw(12)
+              << result.p99Time * 1e6 << std::setw(16) << result.numItems / result.meanTime
+              << std::setw(10) << result.numFlops / result.meanTime * 1e-9 << std::setw(10)
+              << result.numBytes / result.meanTime * 1e-9 << std::endl;
+}
+
+/**
+ * Writes the results as JSON. The names of the keys are stable, so that the reports of two runs
+ * can be compared line by line.
+ */
+void WriteReport(std::filesystem::path const&        path,
+                 std::vector<BenchmarkResult> const& results,
+                 double                              minTime,
+                 size_t                              numSamples)
+{
+    std::ofstream out { path };
+    if (!out)
+        throw std::runtime_error { "Cannot write " + path.string() };
+
+    out << std::setprecision(9);
+    out << "{\n";
+    out << "  \"context\": {\n";
+    out << "    \"isa\": \"" << mf::Cpu::GetIsaName(mf::Dense::GetIsa()) << "\",\n";
+    out << "    \"min_time_s\": " << minTime << ",\n";
+    out << "    \"num_samples\": " << numSamples << "\n";
+    out << "  },\n";
+    out << "  \"benchmarks\": [";
+    for (size_t i = 0; i < results.size(); ++i)
+    {
+        auto const& result { results[i] };
+        out << (i == 0 ? "\n" : ",\n");
+        out << "    {\n";
+        out << "      \"name\": \"" << result.name << "\",\n";
+        out << "      \"iterations\": " << result.numIterations << ",\n";
+        out << "      \"mean_ns\": " << result.meanTime * 1e9 << ",\n";
+        out << "      \"p50_ns\": " << result.p50Time * 1e9 << ",\n";
+        out << "      \"p99_ns\": " << result.p99Time * 1e9 << ",\n";
+        out << "      \"items_per_second\": " << result.numItems / result.meanTime << ",\n";
+        out << "      \"gflops\": " << result.numFlops / result.meanTime * 1e-9 << ",\n";
+        out << "      \"bytes_per_second\": " << result.numBytes / result.meanTime << "\n";
+        out << "    }";
+    }
+    out << "\n  ]\n";
+    out << "}\n";
+
+    if (!out)
+        throw std::runtime_error { "Cannot write " + path.string() };
+}
+
+/**
+ * Returns `numSamples` images of `inputSize` pixels, each of which is nonzero with the given
+ * probability. The images are the same on every run.
+ */
+std::vector<uint8_t> MakeSparseImages(size_t numSamples, size_t inputSize, double density)
+{
+    std::mt19937                            random { 0 };
+    std::bernoulli_distribution             isNonzero { density };
+    std::uniform_int_distribution<unsigned> value { 1, 255 };
+
+    std::vector<uint8_t> rtn(numSamples * inputSize);
+    for (auto& pixel : rtn) pixel = isNonzero(random) ? (uint8_t)value(random) : 0;
+    return rtn;
+}
+
+/**
+ * Prints the lowest density at which the sparse benchmarks are no faster than the dense ones.
+ * `dense` and `sparse` are the means of the benchmarks at each of `sparseDensities`.
+ */
+void PrintCrossover(char const*                name,
+                    std::vector<double> const& dense,
+                    std::vector<double> const& sparse)
+{
+    std::cout << "sparse crossover of " << name << ": ";
+    for (size_t i = 0; i < dense.size(); ++i)
+    {
+        if (sparse[i] >= dense[i])
+        {
+            std::cout << sparseDensities[i] << "% nonzero" << std::endl;
+            return;
+        }
+    }
+    std::cout << "above " << sparseDensities[std::size(sparseDensities) - 1] << "% nonzero"
+              << std::endl;
+}
+
+/**
+ * The value `Consume` writes to. It is volatile, so the compiler cannot drop the writes.
+ */
+float volatile sink;
+
+/**
+ * Keeps the compiler from removing the computation of `value`.
+ */
+void Consume(float value)
+{
+    sink = value;
+}
+
+}
+
+int main()
+try
+{
+    std::filesystem::path const weightPath { GetRequiredVariable("WEIGHT_PATH") };
+    std::filesystem::path const imagePath { GetRequiredVariable("MNIST_IMAGE_PATH") };
+    std::filesystem::path const labelPath { GetRequiredVariable("MNIST_LABEL_PATH") };
+
+    double minTime { 0.5 };
+    if (char const* value { std::getenv("BENCH_MIN_TIME") }; value != nullptr && *value != '\0')
+        minTime = std::stoul(value) / 1000.0;
+
+    if (char const* value { std::getenv("DENSE_ISA") }; value != nullptr && *value != '\0')
+    {
+        mf::Isa isa;
+        if (!mf::Cpu::ParseIsaName(value, isa))
+            throw std::runtime_error { std::string { "Unknown instruction set: " } + value };
+        mf::Dense::SetIsa(isa);
+    }
+
+    std::vector<BenchmarkResult> results;
+    auto const                   run { [&](auto&&... args) {
+        results.push_back(Measure(std::forward<decltype(args)>(args)...));
+        PrintResult(results.back());
+    } };
+
+    std::cout << "isa: " << mf::Cpu::GetIsaName(mf::Dense::GetIsa()) << std::endl;
+    std::cout << std::left << std::setw(32) << "benchmark" << std::right << std::setw(12)
+              << "p50 (us)" << std::setw(12) << "p99 (us)" << std::setw(16) << "items/s"
+              << std::setw(10) << "GFLOP/s" << std::setw(10) << "GB/s" << std::endl;
+
+    // The loaders are timed with the files in the page cache, so they measure the parsing and the
+    // conversion rather than the disk.
+    auto         mnist { mf::Mnist::MakeFromFile(imagePath, labelPath) };
+    auto const&  images { mnist.GetImages() };
+    size_t const numSamples { mnist.GetNumSamples() };
+    double const mnistSize = std::filesystem::file_size(imagePath)
+                             + std::filesystem::file_size(labelPath);
+    run("load/Mnist::MakeFromFile", minTime, numSamples, 0.0, mnistSize, [&] {
+        Consume(mf::Mnist::MakeFromFile(imagePath, labelPath).GetImages()[0]);
+    });
+
+    constexpr auto layout { mf::WeightLayout::RawAndPacked };
+    bool const     isFlatFile { mf::Weights::IsFlatFile(weightPath) };
+    auto const     loadWeights { [&] {
+        return isFlatFile ? mf::Weights::MakeFromFlatFile(weightPath, layout)
+                              : mf::Weights::MakeFromHdf5(weightPath, layout);
+    } };
+    auto const     weights { loadWeights() };
+    auto const     layers { isFlatFile ? mf::Model::ReadFromFlatFile(weightPath)
+                                       : mf::Model::ReadFromHdf5(weightPath) };
+
+    double numParameters = 0.0, numNetworkFlops = 0.0;
+    for (auto const& layer : layers)
+    {
+        auto const& weight { weights.at(layer.name) };
+        numParameters += (weight.GetInputSize() + 1.0) * weight.GetOutputSize();
+        numNetworkFlops += 2.0 * weight.GetInputSize() * weight.GetOutputSize();
+    }
+    run(isFlatFile ? "load/Weights::MakeFromFlatFile" : "load/Weights::MakeFromHdf5",
+        minTime,
+        numParameters,
+        0.0,
+        (double)std::filesystem::file_size(weightPath),
+        [&] { Consume((float)loadWeights().size()); });
+
+    // One sample through each layer with the reference kernel, and a batch with the kernel of the
+    // selected instruction set. The bytes are those of the weights, the inputs and the outputs.
+    size_t const             numBatchSamples { mf::DenseBlocking {}.numSamples };
+    mf::AlignedVector<float> in, out;
+    for (auto const& layer : layers)
+    {
+        auto const&  weight { weights.at(layer.name) };
+        size_t const inputSize { weight.GetInputSize() };
+        size_t const outputSize { weight.GetOutputSize() };
+        double const numFlops = 2.0 * inputSize * outputSize;
+        double const numWeightBytes = (inputSize + 1.0) * outputSize * sizeof(float);
+        double const numSampleBytes = (inputSize + outputSize) * sizeof(float);
+        std::string const shape { std::to_string(inputSize) + "x" + std::to_string(outputSize) };
+
+        in.assign(numBatchSamples * inputSize, 0.0f);
+        out.assign(numBatchSamples * outputSize, 0.0f);
+        std::copy_n(images.begin(), std::min(in.size(), images.size()), in.begin());
+
+        run("dense/Apply/" + shape, minTime, 1.0, numFlops, numWeightBytes + numSampleBytes, [&] {
+            mf::Dense::Apply(in.data(), out.data(), weight);
+            Consume(out[0]);
+        });
+        run("dense/ApplyBatch/" + shape + "/" + std::to_string(numBatchSamples),
+            minTime,
+            numBatchSamples,
+            numFlops * numBatchSamples,
+            numWeightBytes + numSampleBytes * numBatchSamples,
+            [&] {
+                mf::Dense::ApplyBatch(
+                    in.data(), out.data(), numBatchSamples, weight, {}, layer.activation);
+                Consume(out[0]);
+            });
+    }
+
+    // The whole network, over inputs cycling through the dataset.
+    size_t const inputSize { weights.at(layers.front().name).GetInputSize() };
+    size_t const outputSize { weights.at(layers.back().name).GetOutputSize() };
+    in.resize(maxBatchSize * inputSize);
+    for (size_t i = 0; i < in.size(); i += images.size())
+        std::copy_n(images.begin(), std::min(images.size(), in.size() - i), in.begin() + i);
+
+    for (size_t batchSize = minBatchSize; batchSize <= maxBatchSize; batchSize *= 2)
+    {
+        auto engine { mf::Engine::MakeFromPlan(std::make_shared<mf::ExecutionPlan const>(
+            mf::ExecutionPlan::Compile(weights, layers, batchSize))) };
+        size_t offset = 0;
+        run("forward/" + std::to_string(batchSize),
+            minTime,
+            batchSize,
+            numNetworkFlops * batchSize,
+            numParameters * sizeof(float) + batchSize * (inputSize + outputSize) * sizeof(float),
+            [&] {
+                Consume(engine.Forward(in.data() + offset * inputSize, batchSize)[0]);
+                offset = offset + 2 * batchSize <= maxBatchSize ? offset + batchSize : 0;
+            });
+    }
+
+    // The first layer and the whole network on images with a growing fraction of nonzero pixels,
+    // computed densely and from the nonzero pixels only, encoding included, as the engine does
+    // below its sparse threshold. The GFLOP/s of both count the multiplications by zero.
+    {
+        auto const&  first { weights.at(layers.front().name) };
+        size_t const firstOutputSize { first.GetOutputSize() };
+        double const numFirstFlops = 2.0 * inputSize * firstOutputSize * sparseBatchSize;
+        auto const   plan { std::make_shared<mf::ExecutionPlan const>(
+            mf::ExecutionPlan::Compile(weights, layers, sparseBatchSize)) };
+        auto denseEngine { mf::Engine::MakeFromPlan(plan, {}, true, 0.0) };
+        auto sparseEngine { mf::Engine::MakeFromPlan(plan, {}, true, 1.0) };
+
+        mf::SparseBatch     sparse { sparseBatchSize, inputSize };
+        std::vector<double> layerDense, layerSparse, forwardDense, forwardSparse;
+        out.resize(sparseBatchSize * firstOutputSize);
+        for (int density : sparseDensities)
+        {
+            auto const bytes { MakeSparseImages(sparseBatchSize, inputSize, density / 100.0) };
+            std::string const suffix { "/" + std::to_string(density) + "%" };
+
+            run("sparse/ApplyBatch" + suffix,
+                minTime,
+                sparseBatchSize,
+                numFirstFlops,
+                bytes.size(),
+                [&] {
+                    mf::Dense::ApplyBatch(bytes.data(), out.data(), sparseBatchSize, first);
+                    Consume(out[0]);
+                });
+            layerDense.push_back(results.back().meanTime);
+            run("sparse/ApplySparse" + suffix,
+                minTime,
+                sparseBatchSize,
+                numFirstFlops,
+                bytes.size(),
+                [&] {
+                    sparse.Encode(bytes.data(), sparseBatchSize, inputSize);
+                    mf::Dense::ApplySparse(sparse, out.data(), first);
+                    Consume(out[0]);
+                });
+            layerSparse.push_back(results.back().meanTime);
+
+            run("sparse/forward-dense" + suffix,
+                minTime,
+                sparseBatchSize,
+                numNetworkFlops * sparseBatchSize,
+                bytes.size(),
+                [&] { Consume(denseEngine.Forward(bytes.data(), sparseBatchSize)[0]); });
+            forwardDense.push_back(results.back().meanTime);
+            run("sparse/forward-sparse" + suffix,
+                minTime,
+                sparseBatchSize,
+                numNetworkFlops * sparseBatchSize,
+                bytes.size(),
+                [&] { Consume(sparseEngine.Forward(bytes.data(), sparseBatchSize)[0]); });
+            forwardSparse.push_back(results.back().meanTime);
+        }
+
+        std::cout << "dataset density: " << std::setprecision(1)
+                  << mf::SparseBatch::GetDensity(images.data(), images.size()) * 100.0
+                  << "% nonzero" << std::endl;
+        PrintCrossover("the first layer", layerDense, layerSparse);
+        PrintCrossover("the forward pass", forwardDense, forwardSparse);
+    }
+
+    if (char const* path { std::getenv("BENCH_REPORT") }; path != nullptr && *path != '\0')
+        WriteReport(path, results, minTime, numSamples);
+
+    return 0;
+}
+catch (mf::Exception const& ex)
+{
+    std::cout << ex.GetGenericInfo();
+    if (auto message { ex.GetMessage() }; message != nullptr)
+        std::cout << ": " << message;
+    std::cout << std::endl;
+    return EXIT_FAILURE;
+}
+catch (std::exception const& ex)
+{
+    std::cout << ex.what() << std::endl;
+    return EXIT_FAILURE;
+}
@@ -0,0 +1,149 @@
+// Copyright (c) 2021 Chanjung Kim. All rights reserved.
+// Licensed under the MIT License.
+
+#include <mf/ClBufferPool.hh>
+
+#include <algorithm>
+#include <stdexcept>
+#include <string>
+
+namespace mf
+{
+
+std::shared_ptr<ClBufferPool> ClBufferPool::MakeFromContext(cl::Context const& context,
+                                                            size_t             capacity)
+{
+    return std::shared_ptr<ClBufferPool> { new ClBufferPool { context, capacity } };
+}
+
+ClBufferPool::ClBufferPool(cl::Context const& context, size_t capacity) :
+    _context { context },
+    _capacity { capacity },
+    _statistics {}
+{
+}
+
+size_t ClBufferPool::GetClassSize(size_t size) noexcept
+{
+    size_t rtn = minClassSize;
+    while (rtn < size) rtn *= 2;
+    return rtn;
+}
+
+ClBufferPoolStatistics ClBufferPool::GetStatistics() const
+{
+    std::lock_guard<std::mutex> lock { _mutex };
+    return _statistics;
+}
+
+cl::Buffer ClBufferPool::Lease(size_t size, cl_mem_flags flags)
+{
+    size_t const classSize { GetClassSize(size) };
+    if (_capacity != 0 && classSize > _capacity)
+        throw BufferPoolExhaustedException { "A buffer of " + std::to_string(classSize)
+                                             + " bytes exceeds the capacity of "
+                                             + std::to_string(_capacity) + " bytes" };
+
+    std::lock_guard<std::mutex> lock { _mutex };
+    _statistics.numLeases += 1;
+
+    auto& free { _free[std::make_pair(flags, classSize)] };
+    CollectPending(false);
+    while (free.empty() && !MakeRoom(classSize))
+    {
+        // Only the buffers on their way back can make room.
+        if (_pending.empty())
+            throw BufferPoolExhaustedException { std::to_string(_statistics.numBytesLeased)
+                                                 + " bytes are leased and none will be returned" };
+        CollectPending(true);
+    }
+
+    cl::Buffer rtn;
+    if (!free.empty())
+    {
+        rtn = free.back();
+        free.pop_back();
+        _statistics.numReused += 1;
+    }
+    else
+    {
+        CL_CHECK_EC(rtn = cl::Buffer(_context, flags, classSize, nullptr, &errorCode));
+        _owned.emplace(rtn(), std::make_pair(flags, classSize));
+        _statistics.numCreated += 1;
+        _statistics.numBytesOwned += classSize;
+    }
+
+    _statistics.numBytesLeased += classSize;
+    _statistics.maxBytesLeased = std::max(_statistics.maxBytesLeased, _statistics.numBytesLeased);
+    return rtn;
+}
+
+void ClBufferPool::Return(cl::Buffer const& buffer)
+{
+    std::lock_guard<std::mutex> lock { _mutex };
+    Free(buffer);
+}
+
+void ClBufferPool::ReturnAfter(cl::Event const& event, cl::Buffer const& buffer)
+{
+    std::lock_guard<std::mutex> lock { _mutex };
+    if (_owned.count(buffer()) == 0)
+        throw std::invalid_argument { "buffer" };
+
+    _pending.push_back(PendingReturn { event, buffer });
+}
+
+void ClBufferPool::CollectPending(bool wait)
+{
+    if (wait && !_pending.empty())
+        CL_CHECK(_pending.front().event.wait());
+
+    // A command terminated by an error reports a negative status, and no longer uses the buffer.
+    size_t numKept = 0;
+    for (size_t i = 0; i < _pending.size(); ++i)
+    {
+        cl_int status = CL_COMPLETE;
+        CL_CHECK(clGetEventInfo(_pending[i].event(),
+                                CL_EVENT_COMMAND_EXECUTION_STATUS,
+                                sizeof(status),
+                                &status,
+                                nullptr));
+        if (status <= CL_COMPLETE)
+            Free(_pending[i].buffer);
+        else if (numKept++ != i)
+            _pending[numKept - 1] = std::move(_pending[i]);
+    }
+    _pending.resize(numKept);
+}
+
+bool ClBufferPool::MakeRoom(size_t size)
+{
+    if (_capacity == 0)
+        return true;
+
+    // The buffers of the largest classes of each kind of flags go first.
+    for (auto it { _free.rbegin() }; it != _free.rend(); ++it)
+    {
+        auto& [key, buffers] = *it;
+        while (_statistics.numBytesOwned + size > _capacity && !buffers.empty())
+        {
+            _owned.erase(buffers.back()());
+            buffers.pop_back();
+            _statistics.numBytesOwned -= key.second;
+            _statistics.numEvicted += 1;
+        }
+    }
+    return _statistics.numBytesOwned + size <= _capacity;
+}
+
+void ClBufferPool::Free(cl::Buffer const& buffer)
+{
+    auto it { _owned.find(buffer()) };
+    if (it == _owned.end())
+        throw std::invalid_argument { "buffer" };
+
+    _free[it->second].push_back(buffer);
+    _statistics.numBytesLeased -= it->second.second;
+}
+
+}
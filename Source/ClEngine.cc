@@ -0,0 +1,498 @@
+// Copyright (c) 2021 Chanjung Kim. All rights reserved.
+// Licensed under the MIT License.
+
+#include <mf/ClEngine.hh>
+#include <mf/PerfCounters.hh>
+#include <mf/Trace.hh>
+
+#include <algorithm>
+#include <array>
+#include <cstdint>
+#include <stdexcept>
+
+namespace mf
+{
+
+namespace
+{
+
+/**
+ * The indices of the arguments of the `dense` kernels.
+ */
+enum DenseArgument : cl_uint
+{
+    InArgument,
+    OutArgument,
+    KernelArgument,
+    BiasArgument,
+    InputSizeArgument,
+    OutputSizeArgument,
+    NumSamplesArgument,
+    ReluArgument,
+};
+
+/**
+ * Returns the (I, O) row-major kernel matrix of the given layer, unpacked from the packed layout.
+ */
+std::vector<float> UnpackKernel(Weight const& layer)
+{
+    constexpr size_t   panelWidth = Weight::panelWidth;
+    size_t const       inputSize  = layer.GetInputSize();
+    size_t const       outputSize = layer.GetOutputSize();
+    auto               packed { layer.GetPackedKernelWeight() };
+    std::vector<float> rtn(inputSize * outputSize);
+    for (size_t o = 0; o < outputSize; ++o)
+    {
+        float const* panel = packed.data() + (o / panelWidth) * inputSize * panelWidth;
+        for (size_t i = 0; i < inputSize; ++i)
+            rtn[i * outputSize + o] = panel[i * panelWidth + o % panelWidth];
+    }
+
+    return rtn;
+}
+
+/**
+ * Creates a read-only buffer of the given values. If `inPlace` is set and the values are aligned
+ * to a page, the buffer wraps them instead of copying them, and they must outlive the buffer.
+ */
+cl::Buffer MakeConstantBuffer(cl::Context const& context,
+                              float const*       values,
+                              size_t             size,
+                              bool               inPlace)
+{
+    inPlace = inPlace && (uintptr_t)values % pageSize == 0;
+
+    cl::Buffer rtn;
+    CL_CHECK_EC(rtn = cl::Buffer(context,
+                                 CL_MEM_READ_ONLY
+                                     | (inPlace ? CL_MEM_USE_HOST_PTR : CL_MEM_COPY_HOST_PTR),
+                                 size * sizeof(float),
+                                 (void*)values,
+                                 &errorCode));
+    return rtn;
+}
+
+/**
+ * Returns the device of the given queue.
+ */
+cl_device_id GetDevice(cl::CommandQueue const& queue)
+{
+    cl_device_id rtn = nullptr;
+    CL_CHECK(clGetCommandQueueInfo(queue(), CL_QUEUE_DEVICE, sizeof(rtn), &rtn, nullptr));
+    return rtn;
+}
+
+/**
+ * Returns the work-group size the given kernel was compiled for with `reqd_work_group_size`, or
+ * zeros if the kernel leaves it to the implementation.
+ */
+std::array<size_t, 2> GetCompiledWorkGroupSize(cl::Kernel const& kernel, cl_device_id device)
+{
+    size_t sizes[3] {};
+    CL_CHECK(clGetKernelWorkGroupInfo(
+        kernel(), device, CL_KERNEL_COMPILE_WORK_GROUP_SIZE, sizeof(sizes), sizes, nullptr));
+    return { sizes[0], sizes[1] };
+}
+
+/**
+ * Returns the smallest multiple of `multiple` not less than `value`, or `value` if `multiple` is
+ * zero.
+ */
+size_t RoundUp(size_t value, size_t multiple)
+{
+    return multiple == 0 ? value : (value + multiple - 1) / multiple * multiple;
+}
+
+/**
+ * Creates a kernel computing the given layer, with every argument but `in`, `out` and
+ * `numSamples` set.
+ */
+cl::Kernel MakeLayerKernel(cl::Program const& program,
+                           char const*        name,
+                           cl::Buffer const&  kernel,
+                           cl::Buffer const&  bias,
+                           size_t             inputSize,
+                           size_t             outputSize,
+                           bool               relu)
+{
+    cl::Kernel rtn;
+    CL_CHECK_EC(rtn = cl::Kernel(program, name, &errorCode));
+    CL_CHECK(rtn.setArg(KernelArgument, kernel));
+    CL_CHECK(rtn.setArg(BiasArgument, bias));
+    CL_CHECK(rtn.setArg(InputSizeArgument, (cl_uint)inputSize));
+    CL_CHECK(rtn.setArg(OutputSizeArgument, (cl_uint)outputSize));
+    CL_CHECK(rtn.setArg(ReluArgument, (cl_uint)relu));
+    return rtn;
+}
+
+}
+
+ClEngine ClEngine::MakeFromPlan(ExecutionPlan const&          plan,
+                                cl::Context const&            context,
+                                cl::CommandQueue const&       queue,
+                                cl::Program const&            program,
+                                size_t                        numSlots,
+                                std::optional<bool>           zeroCopy,
+                                std::shared_ptr<ClBufferPool> pool)
+{
+    if (numSlots < 2)
+        throw std::invalid_argument { "numSlots" };
+
+    if (!pool)
+        pool = ClBufferPool::MakeFromContext(context);
+    return ClEngine { plan, context, queue, program, numSlots, zeroCopy, std::move(pool) };
+}
+
+ClEngine::ClEngine(ExecutionPlan const&          plan,
+                   cl::Context const&            context,
+                   cl::CommandQueue const&       queue,
+                   cl::Program const&            program,
+                   size_t                        numSlots,
+                   std::optional<bool>           zeroCopy,
+                   std::shared_ptr<ClBufferPool> pool) :
+    _context { context },
+    _queue { queue },
+    _batchSize { plan.GetBatchSize() },
+    _slots(numSlots),
+    _workGroupSize {},
+    _zeroCopy { false },
+    _baseAddressAlignment { 1 },
+    _profiler { nullptr },
+    _pool { std::move(pool) },
+    _activationSize { 0 }
+{
+    MF_TRACE_SPAN("ClEngine::MakeFromPlan");
+
+    cl_device_id const device { GetDevice(queue) };
+
+    // Devices sharing the memory of the host read host buffers in place; others would read them
+    // over the bus on every access, so they get copies in their own memory.
+    cl_bool hostUnifiedMemory = CL_FALSE;
+    cl_uint baseAddressAlignmentBits = 8;
+    CL_CHECK(clGetDeviceInfo(device,
+                             CL_DEVICE_HOST_UNIFIED_MEMORY,
+                             sizeof(hostUnifiedMemory),
+                             &hostUnifiedMemory,
+                             nullptr));
+    CL_CHECK(clGetDeviceInfo(device,
+                             CL_DEVICE_MEM_BASE_ADDR_ALIGN,
+                             sizeof(baseAddressAlignmentBits),
+                             &baseAddressAlignmentBits,
+                             nullptr));
+    _zeroCopy             = zeroCopy.value_or(hostUnifiedMemory == CL_TRUE);
+    _baseAddressAlignment = std::max<size_t>(baseAddressAlignmentBits / 8, 1);
+
+    for (auto& step : plan.GetSteps())
+    {
+        auto const&  layer { *step.layer };
+        size_t const inputSize  = layer.GetInputSize();
+        size_t const outputSize = layer.GetOutputSize();
+
+        cl::Buffer kernel, bias;
+        if (layer.HasRawKernel())
+        {
+            kernel = MakeConstantBuffer(
+                context, layer.GetKernelWeight().data(), inputSize * outputSize, _zeroCopy);
+            bias = MakeConstantBuffer(
+                context, layer.GetBiasWeight().data(), outputSize, _zeroCopy);
+        }
+        else
+        {
+            auto const unpacked { UnpackKernel(layer) };
+            kernel = MakeConstantBuffer(context, unpacked.data(), unpacked.size(), false);
+            bias   = MakeConstantBuffer(
+                context, layer.GetPackedBiasWeight().data(), outputSize, false);
+        }
+
+        _layers.push_back(Layer {
+            step.name,
+            std::move(kernel),
+            std::move(bias),
+            inputSize,
+            outputSize,
+            step.activation == Activation::Relu,
+        });
+        _activationSize = std::max(_activationSize, outputSize);
+    }
+
+    // The buffers of the batches are leased in `Submit`, which sets the `in` and `out` arguments.
+    for (auto& slot : _slots)
+    {
+        for (auto& layer : _layers)
+        {
+            slot.kernels.push_back(MakeLayerKernel(program,
+                                                   "dense",
+                                                   layer.kernel,
+                                                   layer.bias,
+                                                   layer.inputSize,
+                                                   layer.outputSize,
+                                                   layer.relu));
+        }
+
+        auto& first { _layers.front() };
+        slot.firstByteKernel = MakeLayerKernel(program,
+                                               "dense_u8",
+                                               first.kernel,
+                                               first.bias,
+                                               first.inputSize,
+                                               first.outputSize,
+                                               first.relu);
+
+        slot.output.resize(_batchSize * GetOutputSize());
+        slot.begin      = 0;
+        slot.numSamples = 0;
+        slot.inputBytes = 0;
+    }
+
+    // Every kernel is built from the same source, with the same work-group size.
+    _workGroupSize = GetCompiledWorkGroupSize(_slots.front().kernels.front(), device);
+}
+
+template <typename In>
+void ClEngine::Submit(
+    Slot& slot, In const* in, cl::Buffer& hostInput, size_t begin, size_t numSamples)
+{
+    MF_TRACE_SPAN("ClEngine::Submit", "samples", numSamples);
+
+    slot.begin      = begin;
+    slot.numSamples = numSamples;
+    slot.inputBytes = numSamples * GetInputSize() * sizeof(In);
+    slot.view       = cl::Buffer {};
+    slot.events.clear();
+
+    // Layer l reads `activations[(l - 1) % 2]` and writes `activations[l % 2]`.
+    for (auto& activation : slot.activations)
+        activation = _pool->Lease(_batchSize * _activationSize * sizeof(float), CL_MEM_READ_WRITE);
+
+    // The first kernel reads either the batch in place from the caller's buffer, or a copy.
+    std::vector<cl::Event> previous;
+    if (hostInput())
+    {
+        cl_buffer_region const region { begin * GetInputSize() * sizeof(In), slot.inputBytes };
+        CL_CHECK_EC(slot.view = hostInput.createSubBuffer(
+                        CL_MEM_READ_ONLY, CL_BUFFER_CREATE_TYPE_REGION, &region, &errorCode));
+    }
+    else
+    {
+        slot.input = _pool->Lease(_batchSize * GetInputSize() * sizeof(float), CL_MEM_READ_ONLY);
+
+        cl::Event uploaded;
+        CL_CHECK(_queue.enqueueWriteBuffer(
+            slot.input, CL_FALSE, 0, slot.inputBytes, in, nullptr, &uploaded));
+        if (_profiler)
+            slot.events.push_back(uploaded);
+        previous.push_back(uploaded);
+    }
+
+    auto& first { sizeof(In) == 1 ? slot.firstByteKernel : slot.kernels.front() };
+    CL_CHECK(first.setArg(InArgument, hostInput() ? slot.view : slot.input));
+
+    for (size_t l = 0; l < _layers.size(); ++l)
+    {
+        auto& kernel { l == 0 && sizeof(In) == 1 ? slot.firstByteKernel : slot.kernels[l] };
+        if (l != 0)
+            CL_CHECK(kernel.setArg(InArgument, slot.activations[(l - 1) % 2]));
+        CL_CHECK(kernel.setArg(OutArgument, slot.activations[l % 2]));
+        CL_CHECK(kernel.setArg(NumSamplesArgument, (cl_uint)numSamples));
+
+        // The kernels ignore the work-items past the edges of the output.
+        cl::NDRange const global { RoundUp(_layers[l].outputSize, _workGroupSize[0]),
+                                   RoundUp(numSamples, _workGroupSize[1]) };
+        cl::NDRange const local { _workGroupSize[0] == 0
+                                      ? cl::NullRange
+                                      : cl::NDRange { _workGroupSize[0], _workGroupSize[1] } };
+
+        cl::Event computed;
+        CL_CHECK(_queue.enqueueNDRangeKernel(kernel,
+                                             cl::NullRange,
+                                             global,
+                                             local,
+                                             previous.empty() ? nullptr : &previous,
+                                             &computed));
+        if (_profiler)
+            slot.events.push_back(computed);
+        previous = { computed };
+    }
+
+    CL_CHECK(_queue.enqueueReadBuffer(slot.activations[(_layers.size() - 1) % 2],
+                                      CL_FALSE,
+                                      0,
+                                      numSamples * GetOutputSize() * sizeof(float),
+                                      slot.output.data(),
+                                      &previous,
+                                      &slot.done));
+
+    // The buffers go back to the pool as soon as the batch is done, even before it is retired.
+    if (slot.input())
+        _pool->ReturnAfter(slot.done, slot.input);
+    for (auto const& activation : slot.activations) _pool->ReturnAfter(slot.done, activation);
+    slot.input          = cl::Buffer {};
+    slot.activations[0] = cl::Buffer {};
+    slot.activations[1] = cl::Buffer {};
+
+    // Without a flush, the commands may sit on the host until the next blocking call.
+    CL_CHECK(_queue.flush());
+}
+
+void ClEngine::ReturnBuffers(Slot& slot)
+{
+    for (auto* buffer : { &slot.input, &slot.activations[0], &slot.activations[1] })
+    {
+        if ((*buffer)())
+            _pool->Return(*buffer);
+        *buffer = cl::Buffer {};
+    }
+}
+
+void ClEngine::Retire(Slot& slot, MnistLabel* labels, BatchCallback const& onBatch)
+{
+    if (slot.numSamples == 0)
+        return;
+
+    MF_TRACE_SPAN("ClEngine::Retire", "samples", slot.numSamples);
+    CL_CHECK(slot.done.wait());
+
+    // The commands of a batch are chained, so every one of them has completed.
+    if (_profiler && !slot.events.empty())
+    {
+        // A batch read in place has no upload.
+        auto event { slot.events.begin() };
+        if (!slot.view())
+            _profiler->Record(*event++, "write", ClCommandKind::Write, slot.inputBytes);
+        for (auto const& layer : _layers)
+            _profiler->Record(*event++, layer.name, ClCommandKind::Kernel);
+        _profiler->Record(slot.done,
+                          "read",
+                          ClCommandKind::Read,
+                          slot.numSamples * GetOutputSize() * sizeof(float));
+    }
+
+    size_t const outputSize = GetOutputSize();
+    PerfScope    perf { "argmax", slot.numSamples };
+    for (size_t i = 0; i < slot.numSamples; ++i)
+    {
+        float const* scores = slot.output.data() + i * outputSize;
+        labels[slot.begin + i]
+            = (MnistLabel)std::distance(scores, std::max_element(scores, scores + outputSize));
+    }
+
+    if (onBatch)
+        onBatch(slot.begin, slot.numSamples);
+    slot.numSamples = 0;
+    slot.view       = cl::Buffer {};
+}
+
+template <typename In>
+void ClEngine::ClassifyWith(In const*            in,
+                            size_t               numSamples,
+                            MnistLabel*          labels,
+                            BatchSource const&   source,
+                            BatchCallback const& onBatch)
+{
+    size_t const inputSize = GetInputSize();
+    size_t       next      = 0;
+    try
+    {
+        // The input is wrapped in place if the device reads host memory and every batch starts at
+        // an address the device can address a sub-buffer at.
+        cl::Buffer hostInput;
+        if (_zeroCopy && numSamples != 0 && (uintptr_t)in % pageSize == 0
+            && _batchSize * inputSize * sizeof(In) % _baseAddressAlignment == 0)
+        {
+            CL_CHECK_EC(hostInput = cl::Buffer(_context,
+                                               CL_MEM_READ_ONLY | CL_MEM_USE_HOST_PTR,
+                                               numSamples * inputSize * sizeof(In),
+                                               (void*)in,
+                                               &errorCode));
+        }
+
+        // A batch is only taken once a slot is free, so a slower device takes fewer of them.
+        for (;;)
+        {
+            auto& slot { _slots[next] };
+            Retire(slot, labels, onBatch);
+
+            size_t begin = 0, count = 0;
+            if (!source(begin, count))
+                break;
+
+            Submit(slot, in + begin * inputSize, hostInput, begin, count);
+            next = (next + 1) % _slots.size();
+        }
+
+        // The oldest batch is in the slot to be used next.
+        for (size_t i = 0; i < _slots.size(); ++i)
+            Retire(_slots[(next + i) % _slots.size()], labels, onBatch);
+    }
+    catch (...)
+    {
+        // The device must not be left reading the input or writing the slots after returning.
+        _queue.finish();
+        for (auto& slot : _slots)
+        {
+            ReturnBuffers(slot);
+            slot.numSamples = 0;
+            slot.view       = cl::Buffer {};
+        }
+        throw;
+    }
+}
+
+template <typename In>
+void ClEngine::ClassifyWith(In const*            in,
+                            size_t               numSamples,
+                            MnistLabel*          labels,
+                            BatchCallback const& onBatch)
+{
+    size_t nextBegin = 0;
+    ClassifyWith(
+        in,
+        numSamples,
+        labels,
+        [&](size_t& begin, size_t& count) {
+            if (nextBegin >= numSamples)
+                return false;
+
+            begin = nextBegin;
+            count = std::min(_batchSize, numSamples - begin);
+            nextBegin += count;
+            return true;
+        },
+        onBatch);
+}
+
+void ClEngine::Classify(float const*         in,
+                        size_t               numSamples,
+                        MnistLabel*          labels,
+                        BatchCallback const& onBatch)
+{
+    ClassifyWith(in, numSamples, labels, onBatch);
+}
+
+void ClEngine::Classify(uint8_t const*       in,
+                        size_t               numSamples,
+                        MnistLabel*          labels,
+                        BatchCallback const& onBatch)
+{
+    ClassifyWith(in, numSamples, labels, onBatch);
+}
+
+void ClEngine::ClassifyFrom(float const*         in,
+                            size_t               numSamples,
+                            MnistLabel*          labels,
+                            BatchSource const&   source,
+                            BatchCallback const& onBatch)
+{
+    ClassifyWith(in, numSamples, labels, source, onBatch);
+}
+
+void ClEngine::ClassifyFrom(uint8_t const*       in,
+                            size_t               numSamples,
+                            MnistLabel*          labels,
+                            BatchSource const&   source,
+                            BatchCallback const& onBatch)
+{
+    ClassifyWith(in, numSamples, labels, source, onBatch);
+}
+
+}
@@ -3,6 +3,17 @@
 
 #include <mf/ClFactory.hh>
 #include <mf/File.hh>
+#include <mf/Trace.hh>
+
+#include "ClKernels.hh"
+
+#include <algorithm>
+#include <cinttypes>
+#include <cstdio>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <vector>
 
 namespace mf
 {
@@ -29,62 +40,300 @@ cl::Platform MakePlatform(Config const& config)
     throw PlatformNotFoundException { config.vendorName };
 }
 
-cl::Device MakeDevice(Config const& config, cl::Platform platform)
+std::vector<cl::Device> FindDevices(Config const& config, cl::Platform platform)
 {
     std::vector<cl::Device> devices;
     CL_CHECK(platform.getDevices(CL_DEVICE_TYPE_ALL, &devices));
 
+    std::vector<cl::Device> rtn;
     for (auto device : devices)
     {
         std::string deviceName;
         CL_CHECK(device.getInfo<std::string>(CL_DEVICE_NAME, &deviceName));
 
         if (strcmp(deviceName.c_str(), config.deviceName.c_str()) == 0)
-            return device;
+            rtn.push_back(device);
     }
-    throw DeviceNotFoundException { config.deviceName };
+    if (rtn.empty())
+        throw DeviceNotFoundException { config.deviceName };
+    return rtn;
+}
+
+/**
+ * Splits the given device into `numSubDevices` sub-devices with the same number of compute units
+ * each (`CL_DEVICE_PARTITION_EQUALLY`). The compute units left over are not used.
+ */
+std::vector<cl::Device> MakeSubDevices(cl::Device const& device, size_t numSubDevices)
+{
+    cl_uint numComputeUnits = 0;
+    CL_CHECK(device.getInfo<cl_uint>(CL_DEVICE_MAX_COMPUTE_UNITS, &numComputeUnits));
+    if (numSubDevices > numComputeUnits)
+        throw InvalidConfigException { "CL_SUB_DEVICES exceeds the number of compute units of the "
+                                       "device ("
+                                       + std::to_string(numComputeUnits) + ")" };
+
+    cl_device_partition_property const properties[] {
+        CL_DEVICE_PARTITION_EQUALLY,
+        (cl_device_partition_property)(numComputeUnits / numSubDevices),
+        0,
+    };
+    std::vector<cl_device_id> subDevices(numSubDevices);
+    cl_uint                   numCreated = 0;
+    CL_CHECK(clCreateSubDevices(
+        device(), properties, (cl_uint)subDevices.size(), subDevices.data(), &numCreated));
+
+    // The sub-devices are released by their wrappers.
+    std::vector<cl::Device> rtn;
+    for (size_t i = 0; i < std::min<size_t>(numCreated, numSubDevices); ++i)
+        rtn.push_back(cl::Device { subDevices[i] });
+    return rtn;
+}
+
+/**
+ * Returns the given string up to the first null character; strings returned by
+ * `cl::Device::getInfo` may include the terminating null character.
+ */
+std::string GetDeviceString(cl::Device const& device, cl_device_info info)
+{
+    std::string rtn;
+    CL_CHECK(device.getInfo<std::string>(info, &rtn));
+    return std::string { rtn.c_str() };
+}
+
+/**
+ * Returns the options defining the tile sizes of the OpenCL C kernels, after checking that the
+ * device can run work-groups of that size.
+ */
+std::string MakeBuildOptions(Config const& config, cl::Device const& device)
+{
+    cl_ulong maxWorkGroupSize = 0;
+    cl_ulong localMemSize     = 0;
+    CL_CHECK(device.getInfo<cl_ulong>(CL_DEVICE_MAX_WORK_GROUP_SIZE, &maxWorkGroupSize));
+    CL_CHECK(device.getInfo<cl_ulong>(CL_DEVICE_LOCAL_MEM_SIZE, &localMemSize));
+
+    size_t const workGroupSize = config.clTileOutputs * config.clTileSamples;
+    size_t const localSize
+        = (config.clTileSamples + config.clTileOutputs) * config.clTileInputs * sizeof(float);
+    if (workGroupSize > maxWorkGroupSize)
+        throw InvalidConfigException { "CL_TILE_OUTPUTS * CL_TILE_SAMPLES exceeds the maximum "
+                                       "work-group size of the device ("
+                                       + std::to_string(maxWorkGroupSize) + ")" };
+    if (localSize > localMemSize)
+        throw InvalidConfigException { "The tiles need " + std::to_string(localSize)
+                                       + " bytes of local memory, more than the device has ("
+                                       + std::to_string(localMemSize) + ")" };
+
+    return "-cl-mad-enable -D TILE_OUTPUTS=" + std::to_string(config.clTileOutputs)
+           + " -D TILE_SAMPLES=" + std::to_string(config.clTileSamples)
+           + " -D TILE_INPUTS=" + std::to_string(config.clTileInputs);
+}
+
+/**
+ * Builds the given program, throwing the build log if it failed.
+ */
+void BuildProgram(cl_program program, cl_device_id device, char const* options = nullptr)
+{
+    cl_int const errorCode { clBuildProgram(program, 1, &device, options, nullptr, nullptr) };
+    if (errorCode == CL_SUCCESS)
+        return;
+    if (errorCode != CL_BUILD_PROGRAM_FAILURE)
+        throw ClException { errorCode, "clBuildProgram" };
+
+    size_t logSize = 0;
+    CL_CHECK(clGetProgramBuildInfo(program, device, CL_PROGRAM_BUILD_LOG, 0, nullptr, &logSize));
+    std::string log(logSize, '\0');
+    CL_CHECK(clGetProgramBuildInfo(
+        program, device, CL_PROGRAM_BUILD_LOG, logSize, log.data(), nullptr));
+    throw ProgramBuildException { log.c_str() };
+}
+
+/**
+ * Returns the path of the cached binary of the OpenCL C kernels built with the given options.
+ * The name is the 64-bit FNV-1a hash of the name and the driver version of the device, the
+ * options and the source, so a new driver or a change of the kernels misses the cache instead of
+ * loading a stale binary.
+ */
+std::filesystem::path GetCachePath(std::filesystem::path const& directory,
+                                   cl::Device const&            device,
+                                   std::string const&           options)
+{
+    uint64_t hash { 0xcbf29ce484222325 };
+    auto     update = [&hash](std::string const& value) {
+        // Includes the terminating null character, so that the fields cannot run into each other.
+        for (char c : std::string_view { value.c_str(), value.size() + 1 })
+            hash = (hash ^ (uint8_t)c) * 0x100000001b3;
+    };
+    update(GetDeviceString(device, CL_DEVICE_NAME));
+    update(GetDeviceString(device, CL_DRIVER_VERSION));
+    update(options);
+    update(clKernelSource);
+
+    char name[32];
+    snprintf(name, sizeof(name), "%016" PRIx64 ".clbin", hash);
+    return directory / name;
+}
+
+/**
+ * Creates a program from the binary in the given file and builds it. Returns `std::nullopt`
+ * instead of throwing if the file does not exist or the device rejects it, in which case the
+ * caller builds the source again.
+ */
+std::optional<cl::Program> LoadCachedProgram(std::filesystem::path const& path,
+                                             cl::Context const&           context,
+                                             cl::Device const&            device,
+                                             std::string const&           options)
+{
+    std::error_code errorCode;
+    if (!std::filesystem::is_regular_file(path, errorCode))
+        return std::nullopt;
+
+    // Another process may replace or evict the file after the check.
+    std::optional<MappedFile> file;
+    try
+    {
+        file.emplace(MappedFile::Open(path));
+    }
+    catch (NoSuchFileException const&)
+    {
+        return std::nullopt;
+    }
+
+    size_t         size         = file->GetSize();
+    uint8_t const* data         = file->GetData();
+    cl_device_id   deviceId     = device();
+    cl_int         binaryStatus = CL_SUCCESS;
+    cl_int         createStatus = CL_SUCCESS;
+    cl_program     program      = clCreateProgramWithBinary(
+        context(), 1, &deviceId, &size, &data, &binaryStatus, &createStatus);
+    if (createStatus != CL_SUCCESS || binaryStatus != CL_SUCCESS)
+        return std::nullopt;
+
+    cl::Program rtn { program };
+    if (clBuildProgram(program, 1, &deviceId, options.c_str(), nullptr, nullptr) != CL_SUCCESS)
+        return std::nullopt;
+
+    return rtn;
+}
+
+/**
+ * Writes the binary of the given program to the given file. The cache is an optimization, so
+ * failures are ignored; the file is written under a temporary name and renamed, so concurrent
+ * processes never load a partial binary.
+ */
+void StoreCachedProgram(std::filesystem::path const& path, cl::Program const& program)
+{
+    size_t size = 0;
+    if (clGetProgramInfo(program(), CL_PROGRAM_BINARY_SIZES, sizeof(size), &size, nullptr)
+            != CL_SUCCESS
+        || size == 0)
+        return;
+
+    std::vector<uint8_t> binary(size);
+    uint8_t*             data = binary.data();
+    if (clGetProgramInfo(program(), CL_PROGRAM_BINARIES, sizeof(data), &data, nullptr)
+        != CL_SUCCESS)
+        return;
+
+    File::WriteFileAtomically(
+        path, [&](std::ostream& os) { os.write((char const*)binary.data(), binary.size()); });
+}
+
+cl::Program MakeProgramFromSource(Config const&      config,
+                                  cl::Context const& context,
+                                  cl::Device const&  device)
+{
+    auto const options { MakeBuildOptions(config, device) };
+    auto const cachePath { config.clCacheDirectory.empty()
+                               ? std::filesystem::path {}
+                               : GetCachePath(config.clCacheDirectory, device, options) };
+    if (!cachePath.empty())
+    {
+        if (auto cached { LoadCachedProgram(cachePath, context, device, options) })
+            return *cached;
+    }
+
+    char const* source  = clKernelSource;
+    cl_program  program = nullptr;
+    CL_CHECK_EC(program = clCreateProgramWithSource(context(), 1, &source, nullptr, &errorCode));
+
+    cl::Program rtn { program };
+    BuildProgram(program, device(), options.c_str());
+    if (!cachePath.empty())
+        StoreCachedProgram(cachePath, rtn);
+    return rtn;
 }
 
 }
 
 std::pair<cl::Platform, cl::Device> ClFactory::MakePlatformAndDevice(Config const& config)
 {
+    MF_TRACE_SPAN("ClFactory::MakePlatformAndDevice");
+
     auto platform { MakePlatform(config) };
-    auto device { MakeDevice(config, platform) };
-    return std::make_pair(platform, device);
+    auto devices { FindDevices(config, platform) };
+    return std::make_pair(platform, devices.front());
+}
+
+std::vector<cl::Device> ClFactory::MakeDevices(Config const& config)
+{
+    MF_TRACE_SPAN("ClFactory::MakeDevices");
+
+    auto devices { FindDevices(config, MakePlatform(config)) };
+    if (!config.clAllDevices)
+        devices.resize(1);
+    if (config.clNumSubDevices < 2)
+        return devices;
+
+    std::vector<cl::Device> rtn;
+    for (auto const& device : devices)
+    {
+        auto subDevices { MakeSubDevices(device, config.clNumSubDevices) };
+        rtn.insert(rtn.end(), subDevices.begin(), subDevices.end());
+    }
+    return rtn;
 }
 
 std::pair<cl::Context, cl::CommandQueue> ClFactory::MakeContextAndQueue(cl::Device device)
 {
+    MF_TRACE_SPAN("ClFactory::MakeContextAndQueue");
+
     cl_device_id deviceId = device();
     cl_context   context  = nullptr;
     CL_CHECK_EC(context = clCreateContext(nullptr, 1, &deviceId, nullptr, nullptr, &errorCode));
 
+    cl::Context rtnContext { context };
+
     cl_command_queue queue = nullptr;
 #pragma GCC diagnostic ignored "-Wdeprecated-declarations"
-    CL_CHECK_EC(
-        clCreateCommandQueue(context,
-                             deviceId,
-                             CL_QUEUE_PROFILING_ENABLE | CL_QUEUE_OUT_OF_ORDER_EXEC_MODE_ENABLE,
-                             &errorCode));
+    CL_CHECK_EC(queue = clCreateCommandQueue(
+                    context,
+                    deviceId,
+                    CL_QUEUE_PROFILING_ENABLE | CL_QUEUE_OUT_OF_ORDER_EXEC_MODE_ENABLE,
+                    &errorCode));
 #pragma GCC diagnostic warning "-Wdeprecated-declarations"
 
-    return std::make_pair(context, queue);
+    return std::make_pair(rtnContext, cl::CommandQueue { queue });
 }
 
 cl::Program ClFactory::MakeProgram(Config const& config, cl::Context context, cl::Device device)
 {
-    auto file { File::ReadFile(config.xclbinPath) };
+    MF_TRACE_SPAN("ClFactory::MakeProgram");
 
-    size_t         numBytesProgram = file.size();
-    uint8_t const* data            = file.data();
+    if (config.xclbinPath.empty())
+        return MakeProgramFromSource(config, context, device);
+
+    // The binary is only read once by `clCreateProgramWithBinary`, so it is not copied to memory.
+    auto file { MappedFile::Open(config.xclbinPath) };
+
+    size_t         numBytesProgram = file.GetSize();
+    uint8_t const* data            = file.GetData();
     cl_int         binaryStatus    = CL_SUCCESS;
     cl_program     program         = nullptr;
     CL_CHECK_EC(program = clCreateProgramWithBinary(
                     context(), 1, &device(), &numBytesProgram, &data, &binaryStatus, &errorCode));
-    CL_CHECK(clBuildProgram(program, 1, &device(), nullptr, nullptr, nullptr));
-
-    return program;
+    cl::Program rtn { program };
+    BuildProgram(program, device());
+    return rtn;
 }
 
 }
\ No newline at end of file
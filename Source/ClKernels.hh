@@ -0,0 +1,102 @@
+// Copyright (c) 2021 Chanjung Kim. All rights reserved.
+// Licensed under the MIT License.
+
+#ifndef MNIST_FPGA_CL_KERNELS_HH
+#define MNIST_FPGA_CL_KERNELS_HH
+
+namespace mf
+{
+
+/**
+ * The OpenCL C source of the kernels run by `ClEngine`, built when no xclbin file is configured. A
+ * xclbin file must contain kernels with the same names and arguments.
+ *
+ * `dense` computes one FC layer on a batch: `out[s][o] = act(bias[o] + sum_i in[s][i] *
+ * weights[i][o])`, where `weights` is the (`inputSize`, `outputSize`) row-major matrix as stored by
+ * Keras and `act` is ReLU if `relu` is not zero. `dense_u8` is the same but reads the input as
+ * 8-bit integers.
+ *
+ * Work-item (o, s) computes one output, and a work-group computes a (`TILE_SAMPLES`,
+ * `TILE_OUTPUTS`) tile of the output. The work-group walks the inputs `TILE_INPUTS` at a time,
+ * staging the matching tiles of the input and the weights in local memory, so each element
+ * read from global memory is reused by `TILE_OUTPUTS` or `TILE_SAMPLES` work-items instead of
+ * being read by each of them. The tile sizes are build options (`-D TILE_OUTPUTS=...`) and the
+ * work-group size is fixed to (`TILE_OUTPUTS`, `TILE_SAMPLES`), which `ClEngine` queries; the
+ * global size is rounded up to whole work-groups.
+ */
+constexpr char clKernelSource[] = R"CL(
+#ifndef TILE_OUTPUTS
+#define TILE_OUTPUTS 16
+#endif
+
+#ifndef TILE_SAMPLES
+#define TILE_SAMPLES 16
+#endif
+
+#ifndef TILE_INPUTS
+#define TILE_INPUTS 32
+#endif
+
+#define DENSE_KERNEL(Name, In)                                                                     \
+    __kernel __attribute__((reqd_work_group_size(TILE_OUTPUTS, TILE_SAMPLES, 1)))                  \
+    void Name(__global In const* restrict    in,                                                   \
+              __global float* restrict       out,                                                  \
+              __global float const* restrict weights,                                              \
+              __global float const* restrict bias,                                                 \
+              uint                           inputSize,                                            \
+              uint                           outputSize,                                           \
+              uint                           numSamples,                                           \
+              uint                           relu)                                                 \
+    {                                                                                              \
+        __local float inTile[TILE_SAMPLES][TILE_INPUTS];                                           \
+        __local float weightTile[TILE_INPUTS][TILE_OUTPUTS];                                       \
+                                                                                                   \
+        uint const o            = get_global_id(0);                                                \
+        uint const s            = get_global_id(1);                                                \
+        uint const localO       = get_local_id(0);                                                 \
+        uint const localS       = get_local_id(1);                                                 \
+        uint const firstO       = get_group_id(0) * TILE_OUTPUTS;                                  \
+        uint const firstS       = get_group_id(1) * TILE_SAMPLES;                                  \
+        uint const localId      = localS * TILE_OUTPUTS + localO;                                  \
+        uint const numWorkItems = TILE_OUTPUTS * TILE_SAMPLES;                                     \
+                                                                                                   \
+        float acc = o < outputSize ? bias[o] : 0.0f;                                               \
+        for (uint firstI = 0; firstI < inputSize; firstI += TILE_INPUTS)                           \
+        {                                                                                          \
+            /* Consecutive work-items load consecutive addresses; out of range is zero. */         \
+            for (uint t = localId; t < TILE_SAMPLES * TILE_INPUTS; t += numWorkItems)              \
+            {                                                                                      \
+                uint const ts = t / TILE_INPUTS;                                                   \
+                uint const ti = t % TILE_INPUTS;                                                   \
+                inTile[ts][ti] = firstS + ts < numSamples && firstI + ti < inputSize               \
+                                     ? (float)in[(size_t)(firstS + ts) * inputSize + firstI + ti]  \
+                                     : 0.0f;                                                       \
+            }                                                                                      \
+            for (uint t = localId; t < TILE_INPUTS * TILE_OUTPUTS; t += numWorkItems)              \
+            {                                                                                      \
+                uint const ti = t / TILE_OUTPUTS;                                                  \
+                uint const to = t % TILE_OUTPUTS;                                                  \
+                weightTile[ti][to]                                                                 \
+                    = firstI + ti < inputSize && firstO + to < outputSize                          \
+                          ? weights[(size_t)(firstI + ti) * outputSize + firstO + to]              \
+                          : 0.0f;                                                                  \
+            }                                                                                      \
+            barrier(CLK_LOCAL_MEM_FENCE);                                                          \
+                                                                                                   \
+            for (uint i = 0; i < TILE_INPUTS; ++i)                                                 \
+                acc = mad(inTile[localS][i], weightTile[i][localO], acc);                          \
+            barrier(CLK_LOCAL_MEM_FENCE);                                                          \
+        }                                                                                          \
+                                                                                                   \
+        /* Work-items past the edges still take part in loading the tiles above. */                \
+        if (o < outputSize && s < numSamples)                                                      \
+            out[(size_t)s * outputSize + o] = relu ? fmax(acc, 0.0f) : acc;                        \
+    }
+
+DENSE_KERNEL(dense, float)
+DENSE_KERNEL(dense_u8, uchar)
+)CL";
+
+}
+
+#endif
@@ -0,0 +1,204 @@
+// Copyright (c) 2021 Chanjung Kim. All rights reserved.
+// Licensed under the MIT License.
+
+#include <mf/ClProfiler.hh>
+
+#include "Json.hh"
+
+#include <algorithm>
+#include <iomanip>
+
+namespace mf
+{
+
+namespace
+{
+
+char const* GetKindName(ClCommandKind kind)
+{
+    switch (kind)
+    {
+    case ClCommandKind::Write: return "write";
+    case ClCommandKind::Kernel: return "kernel";
+    case ClCommandKind::Read: return "read";
+    }
+    return "unknown";
+}
+
+/**
+ * Returns the given duration in microseconds.
+ */
+double ToMicroseconds(uint64_t duration)
+{
+    return duration / 1e3;
+}
+
+/**
+ * Merges [`start`, `end`) into the given disjoint intervals and returns the length it adds to
+ * their union.
+ */
+uint64_t AddInterval(std::map<uint64_t, uint64_t>& intervals, uint64_t start, uint64_t end)
+{
+    if (start == end)
+        return 0;
+
+    auto it { intervals.upper_bound(start) };
+    if (it != intervals.begin() && std::prev(it)->second >= start)
+        --it;
+
+    uint64_t covered = 0;
+    while (it != intervals.end() && it->first <= end)
+    {
+        covered += it->second - it->first;
+        start = std::min(start, it->first);
+        end   = std::max(end, it->second);
+        it    = intervals.erase(it);
+    }
+    intervals.emplace(start, end);
+    return end - start - covered;
+}
+
+}
+
+double ClCommandStatistics::GetBandwidth() const noexcept
+{
+    return executionTime == 0 ? 0.0 : numBytes * 1e9 / executionTime;
+}
+
+void ClProfiler::Record(cl::Event const& event,
+                        std::string_view name,
+                        ClCommandKind    kind,
+                        uint64_t         numBytes)
+{
+    cl_ulong queued = 0, submit = 0, start = 0, end = 0;
+    CL_CHECK(event.getProfilingInfo(CL_PROFILING_COMMAND_QUEUED, &queued));
+    CL_CHECK(event.getProfilingInfo(CL_PROFILING_COMMAND_SUBMIT, &submit));
+    CL_CHECK(event.getProfilingInfo(CL_PROFILING_COMMAND_START, &start));
+    CL_CHECK(event.getProfilingInfo(CL_PROFILING_COMMAND_END, &end));
+
+    // Some implementations report timestamps out of order for commands that ran immediately.
+    submit = std::max(submit, queued);
+    start  = std::max(start, submit);
+    end    = std::max(end, start);
+
+    std::lock_guard<std::mutex> lock { _mutex };
+
+    auto it { std::find_if(_statistics.begin(), _statistics.end(), [&](auto const& statistics) {
+        return statistics.name == name && statistics.kind == kind;
+    }) };
+    if (it == _statistics.end())
+    {
+        ClCommandStatistics statistics;
+        statistics.name = name;
+        statistics.kind = kind;
+        _statistics.push_back(std::move(statistics));
+        it = std::prev(_statistics.end());
+    }
+
+    uint64_t const executionTime = end - start;
+    it->count += 1;
+    it->numBytes += numBytes;
+    it->queuedTime += submit - queued;
+    it->waitTime += start - submit;
+    it->executionTime += executionTime;
+    it->minExecutionTime = std::min(it->minExecutionTime, executionTime);
+    it->maxExecutionTime = std::max(it->maxExecutionTime, executionTime);
+    it->histogram.Add(executionTime);
+
+    _firstStart = std::min<uint64_t>(_firstStart, start);
+    _lastEnd    = std::max<uint64_t>(_lastEnd, end);
+    if (kind == ClCommandKind::Kernel)
+        _kernelBusyTime += AddInterval(_kernelIntervals, start, end);
+    else
+        _transferBusyTime += AddInterval(_transferIntervals, start, end);
+}
+
+std::vector<ClCommandStatistics> ClProfiler::GetStatistics() const
+{
+    std::lock_guard<std::mutex> lock { _mutex };
+    return _statistics;
+}
+
+void ClProfiler::PrintSummary(std::ostream& os) const
+{
+    std::lock_guard<std::mutex> lock { _mutex };
+
+    auto flags { os.flags() };
+    auto precision { os.precision() };
+    os << std::fixed << std::setprecision(1);
+
+    os << "OpenCL profile (us)" << std::endl;
+    os << std::left << std::setw(16) << "command" << std::right << std::setw(8) << "count";
+    for (auto column : { "mean", "min", "p50", "p99", "max", "queued", "wait", "GB/s" })
+        os << std::setw(12) << column;
+    os << std::endl;
+
+    for (auto const& s : _statistics)
+    {
+        os << std::left << std::setw(16) << s.name << std::right << std::setw(8) << s.count;
+        for (double value : { ToMicroseconds(s.executionTime) / s.count,
+                              ToMicroseconds(s.minExecutionTime),
+                              ToMicroseconds(s.histogram.GetQuantile(0.5)),
+                              ToMicroseconds(s.histogram.GetQuantile(0.99)),
+                              ToMicroseconds(s.maxExecutionTime),
+                              ToMicroseconds(s.queuedTime) / s.count,
+                              ToMicroseconds(s.waitTime) / s.count })
+            os << std::setw(12) << value;
+        os << std::setw(12);
+        if (s.kind == ClCommandKind::Kernel)
+            os << "-";
+        else
+            os << s.GetBandwidth() / 1e9;
+        os << std::endl;
+    }
+
+    uint64_t const span = _lastEnd > _firstStart ? _lastEnd - _firstStart : 0;
+    if (span != 0)
+    {
+        os << "transfers busy " << ToMicroseconds(_transferBusyTime) / 1e3 << " ms ("
+           << _transferBusyTime * 100.0 / span << "%), kernels busy "
+           << ToMicroseconds(_kernelBusyTime) / 1e3 << " ms (" << _kernelBusyTime * 100.0 / span
+           << "%) of " << ToMicroseconds(span) / 1e3 << " ms on the device: "
+           << (_transferBusyTime > _kernelBusyTime ? "transfer-bound" : "compute-bound")
+           << std::endl;
+    }
+
+    os.flags(flags);
+    os.precision(precision);
+}
+
+void ClProfiler::WriteReport(std::ostream& os) const
+{
+    std::lock_guard<std::mutex> lock { _mutex };
+
+    os << "{\"span_ns\":" << (_lastEnd > _firstStart ? _lastEnd - _firstStart : 0)
+       << ",\"transfer_busy_ns\":" << _transferBusyTime << ",\"kernel_busy_ns\":" << _kernelBusyTime
+       << ",\"commands\":[";
+    for (size_t i = 0; i < _statistics.size(); ++i)
+    {
+        auto const& s { _statistics[i] };
+        os << (i == 0 ? "" : ",") << "{\"name\":";
+        WriteJsonString(os, s.name);
+        os << ",\"kind\":\"" << GetKindName(s.kind) << "\",\"count\":" << s.count
+           << ",\"bytes\":" << s.numBytes << ",\"queued_ns\":" << s.queuedTime
+           << ",\"wait_ns\":" << s.waitTime << ",\"execution_ns\":" << s.executionTime
+           << ",\"min_ns\":" << s.minExecutionTime << ",\"p50_ns\":"
+           << s.histogram.GetQuantile(0.5) << ",\"p99_ns\":"
+           << s.histogram.GetQuantile(0.99) << ",\"max_ns\":" << s.maxExecutionTime
+           << ",\"histogram\":[";
+
+        bool first { true };
+        for (size_t b = 0; b < Histogram::numBuckets; ++b)
+        {
+            if (s.histogram.GetBucketCount(b) == 0)
+                continue;
+            os << (first ? "" : ",") << "{\"from_ns\":" << Histogram::GetBucketLowerBound(b)
+               << ",\"count\":" << s.histogram.GetBucketCount(b) << "}";
+            first = false;
+        }
+        os << "]}";
+    }
+    os << "]}" << std::endl;
+}
+
+}
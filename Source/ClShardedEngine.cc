@@ -0,0 +1,137 @@
+// Copyright (c) 2021 Chanjung Kim. All rights reserved.
+// Licensed under the MIT License.
+
+#include <mf/ClShardedEngine.hh>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <exception>
+#include <mutex>
+#include <stdexcept>
+#include <thread>
+
+namespace mf
+{
+
+ClShardedEngine ClShardedEngine::MakeFromEngines(std::vector<ClEngine>    engines,
+                                                 std::vector<std::string> names)
+{
+    if (engines.empty() || engines.size() != names.size())
+        throw std::invalid_argument { "engines" };
+
+    for (auto const& engine : engines)
+    {
+        if (engine.GetBatchSize() != engines.front().GetBatchSize()
+            || engine.GetInputSize() != engines.front().GetInputSize()
+            || engine.GetOutputSize() != engines.front().GetOutputSize())
+            throw std::invalid_argument { "engines" };
+    }
+
+    return ClShardedEngine { std::move(engines), std::move(names) };
+}
+
+ClShardedEngine::ClShardedEngine(std::vector<ClEngine> engines, std::vector<std::string> names) :
+    _engines { std::move(engines) }
+{
+    for (auto& name : names) _statistics.push_back(ClShardStatistics { std::move(name), 0, 0, 0.0 });
+}
+
+template <typename In>
+void ClShardedEngine::ClassifyWith(In const*            in,
+                                   size_t               numSamples,
+                                   MnistLabel*          labels,
+                                   BatchCallback const& onBatch)
+{
+    size_t const batchSize  = GetBatchSize();
+    size_t const numBatches = (numSamples + batchSize - 1) / batchSize;
+
+    // Every engine takes the next batch from the same counter when it has a free slot.
+    std::atomic<size_t> nextBatch { 0 };
+    std::atomic<bool>   failed { false };
+    auto                source { [&](size_t& begin, size_t& count) {
+        if (failed.load(std::memory_order_relaxed))
+            return false;
+
+        size_t const batch { nextBatch.fetch_add(1, std::memory_order_relaxed) };
+        if (batch >= numBatches)
+            return false;
+
+        begin = batch * batchSize;
+        count = std::min(batchSize, numSamples - begin);
+        return true;
+    } };
+
+    // The batches complete out of order across the engines, so each one is reported once every
+    // earlier one has completed.
+    std::mutex         mutex;
+    std::vector<bool>  completed(numBatches);
+    size_t             numReported = 0;
+    std::exception_ptr exception;
+    auto               run { [&](size_t shard) {
+        auto& statistics { _statistics[shard] };
+        auto  begin { std::chrono::steady_clock::now() };
+        try
+        {
+            _engines[shard].ClassifyFrom(
+                in, numSamples, labels, source, [&](size_t first, size_t count) {
+                    statistics.numBatches += 1;
+                    statistics.numSamples += count;
+
+                    std::lock_guard<std::mutex> lock { mutex };
+                    completed[first / batchSize] = true;
+                    for (; numReported < numBatches && completed[numReported]; ++numReported)
+                    {
+                        if (onBatch && !failed.load(std::memory_order_relaxed))
+                            onBatch(numReported * batchSize,
+                                    std::min(batchSize, numSamples - numReported * batchSize));
+                    }
+                });
+        }
+        catch (...)
+        {
+            std::lock_guard<std::mutex> lock { mutex };
+            if (!exception)
+                exception = std::current_exception();
+            failed = true;
+        }
+        statistics.busyTime
+            += std::chrono::duration<double> { std::chrono::steady_clock::now() - begin }.count();
+    } };
+
+    // The first engine is driven by the calling thread.
+    std::vector<std::thread> threads;
+    try
+    {
+        for (size_t shard = 1; shard < _engines.size(); ++shard) threads.emplace_back(run, shard);
+    }
+    catch (...)
+    {
+        failed = true;
+        for (auto& thread : threads) thread.join();
+        throw;
+    }
+    run(0);
+    for (auto& thread : threads) thread.join();
+
+    if (exception)
+        std::rethrow_exception(exception);
+}
+
+void ClShardedEngine::Classify(float const*         in,
+                               size_t               numSamples,
+                               MnistLabel*          labels,
+                               BatchCallback const& onBatch)
+{
+    ClassifyWith(in, numSamples, labels, onBatch);
+}
+
+void ClShardedEngine::Classify(uint8_t const*       in,
+                               size_t               numSamples,
+                               MnistLabel*          labels,
+                               BatchCallback const& onBatch)
+{
+    ClassifyWith(in, numSamples, labels, onBatch);
+}
+
+}
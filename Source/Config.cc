@@ -2,27 +2,416 @@
 // Licensed under the MIT License.
 
 #include <mf/Config.hh>
+#include <mf/Dense.hh>
+#include <mf/Trace.hh>
+
+#include <algorithm>
+#include <cctype>
+#include <cstring>
+#include <string>
+#include <thread>
 
 #define GETENV(VarName, EnvVarName)                                                                \
     char const* VarName { std::getenv(#EnvVarName) };                                              \
     if (VarName == nullptr)                                                                        \
         throw ConfigNotFoundException { #EnvVarName " is missing" };
 
+#define GETENV_OR(VarName, EnvVarName, DefaultValue)                                               \
+    char const* VarName { std::getenv(#EnvVarName) };                                              \
+    if (VarName == nullptr)                                                                        \
+        VarName = (DefaultValue);
+
+#define GETENV_SIZE_OR(VarName, EnvVarName, DefaultValue)                                          \
+    GETENV_OR(VarName##String, EnvVarName, #DefaultValue);                                         \
+    size_t VarName { ParseSize(VarName##String, #EnvVarName) };
+
+#define GETENV_COUNT_OR(VarName, EnvVarName, DefaultValue)                                         \
+    GETENV_OR(VarName##String, EnvVarName, #DefaultValue);                                         \
+    size_t VarName { ParseSize(VarName##String, #EnvVarName, true) };
+
 namespace mf
 {
 
+namespace
+{
+
+/**
+ * Parses the given string as a non-negative integer.
+ *
+ * @param value the string to parse
+ * @param name the name of the environmental variable, used in the error message
+ * @param allowZero whether zero is a valid value
+ */
+size_t ParseSize(char const* value, char const* name, bool allowZero = false)
+{
+    std::string const message { std::string { name }
+                                + (allowZero ? " must be a non-negative integer"
+                                             : " must be a positive integer") };
+    if (!std::isdigit((unsigned char)value[0]))
+        throw InvalidConfigException { message };
+
+    try
+    {
+        size_t idx { 0 };
+        auto   rtn { std::stoull(value, &idx) };
+        if (value[idx] != '\0' || (rtn == 0 && !allowZero))
+            throw InvalidConfigException { message };
+
+        return (size_t)rtn;
+    }
+    catch (std::logic_error const&)
+    {
+        throw InvalidConfigException { message };
+    }
+}
+
+/**
+ * Parses the given string as a non-negative decimal number.
+ *
+ * @param value the string to parse
+ * @param name the name of the environmental variable, used in the error message
+ */
+double ParseNumber(char const* value, char const* name)
+{
+    std::string const message { std::string { name } + " must be a non-negative number" };
+    if (!std::isdigit((unsigned char)value[0]) && value[0] != '.')
+        throw InvalidConfigException { message };
+
+    try
+    {
+        size_t idx { 0 };
+        auto   rtn { std::stod(value, &idx) };
+        if (value[idx] != '\0')
+            throw InvalidConfigException { message };
+
+        return rtn;
+    }
+    catch (std::logic_error const&)
+    {
+        throw InvalidConfigException { message };
+    }
+}
+
+/**
+ * Parses the given string as the name of an instruction set.
+ *
+ * @param value the string to parse, or `nullptr`
+ * @param name the name of the environmental variable, used in the error message
+ */
+std::optional<Isa> ParseIsa(char const* value, char const* name)
+{
+    if (value == nullptr)
+        return std::nullopt;
+
+    Isa isa;
+    if (!Cpu::ParseIsaName(value, isa))
+        throw InvalidConfigException { std::string { name } + " must be one of scalar, sse4, avx2 "
+                                                              "and avx512" };
+    return isa;
+}
+
+/**
+ * Parses the given string as the name of a weight layout.
+ *
+ * @param value the string to parse
+ * @param name the name of the environmental variable, used in the error message
+ */
+WeightLayout ParseWeightLayout(char const* value, char const* name)
+{
+    if (strcmp(value, "raw") == 0)
+        return WeightLayout::Raw;
+    if (strcmp(value, "packed") == 0)
+        return WeightLayout::Packed;
+    if (strcmp(value, "both") == 0)
+        return WeightLayout::RawAndPacked;
+
+    throw InvalidConfigException { std::string { name } + " must be one of raw, packed and both" };
+}
+
+
+/**
+ * Parses the given string as the name of a pixel format.
+ *
+ * @param value the string to parse
+ * @param name the name of the environmental variable, used in the error message
+ */
+MnistPixelFormat ParseMnistPixelFormat(char const* value, char const* name)
+{
+    if (strcmp(value, "float") == 0)
+        return MnistPixelFormat::Float;
+    if (strcmp(value, "uint8") == 0)
+        return MnistPixelFormat::Byte;
+
+    throw InvalidConfigException { std::string { name } + " must be one of float and uint8" };
+}
+
+
+/**
+ * Parses the given string as the name of a backend.
+ *
+ * @param value the string to parse
+ * @param name the name of the environmental variable, used in the error message
+ */
+Backend ParseBackend(char const* value, char const* name)
+{
+    if (strcmp(value, "cpu") == 0)
+        return Backend::Cpu;
+    if (strcmp(value, "opencl") == 0)
+        return Backend::OpenCl;
+    if (strcmp(value, "hybrid") == 0)
+        return Backend::Hybrid;
+
+    throw InvalidConfigException { std::string { name } + " must be one of cpu, opencl and "
+                                                          "hybrid" };
+}
+
+/**
+ * Parses the given string as where the parameters of the CPU kernels come from.
+ *
+ * @param value the string to parse
+ * @param name the name of the environmental variable, used in the error message
+ */
+AutotuneMode ParseAutotuneMode(char const* value, char const* name)
+{
+    if (strcmp(value, "off") == 0)
+        return AutotuneMode::Off;
+    if (strcmp(value, "cached") == 0)
+        return AutotuneMode::Cached;
+    if (strcmp(value, "on") == 0)
+        return AutotuneMode::On;
+
+    throw InvalidConfigException { std::string { name } + " must be one of off, cached and on" };
+}
+
+/**
+ * Parses the given string as a switch.
+ *
+ * @param value the string to parse
+ * @param name the name of the environmental variable, used in the error message
+ */
+bool ParseSwitch(char const* value, char const* name)
+{
+    if (strcmp(value, "off") == 0)
+        return false;
+    if (strcmp(value, "on") == 0)
+        return true;
+
+    throw InvalidConfigException { std::string { name } + " must be one of off and on" };
+}
+
+/**
+ * Parses the given string as a switch that may be left to the program.
+ *
+ * @param value the string to parse
+ * @param name the name of the environmental variable, used in the error message
+ */
+std::optional<bool> ParseAutoSwitch(char const* value, char const* name)
+{
+    if (strcmp(value, "auto") == 0)
+        return std::nullopt;
+    if (strcmp(value, "off") == 0)
+        return false;
+    if (strcmp(value, "on") == 0)
+        return true;
+
+    throw InvalidConfigException { std::string { name } + " must be one of auto, off and on" };
+}
+
+/**
+ * Returns the bit of the given field if the given environmental variable is set, or zero.
+ */
+uint32_t GetExplicitBit(char const* name, ConfigField field) noexcept
+{
+    return std::getenv(name) != nullptr ? (uint32_t)field : 0;
+}
+
+/**
+ * Returns the default directory of the OpenCL program cache, or an empty path if neither
+ * `XDG_CACHE_HOME` nor `HOME` is set.
+ */
+std::filesystem::path GetDefaultCacheDirectory()
+{
+    if (char const* cacheHome { std::getenv("XDG_CACHE_HOME") }; cacheHome && *cacheHome)
+        return std::filesystem::path { cacheHome } / "mnist-fpga";
+    if (char const* home { std::getenv("HOME") }; home && *home)
+        return std::filesystem::path { home } / ".cache" / "mnist-fpga";
+    return {};
+}
+
+/**
+ * Returns the default path of the autotune cache, or an empty path if there is no default cache
+ * directory.
+ */
+std::filesystem::path GetDefaultAutotuneCachePath()
+{
+    auto directory { GetDefaultCacheDirectory() };
+    return directory.empty() ? directory : directory / "autotune.json";
+}
+
+/**
+ * Parses the given string as whether to use every matching OpenCL device.
+ *
+ * @param value the string to parse
+ * @param name the name of the environmental variable, used in the error message
+ */
+bool ParseAllDevices(char const* value, char const* name)
+{
+    if (strcmp(value, "first") == 0)
+        return false;
+    if (strcmp(value, "all") == 0)
+        return true;
+
+    throw InvalidConfigException { std::string { name } + " must be one of first and all" };
+}
+
+/**
+ * Parses the given string as whether and how to map the MNIST files to memory.
+ *
+ * @param value the string to parse
+ * @param name the name of the environmental variable, used in the error message
+ */
+std::optional<MapHint> ParseMapHint(char const* value, char const* name)
+{
+    if (strcmp(value, "off") == 0)
+        return std::nullopt;
+    if (strcmp(value, "on") == 0)
+        return MapHint::None;
+    if (strcmp(value, "populate") == 0)
+        return MapHint::Populate;
+    if (strcmp(value, "sequential") == 0)
+        return MapHint::Sequential;
+    if (strcmp(value, "willneed") == 0)
+        return MapHint::WillNeed;
+
+    throw InvalidConfigException { std::string { name } + " must be one of off, on, populate, "
+                                                          "sequential and willneed" };
+}
+
+}
+
 Config Config::MakeFromEnvironment()
 {
+    MF_TRACE_SPAN("Config::MakeFromEnvironment");
+
     GETENV(vendorName, VENDOR_NAME);
     GETENV(deviceName, DEVICE_NAME);
-    GETENV(xclbinPath, XCLBIN_PATH);
+    GETENV_OR(xclbinPath, XCLBIN_PATH, "");
     GETENV(weightFilePath, WEIGHT_PATH)
+    GETENV_OR(weightLayout, WEIGHT_LAYOUT, "both");
     GETENV(mnistImageFilePath, MNIST_IMAGE_PATH);
     GETENV(mnisgLabelFilePath, MNIST_LABEL_PATH);
+    GETENV_OR(mnistPixelFormat, MNIST_PIXEL_FORMAT, "float");
+    GETENV_OR(mnistMapHint, MNIST_MMAP, "off");
+    GETENV_COUNT_OR(mnistStreamBatch, MNIST_STREAM_BATCH, 0);
+    GETENV_SIZE_OR(mnistStreamBuffers, MNIST_STREAM_BUFFERS, 4);
+    GETENV_OR(backend, BACKEND, "cpu");
+    GETENV_SIZE_OR(hybridRoundSize, HYBRID_ROUND_SIZE, 4096);
+    GETENV_OR(clDevices, CL_DEVICES, "first");
+    GETENV_COUNT_OR(clNumSubDevices, CL_SUB_DEVICES, 0);
+    GETENV_SIZE_OR(clNumBuffers, CL_NUM_BUFFERS, 2);
+    GETENV_COUNT_OR(clPoolCapacity, CL_POOL_CAPACITY, 0);
+    GETENV_OR(clZeroCopy, CL_ZERO_COPY, "auto");
+    GETENV_SIZE_OR(clTileOutputs, CL_TILE_OUTPUTS, 16);
+    GETENV_SIZE_OR(clTileSamples, CL_TILE_SAMPLES, 16);
+    GETENV_SIZE_OR(clTileInputs, CL_TILE_INPUTS, 32);
+    GETENV_OR(clCacheDirectory, CL_CACHE_DIR, nullptr);
+    GETENV_OR(clProfile, CL_PROFILE, "off");
+    GETENV_OR(clProfileReportPath, CL_PROFILE_REPORT, "");
+    GETENV_SIZE_OR(batchSize, BATCH_SIZE, 256);
+    GETENV_OR(denseIsa, DENSE_ISA, nullptr);
+    GETENV_OR(denseFused, DENSE_FUSED, "on");
+    GETENV_SIZE_OR(denseTileSamples, DENSE_TILE_SAMPLES, 64);
+    GETENV_SIZE_OR(denseTileInputs, DENSE_TILE_INPUTS, 256);
+    GETENV_SIZE_OR(denseTileOutputs, DENSE_TILE_OUTPUTS, 128);
+    GETENV_OR(denseSparseThreshold, DENSE_SPARSE_THRESHOLD, nullptr);
+    GETENV_OR(autotune, AUTOTUNE, "cached");
+    GETENV_OR(autotuneCachePath, AUTOTUNE_CACHE, nullptr);
+    GETENV_COUNT_OR(autotuneLatencyBudget, AUTOTUNE_LATENCY_BUDGET, 0);
+    GETENV_OR(perfCounters, PERF_COUNTERS, "off");
+    GETENV_COUNT_OR(numThreads, NUM_THREADS, 0);
+    GETENV_COUNT_OR(progressInterval, PROGRESS_INTERVAL, 1000);
+    GETENV_COUNT_OR(int8CalibrationSize, INT8_CALIBRATION_SIZE, 0);
+    GETENV_OR(int8MaxAccuracyDrop, INT8_MAX_ACCURACY_DROP, "0.5");
+    GETENV_OR(serverSocketPath, SERVER_SOCKET, "");
+    GETENV_COUNT_OR(serverMaxWait, SERVER_MAX_WAIT, 1000);
+
+    uint32_t const explicitFields {
+        GetExplicitBit("BATCH_SIZE", ConfigField::BatchSize)
+        | GetExplicitBit("NUM_THREADS", ConfigField::NumThreads)
+        | GetExplicitBit("DENSE_TILE_SAMPLES", ConfigField::DenseTileSamples)
+        | GetExplicitBit("DENSE_TILE_INPUTS", ConfigField::DenseTileInputs)
+        | GetExplicitBit("DENSE_TILE_OUTPUTS", ConfigField::DenseTileOutputs)
+        | GetExplicitBit("DENSE_FUSED", ConfigField::DenseFused)
+    };
+
+    if (mnistStreamBuffers < 2)
+        throw InvalidConfigException { "MNIST_STREAM_BUFFERS must be at least 2" };
+    if (clNumBuffers < 2)
+        throw InvalidConfigException { "CL_NUM_BUFFERS must be at least 2" };
+    if (denseSparseThreshold && ParseNumber(denseSparseThreshold, "DENSE_SPARSE_THRESHOLD") > 1.0)
+        throw InvalidConfigException { "DENSE_SPARSE_THRESHOLD must be at most 1" };
+
+    // Tuning measures the kernels on samples of the dataset, which a stream does not keep.
+    if (mnistStreamBatch != 0 && ParseAutotuneMode(autotune, "AUTOTUNE") == AutotuneMode::On)
+        throw InvalidConfigException { "AUTOTUNE=on cannot be used with MNIST_STREAM_BATCH" };
+
+    // The server runs copies of the CPU engine, and reads the images from its clients.
+    if (*serverSocketPath != '\0' && ParseBackend(backend, "BACKEND") != Backend::Cpu)
+        throw InvalidConfigException { "SERVER_SOCKET can only be used with BACKEND=cpu" };
+    if (*serverSocketPath != '\0' && mnistStreamBatch != 0)
+        throw InvalidConfigException { "SERVER_SOCKET cannot be used with MNIST_STREAM_BATCH" };
+
+    // Calibration needs random access to the dataset, which a stream does not give.
+    if (mnistStreamBatch != 0 && int8CalibrationSize != 0)
+        throw InvalidConfigException { "INT8_CALIBRATION_SIZE cannot be used with "
+                                       "MNIST_STREAM_BATCH" };
 
     return Config {
-        vendorName, deviceName, xclbinPath, weightFilePath, mnistImageFilePath, mnisgLabelFilePath,
+        vendorName,
+        deviceName,
+        xclbinPath,
+        weightFilePath,
+        ParseWeightLayout(weightLayout, "WEIGHT_LAYOUT"),
+        mnistImageFilePath,
+        mnisgLabelFilePath,
+        ParseMnistPixelFormat(mnistPixelFormat, "MNIST_PIXEL_FORMAT"),
+        ParseMapHint(mnistMapHint, "MNIST_MMAP"),
+        mnistStreamBatch,
+        mnistStreamBuffers,
+        ParseBackend(backend, "BACKEND"),
+        hybridRoundSize,
+        ParseAllDevices(clDevices, "CL_DEVICES"),
+        clNumSubDevices,
+        clNumBuffers,
+        clPoolCapacity,
+        ParseAutoSwitch(clZeroCopy, "CL_ZERO_COPY"),
+        clTileOutputs,
+        clTileSamples,
+        clTileInputs,
+        clCacheDirectory ? std::filesystem::path { clCacheDirectory } : GetDefaultCacheDirectory(),
+        ParseSwitch(clProfile, "CL_PROFILE"),
+        clProfileReportPath,
+        batchSize,
+        ParseIsa(denseIsa, "DENSE_ISA"),
+        ParseSwitch(denseFused, "DENSE_FUSED"),
+        denseTileSamples,
+        denseTileInputs,
+        denseTileOutputs,
+        denseSparseThreshold ? ParseNumber(denseSparseThreshold, "DENSE_SPARSE_THRESHOLD")
+                             : SparseBatch::defaultThreshold,
+        ParseAutotuneMode(autotune, "AUTOTUNE"),
+        autotuneCachePath ? std::filesystem::path { autotuneCachePath }
+                          : GetDefaultAutotuneCachePath(),
+        autotuneLatencyBudget,
+        ParseSwitch(perfCounters, "PERF_COUNTERS"),
+        numThreads == 0 ? std::max(std::thread::hardware_concurrency(), 1u) : numThreads,
+        progressInterval,
+        int8CalibrationSize,
+        ParseNumber(int8MaxAccuracyDrop, "INT8_MAX_ACCURACY_DROP"),
+        serverSocketPath,
+        serverMaxWait,
+        explicitFields,
     };
 }
 
-}
\ No newline at end of file
+}
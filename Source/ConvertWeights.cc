@@ -0,0 +1,66 @@
+// Copyright (c) 2021 Chanjung Kim. All rights reserved.
+// Licensed under the MIT License.
+
+#include <mf/Model.hh>
+#include <mf/Weights.hh>
+
+#include <cstring>
+#include <iostream>
+
+// Converts a Keras HDF5 weight file to a flat weight file (see `Weights::WriteFlatFile`), so that
+// `mnist-fpga` can map the weights at startup instead of going through HDF5. The layer order and the
+// activations in `model_config` are written along with the weights.
+//
+// Usage: mnist-fpga-convert-weights <input .h5> <output> [raw|packed|both]
+
+int main(int argc, char** argv)
+try
+{
+    if (argc != 3 && argc != 4)
+    {
+        std::cout << "Usage: " << argv[0] << " <input .h5> <output> [raw|packed|both]" << std::endl;
+        return EXIT_FAILURE;
+    }
+
+    mf::WeightLayout layout { mf::WeightLayout::RawAndPacked };
+    if (argc == 4)
+    {
+        if (std::strcmp(argv[3], "raw") == 0)
+            layout = mf::WeightLayout::Raw;
+        else if (std::strcmp(argv[3], "packed") == 0)
+            layout = mf::WeightLayout::Packed;
+        else if (std::strcmp(argv[3], "both") != 0)
+        {
+            std::cout << "The layout must be one of raw, packed and both" << std::endl;
+            return EXIT_FAILURE;
+        }
+    }
+
+    auto weights { mf::Weights::MakeFromHdf5(argv[1], layout) };
+    if (weights.empty())
+        throw mf::InvalidWeightFileException { argv[1] };
+
+    auto layers { mf::Model::ReadFromHdf5(argv[1]) };
+    mf::Weights::WriteFlatFile(weights, argv[2], layers);
+    for (auto& [name, weight] : weights)
+    {
+        std::cout << name << ": " << weight.GetInputSize() << " x " << weight.GetOutputSize()
+                  << (weight.HasRawKernel() ? " raw" : "")
+                  << (weight.HasPackedKernel() ? " packed" : "") << std::endl;
+    }
+
+    return 0;
+}
+catch (mf::Exception const& ex)
+{
+    std::cout << ex.GetGenericInfo();
+    if (auto message { ex.GetMessage() }; message != nullptr)
+        std::cout << ": " << message;
+    std::cout << std::endl;
+    return EXIT_FAILURE;
+}
+catch (std::exception const& ex)
+{
+    std::cout << ex.what() << std::endl;
+    return EXIT_FAILURE;
+}
@@ -0,0 +1,131 @@
+// Copyright (c) 2021 Chanjung Kim. All rights reserved.
+// Licensed under the MIT License.
+
+#include <mf/Cpu.hh>
+
+#include <cstring>
+#include <string>
+
+#if defined(__x86_64__) || defined(__i386__)
+#    include <cpuid.h>
+#    define MF_CPU_X86
+#endif
+
+namespace mf
+{
+
+namespace
+{
+
+#ifdef MF_CPU_X86
+
+/**
+ * Returns the lower 32 bits of the extended control register 0, which tells which register states
+ * are saved by the operating system on a context switch.
+ */
+uint32_t GetXcr0() noexcept
+{
+    uint32_t eax, edx;
+    __asm__ volatile("xgetbv" : "=a"(eax), "=d"(edx) : "c"(0));
+    return eax;
+}
+
+Isa DetectIsa() noexcept
+{
+    unsigned int eax, ebx, ecx, edx;
+    if (!__get_cpuid(1, &eax, &ebx, &ecx, &edx))
+        return Isa::Scalar;
+
+    bool const sse41   = ecx & bit_SSE4_1;
+    bool const fma     = ecx & bit_FMA;
+    bool const avx     = ecx & bit_AVX;
+    bool const osxsave = ecx & bit_OSXSAVE;
+    if (!sse41)
+        return Isa::Scalar;
+    if (!avx || !osxsave || !fma)
+        return Isa::Sse4;
+
+    // XMM and YMM states
+    uint32_t const xcr0 = GetXcr0();
+    if ((xcr0 & 0x06) != 0x06)
+        return Isa::Sse4;
+
+    if (!__get_cpuid_count(7, 0, &eax, &ebx, &ecx, &edx) || !(ebx & bit_AVX2))
+        return Isa::Sse4;
+
+    // opmask, upper ZMM0-15 and ZMM16-31 states
+    if (!(ebx & bit_AVX512F) || (xcr0 & 0xE0) != 0xE0)
+        return Isa::Avx2;
+
+    return Isa::Avx512;
+}
+
+std::string DetectModelName()
+{
+    unsigned int brand[12];
+    if (!__get_cpuid(0x80000000, &brand[0], &brand[1], &brand[2], &brand[3])
+        || brand[0] < 0x80000004)
+        return "unknown";
+
+    for (unsigned int i = 0; i < 3; ++i)
+    {
+        unsigned int* regs { brand + i * 4 };
+        __get_cpuid(0x80000002 + i, &regs[0], &regs[1], &regs[2], &regs[3]);
+    }
+
+    // The brand string is padded with spaces and terminated by a null character.
+    std::string rtn { (char const*)brand, strnlen((char const*)brand, sizeof(brand)) };
+    rtn.erase(0, rtn.find_first_not_of(' '));
+    rtn.erase(rtn.find_last_not_of(' ') + 1);
+    return rtn.empty() ? "unknown" : rtn;
+}
+
+#else
+
+Isa DetectIsa() noexcept
+{
+    return Isa::Scalar;
+}
+
+std::string DetectModelName()
+{
+    return "unknown";
+}
+
+#endif
+
+constexpr char const* isaNames[] { "scalar", "sse4", "avx2", "avx512" };
+
+}
+
+Isa Cpu::GetIsa() noexcept
+{
+    static Isa const isa { DetectIsa() };
+    return isa;
+}
+
+std::string const& Cpu::GetModelName()
+{
+    static std::string const modelName { DetectModelName() };
+    return modelName;
+}
+
+char const* Cpu::GetIsaName(Isa isa) noexcept
+{
+    return isaNames[(size_t)isa];
+}
+
+bool Cpu::ParseIsaName(char const* name, Isa& isa) noexcept
+{
+    for (size_t i = 0; i < sizeof(isaNames) / sizeof(isaNames[0]); ++i)
+    {
+        if (strcmp(name, isaNames[i]) == 0)
+        {
+            isa = (Isa)i;
+            return true;
+        }
+    }
+    return false;
+}
+
+}
@@ -0,0 +1,369 @@
+// Copyright (c) 2021 Chanjung Kim. All rights reserved.
+// Licensed under the MIT License.
+
+#include <mf/Dense.hh>
+
+#include <algorithm>
+#include <cmath>
+#include <stdexcept>
+
+#include "DenseKernel.hh"
+
+namespace mf
+{
+
+void Dense::Apply(float const* in, float* out, Weight const& layer)
+{
+    if (!layer.HasRawKernel())
+        throw std::invalid_argument { "layer" };
+
+    auto weight { layer.GetKernelWeight() };
+    auto bias { layer.GetBiasWeight() };
+
+    for (size_t i = 0, li = layer.GetOutputSize(); i < li; ++i)
+    {
+        out[i] = 0.0f;
+        for (size_t j = 0, lj = layer.GetInputSize(); j < lj; ++j)
+            out[i] += in[j] * weight[j * li + i];
+        out[i] += bias[i];
+        if (out[i] < 0.0f)
+            out[i] = 0.0f;
+    }
+}
+
+namespace
+{
+
+/**
+ * The number of consecutive inputs `SparseBatch::Encode` skips at once if all of them are zero.
+ */
+constexpr size_t encodeChunkSize = 8;
+
+/**
+ * Implementation of `SparseBatch::GetDensity`.
+ */
+template <typename In>
+double GetDensityOf(In const* in, size_t size) noexcept
+{
+    size_t numNonzeros = 0;
+    for (size_t i = 0; i < size; ++i) numNonzeros += in[i] != 0;
+    return size == 0 ? 0.0 : (double)numNonzeros / size;
+}
+
+/**
+ * Replaces the content of the arrays of `SparseBatch` with the nonzero elements of the given
+ * samples. The arrays only grow, so encoding batches no larger than the first allocates nothing.
+ */
+template <typename In>
+void EncodeSparse(In const*              in,
+                  size_t                 numSamples,
+                  size_t                 inputSize,
+                  std::vector<uint32_t>& offsets,
+                  std::vector<uint32_t>& indices,
+                  std::vector<float>&    values)
+{
+    size_t const size { numSamples * inputSize };
+    if (size > UINT32_MAX)
+        throw std::invalid_argument { "numSamples" };
+    if (offsets.size() < numSamples + 1)
+        offsets.resize(numSamples + 1);
+    if (indices.size() < size)
+    {
+        indices.resize(size);
+        values.resize(size);
+    }
+
+    uint32_t numNonzeros = 0;
+    for (size_t s = 0; s < numSamples; ++s)
+    {
+        offsets[s] = numNonzeros;
+        In const* x = in + s * inputSize;
+        for (size_t i0 = 0; i0 < inputSize; i0 += encodeChunkSize)
+        {
+            // The zeros of MNIST images come in long runs, which are skipped a chunk at a time.
+            size_t const i1 = std::min(i0 + encodeChunkSize, inputSize);
+            if (std::all_of(x + i0, x + i1, [](In value) { return value == 0; }))
+                continue;
+
+            // Every element is written, and the position advances past the nonzero ones only.
+            for (size_t i = i0; i < i1; ++i)
+            {
+                indices[numNonzeros] = (uint32_t)i;
+                values[numNonzeros]  = (float)x[i];
+                numNonzeros += x[i] != 0;
+            }
+        }
+    }
+    offsets[numSamples] = numNonzeros;
+}
+
+}
+
+double SparseBatch::GetDensity(float const* in, size_t size) noexcept
+{
+    return GetDensityOf(in, size);
+}
+
+double SparseBatch::GetDensity(uint8_t const* in, size_t size) noexcept
+{
+    return GetDensityOf(in, size);
+}
+
+SparseBatch::SparseBatch(size_t batchSize, size_t inputSize) :
+    _offsets(batchSize + 1, 0),
+    _indices(batchSize * inputSize),
+    _values(batchSize * inputSize),
+    _numSamples { 0 },
+    _inputSize { inputSize }
+{}
+
+void SparseBatch::Encode(float const* in, size_t numSamples, size_t inputSize)
+{
+    EncodeSparse(in, numSamples, inputSize, _offsets, _indices, _values);
+    _numSamples = numSamples;
+    _inputSize  = inputSize;
+}
+
+void SparseBatch::Encode(uint8_t const* in, size_t numSamples, size_t inputSize)
+{
+    EncodeSparse(in, numSamples, inputSize, _offsets, _indices, _values);
+    _numSamples = numSamples;
+    _inputSize  = inputSize;
+}
+
+namespace
+{
+
+/**
+ * Scalar implementation of `Dense::ApplyBatch`.
+ */
+template <typename In>
+void ApplyBatchScalar(In const*            in,
+                      float*               out,
+                      size_t               batchSize,
+                      float const*         weight,
+                      float const*         bias,
+                      size_t               inputSize,
+                      size_t               outputSize,
+                      DenseBlocking const& blocking,
+                      bool                 relu)
+{
+    size_t const sampleStep = std::max<size_t>(blocking.numSamples, 1);
+    size_t const inputStep  = std::max<size_t>(blocking.numInputs, 1);
+    size_t const outputStep = std::max<size_t>(blocking.numOutputs, 1);
+
+    for (size_t s0 = 0; s0 < batchSize; s0 += sampleStep)
+    {
+        size_t const s1 = std::min(s0 + sampleStep, batchSize);
+        for (size_t o0 = 0; o0 < outputSize; o0 += outputStep)
+        {
+            size_t const o1 = std::min(o0 + outputStep, outputSize);
+
+            for (size_t s = s0; s < s1; ++s)
+                std::copy(bias + o0, bias + o1, out + s * outputSize + o0);
+
+            // The (i0..i1, o0..o1) tile of the kernel stays in the cache while it is applied to
+            // every sample of the block.
+            for (size_t i0 = 0; i0 < inputSize; i0 += inputStep)
+            {
+                size_t const i1 = std::min(i0 + inputStep, inputSize);
+                for (size_t s = s0; s < s1; ++s)
+                {
+                    In const*    x = in + s * inputSize;
+                    float*       y = out + s * outputSize;
+                    for (size_t i = i0; i < i1; ++i)
+                    {
+                        float const  xi = (float)x[i];
+                        float const* w  = weight + i * outputSize;
+                        for (size_t o = o0; o < o1; ++o) y[o] += xi * w[o];
+                    }
+                }
+            }
+
+            for (size_t s = s0; s < s1 && relu; ++s)
+            {
+                float* y = out + s * outputSize;
+                for (size_t o = o0; o < o1; ++o) y[o] = std::max(y[o], 0.0f);
+            }
+        }
+    }
+}
+
+/**
+ * The implementations currently used by `Dense::ApplyBatch`.
+ */
+struct Selection
+{
+    Isa          isa;
+    DenseKernels kernels;
+};
+
+Selection& GetSelection() noexcept
+{
+    static Selection selection { [] {
+        // The widest implementation which both the CPU supports and is compiled in
+        for (auto isa { (int)Cpu::GetIsa() }; isa > (int)Isa::Scalar; --isa)
+        {
+            if (auto kernels { GetDenseKernels((Isa)isa) }; kernels.applyBatch != nullptr)
+                return Selection { (Isa)isa, kernels };
+        }
+        return Selection { Isa::Scalar, GetDenseKernels(Isa::Scalar) };
+    }() };
+    return selection;
+}
+
+}
+
+DenseKernels GetDenseKernels(Isa isa) noexcept
+{
+    switch (isa)
+    {
+    case Isa::Scalar:
+    {
+        auto kernels { dense_kernel::MakeDenseKernels<dense_kernel::ScalarTraits>() };
+        kernels.applyBatch      = &ApplyBatchScalar<float>;
+        kernels.applyBatchBytes = &ApplyBatchScalar<uint8_t>;
+        return kernels;
+    }
+    case Isa::Sse4: return GetDenseKernelsSse4();
+    case Isa::Avx2: return GetDenseKernelsAvx2();
+    case Isa::Avx512: return GetDenseKernelsAvx512();
+    }
+    return DenseKernels {};
+}
+
+namespace
+{
+
+/**
+ * Calls the implementation of `Dense::ApplyBatch` matching the layout of the given layer.
+ */
+template <typename In, typename Function>
+void ApplyBatchWith(In const*            in,
+                    float*               out,
+                    size_t               batchSize,
+                    Weight const&        layer,
+                    DenseBlocking const& blocking,
+                    Activation           activation,
+                    Function             applyBatch,
+                    Function             applyBatchPacked)
+{
+    bool const relu = activation == Activation::Relu;
+    if (layer.HasPackedKernel())
+    {
+        applyBatchPacked(in,
+                         out,
+                         batchSize,
+                         layer.GetPackedKernelWeight().data(),
+                         layer.GetPackedBiasWeight().data(),
+                         layer.GetInputSize(),
+                         layer.GetOutputSize(),
+                         blocking,
+                         relu);
+    }
+    else
+    {
+        applyBatch(in,
+                   out,
+                   batchSize,
+                   layer.GetKernelWeight().data(),
+                   layer.GetBiasWeight().data(),
+                   layer.GetInputSize(),
+                   layer.GetOutputSize(),
+                   blocking,
+                   relu);
+    }
+
+    if (activation == Activation::Softmax)
+        Dense::Softmax(out, batchSize, layer.GetOutputSize());
+}
+
+}
+
+void Dense::ApplyBatch(float const*         in,
+                       float*               out,
+                       size_t               batchSize,
+                       Weight const&        layer,
+                       DenseBlocking const& blocking,
+                       Activation           activation)
+{
+    auto& kernels { GetSelection().kernels };
+    ApplyBatchWith(in,
+                   out,
+                   batchSize,
+                   layer,
+                   blocking,
+                   activation,
+                   kernels.applyBatch,
+                   kernels.applyBatchPacked);
+}
+
+void Dense::ApplyBatch(uint8_t const*       in,
+                       float*               out,
+                       size_t               batchSize,
+                       Weight const&        layer,
+                       DenseBlocking const& blocking,
+                       Activation           activation)
+{
+    auto& kernels { GetSelection().kernels };
+    ApplyBatchWith(in,
+                   out,
+                   batchSize,
+                   layer,
+                   blocking,
+                   activation,
+                   kernels.applyBatchBytes,
+                   kernels.applyBatchPackedBytes);
+}
+
+void Dense::ApplySparse(SparseBatch const& in,
+                        float*             out,
+                        Weight const&      layer,
+                        Activation         activation)
+{
+    auto&      kernels { GetSelection().kernels };
+    bool const packed { layer.HasPackedKernel() };
+    auto       applySparse { packed ? kernels.applySparsePacked : kernels.applySparse };
+    applySparse(in.GetOffsets(),
+                in.GetIndices(),
+                in.GetValues(),
+                in.GetNumSamples(),
+                out,
+                packed ? layer.GetPackedKernelWeight().data() : layer.GetKernelWeight().data(),
+                packed ? layer.GetPackedBiasWeight().data() : layer.GetBiasWeight().data(),
+                layer.GetInputSize(),
+                layer.GetOutputSize(),
+                activation == Activation::Relu);
+
+    if (activation == Activation::Softmax)
+        Softmax(out, in.GetNumSamples(), layer.GetOutputSize());
+}
+
+void Dense::Softmax(float* inout, size_t batchSize, size_t size) noexcept
+{
+    for (size_t s = 0; s < batchSize; ++s)
+    {
+        float*      row = inout + s * size;
+        float const max = *std::max_element(row, row + size);
+
+        float sum = 0.0f;
+        for (size_t o = 0; o < size; ++o) sum += row[o] = std::exp(row[o] - max);
+        for (size_t o = 0; o < size; ++o) row[o] /= sum;
+    }
+}
+
+Isa Dense::GetIsa() noexcept
+{
+    return GetSelection().isa;
+}
+
+void Dense::SetIsa(Isa isa)
+{
+    auto kernels { isa <= Cpu::GetIsa() ? GetDenseKernels(isa) : DenseKernels {} };
+    if (kernels.applyBatch == nullptr)
+        throw UnsupportedIsaException { Cpu::GetIsaName(isa) };
+
+    GetSelection() = Selection { isa, kernels };
+}
+
+}
@@ -0,0 +1,72 @@
+// Copyright (c) 2021 Chanjung Kim. All rights reserved.
+// Licensed under the MIT License.
+
+#if defined(__AVX2__) && defined(__FMA__)
+#    include <immintrin.h>
+#endif
+
+#include "DenseKernel.hh"
+
+namespace mf
+{
+
+#if defined(__AVX2__) && defined(__FMA__)
+
+namespace
+{
+
+struct Avx2Traits
+{
+    using Vec = __m256;
+
+    constexpr static size_t width { 8 };
+    constexpr static size_t rows { 4 };
+
+    static Vec Load(float const* ptr) noexcept
+    {
+        return _mm256_loadu_ps(ptr);
+    }
+
+    static void Store(float* ptr, Vec value) noexcept
+    {
+        _mm256_storeu_ps(ptr, value);
+    }
+
+    static Vec Broadcast(float value) noexcept
+    {
+        return _mm256_set1_ps(value);
+    }
+
+    static Vec MulAdd(Vec a, Vec b, Vec c) noexcept
+    {
+        return _mm256_fmadd_ps(a, b, c);
+    }
+
+    static Vec Max(Vec a, Vec b) noexcept
+    {
+        return _mm256_max_ps(a, b);
+    }
+
+    static Vec Zero() noexcept
+    {
+        return _mm256_setzero_ps();
+    }
+};
+
+}
+
+DenseKernels GetDenseKernelsAvx2() noexcept
+{
+    return dense_kernel::MakeDenseKernels<Avx2Traits>();
+}
+
+#else
+
+DenseKernels GetDenseKernelsAvx2() noexcept
+{
+    return DenseKernels {};
+}
+
+#endif
+
+}
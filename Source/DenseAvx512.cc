@@ -0,0 +1,72 @@
+// Copyright (c) 2021 Chanjung Kim. All rights reserved.
+// Licensed under the MIT License.
+
+#if defined(__AVX512F__)
+#    include <immintrin.h>
+#endif
+
+#include "DenseKernel.hh"
+
+namespace mf
+{
+
+#if defined(__AVX512F__)
+
+namespace
+{
+
+struct Avx512Traits
+{
+    using Vec = __m512;
+
+    constexpr static size_t width { 16 };
+    constexpr static size_t rows { 8 };
+
+    static Vec Load(float const* ptr) noexcept
+    {
+        return _mm512_loadu_ps(ptr);
+    }
+
+    static void Store(float* ptr, Vec value) noexcept
+    {
+        _mm512_storeu_ps(ptr, value);
+    }
+
+    static Vec Broadcast(float value) noexcept
+    {
+        return _mm512_set1_ps(value);
+    }
+
+    static Vec MulAdd(Vec a, Vec b, Vec c) noexcept
+    {
+        return _mm512_fmadd_ps(a, b, c);
+    }
+
+    static Vec Max(Vec a, Vec b) noexcept
+    {
+        return _mm512_max_ps(a, b);
+    }
+
+    static Vec Zero() noexcept
+    {
+        return _mm512_setzero_ps();
+    }
+};
+
+}
+
+DenseKernels GetDenseKernelsAvx512() noexcept
+{
+    return dense_kernel::MakeDenseKernels<Avx512Traits>();
+}
+
+#else
+
+DenseKernels GetDenseKernelsAvx512() noexcept
+{
+    return DenseKernels {};
+}
+
+#endif
+
+}
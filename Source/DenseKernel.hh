@@ -0,0 +1,796 @@
+// Copyright (c) 2021 Chanjung Kim. All rights reserved.
+// Licensed under the MIT License.
+
+#ifndef MNIST_FPGA_DENSE_KERNEL_HH
+#define MNIST_FPGA_DENSE_KERNEL_HH
+
+#include <mf/Dense.hh>
+#include <mf/StaticNetwork.hh>
+
+// Shared, ISA-independent part of the vectorized implementations of `Dense::ApplyBatch`. Every
+// `DenseXxx.cc` file defines a traits type wrapping the intrinsics of its instruction set and
+// instantiates `ApplyBatch` with it. Since each of those files is compiled with different target
+// flags, everything in `dense_kernel` has internal linkage and nothing here may call an
+// out-of-line function with external linkage (including standard library templates such as
+// `std::min`), otherwise the linker could pick the copy compiled for the widest instruction set
+// for the rest of the program.
+
+namespace mf
+{
+
+/**
+ * The type of the functions implementing `Dense::ApplyBatch`.
+ */
+using DenseApplyBatchFunction = void (*)(float const*         in,
+                                         float*               out,
+                                         size_t               batchSize,
+                                         float const*         kernel,
+                                         float const*         bias,
+                                         size_t               inputSize,
+                                         size_t               outputSize,
+                                         DenseBlocking const& blocking,
+                                         bool                 relu);
+
+/**
+ * The type of the functions implementing `Dense::ApplyBatch` for inputs of `uint8_t`.
+ */
+using DenseApplyBatchBytesFunction = void (*)(uint8_t const*       in,
+                                              float*               out,
+                                              size_t               batchSize,
+                                              float const*         kernel,
+                                              float const*         bias,
+                                              size_t               inputSize,
+                                              size_t               outputSize,
+                                              DenseBlocking const& blocking,
+                                              bool                 relu);
+
+/**
+ * The type of the functions implementing `Dense::ApplySparse`. The input is given as the arrays of
+ * `SparseBatch`.
+ */
+using DenseApplySparseFunction = void (*)(uint32_t const* offsets,
+                                          uint32_t const* indices,
+                                          float const*    values,
+                                          size_t          numSamples,
+                                          float*          out,
+                                          float const*    kernel,
+                                          float const*    bias,
+                                          size_t          inputSize,
+                                          size_t          outputSize,
+                                          bool            relu);
+
+/**
+ * The implementations of `Dense::ApplyBatch` and `Dense::ApplySparse` for one instruction set.
+ */
+struct DenseKernels
+{
+    /**
+     * reads the kernel in the (I, O) row-major layout.
+     */
+    DenseApplyBatchFunction applyBatch;
+
+    /**
+     * reads the kernel and the bias in the packed layout (see `Weight::GetPackedKernelWeight`).
+     */
+    DenseApplyBatchFunction applyBatchPacked;
+
+    /**
+     * the same as `applyBatch` for inputs of `uint8_t`.
+     */
+    DenseApplyBatchBytesFunction applyBatchBytes;
+
+    /**
+     * the same as `applyBatchPacked` for inputs of `uint8_t`.
+     */
+    DenseApplyBatchBytesFunction applyBatchPackedBytes;
+
+    /**
+     * implements `Dense::ApplySparse`, reading the kernel in the (I, O) row-major layout.
+     */
+    DenseApplySparseFunction applySparse;
+
+    /**
+     * implements `Dense::ApplySparse`, reading the kernel and the bias in the packed layout.
+     */
+    DenseApplySparseFunction applySparsePacked;
+
+    /**
+     * implements `MnistNetwork::Forward`.
+     */
+    StaticForwardFunction mnistForward;
+
+    /**
+     * implements `MnistNetwork::Forward` for inputs of `uint8_t`.
+     */
+    StaticForwardBytesFunction mnistForwardBytes;
+
+    /**
+     * implements `MnistNetwork::Forward` for inputs of `SparseBatch`.
+     */
+    StaticForwardSparseFunction mnistForwardSparse;
+};
+
+/**
+ * Returns the implementations for the given instruction set. All members are `nullptr` if the
+ * implementations were not compiled in.
+ */
+DenseKernels GetDenseKernels(Isa isa) noexcept;
+
+DenseKernels GetDenseKernelsSse4() noexcept;
+DenseKernels GetDenseKernelsAvx2() noexcept;
+DenseKernels GetDenseKernelsAvx512() noexcept;
+
+namespace dense_kernel
+{
+
+namespace
+{
+
+size_t Min(size_t lhs, size_t rhs) noexcept
+{
+    return lhs < rhs ? lhs : rhs;
+}
+
+size_t Max(size_t lhs, size_t rhs) noexcept
+{
+    return lhs < rhs ? rhs : lhs;
+}
+
+/**
+ * Addresses the kernel matrix in the (I, O) row-major layout.
+ */
+struct RawLayout
+{
+    constexpr static bool padded { false };
+
+    float const* weight;
+    size_t       inputSize;
+    size_t       outputSize;
+
+    float const* At(size_t i, size_t o) const noexcept
+    {
+        return weight + i * outputSize + o;
+    }
+
+    size_t GetRowStride() const noexcept
+    {
+        return outputSize;
+    }
+};
+
+/**
+ * Addresses the kernel matrix in the packed layout. Columns are padded up to a multiple of
+ * `Weight::panelWidth`, so a vector never has to be split at the last column.
+ */
+struct PackedLayout
+{
+    constexpr static bool padded { true };
+
+    float const* weight;
+    size_t       inputSize;
+    size_t       outputSize;
+
+    float const* At(size_t i, size_t o) const noexcept
+    {
+        constexpr size_t panelWidth = Weight::panelWidth;
+        return weight + (o / panelWidth) * inputSize * panelWidth + i * panelWidth
+               + o % panelWidth;
+    }
+
+    size_t GetRowStride() const noexcept
+    {
+        return Weight::panelWidth;
+    }
+};
+
+/**
+ * Traits type for the scalar implementations, used where no vector instruction set is available.
+ */
+struct ScalarTraits
+{
+    using Vec = float;
+
+    constexpr static size_t width { 1 };
+    constexpr static size_t rows { 4 };
+
+    static Vec Load(float const* ptr) noexcept
+    {
+        return *ptr;
+    }
+
+    static void Store(float* ptr, Vec value) noexcept
+    {
+        *ptr = value;
+    }
+
+    static Vec Broadcast(float value) noexcept
+    {
+        return value;
+    }
+
+    static Vec MulAdd(Vec a, Vec b, Vec c) noexcept
+    {
+        return a * b + c;
+    }
+
+    static Vec Max(Vec a, Vec b) noexcept
+    {
+        return a < b ? b : a;
+    }
+
+    static Vec Zero() noexcept
+    {
+        return 0.0f;
+    }
+};
+
+/**
+ * Computes a `Rows` x (`Cols` x `Traits::width`) block of the output. The block is kept in
+ * registers while the kernel rows `0..depth` are accumulated into it.
+ *
+ * @param in the first input element of the block
+ * @param inStride the distance between two consecutive samples of the input
+ * @param weight the first kernel element of the block
+ * @param rowStride the distance between two consecutive rows of the kernel
+ * @param colStride the distance between two consecutive vectors of one kernel row
+ * @param out the first output element of the block
+ * @param outStride the distance between two consecutive samples of the output
+ * @param depth the number of kernel rows to accumulate
+ * @param bias the bias to start from, or `nullptr` to continue from the values in `out`
+ * @param relu whether to apply ReLU before storing the block
+ */
+template <typename Traits, size_t Rows, size_t Cols, typename In>
+inline void MicroKernel(In const*    in,
+                        size_t       inStride,
+                        float const* weight,
+                        size_t       rowStride,
+                        size_t       colStride,
+                        float*       out,
+                        size_t       outStride,
+                        size_t       depth,
+                        float const* bias,
+                        bool         relu)
+{
+    using Vec = typename Traits::Vec;
+
+    Vec acc[Rows][Cols];
+    for (size_t r = 0; r < Rows; ++r)
+        for (size_t c = 0; c < Cols; ++c)
+            acc[r][c] = Traits::Load((bias ? bias : out + r * outStride) + c * Traits::width);
+
+    for (size_t k = 0; k < depth; ++k)
+    {
+        Vec w[Cols];
+        for (size_t c = 0; c < Cols; ++c) w[c] = Traits::Load(weight + c * colStride);
+
+        for (size_t r = 0; r < Rows; ++r)
+        {
+            Vec x { Traits::Broadcast((float)in[r * inStride + k]) };
+            for (size_t c = 0; c < Cols; ++c) acc[r][c] = Traits::MulAdd(x, w[c], acc[r][c]);
+        }
+        weight += rowStride;
+    }
+
+    for (size_t r = 0; r < Rows; ++r)
+    {
+        for (size_t c = 0; c < Cols; ++c)
+        {
+            if (relu)
+                acc[r][c] = Traits::Max(acc[r][c], Traits::Zero());
+            Traits::Store(out + r * outStride + c * Traits::width, acc[r][c]);
+        }
+    }
+}
+
+/**
+ * Calls `MicroKernel` with `Rows` set to the given runtime value, which is at most `MaxRows`.
+ */
+template <typename Traits, size_t Cols, size_t MaxRows, typename In>
+inline void MicroKernelRows(size_t       rows,
+                            In const*    in,
+                            size_t       inStride,
+                            float const* weight,
+                            size_t       rowStride,
+                            size_t       colStride,
+                            float*       out,
+                            size_t       outStride,
+                            size_t       depth,
+                            float const* bias,
+                            bool         relu)
+{
+    if constexpr (MaxRows > 1)
+    {
+        if (rows < MaxRows)
+            return MicroKernelRows<Traits, Cols, MaxRows - 1>(rows,
+                                                              in,
+                                                              inStride,
+                                                              weight,
+                                                              rowStride,
+                                                              colStride,
+                                                              out,
+                                                              outStride,
+                                                              depth,
+                                                              bias,
+                                                              relu);
+    }
+    MicroKernel<Traits, MaxRows, Cols>(
+        in, inStride, weight, rowStride, colStride, out, outStride, depth, bias, relu);
+}
+
+/**
+ * Vectorized implementation of `Dense::ApplyBatch`. With `RawLayout`, columns that do not fill a
+ * whole vector are computed with scalar instructions; with `PackedLayout`, they are computed as a
+ * whole vector into a scratch block, of which only the valid columns are copied. `In` is the type
+ * of the input elements, which are converted to `float` as they are loaded.
+ */
+template <typename Traits, typename Layout, typename In>
+void ApplyBatch(In const*            in,
+                float*               out,
+                size_t               batchSize,
+                float const*         weight,
+                float const*         bias,
+                size_t               inputSize,
+                size_t               outputSize,
+                DenseBlocking const& blocking,
+                bool                 relu)
+{
+    constexpr size_t width     = Traits::width;
+    constexpr size_t cols      = 2;
+    constexpr size_t rows      = Traits::rows;
+    constexpr size_t tileWidth = cols * width;
+
+    Layout const layout { weight, inputSize, outputSize };
+    size_t const rowStride = layout.GetRowStride();
+
+    size_t const sampleStep = Max(blocking.numSamples, 1);
+    size_t const inputStep  = Max(blocking.numInputs, 1);
+    size_t const outputStep = Max(blocking.numOutputs / tileWidth, 1) * tileWidth;
+
+    for (size_t s0 = 0; s0 < batchSize; s0 += sampleStep)
+    {
+        size_t const s1 = Min(s0 + sampleStep, batchSize);
+        for (size_t o0 = 0; o0 < outputSize; o0 += outputStep)
+        {
+            size_t const o1 = Min(o0 + outputStep, outputSize);
+            for (size_t i0 = 0; i0 < inputSize; i0 += inputStep)
+            {
+                size_t const i1        = Min(i0 + inputStep, inputSize);
+                float const* tileBias  = i0 == 0 ? bias : nullptr;
+                bool const   tileRelu  = relu && i1 == inputSize;
+                size_t const depth     = i1 - i0;
+                In const*    tileInput = in + i0;
+
+                for (size_t s = s0; s < s1; s += rows)
+                {
+                    size_t const numRows = Min(rows, s1 - s);
+                    size_t       o       = o0;
+                    for (; o + tileWidth <= o1; o += tileWidth)
+                    {
+                        float const* w { layout.At(i0, o) };
+                        MicroKernelRows<Traits, cols, rows>(numRows,
+                                                            tileInput + s * inputSize,
+                                                            inputSize,
+                                                            w,
+                                                            rowStride,
+                                                            layout.At(i0, o + width) - w,
+                                                            out + s * outputSize + o,
+                                                            outputSize,
+                                                            depth,
+                                                            tileBias ? tileBias + o : nullptr,
+                                                            tileRelu);
+                    }
+                    for (; o + width <= o1; o += width)
+                    {
+                        MicroKernelRows<Traits, 1, rows>(numRows,
+                                                         tileInput + s * inputSize,
+                                                         inputSize,
+                                                         layout.At(i0, o),
+                                                         rowStride,
+                                                         0,
+                                                         out + s * outputSize + o,
+                                                         outputSize,
+                                                         depth,
+                                                         tileBias ? tileBias + o : nullptr,
+                                                         tileRelu);
+                    }
+                    if (o == o1)
+                        continue;
+
+                    if constexpr (Layout::padded)
+                    {
+                        // The padded columns must not be stored to `out`.
+                        float block[rows * width];
+                        for (size_t r = 0; r < numRows && !tileBias; ++r)
+                            for (size_t oo = o; oo < o1; ++oo)
+                                block[r * width + oo - o] = out[(s + r) * outputSize + oo];
+
+                        MicroKernelRows<Traits, 1, rows>(numRows,
+                                                         tileInput + s * inputSize,
+                                                         inputSize,
+                                                         layout.At(i0, o),
+                                                         rowStride,
+                                                         0,
+                                                         block,
+                                                         width,
+                                                         depth,
+                                                         tileBias ? tileBias + o : nullptr,
+                                                         tileRelu);
+
+                        for (size_t r = 0; r < numRows; ++r)
+                            for (size_t oo = o; oo < o1; ++oo)
+                                out[(s + r) * outputSize + oo] = block[r * width + oo - o];
+                    }
+                    else
+                    {
+                        for (size_t r = s; r < s + numRows; ++r)
+                        {
+                            In const*    x = in + r * inputSize;
+                            float*       y = out + r * outputSize;
+                            for (size_t oo = o; oo < o1; ++oo)
+                            {
+                                float acc = tileBias ? tileBias[oo] : y[oo];
+                                for (size_t i = i0; i < i1; ++i)
+                                    acc += (float)x[i] * *layout.At(i, oo);
+                                y[oo] = tileRelu && acc < 0.0f ? 0.0f : acc;
+                            }
+                        }
+                    }
+                }
+            }
+        }
+    }
+}
+
+/**
+ * The number of vectors of output one pass of `SparseMicroKernel` accumulates. Unlike the dense
+ * micro-kernel, no input is shared between samples, so the accumulators of one sample must hide
+ * the latency of the multiply-adds on their own.
+ */
+constexpr size_t sparseCols = 8;
+
+/**
+ * Computes `Cols` x `Traits::width` outputs of one sample from its nonzero inputs: the bias plus
+ * the kernel row of each nonzero input scaled by its value.
+ *
+ * @param layout the kernel matrix
+ * @param o the first output column of the block
+ * @param indices the indices of the nonzero inputs
+ * @param values the nonzero inputs
+ * @param numNonzeros the number of nonzero inputs
+ * @param bias the bias of the first output column of the block
+ * @param out the first output element of the block
+ * @param relu whether to apply ReLU before storing the block
+ */
+template <typename Traits, size_t Cols, typename Layout>
+inline void SparseMicroKernel(Layout const&   layout,
+                              size_t          o,
+                              uint32_t const* indices,
+                              float const*    values,
+                              size_t          numNonzeros,
+                              float const*    bias,
+                              float*          out,
+                              bool            relu)
+{
+    using Vec = typename Traits::Vec;
+
+    size_t const rowStride = layout.GetRowStride();
+    Vec          acc[Cols];
+    float const* weight[Cols];
+    for (size_t c = 0; c < Cols; ++c)
+    {
+        acc[c]    = Traits::Load(bias + c * Traits::width);
+        weight[c] = layout.At(0, o + c * Traits::width);
+    }
+
+    for (size_t k = 0; k < numNonzeros; ++k)
+    {
+        Vec const    x { Traits::Broadcast(values[k]) };
+        size_t const row { indices[k] * rowStride };
+        for (size_t c = 0; c < Cols; ++c)
+            acc[c] = Traits::MulAdd(x, Traits::Load(weight[c] + row), acc[c]);
+    }
+
+    for (size_t c = 0; c < Cols; ++c)
+    {
+        if (relu)
+            acc[c] = Traits::Max(acc[c], Traits::Zero());
+        Traits::Store(out + c * Traits::width, acc[c]);
+    }
+}
+
+/**
+ * Computes all outputs of one sample from its nonzero inputs. With `RawLayout`, columns that do
+ * not fill a whole vector are computed with scalar instructions; with `PackedLayout`, they are
+ * computed as a whole vector into a scratch block, of which only the valid columns are copied.
+ */
+template <typename Traits, typename Layout>
+inline void SparseRow(Layout const&   layout,
+                      uint32_t const* indices,
+                      float const*    values,
+                      size_t          numNonzeros,
+                      float const*    bias,
+                      float*          out,
+                      size_t          outputSize,
+                      bool            relu)
+{
+    constexpr size_t width     = Traits::width;
+    constexpr size_t tileWidth = sparseCols * width;
+
+    size_t o = 0;
+    for (; o + tileWidth <= outputSize; o += tileWidth)
+        SparseMicroKernel<Traits, sparseCols>(
+            layout, o, indices, values, numNonzeros, bias + o, out + o, relu);
+    for (; o + width <= outputSize; o += width)
+        SparseMicroKernel<Traits, 1>(
+            layout, o, indices, values, numNonzeros, bias + o, out + o, relu);
+    if (o == outputSize)
+        return;
+
+    if constexpr (Layout::padded)
+    {
+        // The padded columns must not be stored to `out`.
+        float block[width];
+        SparseMicroKernel<Traits, 1>(
+            layout, o, indices, values, numNonzeros, bias + o, block, relu);
+        for (size_t oo = o; oo < outputSize; ++oo) out[oo] = block[oo - o];
+    }
+    else
+    {
+        for (size_t oo = o; oo < outputSize; ++oo)
+        {
+            float acc = bias[oo];
+            for (size_t k = 0; k < numNonzeros; ++k) acc += values[k] * *layout.At(indices[k], oo);
+            out[oo] = relu && acc < 0.0f ? 0.0f : acc;
+        }
+    }
+}
+
+/**
+ * Vectorized implementation of `Dense::ApplySparse`. Each sample is computed on its own, since
+ * samples share no nonzero inputs to reuse the kernel rows for.
+ */
+template <typename Traits, typename Layout>
+void ApplySparse(uint32_t const* offsets,
+                 uint32_t const* indices,
+                 float const*    values,
+                 size_t          numSamples,
+                 float*          out,
+                 float const*    weight,
+                 float const*    bias,
+                 size_t          inputSize,
+                 size_t          outputSize,
+                 bool            relu)
+{
+    Layout const layout { weight, inputSize, outputSize };
+    for (size_t s = 0; s < numSamples; ++s)
+    {
+        size_t const begin = offsets[s];
+        SparseRow<Traits>(layout,
+                          indices + begin,
+                          values + begin,
+                          offsets[s + 1] - begin,
+                          bias,
+                          out + s * outputSize,
+                          outputSize,
+                          relu);
+    }
+}
+
+/**
+ * Computes one layer of `StaticNetwork` for `Rows` samples. Every size is a compile-time constant.
+ *
+ * @param in the input matrix of dimension (`Rows`, `Input`) with the given stride
+ * @param out the output matrix of dimension (`Rows`, `Output` padded to `Weight::panelWidth`)
+ */
+template <typename Traits, size_t Rows, size_t Input, size_t Output, typename In>
+inline void StaticLayer(In const*    in,
+                        size_t       inStride,
+                        float*       out,
+                        float const* kernel,
+                        float const* bias,
+                        bool         relu)
+{
+    constexpr size_t width        = Traits::width;
+    constexpr size_t cols         = 2;
+    constexpr size_t tileWidth    = cols * width;
+    constexpr size_t paddedOutput = (Output + Weight::panelWidth - 1) / Weight::panelWidth
+                                    * Weight::panelWidth;
+
+    PackedLayout const layout { kernel, Input, paddedOutput };
+    constexpr size_t   rowStride = Weight::panelWidth;
+
+    // Since `paddedOutput` is a multiple of the panel width, which is a multiple of `width`, the
+    // columns are covered by whole vectors.
+    size_t o = 0;
+    for (; o + tileWidth <= paddedOutput; o += tileWidth)
+    {
+        float const* w { layout.At(0, o) };
+        MicroKernel<Traits, Rows, cols>(
+            in, inStride, w, rowStride, layout.At(0, o + width) - w, out + o, paddedOutput, Input,
+            bias + o, relu);
+    }
+    for (; o < paddedOutput; o += width)
+    {
+        MicroKernel<Traits, Rows, 1>(
+            in, inStride, layout.At(0, o), rowStride, 0, out + o, paddedOutput, Input, bias + o,
+            relu);
+    }
+}
+
+/**
+ * Computes the remaining layers of `StaticNetwork` for `Rows` samples, of which the first
+ * `numSamples` are stored to `out`. Every layer but the last is followed by ReLU; the last one is
+ * if `lastRelu` is `true`.
+ */
+template <typename Traits, typename In, size_t Rows, size_t Input, size_t Output, size_t... Rest>
+inline void StaticLayers(In const*           in,
+                         size_t              inStride,
+                         size_t              numSamples,
+                         float*              out,
+                         float const* const* kernels,
+                         float const* const* biases,
+                         bool                lastRelu)
+{
+    constexpr size_t paddedOutput = (Output + Weight::panelWidth - 1) / Weight::panelWidth
+                                    * Weight::panelWidth;
+
+    alignas(64) float activation[Rows * paddedOutput];
+    StaticLayer<Traits, Rows, Input, Output>(
+        in, inStride, activation, kernels[0], biases[0], sizeof...(Rest) > 0 || lastRelu);
+
+    if constexpr (sizeof...(Rest) > 0)
+    {
+        StaticLayers<Traits, float, Rows, Output, Rest...>(
+            activation, paddedOutput, numSamples, out, kernels + 1, biases + 1, lastRelu);
+    }
+    else
+    {
+        for (size_t r = 0; r < numSamples; ++r)
+            for (size_t o = 0; o < Output; ++o) out[r * Output + o] = activation[r * paddedOutput + o];
+    }
+}
+
+/**
+ * Implementation of `StaticNetwork::Forward`. Samples go through all layers in groups of
+ * `Traits::rows`; a last, incomplete group is copied into a zero-filled block first.
+ */
+template <typename Traits, typename In, size_t Input, size_t... Rest>
+void StaticForward(In const*           in,
+                   size_t              numSamples,
+                   float*              out,
+                   float const* const* kernels,
+                   float const* const* biases,
+                   bool                lastRelu)
+{
+    constexpr size_t rows   = Traits::rows;
+    constexpr size_t output = StaticNetwork<Input, Rest...>::widths.back();
+
+    size_t s = 0;
+    for (; s + rows <= numSamples; s += rows)
+        StaticLayers<Traits, In, rows, Input, Rest...>(
+            in + s * Input, Input, rows, out + s * output, kernels, biases, lastRelu);
+
+    if (s < numSamples)
+    {
+        alignas(64) In block[rows * Input] {};
+        for (size_t i = 0; i < (numSamples - s) * Input; ++i) block[i] = in[s * Input + i];
+
+        StaticLayers<Traits, In, rows, Input, Rest...>(
+            block, Input, numSamples - s, out + s * output, kernels, biases, lastRelu);
+    }
+}
+
+/**
+ * Implementation of `StaticNetwork::Forward` for inputs of `SparseBatch`. The first layer of each
+ * group of `Traits::rows` samples is computed from the nonzero inputs, and the other layers as by
+ * `StaticForward`.
+ */
+template <typename Traits, size_t Input, size_t Output, size_t... Rest>
+void StaticForwardSparse(uint32_t const*     offsets,
+                         uint32_t const*     indices,
+                         float const*        values,
+                         size_t              numSamples,
+                         float*              out,
+                         float const* const* kernels,
+                         float const* const* biases,
+                         bool                lastRelu)
+{
+    constexpr size_t rows         = Traits::rows;
+    constexpr size_t output       = StaticNetwork<Input, Output, Rest...>::widths.back();
+    constexpr size_t paddedOutput = (Output + Weight::panelWidth - 1) / Weight::panelWidth
+                                    * Weight::panelWidth;
+
+    PackedLayout const layout { kernels[0], Input, paddedOutput };
+    bool const         relu = sizeof...(Rest) > 0 || lastRelu;
+
+    for (size_t s = 0; s < numSamples; s += rows)
+    {
+        size_t const numRows = Min(rows, numSamples - s);
+
+        // The rows past the last sample are zero-filled, as the block of `StaticForward` is.
+        alignas(64) float activation[rows * paddedOutput];
+        for (size_t r = 0; r < rows; ++r)
+        {
+            float* y = activation + r * paddedOutput;
+            if (r < numRows)
+            {
+                size_t const begin = offsets[s + r];
+                SparseRow<Traits>(layout,
+                                  indices + begin,
+                                  values + begin,
+                                  offsets[s + r + 1] - begin,
+                                  biases[0],
+                                  y,
+                                  paddedOutput,
+                                  relu);
+            }
+            else
+            {
+                for (size_t o = 0; o < paddedOutput; ++o) y[o] = 0.0f;
+            }
+        }
+
+        if constexpr (sizeof...(Rest) > 0)
+        {
+            StaticLayers<Traits, float, rows, Output, Rest...>(activation,
+                                                               paddedOutput,
+                                                               numRows,
+                                                               out + s * output,
+                                                               kernels + 1,
+                                                               biases + 1,
+                                                               lastRelu);
+        }
+        else
+        {
+            for (size_t r = 0; r < numRows; ++r)
+                for (size_t o = 0; o < Output; ++o)
+                    out[(s + r) * Output + o] = activation[r * paddedOutput + o];
+        }
+    }
+}
+
+/**
+ * Returns `StaticForward` instantiated with the widths of the given `StaticNetwork` type.
+ */
+template <typename Traits, typename In, size_t... Widths>
+auto GetStaticForward(StaticNetwork<Widths...> const*) noexcept
+{
+    return &StaticForward<Traits, In, Widths...>;
+}
+
+/**
+ * Returns `StaticForwardSparse` instantiated with the widths of the given `StaticNetwork` type.
+ */
+template <typename Traits, size_t... Widths>
+auto GetStaticForwardSparse(StaticNetwork<Widths...> const*) noexcept
+{
+    return &StaticForwardSparse<Traits, Widths...>;
+}
+
+/**
+ * Returns the implementations of `Dense::ApplyBatch`, `Dense::ApplySparse` and
+ * `MnistNetwork::Forward` using the given traits.
+ */
+template <typename Traits>
+DenseKernels MakeDenseKernels() noexcept
+{
+    return DenseKernels {
+        &ApplyBatch<Traits, RawLayout, float>,
+        &ApplyBatch<Traits, PackedLayout, float>,
+        &ApplyBatch<Traits, RawLayout, uint8_t>,
+        &ApplyBatch<Traits, PackedLayout, uint8_t>,
+        &ApplySparse<Traits, RawLayout>,
+        &ApplySparse<Traits, PackedLayout>,
+        GetStaticForward<Traits, float>((MnistNetwork const*)nullptr),
+        GetStaticForward<Traits, uint8_t>((MnistNetwork const*)nullptr),
+        GetStaticForwardSparse<Traits>((MnistNetwork const*)nullptr),
+    };
+}
+
+}
+
+}
+
+}
+
+#endif
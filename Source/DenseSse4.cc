@@ -0,0 +1,72 @@
+// Copyright (c) 2021 Chanjung Kim. All rights reserved.
+// Licensed under the MIT License.
+
+#if defined(__SSE4_1__)
+#    include <immintrin.h>
+#endif
+
+#include "DenseKernel.hh"
+
+namespace mf
+{
+
+#if defined(__SSE4_1__)
+
+namespace
+{
+
+struct Sse4Traits
+{
+    using Vec = __m128;
+
+    constexpr static size_t width { 4 };
+    constexpr static size_t rows { 4 };
+
+    static Vec Load(float const* ptr) noexcept
+    {
+        return _mm_loadu_ps(ptr);
+    }
+
+    static void Store(float* ptr, Vec value) noexcept
+    {
+        _mm_storeu_ps(ptr, value);
+    }
+
+    static Vec Broadcast(float value) noexcept
+    {
+        return _mm_set1_ps(value);
+    }
+
+    static Vec MulAdd(Vec a, Vec b, Vec c) noexcept
+    {
+        return _mm_add_ps(_mm_mul_ps(a, b), c);
+    }
+
+    static Vec Max(Vec a, Vec b) noexcept
+    {
+        return _mm_max_ps(a, b);
+    }
+
+    static Vec Zero() noexcept
+    {
+        return _mm_setzero_ps();
+    }
+};
+
+}
+
+DenseKernels GetDenseKernelsSse4() noexcept
+{
+    return dense_kernel::MakeDenseKernels<Sse4Traits>();
+}
+
+#else
+
+DenseKernels GetDenseKernelsSse4() noexcept
+{
+    return DenseKernels {};
+}
+
+#endif
+
+}
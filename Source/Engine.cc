@@ -0,0 +1,165 @@
+// Copyright (c) 2021 Chanjung Kim. All rights reserved.
+// Licensed under the MIT License.
+
+#include <mf/Engine.hh>
+#include <mf/PerfCounters.hh>
+#include <mf/Trace.hh>
+
+#include <algorithm>
+#include <stdexcept>
+
+namespace mf
+{
+
+Engine Engine::MakeFromPlan(std::shared_ptr<ExecutionPlan const> plan,
+                            DenseBlocking const&                 blocking,
+                            bool                                 fused,
+                            double                               sparseThreshold)
+{
+    if (!plan)
+        throw std::invalid_argument { "plan" };
+
+    return Engine { std::move(plan), blocking, fused, sparseThreshold };
+}
+
+Engine Engine::MakeFromWeights(WeightCollection const&         weights,
+                               std::vector<std::string> const& layerNames,
+                               size_t                          batchSize,
+                               DenseBlocking const&            blocking)
+{
+    std::vector<LayerSpec> layers;
+    for (auto& layerName : layerNames) layers.push_back(LayerSpec { layerName, Activation::Relu });
+
+    return MakeFromPlan(
+        std::make_shared<ExecutionPlan const>(ExecutionPlan::Compile(weights, layers, batchSize)),
+        blocking);
+}
+
+Engine::Engine(std::shared_ptr<ExecutionPlan const>&& plan,
+               DenseBlocking const&                   blocking,
+               bool                                   fused,
+               double                                 sparseThreshold) :
+    _plan { std::move(plan) },
+    _blocking { blocking },
+    _sparseThreshold { sparseThreshold },
+    _arena(_plan->GetArenaSize(), 0.0f)
+{
+    auto const& steps { _plan->GetSteps() };
+
+    // The sparse batch has room for the widest input of a full batch, so that encoding any layer
+    // allocates nothing.
+    if (_sparseThreshold > 0.0)
+    {
+        size_t inputSize = 0;
+        for (auto const& step : steps) inputSize = std::max(inputSize, step.layer->GetInputSize());
+        _sparse = SparseBatch { GetBatchSize(), inputSize };
+    }
+
+    bool const  hiddenRelu { std::all_of(steps.begin(), steps.end() - 1, [](auto const& step) {
+        return step.activation == Activation::Relu;
+    }) };
+    if (fused && hiddenRelu)
+        _mnistNetwork = MnistNetwork::TryMakeFromWeights(_plan->GetLayers(),
+                                                         _plan->GetOutputActivation()
+                                                             == Activation::Relu);
+}
+
+template <typename In>
+bool Engine::TryEncodeSparse(In const* in, size_t numSamples, size_t inputSize)
+{
+    if (_sparseThreshold <= 0.0
+        || SparseBatch::GetDensity(in, numSamples * inputSize) >= _sparseThreshold)
+        return false;
+
+    MF_TRACE_SPAN("SparseBatch::Encode", "samples", numSamples);
+    _sparse.Encode(in, numSamples, inputSize);
+    return true;
+}
+
+template <typename In>
+float const* Engine::ForwardWith(In const* in, size_t numSamples, bool normalize)
+{
+    if (numSamples > GetBatchSize())
+        throw std::invalid_argument { "numSamples" };
+
+    MF_TRACE_SPAN("Engine::Forward", "samples", numSamples);
+    float* const buffers[2] { _arena.data(), _arena.data() + _plan->GetBufferSize() };
+    bool const   softmax { _plan->GetOutputActivation() == Activation::Softmax };
+
+    // The network specialized for MNIST runs its layers fused, so they are counted as one stage.
+    if (_mnistNetwork)
+    {
+        PerfScope perf { "fused network", numSamples };
+        if (TryEncodeSparse(in, numSamples, GetInputSize()))
+            _mnistNetwork->Forward(_sparse, buffers[0]);
+        else
+            _mnistNetwork->Forward(in, numSamples, buffers[0]);
+        if (softmax && normalize)
+            Dense::Softmax(buffers[0], numSamples, GetOutputSize());
+        return buffers[0];
+    }
+
+    auto const& steps { _plan->GetSteps() };
+    auto        activationOf { [&](size_t i) {
+        bool const last { i + 1 == steps.size() };
+        return last && softmax && !normalize ? Activation::Linear : steps[i].activation;
+    } };
+
+    // The density is measured on every input, since the outputs zeroed by ReLU vary per batch.
+    auto const apply { [&](auto const* layerIn, float* layerOut, size_t i) {
+        MF_TRACE_SPAN("Dense::ApplyBatch", "layer", i);
+        PerfScope     perf { steps[i].name, numSamples };
+        Weight const& layer { *steps[i].layer };
+        if (TryEncodeSparse(layerIn, numSamples, layer.GetInputSize()))
+            Dense::ApplySparse(_sparse, layerOut, layer, activationOf(i));
+        else
+            Dense::ApplyBatch(layerIn, layerOut, numSamples, layer, _blocking, activationOf(i));
+    } };
+
+    float* layerOut = buffers[0];
+    apply(in, layerOut, 0);
+    for (size_t i = 1; i < steps.size(); ++i)
+    {
+        float const* layerIn = layerOut;
+        layerOut             = buffers[i % 2];
+        apply(layerIn, layerOut, i);
+    }
+
+    return layerOut;
+}
+
+template <typename In>
+void Engine::ClassifyWith(In const* in, size_t numSamples, MnistLabel* labels)
+{
+    float const* out        = ForwardWith(in, numSamples, false);
+    size_t const outputSize = GetOutputSize();
+
+    PerfScope perf { "argmax", numSamples };
+    for (size_t i = 0; i < numSamples; ++i)
+    {
+        float const* scores = out + i * outputSize;
+        labels[i] = (MnistLabel)std::distance(scores, std::max_element(scores, scores + outputSize));
+    }
+}
+
+float const* Engine::Forward(float const* in, size_t numSamples)
+{
+    return ForwardWith(in, numSamples, true);
+}
+
+float const* Engine::Forward(uint8_t const* in, size_t numSamples)
+{
+    return ForwardWith(in, numSamples, true);
+}
+
+void Engine::Classify(float const* in, size_t numSamples, MnistLabel* labels)
+{
+    ClassifyWith(in, numSamples, labels);
+}
+
+void Engine::Classify(uint8_t const* in, size_t numSamples, MnistLabel* labels)
+{
+    ClassifyWith(in, numSamples, labels);
+}
+
+}
@@ -0,0 +1,350 @@
+// Copyright (c) 2021 Chanjung Kim. All rights reserved.
+// Licensed under the MIT License.
+
+#include <mf/Evaluation.hh>
+
+#include <iomanip>
+#include <vector>
+
+namespace mf
+{
+
+ProgressReporter::ProgressReporter(std::ostream& os, std::chrono::milliseconds interval) :
+    _os { os },
+    _interval { interval },
+    _numSamples { 0 },
+    _numCorrect { 0 },
+    _stop { false },
+    _thread { &ProgressReporter::Run, this }
+{}
+
+ProgressReporter::~ProgressReporter()
+{
+    {
+        std::lock_guard<std::mutex> lock { _mutex };
+        _stop = true;
+    }
+    _stopped.notify_one();
+    _thread.join();
+}
+
+void ProgressReporter::Run()
+{
+    size_t                       lastNumSamples = 0;
+    std::unique_lock<std::mutex> lock { _mutex };
+    while (!_stopped.wait_for(lock, _interval, [this] { return _stop; }))
+    {
+        size_t numSamples = _numSamples.load(std::memory_order_relaxed);
+        size_t numCorrect = _numCorrect.load(std::memory_order_relaxed);
+        if (numSamples == lastNumSamples)
+            continue;
+
+        _os << numCorrect << " out of " << numSamples << std::endl;
+        lastNumSamples = numSamples;
+    }
+}
+
+namespace
+{
+
+/**
+ * The result of one worker, padded to a cache line so that workers do not write to the same line.
+ */
+struct alignas(64) ThreadResult
+{
+    EvaluationResult        result {};
+    std::vector<MnistLabel> predictions;
+};
+
+/**
+ * Counts the given predictions into the result.
+ */
+void CountChunk(MnistLabel const* labels,
+                MnistLabel const* predictions,
+                size_t            numSamples,
+                EvaluationResult& result,
+                ProgressReporter* reporter) noexcept
+{
+    size_t numCorrect = 0;
+    for (size_t i = 0; i < numSamples; ++i)
+    {
+        auto label      = (size_t)labels[i];
+        auto prediction = (size_t)predictions[i];
+        if (label < numMnistLabels && prediction < numMnistLabels)
+            ++result.confusion[label][prediction];
+        if (label == prediction)
+            ++numCorrect;
+    }
+    result.numSamples += numSamples;
+    result.numCorrect += numCorrect;
+
+    if (reporter)
+        reporter->Add(numSamples, numCorrect);
+}
+
+/**
+ * Classifies the given samples and counts the results.
+ */
+template <typename EngineType, typename In>
+void ClassifyChunk(EngineType&       engine,
+                   In const*         images,
+                   MnistLabel const* labels,
+                   size_t            numSamples,
+                   ThreadResult&     threadResult,
+                   ProgressReporter* reporter)
+{
+    auto& [result, predictions] = threadResult;
+    engine.Classify(images, numSamples, predictions.data());
+    CountChunk(labels, predictions.data(), numSamples, result, reporter);
+}
+
+/**
+ * Classifies the given samples on the device and counts the results of each batch as soon as it
+ * is read back.
+ */
+template <typename EngineType, typename In>
+void ClassifyOnDevice(EngineType&       engine,
+                      In const*         images,
+                      MnistLabel const* labels,
+                      size_t            numSamples,
+                      EvaluationResult& result,
+                      ProgressReporter* reporter)
+{
+    std::vector<MnistLabel> predictions(numSamples);
+    engine.Classify(images, numSamples, predictions.data(), [&](size_t begin, size_t count) {
+        CountChunk(labels + begin, predictions.data() + begin, count, result, reporter);
+    });
+}
+
+/**
+ * Sums the results of the workers.
+ */
+EvaluationResult SumResults(std::vector<ThreadResult> const& results) noexcept
+{
+    EvaluationResult rtn {};
+    for (auto& [result, predictions] : results)
+    {
+        rtn.numSamples += result.numSamples;
+        rtn.numCorrect += result.numCorrect;
+        for (size_t i = 0; i < numMnistLabels; ++i)
+            for (size_t j = 0; j < numMnistLabels; ++j) rtn.confusion[i][j] += result.confusion[i][j];
+    }
+
+    return rtn;
+}
+
+/**
+ * Implementation of `Evaluation::Evaluate` for any engine type with `Classify`.
+ */
+template <typename EngineType>
+EvaluationResult EvaluateWith(EngineType const& engine,
+                              Mnist const&      mnist,
+                              ThreadPool&       pool,
+                              ProgressReporter* reporter)
+{
+    size_t const numThreads = pool.GetNumThreads();
+    size_t const imageSize  = engine.GetInputSize();
+
+    std::vector<EngineType>   engines(numThreads, engine);
+    std::vector<ThreadResult> results(numThreads);
+    for (auto& result : results) result.predictions.resize(engine.GetBatchSize());
+
+    auto const& images     = mnist.GetImages();
+    auto const& byteImages = mnist.GetByteImages();
+    auto const& labels     = mnist.GetLabels();
+    pool.ParallelFor(
+        0,
+        mnist.GetNumSamples(),
+        engine.GetBatchSize(),
+        [&](size_t threadIndex, size_t begin, size_t end) {
+            if (mnist.GetPixelFormat() == MnistPixelFormat::Byte)
+                ClassifyChunk(engines[threadIndex],
+                              byteImages.data() + begin * imageSize,
+                              labels.data() + begin,
+                              end - begin,
+                              results[threadIndex],
+                              reporter);
+            else
+                ClassifyChunk(engines[threadIndex],
+                              images.data() + begin * imageSize,
+                              labels.data() + begin,
+                              end - begin,
+                              results[threadIndex],
+                              reporter);
+        });
+
+    return SumResults(results);
+}
+
+/**
+ * Implementation of `Evaluation::Evaluate` taking a `MnistStream` for any engine type with
+ * `Classify`. Each batch of the stream is split among the workers while the stream reads the next
+ * batches in the background.
+ */
+template <typename EngineType>
+EvaluationResult EvaluateStreamWith(EngineType const& engine,
+                                    MnistStream&      stream,
+                                    ThreadPool&       pool,
+                                    ProgressReporter* reporter)
+{
+    size_t const numThreads = pool.GetNumThreads();
+    size_t const imageSize  = engine.GetInputSize();
+
+    std::vector<EngineType>   engines(numThreads, engine);
+    std::vector<ThreadResult> results(numThreads);
+    for (auto& result : results) result.predictions.resize(engine.GetBatchSize());
+
+    MnistBatch batch;
+    while (stream.Next(batch))
+    {
+        pool.ParallelFor(
+            0,
+            batch.numSamples,
+            engine.GetBatchSize(),
+            [&](size_t threadIndex, size_t begin, size_t end) {
+                ClassifyChunk(engines[threadIndex],
+                              batch.images + begin * imageSize,
+                              batch.labels + begin,
+                              end - begin,
+                              results[threadIndex],
+                              reporter);
+            });
+    }
+
+    return SumResults(results);
+}
+
+
+/**
+ * Classifies every sample of the dataset on the device.
+ */
+template <typename EngineType>
+EvaluationResult EvaluateOnDevice(EngineType& engine, Mnist const& mnist, ProgressReporter* reporter)
+{
+    EvaluationResult rtn {};
+    if (mnist.GetPixelFormat() == MnistPixelFormat::Byte)
+        ClassifyOnDevice(engine,
+                         mnist.GetByteImages().data(),
+                         mnist.GetLabels().data(),
+                         mnist.GetNumSamples(),
+                         rtn,
+                         reporter);
+    else
+        ClassifyOnDevice(engine,
+                         mnist.GetImages().data(),
+                         mnist.GetLabels().data(),
+                         mnist.GetNumSamples(),
+                         rtn,
+                         reporter);
+
+    return rtn;
+}
+
+/**
+ * Classifies every sample read from the stream on the device, one batch of the stream at a time.
+ */
+template <typename EngineType>
+EvaluationResult EvaluateStreamOnDevice(EngineType&       engine,
+                                        MnistStream&      stream,
+                                        ProgressReporter* reporter)
+{
+    EvaluationResult rtn {};
+    MnistBatch       batch;
+    while (stream.Next(batch))
+        ClassifyOnDevice(engine, batch.images, batch.labels, batch.numSamples, rtn, reporter);
+
+    return rtn;
+}
+}
+
+EvaluationResult Evaluation::Evaluate(Engine const&     engine,
+                                      Mnist const&      mnist,
+                                      ThreadPool&       pool,
+                                      ProgressReporter* reporter)
+{
+    return EvaluateWith(engine, mnist, pool, reporter);
+}
+
+EvaluationResult Evaluation::Evaluate(QuantizedEngine const& engine,
+                                      Mnist const&           mnist,
+                                      ThreadPool&            pool,
+                                      ProgressReporter*      reporter)
+{
+    return EvaluateWith(engine, mnist, pool, reporter);
+}
+
+EvaluationResult Evaluation::Evaluate(Engine const&     engine,
+                                      MnistStream&      stream,
+                                      ThreadPool&       pool,
+                                      ProgressReporter* reporter)
+{
+    return EvaluateStreamWith(engine, stream, pool, reporter);
+}
+
+EvaluationResult Evaluation::Evaluate(QuantizedEngine const& engine,
+                                      MnistStream&           stream,
+                                      ThreadPool&            pool,
+                                      ProgressReporter*      reporter)
+{
+    return EvaluateStreamWith(engine, stream, pool, reporter);
+}
+
+EvaluationResult Evaluation::Evaluate(ClEngine& engine, Mnist const& mnist, ProgressReporter* reporter)
+{
+    return EvaluateOnDevice(engine, mnist, reporter);
+}
+
+EvaluationResult Evaluation::Evaluate(ClEngine&         engine,
+                                      MnistStream&      stream,
+                                      ProgressReporter* reporter)
+{
+    return EvaluateStreamOnDevice(engine, stream, reporter);
+}
+
+EvaluationResult Evaluation::Evaluate(ClShardedEngine&  engine,
+                                      Mnist const&      mnist,
+                                      ProgressReporter* reporter)
+{
+    return EvaluateOnDevice(engine, mnist, reporter);
+}
+
+EvaluationResult Evaluation::Evaluate(ClShardedEngine&  engine,
+                                      MnistStream&      stream,
+                                      ProgressReporter* reporter)
+{
+    return EvaluateStreamOnDevice(engine, stream, reporter);
+}
+
+EvaluationResult Evaluation::Evaluate(HybridEngine&     engine,
+                                      Mnist const&      mnist,
+                                      ProgressReporter* reporter)
+{
+    return EvaluateOnDevice(engine, mnist, reporter);
+}
+
+EvaluationResult Evaluation::Evaluate(HybridEngine&     engine,
+                                      MnistStream&      stream,
+                                      ProgressReporter* reporter)
+{
+    return EvaluateStreamOnDevice(engine, stream, reporter);
+}
+
+void Evaluation::Print(std::ostream& os, EvaluationResult const& result)
+{
+    auto flags { os.flags() };
+    auto precision { os.precision() };
+    os << result.numCorrect << " out of " << result.numSamples << " (" << std::fixed
+       << std::setprecision(2) << result.GetAccuracy() * 100.0 << "%)" << std::endl;
+    os.flags(flags);
+    os.precision(precision);
+
+    os << "label \\ prediction" << std::endl;
+    for (size_t i = 0; i < numMnistLabels; ++i)
+    {
+        os << std::setw(5) << i << ":";
+        for (size_t j = 0; j < numMnistLabels; ++j) os << std::setw(7) << result.confusion[i][j];
+        os << std::endl;
+    }
+}
+
+}
@@ -0,0 +1,59 @@
+// Copyright (c) 2021 Chanjung Kim. All rights reserved.
+// Licensed under the MIT License.
+
+#include <mf/ExecutionPlan.hh>
+#include <mf/Trace.hh>
+
+#include <algorithm>
+#include <stdexcept>
+
+namespace mf
+{
+
+ExecutionPlan ExecutionPlan::Compile(WeightCollection const&       weights,
+                                     std::vector<LayerSpec> const& layers,
+                                     size_t                        batchSize)
+{
+    MF_TRACE_SPAN("ExecutionPlan::Compile");
+
+    if (layers.empty())
+        throw std::invalid_argument { "layers" };
+    if (batchSize == 0)
+        throw std::invalid_argument { "batchSize" };
+
+    std::vector<Step> steps;
+    for (auto& spec : layers)
+    {
+        auto it { weights.find(spec.name) };
+        if (it == weights.end())
+            throw LayerNotFoundException { spec.name };
+
+        if (!steps.empty() && steps.back().layer->GetOutputSize() != it->second.GetInputSize())
+            throw LayerShapeMismatchException { spec.name };
+
+        steps.push_back(Step { spec.name, &it->second, spec.activation });
+    }
+
+    return ExecutionPlan { std::move(steps), batchSize };
+}
+
+ExecutionPlan::ExecutionPlan(std::vector<Step>&& steps, size_t batchSize) :
+    _steps { std::move(steps) },
+    _batchSize { batchSize }
+{
+    size_t maxOutputSize = 0;
+    for (auto& step : _steps) maxOutputSize = std::max(maxOutputSize, step.layer->GetOutputSize());
+
+    // Rounded up so the second buffer starts on a cache line as well.
+    constexpr size_t lineFloats = cacheLineSize / sizeof(float);
+    _bufferSize = (batchSize * maxOutputSize + lineFloats - 1) / lineFloats * lineFloats;
+}
+
+std::vector<Weight const*> ExecutionPlan::GetLayers() const
+{
+    std::vector<Weight const*> rtn;
+    for (auto& step : _steps) rtn.push_back(step.layer);
+    return rtn;
+}
+
+}
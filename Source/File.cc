@@ -4,6 +4,14 @@
 #include <mf/File.hh>
 
 #include <fstream>
+#include <string>
+#include <system_error>
+#include <utility>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
 
 namespace mf
 {
@@ -25,4 +33,95 @@ std::vector<uint8_t> File::ReadFile(std::filesystem::path const& path)
     return vec;
 }
 
-}
\ No newline at end of file
+bool File::WriteFileAtomically(std::filesystem::path const&              path,
+                               std::function<void(std::ostream&)> const& write)
+{
+    std::error_code errorCode;
+    std::filesystem::create_directories(path.parent_path(), errorCode);
+
+    auto temporaryPath { path };
+    temporaryPath += "." + std::to_string(getpid()) + ".tmp";
+    {
+        std::ofstream ofs { temporaryPath, std::ios::binary };
+        write(ofs);
+        if (!ofs.flush())
+        {
+            ofs.close();
+            std::filesystem::remove(temporaryPath, errorCode);
+            return false;
+        }
+    }
+    std::filesystem::rename(temporaryPath, path, errorCode);
+    if (errorCode)
+    {
+        std::filesystem::remove(temporaryPath, errorCode);
+        return false;
+    }
+    return true;
+}
+
+MappedFile MappedFile::Open(std::filesystem::path const& path, MapHint hint)
+{
+    int fd { open(path.c_str(), O_RDONLY | O_CLOEXEC) };
+    if (fd < 0)
+        throw NoSuchFileException { path.string() };
+
+    struct stat status;
+    if (fstat(fd, &status) < 0)
+    {
+        close(fd);
+        throw NoSuchFileException { path.string() };
+    }
+
+    size_t const size = (size_t)status.st_size;
+    if (size == 0)
+    {
+        close(fd);
+        return MappedFile { nullptr, 0 };
+    }
+
+    int flags { MAP_SHARED };
+#ifdef MAP_POPULATE
+    if (hint == MapHint::Populate)
+        flags |= MAP_POPULATE;
+#endif
+
+    void* data { mmap(nullptr, size, PROT_READ, flags, fd, 0) };
+    close(fd);
+    if (data == MAP_FAILED)
+        throw NoSuchFileException { path.string() };
+
+    // Hints are advisory; failures are ignored.
+    if (hint == MapHint::Sequential)
+        madvise(data, size, MADV_SEQUENTIAL);
+    else if (hint == MapHint::WillNeed)
+        madvise(data, size, MADV_WILLNEED);
+
+    return MappedFile { (uint8_t const*)data, size };
+}
+
+MappedFile::MappedFile(MappedFile&& other) noexcept :
+    _data { std::exchange(other._data, nullptr) },
+    _size { std::exchange(other._size, 0) }
+{}
+
+MappedFile& MappedFile::operator=(MappedFile&& other) noexcept
+{
+    if (this != &other)
+    {
+        if (_data != nullptr)
+            munmap((void*)_data, _size);
+
+        _data = std::exchange(other._data, nullptr);
+        _size = std::exchange(other._size, 0);
+    }
+    return *this;
+}
+
+MappedFile::~MappedFile()
+{
+    if (_data != nullptr)
+        munmap((void*)_data, _size);
+}
+
+}
@@ -0,0 +1,195 @@
+// Copyright (c) 2021 Chanjung Kim. All rights reserved.
+// Licensed under the MIT License.
+
+#include <mf/HybridEngine.hh>
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <exception>
+#include <stdexcept>
+#include <thread>
+
+namespace mf
+{
+
+namespace
+{
+
+/**
+ * Returns the seconds elapsed since the given time.
+ */
+double GetElapsedTime(std::chrono::steady_clock::time_point begin)
+{
+    return std::chrono::duration<double> { std::chrono::steady_clock::now() - begin }.count();
+}
+
+/**
+ * Adds the throughput of the latest round to the given moving average.
+ */
+void UpdateThroughput(double& average, size_t numSamples, double time)
+{
+    if (numSamples == 0 || time <= 0.0)
+        return;
+
+    double const throughput { numSamples / time };
+    average = average == 0.0 ? throughput
+                             : average + HybridEngine::smoothing * (throughput - average);
+}
+
+}
+
+HybridEngine HybridEngine::MakeFromEngines(Engine const&   host,
+                                           ClShardedEngine device,
+                                           ThreadPool&     pool,
+                                           size_t          roundSize)
+{
+    if (host.GetBatchSize() != device.GetBatchSize()
+        || host.GetInputSize() != device.GetInputSize()
+        || host.GetOutputSize() != device.GetOutputSize())
+        throw std::invalid_argument { "device" };
+    if (roundSize == 0)
+        throw std::invalid_argument { "roundSize" };
+
+    return HybridEngine { host, std::move(device), pool, roundSize };
+}
+
+HybridEngine::HybridEngine(Engine const&     host,
+                           ClShardedEngine&& device,
+                           ThreadPool&       pool,
+                           size_t            roundSize) :
+    _hostEngines(pool.GetNumThreads(), host),
+    _device { std::move(device) },
+    _pool { &pool },
+    _roundSize { roundSize },
+    _statistics {},
+    _numIdleHostRounds { 0 },
+    _numIdleDeviceRounds { 0 }
+{
+}
+
+double HybridEngine::GetDeviceShare() const noexcept
+{
+    // Until both sides have been measured, they are assumed to be equally fast.
+    double const host { _statistics.hostThroughput };
+    double const device { _statistics.deviceThroughput };
+    return host == 0.0 || device == 0.0 ? 0.5 : device / (host + device);
+}
+
+size_t HybridEngine::GetDeviceCount(size_t numSamples) const noexcept
+{
+    size_t const batchSize  = GetBatchSize();
+    size_t const numBatches = (numSamples + batchSize - 1) / batchSize;
+    size_t       numDeviceBatches = (size_t)std::lround(GetDeviceShare() * numBatches);
+
+    // Until measured, the devices get a single batch, so that a slow device does not hold back the
+    // first round. A side left idle for too long gets one batch, so that a change of its load is
+    // noticed.
+    if (numBatches >= 2)
+    {
+        if (_statistics.deviceThroughput == 0.0)
+            numDeviceBatches = 1;
+        if (numDeviceBatches == 0 && _numIdleDeviceRounds + 1 >= probeInterval)
+            numDeviceBatches = 1;
+        if (numDeviceBatches == numBatches && _numIdleHostRounds + 1 >= probeInterval)
+            numDeviceBatches = numBatches - 1;
+    }
+    return std::min(numDeviceBatches * batchSize, numSamples);
+}
+
+template <typename In>
+void HybridEngine::ClassifyWith(In const*            in,
+                                size_t               numSamples,
+                                MnistLabel*          labels,
+                                BatchCallback const& onBatch)
+{
+    size_t const inputSize = GetInputSize();
+    size_t const batchSize = GetBatchSize();
+    for (size_t begin = 0; begin < numSamples; begin += _roundSize)
+    {
+        size_t const count       = std::min(_roundSize, numSamples - begin);
+        size_t const deviceCount = GetDeviceCount(count);
+        size_t const hostBegin   = begin + deviceCount;
+        size_t const hostCount   = count - deviceCount;
+
+        // The host part runs on the pool while this thread drives the devices.
+        double             hostTime = 0.0;
+        std::exception_ptr hostException;
+        std::thread        host;
+        if (hostCount != 0)
+        {
+            host = std::thread { [&] {
+                auto hostStart { std::chrono::steady_clock::now() };
+                try
+                {
+                    _pool->ParallelFor(
+                        hostBegin,
+                        hostBegin + hostCount,
+                        batchSize,
+                        [&](size_t threadIndex, size_t first, size_t last) {
+                            _hostEngines[threadIndex].Classify(
+                                in + first * inputSize, last - first, labels + first);
+                        });
+                }
+                catch (...)
+                {
+                    hostException = std::current_exception();
+                }
+                hostTime = GetElapsedTime(hostStart);
+            } };
+        }
+
+        double             deviceTime = 0.0;
+        std::exception_ptr deviceException;
+        if (deviceCount != 0)
+        {
+            auto deviceStart { std::chrono::steady_clock::now() };
+            try
+            {
+                _device.Classify(in + begin * inputSize, deviceCount, labels + begin);
+            }
+            catch (...)
+            {
+                deviceException = std::current_exception();
+            }
+            deviceTime = GetElapsedTime(deviceStart);
+        }
+
+        if (host.joinable())
+            host.join();
+        if (deviceException)
+            std::rethrow_exception(deviceException);
+        if (hostException)
+            std::rethrow_exception(hostException);
+
+        _statistics.numHostSamples += hostCount;
+        _statistics.numDeviceSamples += deviceCount;
+        _statistics.hostTime += hostTime;
+        _statistics.deviceTime += deviceTime;
+        UpdateThroughput(_statistics.hostThroughput, hostCount, hostTime);
+        UpdateThroughput(_statistics.deviceThroughput, deviceCount, deviceTime);
+        _numIdleHostRounds   = hostCount == 0 ? _numIdleHostRounds + 1 : 0;
+        _numIdleDeviceRounds = deviceCount == 0 ? _numIdleDeviceRounds + 1 : 0;
+
+        if (onBatch)
+            onBatch(begin, count);
+    }
+}
+
+void HybridEngine::Classify(float const*         in,
+                            size_t               numSamples,
+                            MnistLabel*          labels,
+                            BatchCallback const& onBatch)
+{
+    ClassifyWith(in, numSamples, labels, onBatch);
+}
+
+void HybridEngine::Classify(uint8_t const*       in,
+                            size_t               numSamples,
+                            MnistLabel*          labels,
+                            BatchCallback const& onBatch)
+{
+    ClassifyWith(in, numSamples, labels, onBatch);
+}
+
+}
@@ -0,0 +1,105 @@
+// Copyright (c) 2021 Chanjung Kim. All rights reserved.
+// Licensed under the MIT License.
+
+#ifndef MNIST_FPGA_IDX_HEADER_HH
+#define MNIST_FPGA_IDX_HEADER_HH
+
+#include <mf/Mnist.hh>
+
+#include <cstdint>
+#include <filesystem>
+
+// Validation of the headers of IDX files, shared by every reader of the MNIST dataset that does
+// not go through `std::ifstream`.
+
+namespace mf
+{
+
+namespace idx
+{
+
+/**
+ * Reads a big-endian 32-bit integer from the given bytes.
+ */
+inline uint32_t ReadBigEndian(uint8_t const* bytes) noexcept
+{
+    return (uint32_t)bytes[0] << 24 | (uint32_t)bytes[1] << 16 | (uint32_t)bytes[2] << 8
+           | (uint32_t)bytes[3];
+}
+
+/**
+ * Validates the header of an image file and returns the number of images.
+ *
+ * @param header the first `Mnist::imageHeaderSize` bytes of the file
+ * @param fileSize the size of the file, which must not be less than `Mnist::imageHeaderSize`
+ * @param imagePath the path of the file, used in the error message
+ * @throws InvalidMnistDatasetException if the header is invalid or the file is shorter than the
+ * header says
+ */
+inline size_t ParseImageHeader(uint8_t const*               header,
+                               size_t                       fileSize,
+                               std::filesystem::path const& imagePath)
+{
+    constexpr size_t imageSize = MnistSample::height * MnistSample::width;
+
+    if (ReadBigEndian(header) != 0x00000803)
+        throw InvalidMnistDatasetException { imagePath.string() };
+
+    size_t const numImages = ReadBigEndian(header + 4);
+    if (ReadBigEndian(header + 8) != MnistSample::height
+        || ReadBigEndian(header + 12) != MnistSample::width)
+        throw InvalidMnistDatasetException { imagePath.string() };
+
+    if (fileSize - Mnist::imageHeaderSize < numImages * imageSize)
+        throw InvalidMnistDatasetException { imagePath.string() };
+
+    return numImages;
+}
+
+/**
+ * Validates the header of a label file and returns the number of labels.
+ *
+ * @param header the first `Mnist::labelHeaderSize` bytes of the file
+ * @param fileSize the size of the file, which must not be less than `Mnist::labelHeaderSize`
+ * @param labelPath the path of the file, used in the error message
+ * @throws InvalidMnistDatasetException if the header is invalid or the file is shorter than the
+ * header says
+ */
+inline size_t ParseLabelHeader(uint8_t const*               header,
+                               size_t                       fileSize,
+                               std::filesystem::path const& labelPath)
+{
+    if (ReadBigEndian(header) != 0x00000801)
+        throw InvalidMnistDatasetException { labelPath.string() };
+
+    size_t const numLabels = ReadBigEndian(header + 4);
+    if (fileSize - Mnist::labelHeaderSize < numLabels)
+        throw InvalidMnistDatasetException { labelPath.string() };
+
+    return numLabels;
+}
+
+/**
+ * Validates the given labels read from a label file.
+ *
+ * @param labels the labels
+ * @param numLabels the number of labels
+ * @param labelPath the path of the file, used in the error message
+ * @throws InvalidMnistDatasetException if a label is not less than `numMnistLabels`
+ */
+inline void ValidateLabels(MnistLabel const*            labels,
+                           size_t                       numLabels,
+                           std::filesystem::path const& labelPath)
+{
+    for (size_t i = 0; i < numLabels; ++i)
+    {
+        if ((size_t)labels[i] >= numMnistLabels)
+            throw InvalidMnistDatasetException { labelPath.string() };
+    }
+}
+
+}
+
+}
+
+#endif
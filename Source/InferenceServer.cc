@@ -0,0 +1,529 @@
+// Copyright (c) 2021 Chanjung Kim. All rights reserved.
+// Licensed under the MIT License.
+
+#include <mf/InferenceServer.hh>
+#include <mf/Trace.hh>
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <iomanip>
+#include <iterator>
+#include <numeric>
+#include <optional>
+#include <stdexcept>
+#include <string>
+
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+namespace mf
+{
+
+namespace
+{
+
+/**
+ * The number of bytes read from a connection at once.
+ */
+constexpr size_t readBufferSize = 64 * sizeof(ServerRequest);
+
+}
+
+/**
+ * A connection of a client. The socket is closed once the I/O thread has dropped the connection
+ * and every request read from it has been answered, so it is never confused with a reused
+ * descriptor.
+ */
+struct InferenceServer::Connection
+{
+    int fd;
+
+    // Used by the I/O thread only: the bytes of the requests not read completely yet, and whether
+    // the client has shut down its side.
+    std::vector<uint8_t> input;
+    size_t               inputSize { 0 };
+    bool                 readClosed { false };
+
+    // Guarded by `mutex`: the responses not written yet, the number of requests given to the
+    // workers and not answered yet, and whether the connection failed, after which the responses
+    // are dropped.
+    std::mutex           mutex;
+    std::vector<uint8_t> output;
+    size_t               numOutstanding { 0 };
+    bool                 broken { false };
+
+    explicit Connection(int fd) : fd { fd }, input(readBufferSize) {}
+
+    Connection(Connection const&) = delete;
+    Connection& operator=(Connection const&) = delete;
+
+    ~Connection()
+    {
+        close(fd);
+    }
+};
+
+namespace
+{
+
+using Clock = std::chrono::steady_clock;
+
+constexpr size_t imageSize { MnistByteSample::height * MnistByteSample::width };
+
+/**
+ * The number of requests the queue holds per worker and request of a batch before the I/O thread
+ * stops reading, so that a client sending faster than the workers answer cannot exhaust the memory.
+ */
+constexpr size_t queueBatchesPerWorker = 16;
+
+/**
+ * The time the I/O thread waits for space in the queue before checking it again.
+ */
+constexpr int fullQueuePollTimeout = 1;
+
+/**
+ * Returns whether the last call on a non-blocking socket failed only because it would block.
+ */
+bool WouldBlock() noexcept
+{
+    return errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR;
+}
+
+/**
+ * Throws `ServerSocketException` describing the last error of the given call.
+ */
+[[noreturn]] void ThrowSocketError(std::string const& what)
+{
+    throw ServerSocketException { what + ": " + std::strerror(errno) };
+}
+
+}
+
+InferenceServer::InferenceServer(Engine const&                engine,
+                                 std::filesystem::path const& socketPath,
+                                 size_t                       numWorkers,
+                                 std::chrono::microseconds    maxWait) :
+    _engine { engine },
+    _socketPath { socketPath },
+    _maxWait { maxWait },
+    _queueCapacity { numWorkers * engine.GetBatchSize() * queueBatchesPerWorker },
+    _listenFd { -1 },
+    _wakeFds { -1, -1 },
+    _stop { false },
+    _workersStopped { false },
+    _readingStopped { false },
+    _statistics {},
+    _latencies {}
+{
+    if (numWorkers == 0)
+        throw std::invalid_argument { "numWorkers" };
+    if (engine.GetInputSize() != imageSize || engine.GetOutputSize() != serverNumClasses)
+        throw std::invalid_argument { "engine" };
+
+    sockaddr_un address {};
+    address.sun_family = AF_UNIX;
+    std::string const path { socketPath.string() };
+    if (path.empty() || path.size() >= sizeof(address.sun_path))
+        throw ServerSocketException { "the socket path must have 1 to "
+                                      + std::to_string(sizeof(address.sun_path) - 1)
+                                      + " characters: " + path };
+    std::memcpy(address.sun_path, path.c_str(), path.size() + 1);
+
+    // A socket left behind by a server that did not stop cleanly would make `bind` fail.
+    struct stat status;
+    if (lstat(path.c_str(), &status) == 0 && S_ISSOCK(status.st_mode))
+        unlink(path.c_str());
+
+    _listenFd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC | SOCK_NONBLOCK, 0);
+    if (_listenFd == -1)
+        ThrowSocketError("socket");
+    if (bind(_listenFd, (sockaddr const*)&address, sizeof(address)) != 0
+        || listen(_listenFd, SOMAXCONN) != 0 || pipe2(_wakeFds, O_CLOEXEC | O_NONBLOCK) != 0)
+    {
+        int const error { errno };
+        close(_listenFd);
+        for (int fd : _wakeFds)
+        {
+            if (fd != -1)
+                close(fd);
+        }
+        errno = error;
+        ThrowSocketError(path);
+    }
+
+    _statistics.batchSizes.resize(engine.GetBatchSize() + 1);
+    for (size_t i = 0; i < numWorkers; ++i)
+        _workers.emplace_back(&InferenceServer::RunWorker, this);
+    _ioThread = std::thread { &InferenceServer::RunIo, this };
+}
+
+InferenceServer::~InferenceServer()
+{
+    Stop();
+}
+
+void InferenceServer::Stop()
+{
+    if (_stop.exchange(true))
+        return;
+
+    // The I/O thread stops reading first, and the workers stop once it has and they drained the
+    // queue. The I/O thread then writes the last responses, and stops once they are written or
+    // `stopFlushTimeout` has passed, so that a client which does not read cannot hold it.
+    Wake();
+    for (auto& worker : _workers) worker.join();
+    _workersStopped.store(true);
+    Wake();
+    _ioThread.join();
+
+    close(_listenFd);
+    close(_wakeFds[0]);
+    close(_wakeFds[1]);
+    unlink(_socketPath.c_str());
+}
+
+ServerStatistics InferenceServer::GetStatistics()
+{
+    size_t queueDepth;
+    {
+        std::lock_guard<std::mutex> lock { _mutex };
+        queueDepth = _queue.size();
+    }
+
+    std::lock_guard<std::mutex> lock { _statisticsMutex };
+    ServerStatistics            rtn { _statistics };
+    rtn.queueDepth  = queueDepth;
+    rtn.p50Latency  = _latencies.GetQuantile(0.50) * 1e-9;
+    rtn.p99Latency  = _latencies.GetQuantile(0.99) * 1e-9;
+    rtn.p999Latency = _latencies.GetQuantile(0.999) * 1e-9;
+    return rtn;
+}
+
+void InferenceServer::PrintSummary(std::ostream& os, ServerStatistics const& statistics)
+{
+    auto const mean { [](size_t sum, size_t count) {
+        return count == 0 ? 0.0 : (double)sum / count;
+    } };
+
+    auto const flags { os.flags() };
+    auto const precision { os.precision() };
+    os << std::fixed << std::setprecision(1) << statistics.numRequests << " requests in "
+       << statistics.numBatches << " batches (mean size "
+       << mean(statistics.numRequests, statistics.numBatches) << "), queue depth "
+       << statistics.queueDepth << " (max " << statistics.maxQueueDepth << ", mean "
+       << mean(statistics.sumQueueDepth, statistics.numBatches) << "), latency p50 "
+       << statistics.p50Latency * 1e6 << " us, p99 " << statistics.p99Latency * 1e6
+       << " us, p999 " << statistics.p999Latency * 1e6 << " us" << std::endl;
+    os.flags(flags);
+    os.precision(precision);
+}
+
+void InferenceServer::Print(std::ostream& os, ServerStatistics const& statistics)
+{
+    PrintSummary(os, statistics);
+
+    // The sizes are grouped by powers of two, so that large batch sizes still fit on a screen.
+    auto const& sizes { statistics.batchSizes };
+    os << "batch sizes:" << std::endl;
+    for (size_t begin = 1; begin < sizes.size(); begin *= 2)
+    {
+        size_t const end { std::min(begin * 2, sizes.size()) };
+        size_t const count { std::accumulate(
+            sizes.begin() + begin, sizes.begin() + end, size_t { 0 }) };
+        if (count == 0)
+            continue;
+
+        std::string const range { end - begin == 1 ? std::to_string(begin)
+                                                    : std::to_string(begin) + "-"
+                                                          + std::to_string(end - 1) };
+        os << std::setw(12) << range << ": " << count << " batches" << std::endl;
+    }
+}
+
+void InferenceServer::Wake() noexcept
+{
+    // The pipe is non-blocking; if it is full, the I/O thread is going to wake up anyway.
+    char const wake { 0 };
+    while (write(_wakeFds[1], &wake, 1) < 0 && errno == EINTR)
+    {
+    }
+}
+
+void InferenceServer::RunIo()
+{
+    std::vector<std::shared_ptr<Connection>> connections;
+    std::vector<pollfd>                      fds;
+    std::vector<Request>                     received;
+    std::optional<Clock::time_point>         flushDeadline;
+
+    // The workers see the connection as broken and drop its responses.
+    auto const drop { [](Connection& connection) {
+        std::lock_guard<std::mutex> lock { connection.mutex };
+        connection.broken = true;
+        connection.output.clear();
+    } };
+
+    auto const flush { [](Connection& connection) {
+        std::lock_guard<std::mutex> lock { connection.mutex };
+        ssize_t const sent { send(connection.fd,
+                                  connection.output.data(),
+                                  connection.output.size(),
+                                  MSG_NOSIGNAL) };
+        if (sent < 0 && !WouldBlock())
+        {
+            connection.broken = true;
+            connection.output.clear();
+        }
+        else if (sent > 0)
+            connection.output.erase(connection.output.begin(), connection.output.begin() + sent);
+    } };
+
+    auto const receive { [&](std::shared_ptr<Connection> const& connection, Clock::time_point now) {
+        auto&         c { *connection };
+        ssize_t const numRead { recv(
+            c.fd, c.input.data() + c.inputSize, readBufferSize - c.inputSize, 0) };
+        if (numRead < 0 && WouldBlock())
+            return;
+        if (numRead < 0)
+        {
+            drop(c);
+            return;
+        }
+        if (numRead == 0)
+        {
+            c.readClosed = true;
+            return;
+        }
+
+        c.inputSize += numRead;
+        size_t offset = 0;
+        for (; c.inputSize - offset >= sizeof(ServerRequest); offset += sizeof(ServerRequest))
+        {
+            auto& request { received.emplace_back(Request { connection, {}, now }) };
+            std::memcpy(&request.request, c.input.data() + offset, sizeof(ServerRequest));
+        }
+        std::memmove(c.input.data(), c.input.data() + offset, c.inputSize - offset);
+        c.inputSize -= offset;
+
+        std::lock_guard<std::mutex> lock { c.mutex };
+        c.numOutstanding += offset / sizeof(ServerRequest);
+    } };
+
+    while (true)
+    {
+        // Once the workers have stopped, no response is added, and the thread stops as soon as
+        // the pending ones are written.
+        bool const stopping { _stop.load() };
+        if (stopping && !flushDeadline && _workersStopped.load())
+            flushDeadline = Clock::now() + stopFlushTimeout;
+
+        // A connection is dropped once it failed, or once its client stopped sending and every
+        // response was written.
+        bool       pending = false;
+        auto const isDone { [&](std::shared_ptr<Connection> const& connection) {
+            std::lock_guard<std::mutex> lock { connection->mutex };
+            pending |= !connection->output.empty();
+            return connection->broken
+                   || (connection->readClosed && connection->numOutstanding == 0
+                       && connection->output.empty());
+        } };
+        connections.erase(std::remove_if(connections.begin(), connections.end(), isDone),
+                          connections.end());
+        if (flushDeadline && (!pending || Clock::now() >= *flushDeadline))
+            break;
+
+        bool full;
+        {
+            std::lock_guard<std::mutex> lock { _mutex };
+            if (stopping && !_readingStopped)
+            {
+                _readingStopped = true;
+                _queued.notify_all();
+            }
+            full = _queue.size() >= _queueCapacity;
+        }
+
+        // Nothing is read while the queue is full, or once the server is stopping, or from a
+        // connection with too many responses in flight.
+        fds.clear();
+        fds.push_back(pollfd { _wakeFds[0], POLLIN, 0 });
+        fds.push_back(pollfd { _listenFd, (short)(stopping ? 0 : POLLIN), 0 });
+        for (auto const& connection : connections)
+        {
+            std::lock_guard<std::mutex> lock { connection->mutex };
+            size_t const numInFlight { connection->numOutstanding
+                                       + connection->output.size() / sizeof(ServerResponse) };
+            short        events = 0;
+            if (!stopping && !full && !connection->readClosed && numInFlight < maxResponsesInFlight)
+                events |= POLLIN;
+            if (!connection->output.empty())
+                events |= POLLOUT;
+            fds.push_back(pollfd { connection->fd, events, 0 });
+        }
+
+        int timeout { full ? fullQueuePollTimeout : -1 };
+        if (flushDeadline)
+        {
+            auto const remaining { *flushDeadline - Clock::now() };
+            timeout = std::max(
+                0, (int)std::chrono::ceil<std::chrono::milliseconds>(remaining).count());
+        }
+        if (poll(fds.data(), fds.size(), timeout) < 0)
+        {
+            if (errno == EINTR)
+                continue;
+            break;
+        }
+
+        if (fds[0].revents & POLLIN)
+        {
+            char drain[64];
+            while (read(_wakeFds[0], drain, sizeof(drain)) > 0)
+            {
+            }
+        }
+
+        if (fds[1].revents & POLLIN)
+        {
+            int const fd { accept4(_listenFd, nullptr, nullptr, SOCK_CLOEXEC | SOCK_NONBLOCK) };
+            if (fd != -1)
+                connections.push_back(std::make_shared<Connection>(fd));
+        }
+
+        // The connections accepted above are not in `fds` yet.
+        auto const now { Clock::now() };
+        received.clear();
+        for (size_t i = 0; i + 2 < fds.size(); ++i)
+        {
+            short const events { fds[i + 2].revents };
+            if (events & POLLOUT)
+                flush(*connections[i]);
+            if (events & POLLIN)
+                receive(connections[i], now);
+            else if (events & (POLLERR | POLLHUP | POLLNVAL))
+                drop(*connections[i]);
+        }
+
+        if (received.empty())
+            continue;
+        {
+            std::lock_guard<std::mutex> lock { _mutex };
+            for (auto& request : received) _queue.push_back(std::move(request));
+        }
+        _queued.notify_all();
+    }
+
+    // The workers stop once the queue is drained, even if the loop ended on an error.
+    {
+        std::lock_guard<std::mutex> lock { _mutex };
+        _readingStopped = true;
+    }
+    _queued.notify_all();
+}
+
+void InferenceServer::RunWorker()
+{
+    Engine       engine { _engine };
+    size_t const batchSize { engine.GetBatchSize() };
+
+    std::vector<Request>        batch;
+    std::vector<uint8_t>        in(batchSize * imageSize);
+    std::vector<ServerResponse> responses(batchSize);
+    std::vector<size_t>         order(batchSize);
+    std::vector<ServerResponse> sending;
+    while (true)
+    {
+        size_t queueDepth;
+        {
+            std::unique_lock<std::mutex> lock { _mutex };
+            _queued.wait(lock, [&] { return _readingStopped || !_queue.empty(); });
+            if (_queue.empty())
+                return;
+
+            // Another worker may take the requests while this one waits, in which case it starts
+            // over with the next request to arrive.
+            auto const deadline { _queue.front().arrival + _maxWait };
+            _queued.wait_until(lock, deadline, [&] {
+                return _readingStopped || _queue.empty() || _queue.size() >= batchSize;
+            });
+            if (_queue.empty())
+                continue;
+
+            queueDepth = _queue.size();
+            batch.clear();
+            size_t const numSamples { std::min(queueDepth, batchSize) };
+            std::move(_queue.begin(), _queue.begin() + numSamples, std::back_inserter(batch));
+            _queue.erase(_queue.begin(), _queue.begin() + numSamples);
+        }
+        if (queueDepth > batch.size())
+            _queued.notify_one();
+
+        size_t const numSamples { batch.size() };
+        {
+            MF_TRACE_SPAN("InferenceServer::Batch", "samples", numSamples);
+            for (size_t i = 0; i < numSamples; ++i)
+                std::memcpy(in.data() + i * imageSize, batch[i].request.pixels, imageSize);
+
+            float const* out { engine.Forward(in.data(), numSamples) };
+            for (size_t i = 0; i < numSamples; ++i)
+            {
+                float const* scores { out + i * serverNumClasses };
+                auto&        response { responses[i] };
+                response.id    = batch[i].request.id;
+                response.label = (MnistLabel)std::distance(
+                    scores, std::max_element(scores, scores + serverNumClasses));
+                std::fill(std::begin(response.reserved), std::end(response.reserved), 0);
+                std::copy_n(scores, serverNumClasses, response.scores);
+            }
+        }
+
+        // The responses to one connection are handed to the I/O thread at once, in the order of
+        // the requests.
+        order.resize(numSamples);
+        std::iota(order.begin(), order.end(), 0);
+        std::stable_sort(order.begin(), order.end(), [&](size_t lhs, size_t rhs) {
+            return batch[lhs].connection < batch[rhs].connection;
+        });
+        for (size_t begin = 0, end; begin < numSamples; begin = end)
+        {
+            auto& connection { *batch[order[begin]].connection };
+            sending.clear();
+            for (end = begin;
+                 end < numSamples && batch[order[end]].connection.get() == &connection;
+                 ++end)
+                sending.push_back(responses[order[end]]);
+
+            std::lock_guard<std::mutex> lock { connection.mutex };
+            connection.numOutstanding -= end - begin;
+            if (!connection.broken)
+            {
+                auto const* bytes { (uint8_t const*)sending.data() };
+                connection.output.insert(connection.output.end(),
+                                         bytes,
+                                         bytes + sending.size() * sizeof(ServerResponse));
+            }
+        }
+        Wake();
+
+        auto const now { Clock::now() };
+        for (size_t i = 0; i < numSamples; ++i)
+            order[i] = std::chrono::duration_cast<std::chrono::nanoseconds>(now - batch[i].arrival)
+                           .count();
+        batch.clear();
+
+        std::lock_guard<std::mutex> lock { _statisticsMutex };
+        _statistics.numRequests += numSamples;
+        _statistics.numBatches += 1;
+        _statistics.maxQueueDepth = std::max(_statistics.maxQueueDepth, queueDepth);
+        _statistics.sumQueueDepth += queueDepth;
+        _statistics.batchSizes[numSamples] += 1;
+        for (size_t i = 0; i < numSamples; ++i) _latencies.Add(order[i]);
+    }
+}
+
+}
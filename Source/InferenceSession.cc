@@ -0,0 +1,318 @@
+// Copyright (c) 2021 Chanjung Kim. All rights reserved.
+// Licensed under the MIT License.
+
+#include <mf/InferenceSession.hh>
+#include <mf/Trace.hh>
+
+#include <algorithm>
+#include <cstring>
+#include <stdexcept>
+#include <thread>
+#include <utility>
+
+namespace mf
+{
+
+/**
+ * The images of one call to `Submit` or `Classify`. The job is split into tasks, and the callback
+ * is called by the worker completing the last of them.
+ */
+struct InferenceSession::Job
+{
+    std::vector<uint8_t>         storage;
+    uint8_t const*               images;
+    std::vector<InferenceResult> results;
+    std::atomic<size_t>          numRemaining;
+    Callback                     callback;
+
+    std::mutex         errorMutex;
+    std::exception_ptr error;
+
+    /**
+     * Records the result of the given task, and calls the callback if it was the last one.
+     */
+    void Complete(std::exception_ptr const& taskError)
+    {
+        if (taskError)
+        {
+            std::lock_guard<std::mutex> lock { errorMutex };
+            if (!error)
+                error = taskError;
+        }
+
+        if (numRemaining.fetch_sub(1, std::memory_order_acq_rel) == 1)
+            callback(error ? std::vector<InferenceResult> {} : std::move(results), error);
+    }
+};
+
+namespace
+{
+
+/**
+ * Returns the given weights with the normalization of the pixels folded into the kernel of the
+ * first layer.
+ */
+WeightCollection NormalizeInput(WeightCollection&& weights, std::vector<LayerSpec> const& layers)
+{
+    if (layers.empty())
+        throw std::invalid_argument { "layers" };
+
+    auto it { weights.find(layers.front().name) };
+    if (it == weights.end())
+        throw LayerNotFoundException { layers.front().name };
+    it->second.ScaleKernel(1.0f / 255.0f);
+    return std::move(weights);
+}
+
+size_t GetNumWorkers(size_t numThreads) noexcept
+{
+    return numThreads == 0 ? std::max(std::thread::hardware_concurrency(), 1u) : numThreads;
+}
+
+/**
+ * Returns a callback fulfilling the given promise with all results of a job.
+ */
+InferenceSession::Callback FulfillWith(
+    std::shared_ptr<std::promise<std::vector<InferenceResult>>> promise)
+{
+    return [promise { std::move(promise) }](std::vector<InferenceResult> results,
+                                            std::exception_ptr           error) {
+        if (error)
+            promise->set_exception(error);
+        else
+            promise->set_value(std::move(results));
+    };
+}
+
+}
+
+std::unique_ptr<InferenceSession> InferenceSession::MakeFromConfig(Config const& config)
+{
+    return std::make_unique<InferenceSession>(
+        Weights::MakeFromFile(config),
+        Model::ReadFromFile(config),
+        config.batchSize,
+        config.numThreads,
+        DenseBlocking { config.denseTileSamples, config.denseTileInputs, config.denseTileOutputs },
+        config.denseFused,
+        config.denseSparseThreshold);
+}
+
+InferenceSession::InferenceSession(WeightCollection              weights,
+                                   std::vector<LayerSpec> const& layers,
+                                   size_t                        batchSize,
+                                   size_t                        numThreads,
+                                   DenseBlocking const&          blocking,
+                                   bool                          fused,
+                                   double                        sparseThreshold) :
+    _weights { NormalizeInput(std::move(weights), layers) },
+    _plan { std::make_shared<ExecutionPlan const>(
+        ExecutionPlan::Compile(_weights, layers, batchSize)) },
+    _engine { Engine::MakeFromPlan(_plan, blocking, fused, sparseThreshold) },
+    _queue { GetNumWorkers(numThreads) * queueTasksPerWorker },
+    _numQueued { 0 },
+    _numSleeping { 0 },
+    _stop { false }
+{
+    numThreads = GetNumWorkers(numThreads);
+    for (size_t i = 0; i < numThreads; ++i)
+        _workers.emplace_back(&InferenceSession::RunWorker, this);
+}
+
+InferenceSession::~InferenceSession()
+{
+    _stop.store(true);
+    {
+        std::lock_guard<std::mutex> lock { _mutex };
+    }
+    _wakeUp.notify_all();
+    for (auto& worker : _workers) worker.join();
+}
+
+std::future<InferenceResult> InferenceSession::Submit(uint8_t const* image)
+{
+    auto promise { std::make_shared<std::promise<InferenceResult>>() };
+    auto rtn { promise->get_future() };
+    Enqueue({ image, GetInputSize() },
+            true,
+            [promise](std::vector<InferenceResult> results, std::exception_ptr error) {
+                if (error)
+                    promise->set_exception(error);
+                else
+                    promise->set_value(std::move(results.front()));
+            });
+    return rtn;
+}
+
+std::future<std::vector<InferenceResult>> InferenceSession::Submit(ArrayView<uint8_t> images)
+{
+    auto promise { std::make_shared<std::promise<std::vector<InferenceResult>>>() };
+    auto rtn { promise->get_future() };
+    Enqueue(images, true, FulfillWith(promise));
+    return rtn;
+}
+
+void InferenceSession::Submit(ArrayView<uint8_t> images, Callback callback)
+{
+    Enqueue(images, true, std::move(callback));
+}
+
+std::vector<InferenceResult> InferenceSession::Classify(ArrayView<uint8_t> images)
+{
+    // The caller waits below, so the workers may read its images in place. The promise is owned
+    // by the callback, since it may still be being set when `get` returns.
+    auto promise { std::make_shared<std::promise<std::vector<InferenceResult>>>() };
+    auto future { promise->get_future() };
+    Enqueue(images, false, FulfillWith(promise));
+    return future.get();
+}
+
+void InferenceSession::Enqueue(ArrayView<uint8_t> images, bool copy, Callback&& callback)
+{
+    size_t const inputSize { GetInputSize() };
+    if (images.size() % inputSize != 0)
+        throw std::invalid_argument { "images" };
+
+    size_t const numImages { images.size() / inputSize };
+    if (numImages == 0)
+    {
+        callback({}, nullptr);
+        return;
+    }
+
+    auto job { std::make_shared<Job>() };
+    if (copy)
+    {
+        job->storage.assign(images.begin(), images.end());
+        job->images = job->storage.data();
+    }
+    else
+        job->images = images.data();
+    job->results.resize(numImages);
+    job->callback = std::move(callback);
+
+    size_t const batchSize { GetBatchSize() };
+    size_t const numTasks { (numImages + batchSize - 1) / batchSize };
+    job->numRemaining.store(numTasks, std::memory_order_relaxed);
+
+    for (size_t i = 0; i < numTasks; ++i)
+    {
+        Task task { job, i * batchSize, std::min(batchSize, numImages - i * batchSize) };
+
+        // The count goes up before the push, so that it never falls below the number of tasks in
+        // the queue, and a worker seeing zero may sleep.
+        _numQueued.fetch_add(1);
+        while (!_queue.TryPush(task)) std::this_thread::yield();
+
+        // A worker increments `_numSleeping` before checking `_numQueued`, and this thread checks
+        // them in the opposite order, so at least one of the two sees the other's increment.
+        if (_numSleeping.load() > 0)
+        {
+            {
+                std::lock_guard<std::mutex> lock { _mutex };
+            }
+            _wakeUp.notify_one();
+        }
+    }
+}
+
+bool InferenceSession::Pop(Task& task)
+{
+    if (!_queue.TryPop(task))
+        return false;
+
+    _numQueued.fetch_sub(1);
+    return true;
+}
+
+bool InferenceSession::WaitForTask()
+{
+    _numSleeping.fetch_add(1);
+    {
+        std::unique_lock<std::mutex> lock { _mutex };
+        _wakeUp.wait(lock, [&] { return _stop.load() || _numQueued.load() > 0; });
+    }
+    _numSleeping.fetch_sub(1);
+
+    // The queue is drained before the workers stop.
+    return _numQueued.load() > 0;
+}
+
+void InferenceSession::RunWorker()
+{
+    Engine       engine { _engine };
+    size_t const batchSize { engine.GetBatchSize() };
+    size_t const inputSize { engine.GetInputSize() };
+    size_t const outputSize { engine.GetOutputSize() };
+
+    std::vector<Task>    tasks;
+    std::vector<uint8_t> in(batchSize * inputSize);
+    Task                 carried {};
+    while (true)
+    {
+        tasks.clear();
+        Task task;
+        if (carried.job)
+            tasks.push_back(std::exchange(carried, Task {}));
+        else if (Pop(task))
+            tasks.push_back(std::move(task));
+        else if (WaitForTask())
+            continue;
+        else
+            return;
+
+        // The tasks already in the queue join the batch, but the worker does not wait for more. A
+        // task which does not fit is carried over to the next batch.
+        size_t numSamples { tasks.front().count };
+        while (numSamples < batchSize && Pop(task))
+        {
+            if (numSamples + task.count > batchSize)
+            {
+                carried = std::move(task);
+                break;
+            }
+            numSamples += task.count;
+            tasks.push_back(std::move(task));
+        }
+
+        std::exception_ptr error;
+        try
+        {
+            MF_TRACE_SPAN("InferenceSession::Batch", "samples", numSamples);
+
+            // A single task is read in place, since its images are already contiguous.
+            uint8_t const* batch { tasks.front().job->images + tasks.front().first * inputSize };
+            if (tasks.size() > 1)
+            {
+                size_t offset = 0;
+                for (auto const& t : tasks)
+                {
+                    std::memcpy(in.data() + offset * inputSize,
+                                t.job->images + t.first * inputSize,
+                                t.count * inputSize);
+                    offset += t.count;
+                }
+                batch = in.data();
+            }
+
+            float const* out { engine.Forward(batch, numSamples) };
+            for (auto const& t : tasks)
+            {
+                for (size_t i = 0; i < t.count; ++i, out += outputSize)
+                {
+                    auto& result { t.job->results[t.first + i] };
+                    result.label = (MnistLabel)(std::max_element(out, out + outputSize) - out);
+                    result.scores.assign(out, out + outputSize);
+                }
+            }
+        }
+        catch (...)
+        {
+            error = std::current_exception();
+        }
+
+        for (auto const& t : tasks) t.job->Complete(error);
+    }
+}
+
+}
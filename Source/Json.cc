@@ -0,0 +1,302 @@
+// Copyright (c) 2021 Chanjung Kim. All rights reserved.
+// Licensed under the MIT License.
+
+#include "Json.hh"
+
+#include <cctype>
+#include <cstdlib>
+#include <limits>
+
+namespace mf
+{
+
+/**
+ * Recursive-descent parser filling `JsonValue` instances.
+ */
+class JsonParser
+{
+  private:
+    /**
+     * The greatest nesting depth, which bounds the recursion.
+     */
+    constexpr static size_t maxDepth { 256 };
+
+  private:
+    std::string_view _text;
+    size_t           _pos;
+
+  public:
+    JsonParser(std::string_view text) noexcept : _text { text }, _pos { 0 } {}
+
+  public:
+    JsonValue ParseDocument()
+    {
+        JsonValue rtn { ParseValue(0) };
+        SkipSpaces();
+        if (_pos != _text.size())
+            Fail();
+
+        return rtn;
+    }
+
+  private:
+    [[noreturn]] void Fail() const
+    {
+        throw InvalidJsonException { "at offset " + std::to_string(_pos) };
+    }
+
+    void SkipSpaces() noexcept
+    {
+        while (_pos < _text.size() && std::isspace((unsigned char)_text[_pos])) ++_pos;
+    }
+
+    bool Consume(char c) noexcept
+    {
+        SkipSpaces();
+        if (_pos < _text.size() && _text[_pos] == c)
+        {
+            ++_pos;
+            return true;
+        }
+        return false;
+    }
+
+    void Expect(char c)
+    {
+        if (!Consume(c))
+            Fail();
+    }
+
+    bool ConsumeWord(std::string_view word) noexcept
+    {
+        if (_text.substr(_pos, word.size()) != word)
+            return false;
+
+        _pos += word.size();
+        return true;
+    }
+
+    JsonValue ParseValue(size_t depth)
+    {
+        if (depth > maxDepth)
+            Fail();
+
+        SkipSpaces();
+        if (_pos == _text.size())
+            Fail();
+
+        JsonValue rtn;
+        char const c = _text[_pos];
+        if (c == '{')
+        {
+            ++_pos;
+            rtn._type = JsonValue::Type::Object;
+            if (Consume('}'))
+                return rtn;
+            do {
+                SkipSpaces();
+                rtn._keys.push_back(ParseString());
+                Expect(':');
+                rtn._values.push_back(ParseValue(depth + 1));
+            } while (Consume(','));
+            Expect('}');
+        }
+        else if (c == '[')
+        {
+            ++_pos;
+            rtn._type = JsonValue::Type::Array;
+            if (Consume(']'))
+                return rtn;
+            do {
+                rtn._values.push_back(ParseValue(depth + 1));
+            } while (Consume(','));
+            Expect(']');
+        }
+        else if (c == '"')
+        {
+            rtn._type   = JsonValue::Type::String;
+            rtn._string = ParseString();
+        }
+        else if (ConsumeWord("true") || ConsumeWord("false"))
+        {
+            rtn._type = JsonValue::Type::Bool;
+            rtn._bool = c == 't';
+        }
+        else if (ConsumeWord("null"))
+        {
+            rtn._type = JsonValue::Type::Null;
+        }
+        else if (ConsumeWord("NaN"))
+        {
+            // Python's `json` module writes these for non-finite floats unless told otherwise,
+            // so they appear in Keras configurations.
+            rtn._type   = JsonValue::Type::Number;
+            rtn._number = std::numeric_limits<double>::quiet_NaN();
+        }
+        else if (ConsumeWord("Infinity") || ConsumeWord("-Infinity"))
+        {
+            rtn._type   = JsonValue::Type::Number;
+            rtn._number = c == '-' ? -std::numeric_limits<double>::infinity()
+                                   : std::numeric_limits<double>::infinity();
+        }
+        else if (c == '-' || std::isdigit((unsigned char)c))
+        {
+            size_t const      length { _text.find_first_of(",]} \t\r\n", _pos) - _pos };
+            std::string const number { _text.substr(_pos, length) };
+            char*             end { nullptr };
+            rtn._type   = JsonValue::Type::Number;
+            rtn._number = std::strtod(number.c_str(), &end);
+            if (end != number.c_str() + number.size())
+                Fail();
+            _pos += number.size();
+        }
+        else
+        {
+            Fail();
+        }
+
+        return rtn;
+    }
+
+    std::string ParseString()
+    {
+        if (_pos == _text.size() || _text[_pos] != '"')
+            Fail();
+        ++_pos;
+
+        std::string rtn;
+        while (true)
+        {
+            if (_pos == _text.size())
+                Fail();
+
+            char const c = _text[_pos++];
+            if (c == '"')
+                return rtn;
+            if (c != '\\')
+            {
+                rtn.push_back(c);
+                continue;
+            }
+
+            if (_pos == _text.size())
+                Fail();
+            switch (char const e = _text[_pos++]; e)
+            {
+            case '"':
+            case '\\':
+            case '/': rtn.push_back(e); break;
+            case 'b': rtn.push_back('\b'); break;
+            case 'f': rtn.push_back('\f'); break;
+            case 'n': rtn.push_back('\n'); break;
+            case 'r': rtn.push_back('\r'); break;
+            case 't': rtn.push_back('\t'); break;
+            case 'u': AppendUtf8(rtn, ParseCodeUnit()); break;
+            default: Fail();
+            }
+        }
+    }
+
+    uint32_t ParseCodeUnit()
+    {
+        if (_text.size() - _pos < 4)
+            Fail();
+
+        uint32_t rtn = 0;
+        for (size_t i = 0; i < 4; ++i)
+        {
+            char const c = _text[_pos++];
+            if (!std::isxdigit((unsigned char)c))
+                Fail();
+            int const digit { std::isdigit((unsigned char)c) ? c - '0'
+                                                             : std::tolower(c) - 'a' + 10 };
+            rtn = rtn * 16 + (uint32_t)digit;
+        }
+        return rtn;
+    }
+
+    /**
+     * Appends the given code point, which may be a lone surrogate, encoded in UTF-8.
+     */
+    static void AppendUtf8(std::string& out, uint32_t codePoint)
+    {
+        if (codePoint < 0x80)
+            out.push_back((char)codePoint);
+        else if (codePoint < 0x800)
+        {
+            out.push_back((char)(0xC0 | codePoint >> 6));
+            out.push_back((char)(0x80 | (codePoint & 0x3F)));
+        }
+        else
+        {
+            out.push_back((char)(0xE0 | codePoint >> 12));
+            out.push_back((char)(0x80 | (codePoint >> 6 & 0x3F)));
+            out.push_back((char)(0x80 | (codePoint & 0x3F)));
+        }
+    }
+};
+
+JsonValue JsonValue::Parse(std::string_view text)
+{
+    return JsonParser { text }.ParseDocument();
+}
+
+bool JsonValue::GetBool() const
+{
+    if (_type != Type::Bool)
+        throw InvalidJsonException { "a boolean is expected" };
+
+    return _bool;
+}
+
+std::string const& JsonValue::GetString() const
+{
+    if (_type != Type::String)
+        throw InvalidJsonException { "a string is expected" };
+
+    return _string;
+}
+
+double JsonValue::GetNumber() const
+{
+    if (_type != Type::Number)
+        throw InvalidJsonException { "a number is expected" };
+
+    return _number;
+}
+
+std::vector<JsonValue> const& JsonValue::GetArray() const
+{
+    if (_type != Type::Array)
+        throw InvalidJsonException { "an array is expected" };
+
+    return _values;
+}
+
+JsonValue const* JsonValue::Find(std::string_view key) const noexcept
+{
+    if (_type != Type::Object)
+        return nullptr;
+
+    for (size_t i = 0; i < _keys.size(); ++i)
+    {
+        if (_keys[i] == key)
+            return &_values[i];
+    }
+    return nullptr;
+}
+
+void WriteJsonString(std::ostream& os, std::string_view value)
+{
+    os << '"';
+    for (char c : value)
+    {
+        if (c == '"' || c == '\\')
+            os << '\\' << c;
+        else if ((unsigned char)c >= 0x20)
+            os << c;
+    }
+    os << '"';
+}
+
+}
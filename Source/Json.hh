@@ -0,0 +1,117 @@
+// Copyright (c) 2021 Chanjung Kim. All rights reserved.
+// Licensed under the MIT License.
+
+#ifndef MNIST_FPGA_JSON_HH
+#define MNIST_FPGA_JSON_HH
+
+#include <mf/Exception.hh>
+
+#include <cstdint>
+#include <ostream>
+#include <string>
+#include <string_view>
+#include <vector>
+
+namespace mf
+{
+
+/**
+ * `InvalidJsonException` is thrown when a JSON document cannot be parsed, or a value does not have
+ * the expected type.
+ */
+MF_MAKE_NEW_EXCEPTION(InvalidJsonException, "Failed to parse JSON");
+
+/**
+ * `JsonValue` is one value of a parsed JSON document. This is a small, read-only parser for the
+ * documents Keras stores next to the weights (e.g. `model_config`); it is not meant to be fast.
+ */
+class JsonValue
+{
+  public:
+    /**
+     * Represents the type of a JSON value.
+     */
+    enum class Type : uint8_t
+    {
+        Null,
+        Bool,
+        Number,
+        String,
+        Array,
+        Object,
+    };
+
+    /**
+     * Parses the given document.
+     *
+     * @param text the document
+     * @throws InvalidJsonException
+     */
+    static JsonValue Parse(std::string_view text);
+
+  private:
+    Type                     _type;
+    bool                     _bool;
+    double                   _number;
+    std::string              _string;
+    std::vector<std::string> _keys;
+    std::vector<JsonValue>   _values;
+
+  public:
+    JsonValue() noexcept : _type { Type::Null }, _bool { false }, _number { 0.0 } {}
+
+  public:
+    /**
+     * Returns the type of the value.
+     */
+    Type GetType() const noexcept
+    {
+        return _type;
+    }
+
+    /**
+     * Returns the boolean.
+     *
+     * @throws InvalidJsonException if the value is not a boolean
+     */
+    bool GetBool() const;
+
+    /**
+     * Returns the string.
+     *
+     * @throws InvalidJsonException if the value is not a string
+     */
+    std::string const& GetString() const;
+
+    /**
+     * Returns the number.
+     *
+     * @throws InvalidJsonException if the value is not a number
+     */
+    double GetNumber() const;
+
+    /**
+     * Returns the elements of the array.
+     *
+     * @throws InvalidJsonException if the value is not an array
+     */
+    std::vector<JsonValue> const& GetArray() const;
+
+    /**
+     * Returns the member with the given key, or `nullptr` if the value is not an object or does
+     * not have the member.
+     */
+    JsonValue const* Find(std::string_view key) const noexcept;
+
+  private:
+    friend class JsonParser;
+};
+
+/**
+ * Writes the given string as a JSON string literal. Control characters are dropped.
+ */
+void WriteJsonString(std::ostream& os, std::string_view value);
+
+}
+
+#endif
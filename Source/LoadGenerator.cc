@@ -0,0 +1,278 @@
+// Copyright (c) 2021 Chanjung Kim. All rights reserved.
+// Licensed under the MIT License.
+
+#include <mf/Mnist.hh>
+#include <mf/ServerProtocol.hh>
+#include <mf/Statistics.hh>
+
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <exception>
+#include <filesystem>
+#include <functional>
+#include <iomanip>
+#include <iostream>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+// Sends the images of an MNIST dataset to `mnist-fpga` running as a server, and reports the
+// throughput, the accuracy and the latency percentiles seen by the clients.
+//
+// `SERVER_SOCKET` is the socket of the server, and the images are read from `MNIST_IMAGE_PATH` and
+// `MNIST_LABEL_PATH`. `LOADGEN_CONNECTIONS` is the number of connections, each on its own thread
+// (default: 8), `LOADGEN_REQUESTS` the total number of requests (default: 100000), and
+// `LOADGEN_DEPTH` the number of requests each connection keeps in flight (default: 1).
+
+namespace
+{
+
+using Clock = std::chrono::steady_clock;
+
+/**
+ * What one connection measured.
+ */
+struct ConnectionResult
+{
+    std::vector<double> latencies;
+    size_t              numCorrect;
+    std::exception_ptr  error;
+};
+
+/**
+ * Returns the value of the given environment variable, or throws if it is not set.
+ */
+std::string GetRequiredVariable(char const* name)
+{
+    char const* value { std::getenv(name) };
+    if (value == nullptr || *value == '\0')
+        throw std::runtime_error { std::string { "Environment variable " } + name + " is not set" };
+    return value;
+}
+
+/**
+ * Returns the value of the given environment variable as a positive integer, or `defaultValue`
+ * if it is not set.
+ */
+size_t GetCountVariable(char const* name, size_t defaultValue)
+{
+    char const* value { std::getenv(name) };
+    if (value == nullptr || *value == '\0')
+        return defaultValue;
+
+    size_t const rtn { std::stoul(value) };
+    if (rtn == 0)
+        throw std::runtime_error { std::string { name } + " must be positive" };
+    return rtn;
+}
+
+/**
+ * Throws `std::runtime_error` describing the last error of the given call.
+ */
+[[noreturn]] void ThrowSystemError(std::string const& what)
+{
+    throw std::runtime_error { what + ": " + std::strerror(errno) };
+}
+
+/**
+ * Connects to the given Unix domain socket.
+ */
+int Connect(std::string const& path)
+{
+    sockaddr_un address {};
+    address.sun_family = AF_UNIX;
+    if (path.size() >= sizeof(address.sun_path))
+        throw std::runtime_error { "The socket path is too long: " + path };
+    std::memcpy(address.sun_path, path.c_str(), path.size() + 1);
+
+    int const fd { socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0) };
+    if (fd == -1)
+        ThrowSystemError("socket");
+    if (connect(fd, (sockaddr const*)&address, sizeof(address)) != 0)
+    {
+        int const error { errno };
+        close(fd);
+        errno = error;
+        ThrowSystemError(path);
+    }
+    return fd;
+}
+
+/**
+ * Writes or reads exactly `size` bytes, retrying on partial transfers.
+ */
+template <typename Transfer>
+void TransferAll(Transfer&& transfer, char const* what, size_t size)
+{
+    for (size_t done = 0; done < size;)
+    {
+        ssize_t const count { transfer(done, size - done) };
+        if (count < 0 && errno == EINTR)
+            continue;
+        if (count < 0)
+            ThrowSystemError(what);
+        if (count == 0)
+            throw std::runtime_error { "The server closed the connection" };
+        done += count;
+    }
+}
+
+/**
+ * Sends `numRequests` requests on the given connection, starting at sample `first` of the dataset,
+ * with at most `depth` of them in flight.
+ */
+void Exchange(int               fd,
+              mf::Mnist const&  mnist,
+              size_t            first,
+              size_t            numRequests,
+              size_t            depth,
+              ConnectionResult& result)
+{
+    auto const&  images { mnist.GetByteImages() };
+    auto const&  labels { mnist.GetLabels() };
+    size_t const numSamples { mnist.GetNumSamples() };
+
+    std::vector<Clock::time_point> sendTimes(numRequests);
+    result.latencies.reserve(numRequests);
+    result.numCorrect = 0;
+
+    size_t numSent = 0;
+    while (result.latencies.size() < numRequests)
+    {
+        for (; numSent < numRequests && numSent - result.latencies.size() < depth; ++numSent)
+        {
+            size_t const sample { (first + numSent) % numSamples };
+
+            mf::ServerRequest request;
+            request.id = (uint32_t)numSent;
+            std::memcpy(request.pixels,
+                        images.data() + sample * sizeof(request.pixels),
+                        sizeof(request.pixels));
+
+            sendTimes[numSent] = Clock::now();
+            TransferAll(
+                [&](size_t offset, size_t size) {
+                    return send(fd, (char const*)&request + offset, size, MSG_NOSIGNAL);
+                },
+                "send",
+                sizeof(request));
+        }
+
+        mf::ServerResponse response;
+        TransferAll(
+            [&](size_t offset, size_t size) {
+                return recv(fd, (char*)&response + offset, size, 0);
+            },
+            "recv",
+            sizeof(response));
+        if (response.id >= numSent)
+            throw std::runtime_error { "The server answered an unknown request" };
+
+        result.latencies.push_back(
+            std::chrono::duration<double> { Clock::now() - sendTimes[response.id] }.count());
+        if (response.label == labels[(first + response.id) % numSamples])
+            result.numCorrect += 1;
+    }
+}
+
+/**
+ * Runs `Exchange` on a connection of its own, keeping the error if it fails.
+ */
+void RunConnection(std::string const& socketPath,
+                   mf::Mnist const&   mnist,
+                   size_t             first,
+                   size_t             numRequests,
+                   size_t             depth,
+                   ConnectionResult&  result) noexcept
+{
+    int fd = -1;
+    try
+    {
+        fd = Connect(socketPath);
+        Exchange(fd, mnist, first, numRequests, depth, result);
+    }
+    catch (...)
+    {
+        result.error = std::current_exception();
+    }
+    if (fd != -1)
+        close(fd);
+}
+
+}
+
+int main()
+try
+{
+    std::string const           socketPath { GetRequiredVariable("SERVER_SOCKET") };
+    std::filesystem::path const imagePath { GetRequiredVariable("MNIST_IMAGE_PATH") };
+    std::filesystem::path const labelPath { GetRequiredVariable("MNIST_LABEL_PATH") };
+    size_t const                numConnections { GetCountVariable("LOADGEN_CONNECTIONS", 8) };
+    size_t const                numRequests { GetCountVariable("LOADGEN_REQUESTS", 100000) };
+    size_t const                depth { GetCountVariable("LOADGEN_DEPTH", 1) };
+
+    auto const mnist { mf::Mnist::MakeFromFile(imagePath, labelPath, mf::MnistPixelFormat::Byte) };
+    if (mnist.GetNumSamples() == 0)
+        throw std::runtime_error { "The dataset is empty" };
+
+    // The requests are split evenly, and each connection starts at its own part of the dataset.
+    std::vector<ConnectionResult> results(numConnections);
+    std::vector<std::thread>      threads;
+    auto const                    begin { Clock::now() };
+    for (size_t i = 0; i < numConnections; ++i)
+    {
+        size_t const first { numRequests * i / numConnections };
+        size_t const count { numRequests * (i + 1) / numConnections - first };
+        threads.emplace_back(RunConnection,
+                             std::cref(socketPath),
+                             std::cref(mnist),
+                             first,
+                             count,
+                             depth,
+                             std::ref(results[i]));
+    }
+    for (auto& thread : threads) thread.join();
+    std::chrono::duration<double> const elapsed { Clock::now() - begin };
+
+    std::vector<double> latencies;
+    size_t              numCorrect = 0;
+    for (auto& result : results)
+    {
+        if (result.error)
+            std::rethrow_exception(result.error);
+        latencies.insert(latencies.end(), result.latencies.begin(), result.latencies.end());
+        numCorrect += result.numCorrect;
+    }
+    std::sort(latencies.begin(), latencies.end());
+
+    std::cout << std::fixed << std::setprecision(1) << latencies.size() << " requests on "
+              << numConnections << " connections (depth " << depth << ") in "
+              << elapsed.count() << " s: " << latencies.size() / elapsed.count()
+              << " requests/s, accuracy " << std::setprecision(2)
+              << numCorrect * 100.0 / latencies.size() << "%, latency p50 "
+              << std::setprecision(1) << mf::GetPercentile(latencies, 0.50) * 1e6 << " us, p99 "
+              << mf::GetPercentile(latencies, 0.99) * 1e6 << " us, p999 "
+              << mf::GetPercentile(latencies, 0.999) * 1e6 << " us" << std::endl;
+    return 0;
+}
+catch (mf::Exception const& ex)
+{
+    std::cout << ex.GetGenericInfo();
+    if (auto message { ex.GetMessage() }; message != nullptr)
+        std::cout << ": " << message;
+    std::cout << std::endl;
+    return EXIT_FAILURE;
+}
+catch (std::exception const& ex)
+{
+    std::cout << ex.what() << std::endl;
+    return EXIT_FAILURE;
+}
@@ -1,66 +1,331 @@
 // Copyright (c) 2021 Chanjung Kim. All rights reserved.
 // Licensed under the MIT License.
 
+#include <mf/Autotuner.hh>
+#include <mf/ClBufferPool.hh>
+#include <mf/ClEngine.hh>
 #include <mf/ClFactory.hh>
+#include <mf/ClProfiler.hh>
+#include <mf/ClShardedEngine.hh>
 #include <mf/Config.hh>
+#include <mf/Dense.hh>
+#include <mf/Engine.hh>
+#include <mf/Evaluation.hh>
+#include <mf/ExecutionPlan.hh>
+#include <mf/HybridEngine.hh>
+#include <mf/InferenceServer.hh>
 #include <mf/Mnist.hh>
+#include <mf/MnistStream.hh>
+#include <mf/Model.hh>
+#include <mf/PerfCounters.hh>
+#include <mf/QuantizedEngine.hh>
+#include <mf/ThreadPool.hh>
+#include <mf/Trace.hh>
 #include <mf/Weights.hh>
 
-#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <cstdlib>
+#include <fstream>
 #include <iostream>
+#include <memory>
+#include <optional>
 #include <string>
+#include <type_traits>
+#include <vector>
 
-void Apply(float const* in, float* out, mf::Weight const& layer)
-{
-    auto& weight = layer.GetKernelWeight();
-    auto& bias   = layer.GetBiasWeight();
-
-    for (size_t i = 0, li = layer.GetOutputSize(); i < li; ++i)
-    {
-        out[i] = 0.0f;
-        for (size_t j = 0, lj = layer.GetInputSize(); j < lj; ++j)
-            out[i] += in[j] * weight[j * li + i];
-        out[i] += bias[i];
-        if (out[i] < 0.0f)
-            out[i] = 0.0f;
-    }
-}
+#include <signal.h>
 
 int main()
 try
 {
+    // Tracing is set up before the configuration is read, so that reading it is traced as well.
+    std::ofstream trace;
+    if (char const* tracePath { std::getenv("TRACE_PATH") }; tracePath && *tracePath)
+    {
+        trace.open(tracePath);
+        if (!trace)
+            throw mf::NoSuchFileException { tracePath };
+        mf::Trace::Start();
+    }
+
     auto config { mf::Config::MakeFromEnvironment() };
-    // auto [platform, device] { mf::ClFactory::MakePlatformAndDevice(config) };
-    // auto [context, queue] { mf::ClFactory::MakeContextAndQueue(device) };
-    // auto program { mf::ClFactory::MakeProgram(config, context, device) };
-    auto weights { mf::Weights::MakeFromHdf5(config) };
-    auto mnist { mf::Mnist::MakeFromFile(config) };
-
-    std::vector<float> out1(128, 0.0f), out2(64, 0.0f), out3(10, 0.0f);
-    auto&              layer1 = weights.at("dense_3");
-    auto&              layer2 = weights.at("dense_4");
-    auto&              layer3 = weights.at("dense_5");
-
-    size_t correct = 0;
-    for (size_t i = 0, li = mnist.GetNumSamples(); i < li; ++i)
+    if (config.perfCounters)
+        mf::PerfCounters::Start();
+
+    auto const writeReports { [&] {
+        if (config.perfCounters)
+        {
+            mf::PerfCounters::Stop();
+            mf::PerfCounters::PrintSummary(std::cout);
+        }
+
+        if (trace.is_open())
+        {
+            mf::Trace::Stop();
+            mf::Trace::WriteChromeJson(trace);
+        }
+    } };
+
+    auto weights { mf::Weights::MakeFromFile(config) };
+    auto layers { mf::Model::ReadFromFile(config) };
+    bool const streaming { config.mnistStreamBatch != 0 };
+    bool const serving { !config.serverSocketPath.empty() };
+
+    // A streamed dataset is read batch by batch during each evaluation instead. The server reads
+    // the images from its clients, and only needs the dataset to tune the engine on.
+    std::optional<mf::Mnist> mnist;
+    if (serving && config.autotune == mf::AutotuneMode::On)
     {
-        auto sample = mnist.GetSample(i);
-        Apply((float*)sample.image, out1.data(), layer1);
-        Apply(out1.data(), out2.data(), layer2);
-        Apply(out2.data(), out3.data(), layer3);
+        auto mnistConfig { config };
+        mnistConfig.mnistPixelFormat = mf::MnistPixelFormat::Byte;
+        mnist.emplace(mf::Mnist::MakeFromFile(mnistConfig));
+    }
+    else if (!streaming && !serving)
+        mnist.emplace(mf::Mnist::MakeFromFile(config));
+    if (streaming || serving || config.mnistPixelFormat == mf::MnistPixelFormat::Byte)
+    {
+        auto it { weights.find(layers.front().name) };
+        if (it == weights.end())
+            throw mf::LayerNotFoundException { layers.front().name };
+        it->second.ScaleKernel(1.0f / 255.0f);
+    }
+
+    if (config.denseIsa)
+        mf::Dense::SetIsa(*config.denseIsa);
+
+    // The parameters are tuned on the final weights and instruction set, since both change which
+    // configuration is the fastest. Only the CPU backend uses them.
+    if (config.backend == mf::Backend::Cpu && config.autotune != mf::AutotuneMode::Off)
+    {
+        auto const pixelFormat { streaming || serving ? mf::MnistPixelFormat::Byte
+                                                      : mnist->GetPixelFormat() };
+        auto const key { mf::Autotuner::GetCacheKey(weights, layers, pixelFormat) };
+
+        std::optional<mf::TunedParameters> tuned;
+        if (config.autotune == mf::AutotuneMode::On)
+        {
+            tuned = mf::Autotuner::Tune(weights,
+                                        layers,
+                                        *mnist,
+                                        std::chrono::microseconds { config.autotuneLatencyBudget },
+                                        config.numThreads);
+            if (!config.autotuneCachePath.empty())
+                mf::Autotuner::Store(config.autotuneCachePath, key, *tuned);
 
-        auto   it    = std::max_element(out3.begin(), out3.end());
-        size_t label = std::distance(out3.begin(), it);
+            std::cout << "autotune: batch size " << tuned->batchSize << ", " << tuned->numThreads
+                      << " threads, " << (tuned->fused ? "fused" : "unfused") << ", tiles "
+                      << tuned->blocking.numSamples << "x" << tuned->blocking.numInputs << "x"
+                      << tuned->blocking.numOutputs << ", " << tuned->throughput << " images/s, "
+                      << tuned->latency * 1e6 << " us per batch (p99)" << std::endl;
+        }
+        else if (!config.autotuneCachePath.empty())
+            tuned = mf::Autotuner::Load(config.autotuneCachePath, key);
+
+        if (tuned)
+            mf::Autotuner::Apply(*tuned, config);
+    }
+
+    auto plan { std::make_shared<mf::ExecutionPlan const>(
+        mf::ExecutionPlan::Compile(weights, layers, config.batchSize)) };
+    mf::DenseBlocking const blocking { config.denseTileSamples,
+                                       config.denseTileInputs,
+                                       config.denseTileOutputs };
 
-        if (label == (size_t)sample.label)
-            ++correct;
+    if (serving)
+    {
+        // The signals are blocked before the threads of the server start, so that they inherit the
+        // mask and only `sigtimedwait` below receives them.
+        sigset_t signals;
+        sigemptyset(&signals);
+        sigaddset(&signals, SIGINT);
+        sigaddset(&signals, SIGTERM);
+        pthread_sigmask(SIG_BLOCK, &signals, nullptr);
+
+        auto const engine { mf::Engine::MakeFromPlan(
+            plan, blocking, config.denseFused, config.denseSparseThreshold) };
+        mf::InferenceServer server { engine,
+                                     config.serverSocketPath,
+                                     config.numThreads,
+                                     std::chrono::microseconds { config.serverMaxWait } };
+        std::cout << "listening on " << config.serverSocketPath.string() << " (batch size "
+                  << server.GetBatchSize() << ", " << server.GetNumWorkers() << " workers, "
+                  << config.serverMaxWait << " us max wait)" << std::endl;
 
-        if (i % 100 == 0)
+        timespec const interval { (time_t)(config.progressInterval / 1000),
+                                  (long)(config.progressInterval % 1000 * 1000000) };
+        while (true)
         {
-            std::cout << correct << " out of " << i << std::endl;
+            int const received { sigtimedwait(
+                &signals, nullptr, config.progressInterval == 0 ? nullptr : &interval) };
+            if (received == SIGINT || received == SIGTERM)
+                break;
+            if (received == -1 && errno == EAGAIN)
+                mf::InferenceServer::PrintSummary(std::cout, server.GetStatistics());
         }
+
+        server.Stop();
+        mf::InferenceServer::Print(std::cout, server.GetStatistics());
+        writeReports();
+        return 0;
     }
-    std::cout << correct << " out of " << mnist.GetNumSamples() << std::endl;
+
+    mf::ThreadPool pool { config.numThreads };
+
+    // `ClShardedEngine` pipelines the batches on its own threads and `HybridEngine` holds the
+    // pool, so neither takes it.
+    auto evaluate { [&](auto& engine, std::string const& description) {
+        using EngineType = std::decay_t<decltype(engine)>;
+        constexpr bool onDevice { std::is_same_v<EngineType, mf::ClShardedEngine>
+                                  || std::is_same_v<EngineType, mf::HybridEngine> };
+
+        auto begin { std::chrono::steady_clock::now() };
+        auto run { [&](mf::ProgressReporter* reporter) {
+            if (!streaming)
+            {
+                if constexpr (onDevice)
+                    return mf::Evaluation::Evaluate(engine, *mnist, reporter);
+                else
+                    return mf::Evaluation::Evaluate(engine, *mnist, pool, reporter);
+            }
+
+            mf::MnistStream stream { config.mnistImageFilePath,
+                                     config.mnistLabelFilePath,
+                                     config.mnistStreamBatch,
+                                     config.mnistStreamBuffers };
+            if constexpr (onDevice)
+                return mf::Evaluation::Evaluate(engine, stream, reporter);
+            else
+                return mf::Evaluation::Evaluate(engine, stream, pool, reporter);
+        } };
+        auto result { [&] {
+            if (config.progressInterval == 0)
+                return run(nullptr);
+
+            mf::ProgressReporter reporter { std::cout,
+                                            std::chrono::milliseconds { config.progressInterval } };
+            return run(&reporter);
+        }() };
+        std::chrono::duration<double> elapsed { std::chrono::steady_clock::now() - begin };
+
+        mf::Evaluation::Print(std::cout, result);
+        std::cout << result.numSamples / elapsed.count() << " images/s (batch size "
+                  << engine.GetBatchSize() << ", " << description << ")" << std::endl;
+        return result;
+    } };
+    std::string const cpuDescription { std::string { mf::Cpu::GetIsaName(mf::Dense::GetIsa()) }
+                                       + ", " + std::to_string(pool.GetNumThreads())
+                                       + " threads" };
+
+    mf::EvaluationResult result;
+    if (config.backend == mf::Backend::Cpu)
+    {
+        auto engine { mf::Engine::MakeFromPlan(
+            plan, blocking, config.denseFused, config.denseSparseThreshold) };
+        result = evaluate(engine, cpuDescription);
+    }
+    else
+    {
+        // Each device gets its own context, queue and program.
+        std::vector<mf::ClEngine> engines;
+        std::vector<std::string>  names;
+        for (auto const& device : mf::ClFactory::MakeDevices(config))
+        {
+            auto [context, queue] { mf::ClFactory::MakeContextAndQueue(device) };
+            auto program { mf::ClFactory::MakeProgram(config, context, device) };
+            engines.push_back(mf::ClEngine::MakeFromPlan(
+                *plan,
+                context,
+                queue,
+                program,
+                config.clNumBuffers,
+                config.clZeroCopy,
+                mf::ClBufferPool::MakeFromContext(context, config.clPoolCapacity)));
+            names.push_back(config.deviceName + " #" + std::to_string(names.size()));
+        }
+        auto engine { mf::ClShardedEngine::MakeFromEngines(std::move(engines), std::move(names)) };
+
+        // The report is opened first, so that a wrong path does not waste the evaluation.
+        std::optional<mf::ClProfiler> profiler;
+        std::ofstream                 report;
+        if (!config.clProfileReportPath.empty())
+        {
+            report.open(config.clProfileReportPath);
+            if (!report)
+                throw mf::NoSuchFileException { config.clProfileReportPath.string() };
+        }
+        if (config.clProfile || report.is_open())
+            engine.SetProfiler(&profiler.emplace());
+
+        auto const& first { engine.GetShard(0) };
+        std::string description { config.deviceName };
+        if (engine.GetNumShards() > 1)
+            description += " x" + std::to_string(engine.GetNumShards());
+        description += ", " + std::to_string(first.GetNumSlots()) + " buffers";
+        if (first.IsZeroCopy())
+            description += ", zero-copy";
+
+        auto printDevices { [&](mf::ClShardedEngine& engine) {
+            auto const& shards { engine.GetStatistics() };
+            for (size_t i = 0; i < shards.size(); ++i)
+            {
+                auto const& shard { shards[i] };
+                if (shards.size() > 1)
+                    std::cout << shard.name << ": " << shard.numSamples << " samples in "
+                              << shard.numBatches << " batches, " << shard.GetThroughput()
+                              << " images/s" << std::endl;
+                if (!config.clProfile)
+                    continue;
+
+                auto const pool { engine.GetShard(i).GetBufferPool().GetStatistics() };
+                std::cout << shard.name << " buffer pool: " << pool.numCreated << " created, "
+                          << pool.numEvicted << " evicted, " << pool.numReused << " of "
+                          << pool.numLeases << " leases reused, " << pool.maxBytesLeased
+                          << " bytes leased at most" << std::endl;
+            }
+        } };
+
+        if (config.backend == mf::Backend::OpenCl)
+        {
+            result = evaluate(engine, description);
+            printDevices(engine);
+        }
+        else
+        {
+            auto hybridEngine { mf::HybridEngine::MakeFromEngines(
+                mf::Engine::MakeFromPlan(plan), std::move(engine), pool, config.hybridRoundSize) };
+            result = evaluate(hybridEngine, description + " + " + cpuDescription);
+
+            auto const& statistics { hybridEngine.GetStatistics() };
+            std::cout << "host: " << statistics.numHostSamples << " samples, "
+                      << statistics.hostThroughput << " images/s; devices: "
+                      << statistics.numDeviceSamples << " samples, "
+                      << statistics.deviceThroughput << " images/s; device share "
+                      << hybridEngine.GetDeviceShare() * 100.0 << "%" << std::endl;
+            printDevices(hybridEngine.GetDevice());
+        }
+
+        if (config.clProfile)
+            profiler->PrintSummary(std::cout);
+        if (report.is_open())
+            profiler->WriteReport(report);
+    }
+
+    if (config.int8CalibrationSize != 0)
+    {
+        auto quantizedEngine { mf::QuantizedEngine::MakeFromPlan(
+            *plan, *mnist, config.int8CalibrationSize) };
+
+        std::cout << "int8:" << std::endl;
+        auto quantizedResult { evaluate(quantizedEngine, cpuDescription) };
+
+        double drop { (result.GetAccuracy() - quantizedResult.GetAccuracy()) * 100.0 };
+        std::cout << "int8 accuracy drop: " << drop << "%p ("
+                  << (drop <= config.int8MaxAccuracyDrop ? "accepted" : "rejected")
+                  << ", threshold " << config.int8MaxAccuracyDrop << "%p)" << std::endl;
+    }
+
+    writeReports();
     return 0;
 }
 catch (mf::ClException const& ex)
@@ -3,11 +3,15 @@
 
 #include <mf/File.hh>
 #include <mf/Mnist.hh>
+#include <mf/PerfCounters.hh>
+#include <mf/Trace.hh>
 
 #include <fstream>
 #include <iostream>
 #include <string>
 
+#include "IdxHeader.hh"
+
 #define READ_FROM_IFS(expr) (ifs.read((char*)(&(expr)), sizeof(expr)))
 
 namespace mf
@@ -37,12 +41,14 @@ void RevertEndian(uint32_t& value)
 }
 
 /**
- * Reads image data from the given file.
+ * Reads image data from the given file. The pixels are returned as stored in the file.
  *
  * @param imagePath the file to read
  */
-std::vector<float> ReadImages(std::filesystem::path const& imagePath)
+PageAlignedVector<uint8_t> ReadImages(std::filesystem::path const& imagePath)
 {
+    MF_TRACE_SPAN("ReadImages");
+
     std::ifstream ifs { imagePath, std::ifstream::binary };
     if (!ifs)
         throw NoSuchFileException { imagePath.string() };
@@ -65,20 +71,23 @@ std::vector<float> ReadImages(std::filesystem::path const& imagePath)
     if (imageHeight != MnistSample::height || imageWidth != MnistSample::width)
         throw InvalidMnistDatasetException { imagePath.string() };
 
-    uint8_t buffer[MnistSample::height * MnistSample::width];
-    float   values[MnistSample::height * MnistSample::width];
-
-    std::vector<float> data;
-    data.reserve(numImages * MnistSample::height * MnistSample::width);
-    for (uint32_t i = 0; i < numImages; ++i)
-    {
-        READ_FROM_IFS(buffer);
+    PageAlignedVector<uint8_t> data;
+    data.resize((size_t)numImages * MnistSample::height * MnistSample::width);
+    if (!ifs.read((char*)data.data(), data.size()))
+        throw InvalidMnistDatasetException { imagePath.string() };
 
-        for (size_t j = 0; j < MnistSample::height * MnistSample::width; ++j)
-            values[j] = buffer[j] / 255.0f;
+    return data;
+}
 
-        data.insert(std::end(data), std::begin(values), std::end(values));
-    }
+/**
+ * Converts the pixels to `float` values in [0, 1].
+ *
+ * @param pixels the pixels as stored in the file
+ */
+PageAlignedVector<float> NormalizeImages(ArrayView<uint8_t> pixels)
+{
+    PageAlignedVector<float> data(pixels.size());
+    for (size_t i = 0; i < pixels.size(); ++i) data[i] = pixels[i] / 255.0f;
 
     return data;
 }
@@ -90,6 +99,8 @@ std::vector<float> ReadImages(std::filesystem::path const& imagePath)
  */
 std::vector<MnistLabel> ReadLabels(std::filesystem::path const& labelPath)
 {
+    MF_TRACE_SPAN("ReadLabels");
+
     std::ifstream ifs { labelPath, std::ifstream::binary };
     if (!ifs)
         throw NoSuchFileException { labelPath.string() };
@@ -106,6 +117,9 @@ std::vector<MnistLabel> ReadLabels(std::filesystem::path const& labelPath)
     std::vector<MnistLabel> data;
     data.resize(numLabels);
     ifs.read((char*)data.data(), numLabels * sizeof(MnistLabel));
+    if (!ifs)
+        throw InvalidMnistDatasetException { labelPath.string() };
+    idx::ValidateLabels(data.data(), data.size(), labelPath);
 
     return data;
 }
@@ -113,14 +127,69 @@ std::vector<MnistLabel> ReadLabels(std::filesystem::path const& labelPath)
 }
 
 Mnist Mnist::MakeFromFile(std::filesystem::path const& imagePath,
-                          std::filesystem::path const& labelPath)
+                          std::filesystem::path const& labelPath,
+                          MnistPixelFormat             pixelFormat)
 {
+    PerfScope perf { "load dataset" };
+
     auto images { ReadImages(imagePath) };
     auto labels { ReadLabels(labelPath) };
     if (images.size() != labels.size() * MnistSample::width * MnistSample::height)
         throw MnistSampleNumberDoesNotMatchException {};
 
-    return Mnist { labels.size(), std::move(images), std::move(labels) };
+    Mnist rtn { labels.size(), pixelFormat };
+    if (pixelFormat == MnistPixelFormat::Byte)
+        rtn._byteImages = std::move(images);
+    else
+        rtn._images = NormalizeImages(images);
+    rtn._labels = std::move(labels);
+
+    perf.SetNumSamples(rtn.GetNumSamples());
+    return rtn;
+}
+
+Mnist Mnist::MakeFromMappedFile(std::filesystem::path const& imagePath,
+                                std::filesystem::path const& labelPath,
+                                MnistPixelFormat             pixelFormat,
+                                MapHint                      hint)
+{
+    MF_TRACE_SPAN("Mnist::MakeFromMappedFile");
+    PerfScope perf { "load dataset" };
+
+    auto imageFile { std::make_shared<MappedFile const>(MappedFile::Open(imagePath, hint)) };
+    auto labelFile { std::make_shared<MappedFile const>(MappedFile::Open(labelPath, hint)) };
+
+    // Accessing past the end of a file would raise SIGBUS instead of an exception, so the sizes
+    // are validated here.
+    if (imageFile->GetSize() < imageHeaderSize)
+        throw InvalidMnistDatasetException { imagePath.string() };
+    if (labelFile->GetSize() < labelHeaderSize)
+        throw InvalidMnistDatasetException { labelPath.string() };
+
+    size_t const numImages
+        = idx::ParseImageHeader(imageFile->GetData(), imageFile->GetSize(), imagePath);
+    size_t const numLabels
+        = idx::ParseLabelHeader(labelFile->GetData(), labelFile->GetSize(), labelPath);
+    if (numImages != numLabels)
+        throw MnistSampleNumberDoesNotMatchException {};
+    idx::ValidateLabels(
+        (MnistLabel const*)(labelFile->GetData() + labelHeaderSize), numLabels, labelPath);
+
+    perf.SetNumSamples(numLabels);
+    Mnist rtn { numLabels, pixelFormat };
+    rtn._labelFile = std::move(labelFile);
+    if (pixelFormat == MnistPixelFormat::Byte)
+    {
+        rtn._imageFile = std::move(imageFile);
+    }
+    else
+    {
+        uint8_t const* pixels = imageFile->GetData() + imageHeaderSize;
+        rtn._images           = NormalizeImages(ArrayView<uint8_t> {
+            pixels, numImages * MnistSample::width * MnistSample::height });
+    }
+
+    return rtn;
 }
 
 }
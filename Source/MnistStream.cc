@@ -0,0 +1,249 @@
+// Copyright (c) 2021 Chanjung Kim. All rights reserved.
+// Licensed under the MIT License.
+
+#include <mf/File.hh>
+#include <mf/MnistStream.hh>
+#include <mf/Trace.hh>
+
+#include <algorithm>
+#include <cerrno>
+#include <stdexcept>
+
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "IdxHeader.hh"
+
+namespace mf
+{
+
+namespace
+{
+
+constexpr size_t imageSize { MnistSample::height * MnistSample::width };
+
+/**
+ * Reads exactly `size` bytes at `offset`, retrying on short reads and interrupts.
+ *
+ * @return `false` if the file ended first
+ * @throws NoSuchFileException if reading failed
+ */
+bool ReadFully(int fd, void* data, size_t size, size_t offset, std::filesystem::path const& path)
+{
+    auto bytes { (uint8_t*)data };
+    while (size > 0)
+    {
+        ssize_t const numRead { pread(fd, bytes, size, (off_t)offset) };
+        if (numRead < 0)
+        {
+            if (errno == EINTR)
+                continue;
+            throw NoSuchFileException { path.string() };
+        }
+        if (numRead == 0)
+            return false;
+
+        bytes += numRead;
+        size -= (size_t)numRead;
+        offset += (size_t)numRead;
+    }
+    return true;
+}
+
+/**
+ * Opens the given file for sequential reading and reads its header.
+ *
+ * @param path the file to open
+ * @param header the buffer of length `headerSize` to write the header to
+ * @param fileSize the variable to write the size of the file to
+ * @return the file descriptor
+ * @throws NoSuchFileException
+ * @throws InvalidMnistDatasetException if the file is shorter than the header
+ */
+int OpenIdx(std::filesystem::path const& path, uint8_t* header, size_t headerSize, size_t& fileSize)
+{
+    int fd { open(path.c_str(), O_RDONLY | O_CLOEXEC) };
+    if (fd < 0)
+        throw NoSuchFileException { path.string() };
+
+    try
+    {
+        struct stat status;
+        if (fstat(fd, &status) < 0)
+            throw NoSuchFileException { path.string() };
+
+        fileSize = (size_t)status.st_size;
+        if (fileSize < headerSize || !ReadFully(fd, header, headerSize, 0, path))
+            throw InvalidMnistDatasetException { path.string() };
+    }
+    catch (...)
+    {
+        close(fd);
+        throw;
+    }
+
+    // Hints are advisory; failures are ignored.
+    posix_fadvise(fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+    return fd;
+}
+
+}
+
+MnistStream::MnistStream(std::filesystem::path const& imagePath,
+                         std::filesystem::path const& labelPath,
+                         size_t                       batchSize,
+                         size_t                       numBuffers) :
+    _imagePath { imagePath },
+    _labelPath { labelPath },
+    _imageFd { -1 },
+    _labelFd { -1 },
+    _numSamples { 0 },
+    _batchSize { batchSize },
+    _numBatches { 0 },
+    _numFilled { 0 },
+    _numReleased { 0 },
+    _holding { false },
+    _stop { false }
+{
+    if (batchSize == 0)
+        throw std::invalid_argument { "batchSize" };
+    if (numBuffers < 2)
+        throw std::invalid_argument { "numBuffers" };
+
+    try
+    {
+        uint8_t imageHeader[Mnist::imageHeaderSize], labelHeader[Mnist::labelHeaderSize];
+        size_t  imageFileSize, labelFileSize;
+        _imageFd = OpenIdx(imagePath, imageHeader, sizeof(imageHeader), imageFileSize);
+        _labelFd = OpenIdx(labelPath, labelHeader, sizeof(labelHeader), labelFileSize);
+
+        size_t const numImages = idx::ParseImageHeader(imageHeader, imageFileSize, imagePath);
+        size_t const numLabels = idx::ParseLabelHeader(labelHeader, labelFileSize, labelPath);
+        if (numImages != numLabels)
+            throw MnistSampleNumberDoesNotMatchException {};
+
+        _numSamples = numImages;
+        _numBatches = (numImages + batchSize - 1) / batchSize;
+
+        _buffers.resize(std::min(numBuffers, std::max(_numBatches, (size_t)1)));
+        for (auto& buffer : _buffers)
+        {
+            buffer.images.resize(batchSize * imageSize);
+            buffer.labels.resize(batchSize);
+        }
+    }
+    catch (...)
+    {
+        if (_imageFd >= 0)
+            close(_imageFd);
+        if (_labelFd >= 0)
+            close(_labelFd);
+        throw;
+    }
+
+    _thread = std::thread { &MnistStream::Run, this };
+}
+
+MnistStream::~MnistStream()
+{
+    {
+        std::lock_guard<std::mutex> lock { _mutex };
+        _stop = true;
+    }
+    _freed.notify_one();
+    _thread.join();
+
+    close(_imageFd);
+    close(_labelFd);
+}
+
+bool MnistStream::Next(MnistBatch& batch)
+{
+    std::unique_lock<std::mutex> lock { _mutex };
+    if (_holding)
+    {
+        ++_numReleased;
+        _holding = false;
+        _freed.notify_one();
+    }
+
+    _filled.wait(lock, [this] {
+        return _numFilled > _numReleased || _exception || _numReleased == _numBatches;
+    });
+
+    // Batches read before a failure are still returned in order.
+    if (_numFilled > _numReleased)
+    {
+        auto& buffer { _buffers[_numReleased % _buffers.size()] };
+        batch.first      = _numReleased * _batchSize;
+        batch.numSamples = std::min(_batchSize, _numSamples - batch.first);
+        batch.images     = buffer.images.data();
+        batch.labels     = buffer.labels.data();
+        _holding         = true;
+        return true;
+    }
+
+    if (_exception)
+        std::rethrow_exception(_exception);
+
+    return false;
+}
+
+void MnistStream::Run()
+{
+    for (size_t batchIndex = 0; batchIndex < _numBatches; ++batchIndex)
+    {
+        {
+            std::unique_lock<std::mutex> lock { _mutex };
+            _freed.wait(lock, [&] { return _stop || batchIndex - _numReleased < _buffers.size(); });
+            if (_stop)
+                return;
+        }
+
+        // The slot is not visible to the consumer until `_numFilled` passes it, so it is filled
+        // without holding the lock.
+        try
+        {
+            Read(batchIndex, _buffers[batchIndex % _buffers.size()]);
+        }
+        catch (...)
+        {
+            std::lock_guard<std::mutex> lock { _mutex };
+            _exception = std::current_exception();
+            _filled.notify_one();
+            return;
+        }
+
+        {
+            std::lock_guard<std::mutex> lock { _mutex };
+            _numFilled = batchIndex + 1;
+        }
+        _filled.notify_one();
+    }
+}
+
+void MnistStream::Read(size_t batchIndex, Buffer& buffer)
+{
+    MF_TRACE_SPAN("MnistStream::Read", "batch", batchIndex);
+
+    size_t const first      = batchIndex * _batchSize;
+    size_t const numSamples = std::min(_batchSize, _numSamples - first);
+
+    size_t const imageOffset = Mnist::imageHeaderSize + first * imageSize;
+    size_t const imageLength = numSamples * imageSize;
+    if (!ReadFully(_imageFd, buffer.images.data(), imageLength, imageOffset, _imagePath))
+        throw InvalidMnistDatasetException { _imagePath.string() };
+
+    size_t const labelOffset = Mnist::labelHeaderSize + first;
+    if (!ReadFully(_labelFd, buffer.labels.data(), numSamples, labelOffset, _labelPath))
+        throw InvalidMnistDatasetException { _labelPath.string() };
+    idx::ValidateLabels(buffer.labels.data(), numSamples, _labelPath);
+
+    // Every byte is read once, so the pages are dropped from the page cache instead of pushing out
+    // pages other processes need.
+    posix_fadvise(_imageFd, (off_t)imageOffset, (off_t)imageLength, POSIX_FADV_DONTNEED);
+    posix_fadvise(_labelFd, (off_t)labelOffset, (off_t)numSamples, POSIX_FADV_DONTNEED);
+}
+
+}
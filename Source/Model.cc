@@ -0,0 +1,256 @@
+// Copyright (c) 2021 Chanjung Kim. All rights reserved.
+// Licensed under the MIT License.
+
+#include <mf/Model.hh>
+#include <mf/Trace.hh>
+#include <mf/Weights.hh>
+
+#include <hdf5.h>
+
+#include <algorithm>
+#include <cstring>
+#include <utility>
+
+#include "Json.hh"
+#include "WeightFileFormat.hh"
+
+namespace mf
+{
+
+namespace
+{
+
+/**
+ * Returns the member with the given key, which must be a string.
+ *
+ * @throws InvalidModelConfigException if the member is missing or is not a string
+ */
+std::string const& GetStringMember(JsonValue const& object, char const* key)
+{
+    auto member { object.Find(key) };
+    if (member == nullptr || member->GetType() != JsonValue::Type::String)
+        throw InvalidModelConfigException { std::string { key } + " is missing" };
+
+    return member->GetString();
+}
+
+/**
+ * Parses the name of a Keras activation.
+ *
+ * @throws InvalidModelConfigException if the activation is not implemented
+ */
+Activation ParseActivation(std::string const& name)
+{
+    if (name == "linear")
+        return Activation::Linear;
+    if (name == "relu")
+        return Activation::Relu;
+    if (name == "softmax")
+        return Activation::Softmax;
+
+    throw InvalidModelConfigException { name + " activations are not supported" };
+}
+
+/**
+ * Applies an activation layer to the preceding FC layer, which must not have one yet.
+ */
+void FoldActivation(std::vector<LayerSpec>& layers, std::string const& name, Activation activation)
+{
+    if (activation == Activation::Linear)
+        return;
+
+    if (layers.empty() || layers.back().activation != Activation::Linear)
+        throw InvalidModelConfigException { name + " does not follow a linear Dense layer" };
+
+    layers.back().activation = activation;
+}
+
+/**
+ * Reads the string attribute with the given name of the given object, either of variable or fixed
+ * length.
+ *
+ * @return `false` if the attribute could not be read
+ */
+bool ReadStringAttribute(hid_t objectId, char const* name, std::string& value)
+{
+    if (H5Aexists(objectId, name) <= 0)
+        return false;
+
+    hid_t attributeId { H5Aopen(objectId, name, H5P_DEFAULT) };
+    if (attributeId < 0)
+        return false;
+
+    hid_t typeId { H5Aget_type(attributeId) };
+    bool  succeeded { false };
+    if (typeId >= 0 && H5Tget_class(typeId) == H5T_STRING)
+    {
+        if (H5Tis_variable_str(typeId) > 0)
+        {
+            hid_t memoryTypeId { H5Tcopy(H5T_C_S1) };
+            H5Tset_size(memoryTypeId, H5T_VARIABLE);
+
+            char* string { nullptr };
+            if (H5Aread(attributeId, memoryTypeId, &string) >= 0 && string != nullptr)
+            {
+                value     = string;
+                succeeded = true;
+                H5free_memory(string);
+            }
+            H5Tclose(memoryTypeId);
+        }
+        else
+        {
+            std::vector<char> buffer(H5Tget_size(typeId) + 1, '\0');
+            if (H5Aread(attributeId, typeId, buffer.data()) >= 0)
+            {
+                value     = buffer.data();
+                succeeded = true;
+            }
+        }
+    }
+
+    if (typeId >= 0)
+        H5Tclose(typeId);
+    H5Aclose(attributeId);
+
+    return succeeded;
+}
+
+}
+
+std::vector<LayerSpec> Model::ParseKerasConfig(std::string_view json)
+{
+    JsonValue root;
+    try
+    {
+        root = JsonValue::Parse(json);
+    }
+    catch (InvalidJsonException const& ex)
+    {
+        throw InvalidModelConfigException { std::string { "model_config is not JSON " }
+                                            + ex.GetMessage() };
+    }
+
+    auto const& className { GetStringMember(root, "class_name") };
+    if (className != "Sequential")
+        throw InvalidModelConfigException { className + " models are not supported" };
+
+    // Keras 2.2 and earlier store the layers as the configuration itself.
+    JsonValue const* layers { root.Find("config") };
+    if (layers != nullptr && layers->GetType() != JsonValue::Type::Array)
+        layers = layers->Find("layers");
+    if (layers == nullptr || layers->GetType() != JsonValue::Type::Array)
+        throw InvalidModelConfigException { "layers is missing" };
+
+    std::vector<LayerSpec> rtn;
+    for (auto& layer : layers->GetArray())
+    {
+        auto const& layerClassName { GetStringMember(layer, "class_name") };
+        auto        layerConfig { layer.Find("config") };
+        if (layerConfig == nullptr)
+            throw InvalidModelConfigException { layerClassName + " has no config" };
+
+        auto const& name { GetStringMember(*layerConfig, "name") };
+        if (layerClassName == "InputLayer" || layerClassName == "Flatten"
+            || layerClassName == "Dropout")
+            continue;
+
+        if (layerClassName == "Dense")
+        {
+            // `linear` is the default of Keras.
+            bool const hasActivation { layerConfig->Find("activation") != nullptr };
+            rtn.push_back(LayerSpec {
+                name,
+                hasActivation ? ParseActivation(GetStringMember(*layerConfig, "activation"))
+                              : Activation::Linear,
+            });
+        }
+        else if (layerClassName == "Activation")
+            FoldActivation(rtn, name, ParseActivation(GetStringMember(*layerConfig, "activation")));
+        else if (layerClassName == "ReLU")
+            FoldActivation(rtn, name, Activation::Relu);
+        else if (layerClassName == "Softmax")
+            FoldActivation(rtn, name, Activation::Softmax);
+        else
+            throw InvalidModelConfigException { layerClassName + " layers are not supported" };
+    }
+
+    if (rtn.empty())
+        throw InvalidModelConfigException { "the model has no Dense layer" };
+
+    return rtn;
+}
+
+std::vector<LayerSpec> Model::ReadFromHdf5(std::filesystem::path const& path)
+{
+    MF_TRACE_SPAN("Model::ReadFromHdf5");
+
+    hid_t fileId { H5Fopen(path.c_str(), H5F_ACC_RDONLY, H5P_DEFAULT) };
+    if (fileId < 0)
+        throw NoSuchFileException { path.string() };
+
+    std::string json;
+    bool const  found { ReadStringAttribute(fileId, "model_config", json) };
+    H5Fclose(fileId);
+
+    if (!found)
+        throw InvalidModelConfigException { path.string() + " has no model_config" };
+
+    return ParseKerasConfig(json);
+}
+
+std::vector<LayerSpec> Model::ReadFromFlatFile(std::filesystem::path const& path)
+{
+    MF_TRACE_SPAN("Model::ReadFromFlatFile");
+
+    auto file { MappedFile::Open(path) };
+
+    flat::FileHeader header;
+    if (file.GetSize() < sizeof(header))
+        throw InvalidFlatWeightFileException { path.string() };
+    std::memcpy(&header, file.GetData(), sizeof(header));
+    if (std::memcmp(header.signature, flat::signature, sizeof(flat::signature)) != 0
+        || header.byteOrder != flat::byteOrderMark
+        || (uint64_t)header.numLayers * sizeof(flat::LayerEntry)
+               > file.GetSize() - sizeof(header))
+        throw InvalidFlatWeightFileException { path.string() };
+
+    std::vector<std::pair<uint32_t, LayerSpec>> positioned;
+    for (uint32_t l = 0; l < header.numLayers; ++l)
+    {
+        flat::LayerEntry entry;
+        std::memcpy(&entry,
+                    file.GetData() + sizeof(header) + l * sizeof(flat::LayerEntry),
+                    sizeof(entry));
+        if (entry.position == 0)
+            continue;
+        if (std::memchr(entry.name, '\0', sizeof(entry.name)) == nullptr
+            || entry.activation > (uint8_t)Activation::Softmax)
+            throw InvalidFlatWeightFileException { path.string() };
+
+        positioned.emplace_back(entry.position,
+                                LayerSpec { entry.name, (Activation)entry.activation });
+    }
+
+    if (positioned.empty())
+        throw InvalidModelConfigException { path.string() + " was written without the model "
+                                                            "architecture" };
+
+    std::sort(positioned.begin(), positioned.end(), [](auto const& lhs, auto const& rhs) {
+        return lhs.first < rhs.first;
+    });
+
+    std::vector<LayerSpec> rtn;
+    for (auto& [position, spec] : positioned) rtn.push_back(std::move(spec));
+    return rtn;
+}
+
+std::vector<LayerSpec> Model::ReadFromFile(Config const& config)
+{
+    if (Weights::IsFlatFile(config.weightFilePath))
+        return ReadFromFlatFile(config.weightFilePath);
+
+    return ReadFromHdf5(config.weightFilePath);
+}
+
+}
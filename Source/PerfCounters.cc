@@ -0,0 +1,396 @@
+// Copyright (c) 2021 Chanjung Kim. All rights reserved.
+// Licensed under the MIT License.
+
+#include <mf/PerfCounters.hh>
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <fstream>
+#include <iomanip>
+#include <memory>
+#include <mutex>
+
+#if defined(__linux__)
+#    include <linux/perf_event.h>
+#    include <sys/syscall.h>
+#    include <unistd.h>
+#endif
+
+namespace mf
+{
+
+std::atomic<bool> PerfCounters::_enabled { false };
+
+namespace
+{
+
+/**
+ * The stages of one thread. The mutex is only contended while the statistics are collected.
+ */
+struct ThreadStages
+{
+    std::mutex                       mutex;
+    std::vector<PerfStageStatistics> stages;
+};
+
+/**
+ * The stages of every thread that has opened its counters, kept after the threads exit.
+ */
+struct PerfRegistry
+{
+    std::mutex                                   mutex;
+    std::vector<std::unique_ptr<ThreadStages>>   threads;
+    std::string                                  error;
+    std::array<std::atomic<bool>, numPerfEvents> missing {};
+};
+
+PerfRegistry& GetRegistry() noexcept
+{
+    static PerfRegistry registry;
+    return registry;
+}
+
+/**
+ * Records why a thread could not open its counters, keeping the first reason only.
+ */
+void SetError(std::string error) noexcept
+{
+    try
+    {
+        auto&                       registry { GetRegistry() };
+        std::lock_guard<std::mutex> lock { registry.mutex };
+        if (registry.error.empty())
+            registry.error = std::move(error);
+    }
+    catch (...)
+    {
+    }
+}
+
+#if defined(__linux__)
+
+/**
+ * Returns the type and the configuration of `perf_event_attr` counting the given event.
+ */
+std::pair<uint32_t, uint64_t> GetEventConfig(PerfEvent event) noexcept
+{
+    uint64_t const readMiss { (PERF_COUNT_HW_CACHE_OP_READ << 8)
+                              | (PERF_COUNT_HW_CACHE_RESULT_MISS << 16) };
+
+    switch (event)
+    {
+    case PerfEvent::Cycles: return { PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES };
+    case PerfEvent::Instructions: return { PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS };
+    case PerfEvent::L1dMisses: return { PERF_TYPE_HW_CACHE, PERF_COUNT_HW_CACHE_L1D | readMiss };
+    case PerfEvent::LlcMisses: return { PERF_TYPE_HARDWARE, PERF_COUNT_HW_CACHE_MISSES };
+    case PerfEvent::DtlbMisses: return { PERF_TYPE_HW_CACHE, PERF_COUNT_HW_CACHE_DTLB | readMiss };
+    case PerfEvent::BranchMisses: return { PERF_TYPE_HARDWARE, PERF_COUNT_HW_BRANCH_MISSES };
+    }
+    return { PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES };
+}
+
+/**
+ * Returns the contents of `/proc/sys/kernel/perf_event_paranoid`, or an empty string.
+ */
+std::string GetParanoidLevel()
+{
+    std::ifstream ifs { "/proc/sys/kernel/perf_event_paranoid" };
+    std::string   rtn;
+    ifs >> rtn;
+    return rtn;
+}
+
+/**
+ * The counters of one thread, read together as a group. They are closed when the thread exits;
+ * what they counted is kept in the registry.
+ */
+class ThreadCounters
+{
+  private:
+    int                            _leader;
+    std::array<int, numPerfEvents> _fds;
+    std::array<int, numPerfEvents> _positions;
+    size_t                         _numOpened;
+    ThreadStages*                  _stages;
+
+  public:
+    ThreadCounters() noexcept : _leader { -1 }, _numOpened { 0 }, _stages { nullptr }
+    {
+        _fds.fill(-1);
+        _positions.fill(-1);
+        Open();
+    }
+
+    ThreadCounters(ThreadCounters const&) = delete;
+    ThreadCounters& operator=(ThreadCounters const&) = delete;
+
+    ~ThreadCounters()
+    {
+        for (int fd : _fds)
+        {
+            if (fd != -1)
+                close(fd);
+        }
+    }
+
+  public:
+    ThreadStages* GetStages() const noexcept
+    {
+        return _stages;
+    }
+
+    bool Read(PerfEventCounts& counts) const noexcept
+    {
+        if (_stages == nullptr)
+            return false;
+
+        // The group is read as { nr, time_enabled, time_running, value[nr] }.
+        uint64_t buffer[3 + numPerfEvents];
+        ssize_t const size { read(_leader, buffer, sizeof(buffer)) };
+        if (size < (ssize_t)(3 * sizeof(uint64_t)) || buffer[0] != _numOpened)
+            return false;
+
+        // The counts are scaled up if the group was multiplexed with other counters.
+        double const scale { buffer[2] == 0 ? 0.0 : (double)buffer[1] / buffer[2] };
+        for (size_t i = 0; i < numPerfEvents; ++i)
+            counts[i] = _positions[i] < 0 ? 0 : (uint64_t)(buffer[3 + _positions[i]] * scale);
+        return true;
+    }
+
+  private:
+    void Open() noexcept
+    {
+        auto& registry { GetRegistry() };
+        int   leaderError { 0 };
+        for (size_t i = 0; i < numPerfEvents; ++i)
+        {
+            auto [type, config] { GetEventConfig((PerfEvent)i) };
+
+            perf_event_attr attr;
+            std::memset(&attr, 0, sizeof(attr));
+            attr.size           = sizeof(attr);
+            attr.type           = type;
+            attr.config         = config;
+            attr.exclude_kernel = 1;
+            attr.exclude_hv     = 1;
+            attr.read_format    = PERF_FORMAT_GROUP | PERF_FORMAT_TOTAL_TIME_ENABLED
+                               | PERF_FORMAT_TOTAL_TIME_RUNNING;
+
+            int const fd { (int)syscall(
+                SYS_perf_event_open, &attr, 0, -1, _leader, (unsigned long)PERF_FLAG_FD_CLOEXEC) };
+            if (fd == -1)
+            {
+                if (_leader == -1 && leaderError == 0)
+                    leaderError = errno;
+                registry.missing[i] = true;
+                continue;
+            }
+
+            if (_leader == -1)
+                _leader = fd;
+            _fds[i]       = fd;
+            _positions[i] = (int)_numOpened++;
+        }
+
+        if (_leader == -1)
+        {
+            try
+            {
+                std::string error { "perf_event_open failed: " };
+                error += std::strerror(leaderError);
+                if (leaderError == EACCES || leaderError == EPERM)
+                    error += " (perf_event_paranoid is " + GetParanoidLevel() + ")";
+                else if (leaderError == ENOENT || leaderError == EOPNOTSUPP)
+                    error += " (the CPU or the hypervisor exposes no hardware counters)";
+                SetError(std::move(error));
+            }
+            catch (...)
+            {
+            }
+            return;
+        }
+
+        try
+        {
+            std::lock_guard<std::mutex> lock { registry.mutex };
+            registry.threads.push_back(std::make_unique<ThreadStages>());
+            _stages = registry.threads.back().get();
+        }
+        catch (...)
+        {
+        }
+    }
+};
+
+ThreadCounters& GetThreadCounters() noexcept
+{
+    thread_local ThreadCounters counters;
+    return counters;
+}
+
+#endif
+
+}
+
+char const* PerfCounters::GetEventName(PerfEvent event) noexcept
+{
+    switch (event)
+    {
+    case PerfEvent::Cycles: return "cycles";
+    case PerfEvent::Instructions: return "instructions";
+    case PerfEvent::L1dMisses: return "l1d-misses";
+    case PerfEvent::LlcMisses: return "llc-misses";
+    case PerfEvent::DtlbMisses: return "dtlb-misses";
+    case PerfEvent::BranchMisses: return "branch-misses";
+    }
+    return "unknown";
+}
+
+void PerfCounters::Start() noexcept
+{
+    _enabled.store(true, std::memory_order_relaxed);
+}
+
+void PerfCounters::Stop() noexcept
+{
+    _enabled.store(false, std::memory_order_relaxed);
+}
+
+bool PerfCounters::IsAvailable(PerfEvent event) noexcept
+{
+    auto&                       registry { GetRegistry() };
+    std::lock_guard<std::mutex> lock { registry.mutex };
+    return !registry.threads.empty() && !registry.missing[(size_t)event];
+}
+
+bool PerfCounters::Read(PerfEventCounts& counts) noexcept
+{
+#if defined(__linux__)
+    return GetThreadCounters().Read(counts);
+#else
+    SetError("hardware counters are only supported on Linux");
+    return false;
+#endif
+}
+
+void PerfCounters::Add(std::string_view       stage,
+                       size_t                 numSamples,
+                       PerfEventCounts const& begin,
+                       PerfEventCounts const& end) noexcept
+{
+#if defined(__linux__)
+    auto* stages { GetThreadCounters().GetStages() };
+    if (stages == nullptr)
+        return;
+
+    try
+    {
+        std::lock_guard<std::mutex> lock { stages->mutex };
+        auto&                       list { stages->stages };
+
+        auto it { std::find_if(list.begin(), list.end(), [&](auto const& item) {
+            return item.name == stage;
+        }) };
+        if (it == list.end())
+            it = list.insert(it, PerfStageStatistics { std::string { stage }, 0, 0, {} });
+
+        it->numCalls += 1;
+        it->numSamples += numSamples;
+        for (size_t i = 0; i < numPerfEvents; ++i)
+            it->counts[i] += end[i] >= begin[i] ? end[i] - begin[i] : 0;
+    }
+    catch (...)
+    {
+    }
+#else
+    (void)stage;
+    (void)numSamples;
+    (void)begin;
+    (void)end;
+#endif
+}
+
+std::vector<PerfStageStatistics> PerfCounters::GetStatistics()
+{
+    auto&                       registry { GetRegistry() };
+    std::lock_guard<std::mutex> lock { registry.mutex };
+
+    std::vector<PerfStageStatistics> rtn;
+    for (auto const& thread : registry.threads)
+    {
+        std::lock_guard<std::mutex> threadLock { thread->mutex };
+        for (auto const& stage : thread->stages)
+        {
+            auto it { std::find_if(rtn.begin(), rtn.end(), [&](auto const& statistics) {
+                return statistics.name == stage.name;
+            }) };
+            if (it == rtn.end())
+            {
+                rtn.push_back(stage);
+                continue;
+            }
+
+            it->numCalls += stage.numCalls;
+            it->numSamples += stage.numSamples;
+            for (size_t i = 0; i < numPerfEvents; ++i) it->counts[i] += stage.counts[i];
+        }
+    }
+    return rtn;
+}
+
+void PerfCounters::PrintSummary(std::ostream& out)
+{
+    auto const statistics { GetStatistics() };
+    if (statistics.empty())
+    {
+        auto&                       registry { GetRegistry() };
+        std::lock_guard<std::mutex> lock { registry.mutex };
+        out << "hardware counters unavailable"
+            << (registry.error.empty() ? "" : ": " + registry.error) << std::endl;
+        return;
+    }
+
+    std::array<bool, numPerfEvents> available;
+    for (size_t i = 0; i < numPerfEvents; ++i) available[i] = IsAvailable((PerfEvent)i);
+
+    auto const flags { out.flags() };
+    auto const precision { out.precision() };
+    out << "hardware counters (per sample, or per call for stages without samples):" << std::endl;
+    out << std::left << std::setw(24) << "stage" << std::right << std::setw(10) << "calls"
+        << std::setw(10) << "samples" << std::setw(8) << "ipc";
+    for (size_t i = 0; i < numPerfEvents; ++i)
+        out << std::setw(15) << GetEventName((PerfEvent)i);
+    out << std::endl;
+
+    out << std::fixed;
+    for (auto const& stage : statistics)
+    {
+        auto const& counts { stage.counts };
+        double const per { (double)(stage.numSamples != 0 ? stage.numSamples : stage.numCalls) };
+
+        out << std::left << std::setw(24) << stage.name << std::right << std::setw(10)
+            << stage.numCalls << std::setw(10) << stage.numSamples << std::setw(8);
+        if (available[(size_t)PerfEvent::Cycles] && available[(size_t)PerfEvent::Instructions]
+            && counts[(size_t)PerfEvent::Cycles] != 0)
+            out << std::setprecision(2)
+                       << (double)counts[(size_t)PerfEvent::Instructions]
+                              / counts[(size_t)PerfEvent::Cycles];
+        else
+            out << "-";
+
+        for (size_t i = 0; i < numPerfEvents; ++i)
+        {
+            out << std::setw(15);
+            if (available[i])
+                out << std::setprecision(1) << counts[i] / per;
+            else
+                out << "-";
+        }
+        out << std::endl;
+    }
+    out.flags(flags);
+    out.precision(precision);
+}
+
+}
@@ -0,0 +1,141 @@
+// Copyright (c) 2021 Chanjung Kim. All rights reserved.
+// Licensed under the MIT License.
+
+#if defined(__AVX2__)
+#    include <immintrin.h>
+#endif
+
+#include "QuantizedKernel.hh"
+
+namespace mf
+{
+
+#if defined(__AVX2__)
+
+namespace
+{
+
+/**
+ * Computes `Rows` samples of `Panels` consecutive panels of `QuantizedLayer::panelWidth` outputs.
+ */
+template <size_t Rows, size_t Panels>
+inline void QuantizedMicroKernel(uint8_t const* in,
+                                 size_t         inStride,
+                                 int8_t const*  panel,
+                                 size_t         panelStride,
+                                 size_t         numGroups,
+                                 int32_t*       out,
+                                 size_t         outStride)
+{
+    constexpr size_t panelWidth = QuantizedLayer::panelWidth;
+    __m256i const    ones { _mm256_set1_epi16(1) };
+
+    __m256i acc[Rows][Panels];
+    for (size_t r = 0; r < Rows; ++r)
+        for (size_t p = 0; p < Panels; ++p) acc[r][p] = _mm256_setzero_si256();
+
+    for (size_t g = 0; g < numGroups; ++g)
+    {
+        __m256i w[Panels];
+        for (size_t p = 0; p < Panels; ++p)
+            w[p] = _mm256_load_si256((__m256i const*)(panel + p * panelStride + g * 32));
+
+        for (size_t r = 0; r < Rows; ++r)
+        {
+            int32_t x4;
+            __builtin_memcpy(&x4, in + r * inStride + g * 4, sizeof(x4));
+            __m256i const x { _mm256_set1_epi32(x4) };
+
+            // u8 x s8 products summed in pairs into 16 bits, then in pairs again into 32 bits
+            for (size_t p = 0; p < Panels; ++p)
+            {
+                __m256i pairs { _mm256_maddubs_epi16(x, w[p]) };
+                acc[r][p] = _mm256_add_epi32(acc[r][p], _mm256_madd_epi16(pairs, ones));
+            }
+        }
+    }
+
+    for (size_t r = 0; r < Rows; ++r)
+        for (size_t p = 0; p < Panels; ++p)
+            _mm256_storeu_si256((__m256i*)(out + r * outStride + p * panelWidth), acc[r][p]);
+}
+
+/**
+ * Computes every sample of `Panels` consecutive panels.
+ */
+template <size_t Panels>
+inline void QuantizedPanels(uint8_t const* in,
+                            int32_t*       out,
+                            size_t         batchSize,
+                            int8_t const*  panel,
+                            size_t         paddedInputSize,
+                            size_t         paddedOutputSize)
+{
+    constexpr size_t rows        = 4;
+    size_t const     panelStride = paddedInputSize * QuantizedLayer::panelWidth;
+    size_t const     numGroups   = paddedInputSize / QuantizedLayer::groupSize;
+
+    size_t s = 0;
+    for (; s + rows <= batchSize; s += rows)
+    {
+        QuantizedMicroKernel<rows, Panels>(in + s * paddedInputSize,
+                                           paddedInputSize,
+                                           panel,
+                                           panelStride,
+                                           numGroups,
+                                           out + s * paddedOutputSize,
+                                           paddedOutputSize);
+    }
+    for (; s < batchSize; ++s)
+    {
+        QuantizedMicroKernel<1, Panels>(in + s * paddedInputSize,
+                                        paddedInputSize,
+                                        panel,
+                                        panelStride,
+                                        numGroups,
+                                        out + s * paddedOutputSize,
+                                        paddedOutputSize);
+    }
+}
+
+void QuantizedMatMul(uint8_t const* in,
+                     int32_t*       out,
+                     size_t         batchSize,
+                     int8_t const*  kernel,
+                     size_t         paddedInputSize,
+                     size_t         paddedOutputSize)
+{
+    constexpr size_t panelWidth = QuantizedLayer::panelWidth;
+
+    // Two panels are at most a few kilobytes, so they stay in L1 while every sample of the batch
+    // goes through them.
+    size_t o = 0;
+    for (; o + 2 * panelWidth <= paddedOutputSize; o += 2 * panelWidth)
+    {
+        int8_t const* panels = kernel + o * paddedInputSize;
+        QuantizedPanels<2>(in, out + o, batchSize, panels, paddedInputSize, paddedOutputSize);
+    }
+    if (o < paddedOutputSize)
+    {
+        int8_t const* panels = kernel + o * paddedInputSize;
+        QuantizedPanels<1>(in, out + o, batchSize, panels, paddedInputSize, paddedOutputSize);
+    }
+}
+
+}
+
+QuantizedMatMulFunction GetQuantizedMatMulAvx2() noexcept
+{
+    return &QuantizedMatMul;
+}
+
+#else
+
+QuantizedMatMulFunction GetQuantizedMatMulAvx2() noexcept
+{
+    return nullptr;
+}
+
+#endif
+
+}
@@ -0,0 +1,350 @@
+// Copyright (c) 2021 Chanjung Kim. All rights reserved.
+// Licensed under the MIT License.
+
+#include <mf/Dense.hh>
+#include <mf/QuantizedEngine.hh>
+#include <mf/Trace.hh>
+
+#include <algorithm>
+#include <cmath>
+#include <stdexcept>
+
+#include "QuantizedKernel.hh"
+
+namespace mf
+{
+
+namespace
+{
+
+/**
+ * The greatest magnitude of a quantized value.
+ */
+constexpr float maxQuantized { 127.0f };
+
+/**
+ * Scalar implementation of `QuantizedMatMulFunction`.
+ */
+void QuantizedMatMulScalar(uint8_t const* in,
+                           int32_t*       out,
+                           size_t         batchSize,
+                           int8_t const*  kernel,
+                           size_t         paddedInputSize,
+                           size_t         paddedOutputSize)
+{
+    constexpr size_t panelWidth = QuantizedLayer::panelWidth;
+    constexpr size_t groupSize  = QuantizedLayer::groupSize;
+
+    for (size_t o0 = 0; o0 < paddedOutputSize; o0 += panelWidth)
+    {
+        int8_t const* panel = kernel + o0 * paddedInputSize;
+        for (size_t s = 0; s < batchSize; ++s)
+        {
+            uint8_t const* x = in + s * paddedInputSize;
+            int32_t        acc[panelWidth] {};
+            for (size_t i0 = 0; i0 < paddedInputSize; i0 += groupSize)
+            {
+                int8_t const* w = panel + i0 * panelWidth;
+                for (size_t o = 0; o < panelWidth; ++o)
+                    for (size_t i = 0; i < groupSize; ++i)
+                        acc[o] += (int32_t)x[i0 + i] * w[o * groupSize + i];
+            }
+            std::copy(acc, acc + panelWidth, out + s * paddedOutputSize + o0);
+        }
+    }
+}
+
+/**
+ * Returns the implementation for the instruction set used by `Dense`, so `DENSE_ISA` applies to
+ * both engines.
+ */
+QuantizedMatMulFunction GetQuantizedMatMul() noexcept
+{
+    if (Dense::GetIsa() >= Isa::Avx2)
+    {
+        if (auto matMul { GetQuantizedMatMulAvx2() })
+            return matMul;
+    }
+    return &QuantizedMatMulScalar;
+}
+
+size_t RoundUp(size_t value, size_t multiple) noexcept
+{
+    return (value + multiple - 1) / multiple * multiple;
+}
+
+/**
+ * Returns the element (i, o) of the kernel matrix of the given layer, whichever layout it keeps.
+ */
+float GetKernelElement(Weight const& layer, size_t i, size_t o) noexcept
+{
+    if (layer.HasRawKernel())
+        return layer.GetKernelWeight()[i * layer.GetOutputSize() + o];
+
+    constexpr size_t panelWidth = Weight::panelWidth;
+    return layer.GetPackedKernelWeight()[(o / panelWidth) * layer.GetInputSize() * panelWidth
+                                         + i * panelWidth + o % panelWidth];
+}
+
+/**
+ * Returns the bias of the output o of the given layer, whichever layout it keeps.
+ */
+float GetBiasElement(Weight const& layer, size_t o) noexcept
+{
+    return layer.HasRawKernel() ? layer.GetBiasWeight()[o] : layer.GetPackedBiasWeight()[o];
+}
+
+/**
+ * Quantizes the kernel of the given layer per output channel.
+ *
+ * @param layer the layer to quantize
+ * @param inputMax the greatest input of the layer observed during calibration
+ */
+QuantizedLayer QuantizeLayer(Weight const& layer, float inputMax)
+{
+    constexpr size_t panelWidth = QuantizedLayer::panelWidth;
+    constexpr size_t groupSize  = QuantizedLayer::groupSize;
+
+    QuantizedLayer rtn;
+    rtn.inputSize        = layer.GetInputSize();
+    rtn.outputSize       = layer.GetOutputSize();
+    rtn.paddedInputSize  = RoundUp(rtn.inputSize, groupSize);
+    rtn.paddedOutputSize = RoundUp(rtn.outputSize, panelWidth);
+    rtn.inputScale       = (inputMax > 0.0f ? inputMax : 1.0f) / maxQuantized;
+
+    rtn.kernel.assign(rtn.paddedInputSize * rtn.paddedOutputSize, 0);
+    rtn.scales.assign(rtn.paddedOutputSize, 0.0f);
+    rtn.bias.assign(rtn.paddedOutputSize, 0.0f);
+    for (size_t o = 0; o < rtn.outputSize; ++o)
+    {
+        float maxAbs = 0.0f;
+        for (size_t i = 0; i < rtn.inputSize; ++i)
+            maxAbs = std::max(maxAbs, std::abs(GetKernelElement(layer, i, o)));
+
+        float const scale = (maxAbs > 0.0f ? maxAbs : 1.0f) / maxQuantized;
+        int8_t*     panel = rtn.kernel.data() + (o / panelWidth) * rtn.paddedInputSize * panelWidth;
+        for (size_t i = 0; i < rtn.inputSize; ++i)
+        {
+            float const q = std::round(GetKernelElement(layer, i, o) / scale);
+            panel[(i / groupSize) * panelWidth * groupSize + (o % panelWidth) * groupSize
+                  + i % groupSize] = (int8_t)std::clamp(q, -maxQuantized, maxQuantized);
+        }
+
+        rtn.scales[o] = rtn.inputScale * scale;
+        rtn.bias[o]   = GetBiasElement(layer, o);
+    }
+
+    return rtn;
+}
+
+/**
+ * Returns the greatest input of every layer while the given samples go through the layers in
+ * floating point.
+ */
+template <typename In>
+std::vector<float> Calibrate(std::vector<ExecutionPlan::Step> const& layers,
+                             In const*                               images,
+                             size_t                                  numSamples,
+                             size_t                                  batchSize)
+{
+    size_t maxWidth = layers.front().layer->GetInputSize();
+    for (auto& step : layers) maxWidth = std::max(maxWidth, step.layer->GetOutputSize());
+
+    std::vector<float> maxInputs(layers.size(), 0.0f);
+    std::vector<float> buffers[2];
+    for (auto& buffer : buffers) buffer.resize(batchSize * maxWidth);
+
+    size_t const imageSize = layers.front().layer->GetInputSize();
+    for (size_t begin = 0; begin < numSamples; begin += batchSize)
+    {
+        size_t const count = std::min(batchSize, numSamples - begin);
+        In const*    in    = images + begin * imageSize;
+        maxInputs[0] = std::max(maxInputs[0], (float)*std::max_element(in, in + count * imageSize));
+
+        float* out = buffers[0].data();
+        Dense::ApplyBatch(in, out, count, *layers[0].layer, {}, layers[0].activation);
+        for (size_t l = 1; l < layers.size(); ++l)
+        {
+            float const* layerIn   = out;
+            size_t const inputSize = layers[l].layer->GetInputSize();
+            maxInputs[l]
+                = std::max(maxInputs[l], *std::max_element(layerIn, layerIn + count * inputSize));
+
+            out = buffers[l % 2].data();
+            Dense::ApplyBatch(layerIn, out, count, *layers[l].layer, {}, layers[l].activation);
+        }
+    }
+
+    return maxInputs;
+}
+
+/**
+ * Quantizes `count` values, which must not be negative, with the given scale.
+ */
+template <typename In>
+void QuantizeInput(In const* in, uint8_t* out, size_t count, float scale) noexcept
+{
+    float const inverse = 1.0f / scale;
+    for (size_t i = 0; i < count; ++i)
+        out[i] = (uint8_t)std::min((float)in[i] * inverse + 0.5f, maxQuantized);
+}
+
+}
+
+QuantizedEngine QuantizedEngine::MakeFromPlan(ExecutionPlan const& plan,
+                                              Mnist const&         mnist,
+                                              size_t               numCalibrationSamples)
+{
+    if (numCalibrationSamples == 0)
+        throw std::invalid_argument { "numCalibrationSamples" };
+
+    // The inputs of the layers are quantized to unsigned integers.
+    auto const& layers { plan.GetSteps() };
+    for (size_t l = 0; l + 1 < layers.size(); ++l)
+    {
+        if (layers[l].activation != Activation::Relu)
+            throw InvalidModelConfigException { layers[l].name
+                                                + " must be followed by ReLU to be quantized" };
+    }
+
+    size_t const batchSize = plan.GetBatchSize();
+    numCalibrationSamples = std::min(numCalibrationSamples, mnist.GetNumSamples());
+    std::vector<float> maxInputs;
+    if (mnist.GetPixelFormat() == MnistPixelFormat::Byte)
+        maxInputs = Calibrate(layers, mnist.GetByteImages().data(), numCalibrationSamples, batchSize);
+    else
+        maxInputs = Calibrate(layers, mnist.GetImages().data(), numCalibrationSamples, batchSize);
+
+    auto quantizedLayers { std::make_shared<std::vector<QuantizedLayer>>() };
+    for (size_t l = 0; l < layers.size(); ++l)
+    {
+        quantizedLayers->push_back(QuantizeLayer(*layers[l].layer, maxInputs[l]));
+        quantizedLayers->back().activation = layers[l].activation;
+    }
+
+    return QuantizedEngine { std::move(quantizedLayers), batchSize };
+}
+
+QuantizedEngine QuantizedEngine::MakeFromWeights(WeightCollection const&         weights,
+                                                 std::vector<std::string> const& layerNames,
+                                                 Mnist const&                    mnist,
+                                                 size_t numCalibrationSamples,
+                                                 size_t batchSize)
+{
+    std::vector<LayerSpec> layers;
+    for (auto& layerName : layerNames) layers.push_back(LayerSpec { layerName, Activation::Relu });
+
+    return MakeFromPlan(
+        ExecutionPlan::Compile(weights, layers, batchSize), mnist, numCalibrationSamples);
+}
+
+QuantizedEngine::QuantizedEngine(std::shared_ptr<std::vector<QuantizedLayer> const>&& layers,
+                                 size_t                                               batchSize) :
+    _layers { std::move(layers) },
+    _batchSize { batchSize }
+{
+    size_t maxInputSize = 0, maxOutputSize = 0;
+    for (auto& layer : *_layers)
+    {
+        maxInputSize  = std::max(maxInputSize, layer.paddedInputSize);
+        maxOutputSize = std::max(maxOutputSize, layer.paddedOutputSize);
+    }
+
+    for (auto& input : _inputs) input.resize(batchSize * maxInputSize, 0);
+    _accumulators.resize(batchSize * maxOutputSize, 0);
+    _output.resize(batchSize * GetOutputSize(), 0.0f);
+}
+
+template <typename In>
+float const* QuantizedEngine::ForwardWith(In const* in, size_t numSamples, bool normalize)
+{
+    if (numSamples > _batchSize)
+        throw std::invalid_argument { "numSamples" };
+
+    MF_TRACE_SPAN("QuantizedEngine::Forward", "samples", numSamples);
+    auto& first = _layers->front();
+    for (size_t s = 0; s < numSamples; ++s)
+    {
+        QuantizeInput(in + s * first.inputSize,
+                      _inputs[0].data() + s * first.paddedInputSize,
+                      first.inputSize,
+                      first.inputScale);
+    }
+
+    ForwardQuantized(numSamples, normalize);
+    return _output.data();
+}
+
+void QuantizedEngine::ForwardQuantized(size_t numSamples, bool normalize)
+{
+    auto  matMul { GetQuantizedMatMul() };
+    auto& layers = *_layers;
+    for (size_t l = 0; l < layers.size(); ++l)
+    {
+        auto& layer = layers[l];
+        matMul(_inputs[l % 2].data(),
+                _accumulators.data(),
+                numSamples,
+                layer.kernel.data(),
+                layer.paddedInputSize,
+                layer.paddedOutputSize);
+
+        bool const   last    = l + 1 == layers.size();
+        bool const   relu    = layer.activation == Activation::Relu;
+        float const  inverse = last ? 1.0f : 1.0f / layers[l + 1].inputScale;
+        uint8_t*     next    = last ? nullptr : _inputs[(l + 1) % 2].data();
+        size_t const stride  = last ? layer.outputSize : layers[l + 1].paddedInputSize;
+        for (size_t s = 0; s < numSamples; ++s)
+        {
+            int32_t const* acc = _accumulators.data() + s * layer.paddedOutputSize;
+            for (size_t o = 0; o < layer.outputSize; ++o)
+            {
+                float value = acc[o] * layer.scales[o] + layer.bias[o];
+                if (relu)
+                    value = std::max(value, 0.0f);
+                if (last)
+                    _output[s * stride + o] = value;
+                else
+                    next[s * stride + o] = (uint8_t)std::min(value * inverse + 0.5f, maxQuantized);
+            }
+        }
+
+        if (last && normalize && layer.activation == Activation::Softmax)
+            Dense::Softmax(_output.data(), numSamples, layer.outputSize);
+    }
+}
+
+template <typename In>
+void QuantizedEngine::ClassifyWith(In const* in, size_t numSamples, MnistLabel* labels)
+{
+    float const* out        = ForwardWith(in, numSamples, false);
+    size_t const outputSize = GetOutputSize();
+
+    for (size_t i = 0; i < numSamples; ++i)
+    {
+        float const* scores = out + i * outputSize;
+        labels[i] = (MnistLabel)std::distance(scores, std::max_element(scores, scores + outputSize));
+    }
+}
+
+float const* QuantizedEngine::Forward(float const* in, size_t numSamples)
+{
+    return ForwardWith(in, numSamples, true);
+}
+
+float const* QuantizedEngine::Forward(uint8_t const* in, size_t numSamples)
+{
+    return ForwardWith(in, numSamples, true);
+}
+
+void QuantizedEngine::Classify(float const* in, size_t numSamples, MnistLabel* labels)
+{
+    ClassifyWith(in, numSamples, labels);
+}
+
+void QuantizedEngine::Classify(uint8_t const* in, size_t numSamples, MnistLabel* labels)
+{
+    ClassifyWith(in, numSamples, labels);
+}
+
+}
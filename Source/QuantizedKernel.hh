@@ -0,0 +1,42 @@
+// Copyright (c) 2021 Chanjung Kim. All rights reserved.
+// Licensed under the MIT License.
+
+#ifndef MNIST_FPGA_QUANTIZED_KERNEL_HH
+#define MNIST_FPGA_QUANTIZED_KERNEL_HH
+
+#include <mf/Cpu.hh>
+#include <mf/QuantizedEngine.hh>
+
+// Implementations of the integer matrix multiplication of `QuantizedEngine`. As with
+// `DenseKernel.hh`, every implementation lives in a file compiled with the target flags of its
+// instruction set, and is selected at runtime.
+
+namespace mf
+{
+
+/**
+ * The type of the functions computing the accumulators of one `QuantizedLayer`.
+ *
+ * @param in the quantized input matrix of dimension (`batchSize`, `paddedInputSize`), row-major
+ * @param out the accumulator matrix of dimension (`batchSize`, `paddedOutputSize`), row-major
+ * @param batchSize the number of samples
+ * @param kernel the packed kernel (see `QuantizedLayer::kernel`)
+ * @param paddedInputSize the length of the input, a multiple of `QuantizedLayer::groupSize`
+ * @param paddedOutputSize the length of the output, a multiple of `QuantizedLayer::panelWidth`
+ */
+using QuantizedMatMulFunction = void (*)(uint8_t const* in,
+                                         int32_t*       out,
+                                         size_t         batchSize,
+                                         int8_t const*  kernel,
+                                         size_t         paddedInputSize,
+                                         size_t         paddedOutputSize);
+
+/**
+ * Returns the AVX2 implementation, which multiplies with `vpmaddubsw`, or `nullptr` if it was
+ * not compiled in.
+ */
+QuantizedMatMulFunction GetQuantizedMatMulAvx2() noexcept;
+
+}
+
+#endif
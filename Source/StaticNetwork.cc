@@ -0,0 +1,44 @@
+// Copyright (c) 2021 Chanjung Kim. All rights reserved.
+// Licensed under the MIT License.
+
+#include <mf/StaticNetwork.hh>
+
+#include "DenseKernel.hh"
+
+namespace mf
+{
+
+template <>
+StaticForwardFunction MnistNetwork::GetForward(Isa isa) noexcept
+{
+    for (auto i = (uint8_t)isa; i > (uint8_t)Isa::Scalar; --i)
+    {
+        if (auto forward { GetDenseKernels((Isa)i).mnistForward })
+            return forward;
+    }
+    return GetDenseKernels(Isa::Scalar).mnistForward;
+}
+
+template <>
+StaticForwardBytesFunction MnistNetwork::GetForwardBytes(Isa isa) noexcept
+{
+    for (auto i = (uint8_t)isa; i > (uint8_t)Isa::Scalar; --i)
+    {
+        if (auto forward { GetDenseKernels((Isa)i).mnistForwardBytes })
+            return forward;
+    }
+    return GetDenseKernels(Isa::Scalar).mnistForwardBytes;
+}
+
+template <>
+StaticForwardSparseFunction MnistNetwork::GetForwardSparse(Isa isa) noexcept
+{
+    for (auto i = (uint8_t)isa; i > (uint8_t)Isa::Scalar; --i)
+    {
+        if (auto forward { GetDenseKernels((Isa)i).mnistForwardSparse })
+            return forward;
+    }
+    return GetDenseKernels(Isa::Scalar).mnistForwardSparse;
+}
+
+}
@@ -0,0 +1,157 @@
+// Copyright (c) 2021 Chanjung Kim. All rights reserved.
+// Licensed under the MIT License.
+
+#include <mf/ThreadPool.hh>
+
+#include <algorithm>
+#include <stdexcept>
+#include <utility>
+
+namespace mf
+{
+
+ThreadPool::ThreadPool(size_t numThreads) :
+    _generation { 0 },
+    _numActive { 0 },
+    _stop { false },
+    _function { nullptr },
+    _begin { 0 },
+    _end { 0 },
+    _chunkSize { 1 }
+{
+    if (numThreads == 0)
+        numThreads = std::max(std::thread::hardware_concurrency(), 1u);
+
+    for (size_t i = 0; i < numThreads; ++i) _workers.push_back(std::make_unique<Worker>());
+    for (size_t i = 0; i < numThreads; ++i)
+        _workers[i]->thread = std::thread { &ThreadPool::Run, this, i };
+}
+
+ThreadPool::~ThreadPool()
+{
+    {
+        std::lock_guard<std::mutex> lock { _mutex };
+        _stop = true;
+    }
+    _wakeUp.notify_all();
+
+    for (auto& worker : _workers) worker->thread.join();
+}
+
+void ThreadPool::ParallelFor(size_t               begin,
+                             size_t               end,
+                             size_t               chunkSize,
+                             ChunkFunction const& function)
+{
+    if (chunkSize == 0)
+        throw std::invalid_argument { "chunkSize" };
+    if (begin >= end)
+        return;
+
+    // Every worker starts with a contiguous range of chunks and walks it from the front, while
+    // thieves take chunks from the back, as far as possible from where the owner is working.
+    size_t const numChunks  = (end - begin + chunkSize - 1) / chunkSize;
+    size_t const numWorkers = _workers.size();
+    for (size_t i = 0; i < numWorkers; ++i)
+    {
+        std::lock_guard<std::mutex> lock { _workers[i]->mutex };
+        for (size_t chunk = numChunks * i / numWorkers; chunk < numChunks * (i + 1) / numWorkers;
+             ++chunk)
+            _workers[i]->chunks.push_back(chunk);
+    }
+
+    std::unique_lock<std::mutex> lock { _mutex };
+    _function  = &function;
+    _begin     = begin;
+    _end       = end;
+    _chunkSize = chunkSize;
+    _exception = nullptr;
+    _numActive = numWorkers;
+    ++_generation;
+    _wakeUp.notify_all();
+
+    _done.wait(lock, [this] { return _numActive == 0; });
+    _function = nullptr;
+
+    if (auto exception { std::exchange(_exception, nullptr) })
+        std::rethrow_exception(exception);
+}
+
+void ThreadPool::Run(size_t threadIndex)
+{
+    uint64_t generation = 0;
+    while (true)
+    {
+        ChunkFunction const* function;
+        size_t               begin, end, chunkSize;
+        {
+            std::unique_lock<std::mutex> lock { _mutex };
+            _wakeUp.wait(lock, [&] { return _stop || _generation != generation; });
+            if (_stop)
+                return;
+
+            generation = _generation;
+            function   = _function;
+            begin      = _begin;
+            end        = _end;
+            chunkSize  = _chunkSize;
+        }
+
+        size_t chunk;
+        while (TakeChunk(threadIndex, chunk))
+        {
+            size_t const chunkBegin = begin + chunk * chunkSize;
+            try
+            {
+                (*function)(threadIndex, chunkBegin, std::min(chunkBegin + chunkSize, end));
+            }
+            catch (...)
+            {
+                std::lock_guard<std::mutex> lock { _mutex };
+                if (!_exception)
+                    _exception = std::current_exception();
+
+                // Drop the remaining chunks of every worker
+                for (auto& worker : _workers)
+                {
+                    std::lock_guard<std::mutex> workerLock { worker->mutex };
+                    worker->chunks.clear();
+                }
+            }
+        }
+
+        std::lock_guard<std::mutex> lock { _mutex };
+        if (--_numActive == 0)
+            _done.notify_one();
+    }
+}
+
+bool ThreadPool::TakeChunk(size_t threadIndex, size_t& chunk)
+{
+    {
+        auto&                       own = *_workers[threadIndex];
+        std::lock_guard<std::mutex> lock { own.mutex };
+        if (!own.chunks.empty())
+        {
+            chunk = own.chunks.front();
+            own.chunks.pop_front();
+            return true;
+        }
+    }
+
+    for (size_t i = 1; i < _workers.size(); ++i)
+    {
+        auto&                       victim = *_workers[(threadIndex + i) % _workers.size()];
+        std::lock_guard<std::mutex> lock { victim.mutex };
+        if (!victim.chunks.empty())
+        {
+            chunk = victim.chunks.back();
+            victim.chunks.pop_back();
+            return true;
+        }
+    }
+
+    return false;
+}
+
+}
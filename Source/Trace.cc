@@ -0,0 +1,215 @@
+// Copyright (c) 2021 Chanjung Kim. All rights reserved.
+// Licensed under the MIT License.
+
+#include <mf/Trace.hh>
+
+#include <iomanip>
+#include <memory>
+#include <mutex>
+#include <new>
+#include <utility>
+#include <vector>
+
+namespace mf
+{
+
+std::atomic<bool> Trace::_enabled { false };
+
+namespace
+{
+
+struct TraceEvent
+{
+    char const* name;
+    char const* argName;
+    uint64_t    arg;
+    int64_t     begin, end;
+};
+
+/**
+ * A chunk of the buffer of one thread. Only the owning thread appends; it publishes every event
+ * by storing the new size with release semantics, so readers see complete events only.
+ */
+struct TraceChunk
+{
+    constexpr static size_t capacity = 4096;
+
+    TraceEvent               events[capacity];
+    std::atomic<size_t>      size { 0 };
+    std::atomic<TraceChunk*> next { nullptr };
+};
+
+/**
+ * The buffer of one thread, a list of chunks which only grows.
+ */
+class TraceBuffer
+{
+  private:
+    TraceChunk* _first;
+    TraceChunk* _last;
+    size_t      _threadIndex;
+
+  public:
+    explicit TraceBuffer(size_t threadIndex) :
+        _first { new TraceChunk },
+        _last { _first },
+        _threadIndex { threadIndex }
+    {
+    }
+
+    TraceBuffer(TraceBuffer const&) = delete;
+    TraceBuffer& operator=(TraceBuffer const&) = delete;
+
+    ~TraceBuffer()
+    {
+        for (TraceChunk* chunk = _first; chunk != nullptr;)
+            delete std::exchange(chunk, chunk->next.load(std::memory_order_relaxed));
+    }
+
+  public:
+    size_t GetThreadIndex() const noexcept
+    {
+        return _threadIndex;
+    }
+
+    TraceChunk const* GetFirst() const noexcept
+    {
+        return _first;
+    }
+
+    /**
+     * Appends an event. Called by the owning thread only.
+     */
+    void Push(TraceEvent const& event) noexcept
+    {
+        size_t size { _last->size.load(std::memory_order_relaxed) };
+        if (size == TraceChunk::capacity)
+        {
+            auto* chunk { new (std::nothrow) TraceChunk };
+            if (chunk == nullptr)
+                return;
+            _last->next.store(chunk, std::memory_order_release);
+            _last = chunk;
+            size  = 0;
+        }
+        _last->events[size] = event;
+        _last->size.store(size + 1, std::memory_order_release);
+    }
+};
+
+/**
+ * The buffers of every thread that has recorded a span. The mutex is only taken when a thread
+ * records its first span, and when the trace is written.
+ */
+struct TraceRegistry
+{
+    std::mutex                                mutex;
+    std::vector<std::unique_ptr<TraceBuffer>> buffers;
+    std::atomic<int64_t>                      epoch { 0 };
+};
+
+TraceRegistry& GetRegistry() noexcept
+{
+    static TraceRegistry registry;
+    return registry;
+}
+
+/**
+ * Returns the buffer of the calling thread, creating it on the first call, or null if it cannot
+ * be created.
+ */
+TraceBuffer* GetThreadBuffer() noexcept
+{
+    thread_local TraceBuffer* buffer { nullptr };
+    if (buffer != nullptr)
+        return buffer;
+
+    try
+    {
+        auto&                       registry { GetRegistry() };
+        std::lock_guard<std::mutex> lock { registry.mutex };
+        registry.buffers.push_back(std::make_unique<TraceBuffer>(registry.buffers.size()));
+        buffer = registry.buffers.back().get();
+    }
+    catch (...)
+    {
+    }
+    return buffer;
+}
+
+/**
+ * Writes the given nanoseconds as microseconds, the unit of the timestamps of the format.
+ */
+void WriteMicroseconds(std::ostream& out, int64_t time)
+{
+    out << std::fixed << std::setprecision(3) << time / 1000.0;
+}
+
+}
+
+void Trace::Start() noexcept
+{
+    int64_t expected { 0 };
+    GetRegistry().epoch.compare_exchange_strong(expected, GetTime());
+    _enabled.store(true, std::memory_order_relaxed);
+}
+
+void Trace::Stop() noexcept
+{
+    _enabled.store(false, std::memory_order_relaxed);
+}
+
+void Trace::Record(char const* name,
+                   char const* argName,
+                   uint64_t    arg,
+                   int64_t     begin,
+                   int64_t     end) noexcept
+{
+    if (auto* buffer { GetThreadBuffer() }; buffer != nullptr)
+        buffer->Push(TraceEvent { name, argName, arg, begin, end });
+}
+
+void Trace::WriteChromeJson(std::ostream& out)
+{
+    auto&                       registry { GetRegistry() };
+    std::lock_guard<std::mutex> lock { registry.mutex };
+    int64_t const               epoch { registry.epoch.load() };
+
+    auto flags { out.flags() };
+    auto precision { out.precision() };
+
+    // The names are string literals of this project, which need no escaping.
+    bool first = true;
+    out << "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[";
+    for (auto const& buffer : registry.buffers)
+    {
+        size_t const threadIndex { buffer->GetThreadIndex() };
+        out << (first ? "\n" : ",\n") << "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":"
+            << threadIndex << ",\"args\":{\"name\":\"thread " << threadIndex << "\"}}";
+        first = false;
+
+        for (auto const* chunk { buffer->GetFirst() }; chunk != nullptr;
+             chunk = chunk->next.load(std::memory_order_acquire))
+        {
+            size_t const size { chunk->size.load(std::memory_order_acquire) };
+            for (size_t i = 0; i < size; ++i)
+            {
+                auto const& event { chunk->events[i] };
+                out << ",\n{\"name\":\"" << event.name << "\",\"cat\":\"mf\",\"ph\":\"X\",\"ts\":";
+                WriteMicroseconds(out, event.begin - epoch);
+                out << ",\"dur\":";
+                WriteMicroseconds(out, event.end - event.begin);
+                out << ",\"pid\":1,\"tid\":" << threadIndex;
+                if (event.argName != nullptr)
+                    out << ",\"args\":{\"" << event.argName << "\":" << event.arg << "}";
+                out << "}";
+            }
+        }
+    }
+    out << "\n]}\n";
+
+    out.flags(flags);
+    out.precision(precision);
+}
+
+}
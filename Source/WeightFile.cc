@@ -0,0 +1,269 @@
+// Copyright (c) 2021 Chanjung Kim. All rights reserved.
+// Licensed under the MIT License.
+
+#include <mf/ExecutionPlan.hh>
+#include <mf/PerfCounters.hh>
+#include <mf/Trace.hh>
+#include <mf/Weights.hh>
+
+#include <algorithm>
+#include <cstring>
+#include <fstream>
+#include <utility>
+
+#include "WeightFileFormat.hh"
+
+namespace mf
+{
+
+namespace
+{
+
+uint64_t AlignUp(uint64_t value) noexcept
+{
+    return (value + flat::blobAlignment - 1) / flat::blobAlignment * flat::blobAlignment;
+}
+
+/**
+ * Returns the view of `count` floats at `offset` of the file, or an empty view if `offset` is zero.
+ *
+ * @throws InvalidFlatWeightFileException if the blob is misaligned or out of the file
+ */
+ArrayView<float> GetBlob(MappedFile const&            file,
+                         uint64_t                     offset,
+                         uint64_t                     count,
+                         std::filesystem::path const& path)
+{
+    if (offset == 0)
+        return {};
+
+    if (offset % flat::blobAlignment != 0 || offset > file.GetSize()
+        || count > (file.GetSize() - offset) / sizeof(float))
+        throw InvalidFlatWeightFileException { path.string() };
+
+    return ArrayView<float> { (float const*)(file.GetData() + offset), count };
+}
+
+/**
+ * Writes `count` floats followed by zeros up to the next multiple of `flat::blobAlignment`.
+ */
+void WriteBlob(std::ostream& os, float const* data, size_t count)
+{
+    static char const zeros[flat::blobAlignment] {};
+
+    uint64_t const size = count * sizeof(float);
+    os.write((char const*)data, size);
+    os.write(zeros, AlignUp(size) - size);
+}
+
+}
+
+void Weight::CopyFromFile()
+{
+    if (!_file)
+        return;
+
+    _kernel.assign(_mappedKernel.begin(), _mappedKernel.end());
+    _bias.assign(_mappedBias.begin(), _mappedBias.end());
+    _packedKernel.assign(_mappedPackedKernel.begin(), _mappedPackedKernel.end());
+    _packedBias.assign(_mappedPackedBias.begin(), _mappedPackedBias.end());
+
+    _mappedKernel = _mappedBias = _mappedPackedKernel = _mappedPackedBias = {};
+    _file.reset();
+}
+
+WeightCollection Weights::MakeFromFlatFile(std::filesystem::path const& path, WeightLayout layout)
+{
+    MF_TRACE_SPAN("Weights::MakeFromFlatFile");
+    PerfScope perf { "load weights" };
+
+    auto file { std::make_shared<MappedFile const>(MappedFile::Open(path, MapHint::WillNeed)) };
+    if (file->GetSize() < sizeof(flat::FileHeader))
+        throw InvalidFlatWeightFileException { path.string() };
+
+    flat::FileHeader header;
+    std::memcpy(&header, file->GetData(), sizeof(header));
+    if (std::memcmp(header.signature, flat::signature, sizeof(flat::signature)) != 0
+        || header.byteOrder != flat::byteOrderMark || header.fileSize != file->GetSize())
+        throw InvalidFlatWeightFileException { path.string() };
+    if (header.version != flat::version)
+        throw InvalidFlatWeightFileException { path.string() + ": unsupported version "
+                                               + std::to_string(header.version) };
+
+    uint64_t const tableSize = (uint64_t)header.numLayers * sizeof(flat::LayerEntry);
+    if (tableSize > file->GetSize() - sizeof(header))
+        throw InvalidFlatWeightFileException { path.string() };
+
+    // Packed blobs written with another panel width cannot be read by the kernels of this build,
+    // so they are treated as absent.
+    bool const panelWidthMatches = header.panelWidth == Weight::panelWidth;
+
+    bool const needRaw    = layout != WeightLayout::Packed;
+    bool const needPacked = layout != WeightLayout::Raw;
+
+    WeightCollection rtn;
+    for (uint32_t l = 0; l < header.numLayers; ++l)
+    {
+        flat::LayerEntry entry;
+        std::memcpy(&entry,
+                    file->GetData() + sizeof(header) + l * sizeof(flat::LayerEntry),
+                    sizeof(entry));
+        if (std::memchr(entry.name, '\0', sizeof(entry.name)) == nullptr)
+            throw InvalidFlatWeightFileException { path.string() };
+
+        // A corrupt shape could wrap the element counts below and pass the bounds check of
+        // `GetBlob` with a blob shorter than the shape.
+        if (entry.inputSize == 0 || entry.outputSize == 0
+            || entry.outputSize > (SIZE_MAX - Weight::panelWidth) / entry.inputSize)
+            throw InvalidFlatWeightFileException { path.string() + ": " + entry.name
+                                                   + " has an invalid shape" };
+
+        size_t const inputSize        = entry.inputSize;
+        size_t const outputSize       = entry.outputSize;
+        size_t const paddedOutputSize = (outputSize + Weight::panelWidth - 1) / Weight::panelWidth
+                                        * Weight::panelWidth;
+        if (paddedOutputSize > SIZE_MAX / inputSize)
+            throw InvalidFlatWeightFileException { path.string() + ": " + entry.name
+                                                   + " has an invalid shape" };
+
+        Weight weight { inputSize, outputSize, {}, {} };
+        weight._file         = file;
+        weight._mappedKernel = GetBlob(*file, entry.kernelOffset, inputSize * outputSize, path);
+        weight._mappedBias   = GetBlob(*file, entry.biasOffset, outputSize, path);
+        if (panelWidthMatches)
+        {
+            weight._mappedPackedKernel
+                = GetBlob(*file, entry.packedKernelOffset, inputSize * paddedOutputSize, path);
+            weight._mappedPackedBias
+                = GetBlob(*file, entry.packedBiasOffset, paddedOutputSize, path);
+        }
+
+        bool const hasRaw    = !weight._mappedKernel.empty() && !weight._mappedBias.empty();
+        bool const hasPacked = !weight._mappedPackedKernel.empty()
+                               && !weight._mappedPackedBias.empty();
+        if ((needRaw && !hasRaw) || (!hasRaw && !hasPacked))
+            throw InvalidFlatWeightFileException { path.string() + ": " + entry.name
+                                                   + " lacks the requested layout" };
+
+        if (needPacked && !hasPacked)
+        {
+            // Packing needs the raw kernel in the vectors.
+            weight.CopyFromFile();
+            weight.ApplyLayout(layout);
+        }
+        else
+        {
+            if (!needRaw)
+                weight._mappedKernel = weight._mappedBias = {};
+            if (!needPacked)
+                weight._mappedPackedKernel = weight._mappedPackedBias = {};
+        }
+
+        rtn.insert(std::make_pair(std::string { entry.name }, std::move(weight)));
+    }
+
+    return rtn;
+}
+
+void Weights::WriteFlatFile(WeightCollection const&       weights,
+                            std::filesystem::path const&  path,
+                            std::vector<LayerSpec> const& layers)
+{
+    for (auto& spec : layers)
+    {
+        if (weights.find(spec.name) == weights.end())
+            throw LayerNotFoundException { spec.name };
+    }
+
+    flat::FileHeader header {};
+    std::memcpy(header.signature, flat::signature, sizeof(flat::signature));
+    header.version    = flat::version;
+    header.byteOrder  = flat::byteOrderMark;
+    header.numLayers  = (uint32_t)weights.size();
+    header.panelWidth = Weight::panelWidth;
+
+    std::vector<flat::LayerEntry> entries;
+    uint64_t offset = AlignUp(sizeof(header) + weights.size() * sizeof(flat::LayerEntry));
+    auto     place { [&offset](size_t count) {
+        uint64_t const rtn = offset;
+        offset += AlignUp(count * sizeof(float));
+        return rtn;
+    } };
+    for (auto& [name, weight] : weights)
+    {
+        if (name.size() >= flat::maxNameLength)
+            throw InvalidFlatWeightFileException { name + ": the name is too long" };
+
+        flat::LayerEntry entry {};
+        std::memcpy(entry.name, name.c_str(), name.size() + 1);
+        entry.inputSize  = weight.GetInputSize();
+        entry.outputSize = weight.GetOutputSize();
+        for (size_t l = 0; l < layers.size(); ++l)
+        {
+            if (layers[l].name == name)
+            {
+                entry.position   = (uint32_t)(l + 1);
+                entry.activation = (uint8_t)layers[l].activation;
+            }
+        }
+        if (weight.HasRawKernel())
+        {
+            entry.kernelOffset = place(weight.GetKernelWeight().size());
+            entry.biasOffset   = place(weight.GetBiasWeight().size());
+        }
+        if (weight.HasPackedKernel())
+        {
+            entry.packedKernelOffset = place(weight.GetPackedKernelWeight().size());
+            entry.packedBiasOffset   = place(weight.GetPackedBiasWeight().size());
+        }
+        entries.push_back(entry);
+    }
+    header.fileSize = offset;
+
+    bool const written = File::WriteFileAtomically(path, [&](std::ostream& os) {
+        os.write((char const*)&header, sizeof(header));
+        for (auto& entry : entries) os.write((char const*)&entry, sizeof(entry));
+
+        static char const zeros[flat::blobAlignment] {};
+        uint64_t const    tableEnd = sizeof(header) + entries.size() * sizeof(flat::LayerEntry);
+        os.write(zeros, AlignUp(tableEnd) - tableEnd);
+
+        // Blobs are written in the order `place` gave them their offsets.
+        for (auto& [name, weight] : weights)
+        {
+            if (weight.HasRawKernel())
+            {
+                WriteBlob(os, weight.GetKernelWeight().data(), weight.GetKernelWeight().size());
+                WriteBlob(os, weight.GetBiasWeight().data(), weight.GetBiasWeight().size());
+            }
+            if (weight.HasPackedKernel())
+            {
+                auto packedKernel { weight.GetPackedKernelWeight() };
+                auto packedBias { weight.GetPackedBiasWeight() };
+                WriteBlob(os, packedKernel.data(), packedKernel.size());
+                WriteBlob(os, packedBias.data(), packedBias.size());
+            }
+        }
+    });
+    if (!written)
+        throw NoSuchFileException { path.string() };
+}
+
+bool Weights::IsFlatFile(std::filesystem::path const& path)
+{
+    std::ifstream ifs { path, std::ios::binary };
+    char          signature[sizeof(flat::signature)] {};
+    ifs.read(signature, sizeof(signature));
+
+    return ifs && std::memcmp(signature, flat::signature, sizeof(signature)) == 0;
+}
+
+WeightCollection Weights::MakeFromFile(Config const& config)
+{
+    if (IsFlatFile(config.weightFilePath))
+        return MakeFromFlatFile(config.weightFilePath, config.weightLayout);
+
+    return MakeFromHdf5(config);
+}
+
+}
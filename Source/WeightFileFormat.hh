@@ -0,0 +1,94 @@
+// Copyright (c) 2021 Chanjung Kim. All rights reserved.
+// Licensed under the MIT License.
+
+#ifndef MNIST_FPGA_WEIGHT_FILE_FORMAT_HH
+#define MNIST_FPGA_WEIGHT_FILE_FORMAT_HH
+
+#include <cstdint>
+
+// The layout of the flat weight files written by `Weights::WriteFlatFile`.
+//
+// + flat::FileHeader
+// + flat::LayerEntry x numLayers
+// + blobs, each starting at a multiple of `flat::blobAlignment`
+//
+// Integers and floats are stored in the byte order of the machine that wrote the file;
+// `flat::FileHeader::byteOrder` lets a reader with the other byte order reject the file. Every
+// offset is from the beginning of the file, and an offset of zero means the blob is absent.
+
+namespace mf
+{
+
+namespace flat
+{
+
+/**
+ * The first eight bytes of every flat weight file.
+ */
+constexpr char signature[8] { 'M', 'F', 'W', 'E', 'I', 'G', 'H', 'T' };
+
+/**
+ * The version written by this build. Readers reject any other version.
+ */
+constexpr uint32_t version { 1 };
+
+/**
+ * `FileHeader::byteOrder` as written by the machine that wrote the file.
+ */
+constexpr uint32_t byteOrderMark { 0x01020304 };
+
+/**
+ * The alignment of every blob, which is the alignment the packed kernels need.
+ */
+constexpr uint64_t blobAlignment { 64 };
+
+/**
+ * The greatest length of the name of a layer, including the terminating null character.
+ */
+constexpr size_t maxNameLength { 64 };
+
+/**
+ * The header at the beginning of the file.
+ */
+struct FileHeader
+{
+    char     signature[8];
+    uint32_t version;
+    uint32_t byteOrder;
+    uint32_t numLayers;
+    uint32_t panelWidth;
+    uint64_t fileSize;
+    uint8_t  reserved[32];
+};
+
+/**
+ * One entry of the layer table, which follows the header. The lengths of the blobs follow from the
+ * sizes: (I, O) for the kernel, O for the bias, (I, `panelWidth` x P) for the packed kernel and
+ * `panelWidth` x P for the packed bias, where P is the number of panels.
+ *
+ * `position` is the one-based index of the layer in the model and `activation` is its
+ * `Activation`, if the file was written with the architecture of the model; otherwise `position`
+ * is zero.
+ */
+struct LayerEntry
+{
+    char     name[maxNameLength];
+    uint64_t inputSize;
+    uint64_t outputSize;
+    uint64_t kernelOffset;
+    uint64_t biasOffset;
+    uint64_t packedKernelOffset;
+    uint64_t packedBiasOffset;
+    uint32_t position;
+    uint8_t  activation;
+    uint8_t  reserved[11];
+};
+
+static_assert(sizeof(FileHeader) == 64, "FileHeader must be 64 bytes long");
+static_assert(sizeof(LayerEntry) == 128, "LayerEntry must be 128 bytes long");
+
+}
+
+}
+
+#endif
@@ -1,10 +1,13 @@
 // Copyright (c) 2021 Chanjung Kim. All rights reserved.
 // Licensed under the MIT License.
 
+#include <mf/PerfCounters.hh>
+#include <mf/Trace.hh>
 #include <mf/Weights.hh>
 
 #include <hdf5.h>
 
+#include <algorithm>
 #include <functional>
 #include <utility>
 
@@ -144,13 +147,51 @@ void IterateOverModelWeightsGroup(
 
 }
 
-WeightCollection Weights::MakeFromHdf5(std::filesystem::path const& path)
+void Weight::ApplyLayout(WeightLayout layout)
 {
+    if (layout == WeightLayout::Raw)
+        return;
+
+    size_t const paddedOutputSize = GetPackedOutputSize();
+
+    _packedKernel.assign(_inputSize * paddedOutputSize, 0.0f);
+    for (size_t i = 0; i < _inputSize; ++i)
+    {
+        for (size_t o = 0; o < _outputSize; ++o)
+        {
+            float* panel = _packedKernel.data() + (o / panelWidth) * _inputSize * panelWidth;
+            panel[i * panelWidth + o % panelWidth] = _kernel[i * _outputSize + o];
+        }
+    }
+
+    _packedBias.assign(paddedOutputSize, 0.0f);
+    std::copy(_bias.begin(), _bias.end(), _packedBias.begin());
+
+    if (layout == WeightLayout::Packed)
+    {
+        _kernel = PageAlignedVector<float> {};
+        _bias   = PageAlignedVector<float> {};
+    }
+}
+
+void Weight::ScaleKernel(float factor)
+{
+    CopyFromFile();
+    for (auto& value : _kernel) value *= factor;
+    for (auto& value : _packedKernel) value *= factor;
+}
+
+WeightCollection Weights::MakeFromHdf5(std::filesystem::path const& path, WeightLayout layout)
+{
+    MF_TRACE_SPAN("Weights::MakeFromHdf5");
+    PerfScope perf { "load weights" };
+
     auto [fileId, modelWeightsGroupId] { GetFileAndModelWeightsGroup(path) };
 
     WeightCollection rtn;
     IterateOverModelWeightsGroup(
-        modelWeightsGroupId, [&rtn](std::string const& layerName, hid_t biasId, hid_t kernelId) {
+        modelWeightsGroupId,
+        [&rtn, layout](std::string const& layerName, hid_t biasId, hid_t kernelId) {
             hid_t biasSpace { H5Dget_space(biasId) };
             if (biasSpace < 0)
                 return;
@@ -175,20 +216,20 @@ WeightCollection Weights::MakeFromHdf5(std::filesystem::path const& path)
                 if (outputSize != biasDims[0])
                     break;
 
-                std::vector<float> bias(outputSize, 0.0f);
+                PageAlignedVector<float> bias(outputSize, 0.0f);
                 if (H5Dread(biasId, H5T_NATIVE_FLOAT, H5S_ALL, H5S_ALL, H5P_DEFAULT, bias.data())
                     < 0)
                     break;
 
-                std::vector<float> kernel(inputSize * outputSize, 0.0f);
+                PageAlignedVector<float> kernel(inputSize * outputSize, 0.0f);
                 if (H5Dread(
                         kernelId, H5T_NATIVE_FLOAT, H5S_ALL, H5S_ALL, H5P_DEFAULT, kernel.data())
                     < 0)
                     break;
 
-                rtn.insert(std::make_pair(
-                    layerName,
-                    Weight { inputSize, outputSize, std::move(kernel), std::move(bias) }));
+                Weight weight { inputSize, outputSize, std::move(kernel), std::move(bias) };
+                weight.ApplyLayout(layout);
+                rtn.insert(std::make_pair(layerName, std::move(weight)));
 
             } while (false);
 